@@ -119,7 +119,7 @@ int rayColour(int argc, char *argv[])
   if (type != "shape" && type != "normal" && type != "branches")  // chunk loading possible for simple cases
   {
     ray::CloudWriter writer;
-    if (!writer.begin(out_file))
+    if (!writer.begin(out_file, true))
       usage();
 
     auto colour_rays = [flat_colour, flat_alpha, &type, &col, &alpha, &writer, &split_alpha](
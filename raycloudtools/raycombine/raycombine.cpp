@@ -9,8 +9,8 @@
 #include "raylib/rayparse.h"
 #include "raylib/rayply.h"
 #include "raylib/rayprogressthread.h"
-#include "raylib/raythreads.h"
 #include "raylib/raycloudwriter.h"
+#include "raylib/rayrcz.h"
 
 #include <cstdio>
 #include <cstdlib>
@@ -33,6 +33,11 @@ void usage(int exit_code = 1)
   std::cout << "raycombine basecloud min raycloud1 raycloud2 20 rays - 3-way merge, choses the changed geometry (from basecloud) at any differences. " << std::endl;
   std::cout << "                                                       For merge conflicts it uses the specified merge type." << std::endl;
   std::cout << "        --output raycloud_combined.ply               - optionally specify the output file name." << std::endl;
+  std::cout << "        --incremental                                - merge the later clouds into the first one (a combined map) in turn." << std::endl;
+  std::cout << "                                                       The map is updated in place unless --output is given. A state file is kept" << std::endl;
+  std::cout << "                                                       next to it, so later merges only process the new cloud and its surroundings." << std::endl;
+  std::cout << "        --bvh                                        - find the rays through each ellipsoid by tracing them through a bounding volume" << std::endl;
+  std::cout << "                                                       hierarchy, rather than looking them up in a ray grid." << std::endl;
   // clang-format on
   exit(exit_code);
 }
@@ -48,12 +53,14 @@ int rayCombine(int argc, char *argv[])
   // Below: false = allow unusual file extensions, for auto-merging, which occurs on non-standard temporary file names
   ray::FileArgument base_cloud(false), cloud_1(false), cloud_2(false), output_file(false);
   ray::OptionalKeyValueArgument output("output", 'o', &output_file);
+  ray::OptionalFlagArgument incremental("incremental", 'i'), bvh("bvh", 'b');
 
   // three-way merge option
-  bool standard_format = ray::parseCommandLine(argc, argv, { &merge_type, &cloud_files, &num_rays, &rays_text }, { &output });
+  bool standard_format = ray::parseCommandLine(argc, argv, { &merge_type, &cloud_files, &num_rays, &rays_text },
+                                               { &output, &incremental, &bvh });
   bool concatenate_all = ray::parseCommandLine(argc, argv, { &all_text, &cloud_files }, { &output });
   bool threeway = ray::parseCommandLine(
-    argc, argv, { &base_cloud, &merge_type, &cloud_1, &cloud_2, &num_rays, &rays_text }, { &output });
+    argc, argv, { &base_cloud, &merge_type, &cloud_1, &cloud_2, &num_rays, &rays_text }, { &output, &bvh });
   bool threeway_concatenate =
     ray::parseCommandLine(argc, argv, { &base_cloud, &all_text, &cloud_1, &cloud_2 }, { &output });
   if (!standard_format && !concatenate_all && !threeway && !threeway_concatenate)
@@ -70,6 +77,9 @@ int rayCombine(int argc, char *argv[])
     (threeway || threeway_concatenate) ? base_cloud.nameStub() : cloud_files.files()[0].nameStub();
 
   std::vector<ray::Cloud> clouds;
+  // .rcz clouds whose starts are all on their stored trajectories are merged as trajectory clouds, which don't hold
+  // a start per ray
+  std::vector<ray::TrajectoryCloud> trajectory_clouds;
   if (threeway || threeway_concatenate)
   {
     clouds.resize(2);
@@ -78,19 +88,32 @@ int rayCombine(int argc, char *argv[])
     if (!clouds[1].load(cloud_2.name(), false))
       usage();
   }
-  else if (!concatenate_all)
+  else if (!concatenate_all && !incremental.isSet())
   {
-    clouds.resize(cloud_files.files().size());
-    for (int i = 0; i < (int)cloud_files.files().size(); i++)
-      if (!clouds[i].load(cloud_files.files()[i].name()))
-        usage();
+    bool on_trajectories = true;
+    for (const auto &file : cloud_files.files())
+      on_trajectories = on_trajectories && ray::rczStartsOnTrajectory(file.name());
+    if (on_trajectories)
+    {
+      trajectory_clouds.resize(cloud_files.files().size());
+      for (int i = 0; i < (int)cloud_files.files().size(); i++)
+        if (!trajectory_clouds[i].load(cloud_files.files()[i].name()))
+          usage();
+    }
+    else
+    {
+      clouds.resize(cloud_files.files().size());
+      for (int i = 0; i < (int)cloud_files.files().size(); i++)
+        if (!clouds[i].load(cloud_files.files()[i].name()))
+          usage();
+    }
   }
 
-  ray::Threads::init();
   ray::MergerConfig config;
   config.voxel_size = 0.0;  // Infer voxel size
   config.num_rays_filter_threshold = num_rays.value();
   config.merge_type = ray::MergeType::Mininum;
+  config.engine = bvh.isSet() ? ray::MergeEngine::BVH : ray::MergeEngine::RayGrid;
 
   if (merge_type.selectedKey() == "order")
   {
@@ -143,6 +166,29 @@ int rayCombine(int argc, char *argv[])
     return 0;
   }
 
+  if (incremental.isSet())
+  {
+    // each cloud is merged into the result of the previous merge
+    const std::string map_file = cloud_files.files()[0].name();
+    combined_file = output.isSet() ? output_file.name() : map_file;
+    ray::Merger merger(config);
+    ray::Cloud differences;
+    for (size_t i = 1; i < cloud_files.files().size(); i++)
+    {
+      ray::Cloud cloud;
+      if (!cloud.load(cloud_files.files()[i].name()))
+        usage();
+      if (!merger.mergeIncremental(i == 1 ? map_file : combined_file, cloud, combined_file))
+        return 1;
+      std::cout << merger.differenceCloud().rayCount() << " transients merging " << cloud_files.files()[i].name()
+                << std::endl;
+      for (size_t j = 0; j < merger.differenceCloud().rayCount(); j++)
+        differences.addRay(merger.differenceCloud(), j);
+    }
+    differences.save(file_stub + "_differences.ply");
+    return 0;
+  }
+
   ray::Merger merger(config);
   ray::Progress progress;
   ray::ProgressThread progress_thread(progress);
@@ -156,6 +202,28 @@ int rayCombine(int argc, char *argv[])
       usage();
     merger.mergeThreeWay(base_cloud, clouds[0], clouds[1], &progress);
   }
+  else if (!trajectory_clouds.empty())
+  {
+    // the transients are moved out of each cloud, leaving its fixed rays
+    std::vector<ray::TrajectoryCloud> differences;
+    merger.mergeMultiple(trajectory_clouds, &differences, &progress);
+    progress_thread.join();
+    ray::CloudWriter difference_writer, fixed_writer;
+    if (!difference_writer.begin(file_stub + "_differences.ply") || !fixed_writer.begin(combined_file))
+      return 1;
+    size_t num_transients = 0, num_fixed = 0;
+    for (size_t i = 0; i < trajectory_clouds.size(); i++)
+    {
+      num_transients += differences[i].rayCount();
+      num_fixed += trajectory_clouds[i].rayCount();
+      difference_writer.writeChunk(differences[i]);
+      fixed_writer.writeChunk(trajectory_clouds[i]);
+    }
+    std::cout << num_transients << " transients, " << num_fixed << " fixed rays." << std::endl;
+    const bool differences_written = difference_writer.end();
+    const bool fixed_written = fixed_writer.end();
+    return differences_written && fixed_written ? 0 : 1;
+  }
   else
   {
     merger.mergeMultiple(clouds, &progress);
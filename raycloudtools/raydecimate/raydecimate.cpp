@@ -22,6 +22,11 @@ void usage(int exit_code = 1)
   std::cout << "usage:" << std::endl;
   std::cout << "raydecimate raycloud 3 cm   - reduces to one end point every 3 cm. A spatially even subsampling" << std::endl;
   std::cout << "raydecimate raycloud 4 rays - reduces to every fourth ray. A temporally even subsampling (if rays are chronological)" << std::endl;
+  std::cout << "                  --parallel - with cm, decimates on all threads. A pseudo-random ray is kept per voxel, rather than the first," << std::endl;
+  std::cout << "                               so the result is the same for any thread count, but is not supported in rayrestore" << std::endl;
+  std::cout << "raydecimate raycloud pyramid 5,10,20,40 cm - spatially decimates to each width in one pass, to raycloud_decimated_5cm.ply etc." << std::endl;
+  std::cout << "                                           Each level keeps a subset of the rays of the finer levels, at most one per voxel." << std::endl;
+  std::cout << "                                           When each width is a multiple of the finer ones, every occupied voxel keeps a ray." << std::endl;
   std::cout << "advanced methods not supported in rayrestore:" << std::endl;
   std::cout << "raydecimate raycloud 20 cm 64 points - A maximum of 64 end points per cubic 20 cm. Retains small-scale details compared to spatial decimation" << std::endl;
   std::cout << "raydecimate raycloud 20 cm/ray - If all cells overlapping the ray intersect a ray then ray not added. Maintains distribution of rays for e.g. raycombine" << std::endl;
@@ -54,14 +59,26 @@ int rayDecimate(int argc, char *argv[])
   ray::DoubleArgument vox_width(0.01, 100.0);
   ray::DoubleArgument radius_per_length(0.01, 100.0);
   ray::ValueKeyChoice quantity({ &vox_width, &num_rays, &radius_per_length, &width_for_ray }, { "cm", "rays", "cm/m", "cm/ray" });
-  ray::TextArgument cm("cm"), points("points"); 
-  bool standard_format = ray::parseCommandLine(argc, argv, { &cloud_file, &quantity });
+  ray::TextArgument cm("cm"), points("points"), pyramid("pyramid"); 
+  ray::DoubleListArgument pyramid_widths(0.01, 100.0);
+  ray::OptionalFlagArgument parallel("parallel", 'p');
+  bool standard_format = ray::parseCommandLine(argc, argv, { &cloud_file, &quantity }, { &parallel });
   bool double_format_points = ray::parseCommandLine(argc, argv, { &cloud_file, &vox_width, &cm, &num_rays, &points });
-  if (!standard_format && !double_format_points)
+  bool pyramid_format = ray::parseCommandLine(argc, argv, { &cloud_file, &pyramid, &pyramid_widths, &cm });
+  if (!standard_format && !double_format_points && !pyramid_format)
     usage();
+  if (parallel.isSet() && quantity.selectedKey() != "cm")
+  {
+    std::cerr << "Error: --parallel is only supported for spatial decimation (cm)" << std::endl;
+    usage();
+  }
 
   bool res = false;
-  if (double_format_points)
+  if (pyramid_format)
+  {
+    res = ray::decimateSpatialPyramid(cloud_file.nameStub(), pyramid_widths.value());
+  }
+  else if (double_format_points)
   {
     res = ray::decimateSpatioTemporal(cloud_file.nameStub(), vox_width.value(), num_rays.value());
   }
@@ -71,7 +88,10 @@ int rayDecimate(int argc, char *argv[])
   }
   else if (quantity.selectedKey() == "cm")
   {
-    res = ray::decimateSpatial(cloud_file.nameStub(), vox_width.value());
+    if (parallel.isSet())
+      res = ray::decimateSpatialParallel(cloud_file.nameStub(), vox_width.value());
+    else
+      res = ray::decimateSpatial(cloud_file.nameStub(), vox_width.value());
   }
   else if (quantity.selectedKey() == "rays")
   {
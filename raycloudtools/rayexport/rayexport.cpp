@@ -19,7 +19,7 @@ void usage(int exit_code = 1)
   // clang-format off
   std::cout << "Export a ray cloud into a point cloud amd trajectory file" << std::endl;
   std::cout << "usage:" << std::endl;
-  std::cout << "rayexport raycloudfile.ply pointcloud.ply/.laz/.txt/.xyz trajectoryfile.ply/.txt - output in the chosen point cloud and trajectory formats" << std::endl;
+  std::cout << "rayexport raycloudfile.ply pointcloud.ply/.las/.laz/.txt/.xyz trajectoryfile.ply/.txt - output in the chosen point cloud and trajectory formats" << std::endl;
   std::cout << "                           --traj_delta 0.1 - trajectory temporal decimation period in s. Default is 0.1" << std::endl;
   // clang-format on
   exit(exit_code);
@@ -34,29 +34,31 @@ int rayExport(int argc, char *argv[])
     usage();
 
   // Saving to a cloud file is fairly simple, we use chunk reading and writing:
-  if (pointcloud_file.nameExt() == "laz")
+  if (pointcloud_file.nameExt() == "laz" || pointcloud_file.nameExt() == "las")
   {
     ray::LasWriter las_writer(pointcloud_file.name());
     auto add_chunk = [&las_writer](std::vector<Eigen::Vector3d> &, std::vector<Eigen::Vector3d> &ends,
                                    std::vector<double> &times,
                                    std::vector<ray::RGBA> &colours) { las_writer.writeChunk(ends, times, colours); };
-    if (!ray::readPly(raycloud_file.name(), true, add_chunk, 0))
+    if (!ray::Cloud::read(raycloud_file.name(), add_chunk) || !las_writer.end())
       usage();
   }
   else if (pointcloud_file.nameExt() == "ply")
   {
     ray::PointPlyBuffer buffer;
     std::ofstream ofs;
-    if (!ray::writePointCloudChunkStart(pointcloud_file.name(), ofs))
+    ray::PlyChunkHeader header;
+    if (!ray::writePointCloudChunkStart(pointcloud_file.name(), ofs, header))
       usage();
     bool has_warned = false;
-    auto add_chunk = [&ofs, &buffer, &has_warned](std::vector<Eigen::Vector3d> &, std::vector<Eigen::Vector3d> &ends,
-                                     std::vector<double> &times, std::vector<ray::RGBA> &colours) {
-      ray::writePointCloudChunk(ofs, buffer, ends, times, colours, has_warned);
+    auto add_chunk = [&ofs, &header, &buffer, &has_warned](std::vector<Eigen::Vector3d> &,
+                                                           std::vector<Eigen::Vector3d> &ends, std::vector<double> &times,
+                                                           std::vector<ray::RGBA> &colours) {
+      ray::writePointCloudChunk(ofs, header, buffer, ends, times, colours, has_warned);
     };
-    if (!ray::readPly(raycloud_file.name(), true, add_chunk, 0))
+    if (!ray::Cloud::read(raycloud_file.name(), add_chunk))
       usage();
-    ray::writePointCloudChunkEnd(ofs);
+    ray::writePointCloudChunkEnd(ofs, header);
   }
   else if (pointcloud_file.nameExt() == "xyz" || pointcloud_file.nameExt() == "txt")
   {
@@ -88,7 +90,7 @@ int rayExport(int argc, char *argv[])
         }
       }    
     };
-    if (!ray::readPly(raycloud_file.name(), true, add_chunk, 0))
+    if (!ray::Cloud::read(raycloud_file.name(), add_chunk))
     {
       usage();
     }
@@ -111,12 +113,13 @@ int rayExport(int argc, char *argv[])
   {
     ray::PointPlyBuffer buffer;
     std::ofstream ofs;
-    if (!ray::writePointCloudChunkStart(trajectory_file.name(), ofs))
+    ray::PlyChunkHeader header;
+    if (!ray::writePointCloudChunkStart(trajectory_file.name(), ofs, header))
       usage();
     ray::Cloud chunk;
 
     bool has_warned = false;
-    auto decimate_time = [&time_slots, &ofs, &buffer, &chunk, &last_time_slot, time_step, &has_warned](
+    auto decimate_time = [&time_slots, &ofs, &header, &buffer, &chunk, &last_time_slot, time_step, &has_warned](
                            std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
                            std::vector<double> &times, std::vector<ray::RGBA> &colours) {
       chunk.clear();
@@ -133,11 +136,11 @@ int rayExport(int argc, char *argv[])
         }
         last_time_slot = time_slot;
       }
-      ray::writePointCloudChunk(ofs, buffer, chunk.starts, chunk.times, chunk.colours, has_warned);
+      ray::writePointCloudChunk(ofs, header, buffer, chunk.starts, chunk.times, chunk.colours, has_warned);
     };
-    if (!ray::readPly(raycloud_file.name(), true, decimate_time, 0))
+    if (!ray::Cloud::read(raycloud_file.name(), decimate_time))
       usage();
-    ray::writePointCloudChunkEnd(ofs);
+    ray::writePointCloudChunkEnd(ofs, header);
   }
   else if (trajectory_file.nameExt() == "txt")  // for text files we decimate and then sort
   {
@@ -169,7 +172,7 @@ int rayExport(int argc, char *argv[])
         last_time_slot = time_slot;
       }
     };
-    if (!ray::readPly(raycloud_file.name(), true, decimate_time, 0))
+    if (!ray::Cloud::read(raycloud_file.name(), decimate_time))
     {
       usage();
     }
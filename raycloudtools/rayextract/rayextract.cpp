@@ -15,6 +15,7 @@
 #include "raylib/raymesh.h"
 #include "raylib/rayparse.h"
 #include "raylib/rayply.h"
+#include "raylib/rayrcz.h"
 
 #include <cstdio>
 #include <cstdlib>
@@ -84,6 +85,30 @@ void usage(int exit_code = 1)
 
 
 /// extracts natural features from a scene
+/// reconstruct the trees of @c cloud, which is a Cloud, or a TrajectoryCloud for a .rcz file whose starts are on its
+/// trajectory, and save them with the segmented cloud
+template <class CloudT>
+void extractTrees(CloudT &cloud, const ray::FileArgument &cloud_file, const ray::FileArgument &mesh_file,
+                  const ray::TreesParams &params, bool verbose)
+{
+  Eigen::Vector3d offset = cloud.removeStartPos();
+
+  ray::Mesh mesh;
+  if (!ray::readPlyMesh(mesh_file.name(), mesh))
+  {
+    usage(true);
+  }
+  mesh.translate(-offset);
+
+  ray::Trees trees(cloud, offset, mesh, params, verbose);
+
+  // output the picewise cylindrical description of the trees
+  trees.save(cloud_file.nameStub() + "_trees.txt", offset, verbose);
+  // we also save a segmented (one colour per tree) file, as this is a useful output
+  cloud.translate(offset);
+  cloud.save(cloud_file.nameStub() + "_segmented.ply");
+}
+
 int rayExtract(int argc, char *argv[])
 {
   if (argc > 1)
@@ -163,21 +188,6 @@ int rayExtract(int argc, char *argv[])
   // finds full tree structures (piecewise cylindrical representation) and saves to file
   else if (extract_trees)
   {
-    ray::Cloud cloud;
-    const int min_num_rays = 40;
-    if (!cloud.load(cloud_file.name(), true, min_num_rays))
-    {
-      usage(true);
-    }
-    Eigen::Vector3d offset = cloud.removeStartPos();
-
-    ray::Mesh mesh;
-    if (!ray::readPlyMesh(mesh_file.name(), mesh))
-    {
-      usage(true);
-    }
-    mesh.translate(-offset);
-
     ray::TreesParams params;
     if (max_diameter_option.isSet())
     {
@@ -230,13 +240,26 @@ int rayExtract(int argc, char *argv[])
     params.use_rays = use_rays.isSet(); 
     params.segment_branches = segment_branches.isSet();
 
-    ray::Trees trees(cloud, offset, mesh, params, verbose.isSet());
-
-    // output the picewise cylindrical description of the trees
-    trees.save(cloud_file.nameStub() + "_trees.txt", offset, verbose.isSet());
-    // we also save a segmented (one colour per tree) file, as this is a useful output
-    cloud.translate(offset);
-    cloud.save(cloud_file.nameStub() + "_segmented.ply");
+    const int min_num_rays = 40;
+    if (ray::rczStartsOnTrajectory(cloud_file.name()))
+    {
+      // only the trajectory is held in memory, rather than a start per ray
+      ray::TrajectoryCloud cloud;
+      if (!cloud.load(cloud_file.name(), nullptr, 0.001, min_num_rays))
+      {
+        usage(true);
+      }
+      extractTrees(cloud, cloud_file, mesh_file, params, verbose.isSet());
+    }
+    else
+    {
+      ray::Cloud cloud;
+      if (!cloud.load(cloud_file.name(), true, min_num_rays))
+      {
+        usage(true);
+      }
+      extractTrees(cloud, cloud_file, mesh_file, params, verbose.isSet());
+    }
     // let's also save the trees out as a mesh
     // it is a bit inefficient to load from file just to convert it into the forest structure, but
     // it works OK for now. Better would be for ray::Trees so store the result as a ray::ForestStructure
@@ -9,9 +9,11 @@
 #include <iostream>
 
 #include "raylib/raycloud.h"
+#include "raylib/raycloudwriter.h"
 #include "raylib/raylaz.h"
 #include "raylib/rayparse.h"
 #include "raylib/rayply.h"
+#include "raylib/raythreads.h"
 #include "raylib/raytrajectory.h"
 
 void usage(int exit_code = 1)
@@ -26,6 +28,7 @@ void usage(int exit_code = 1)
   std::cout << "                                        --max_intensity 100 - specify maximum intensity value (default 100)." << std::endl;
   std::cout << "                                                              0 sets all to full intensity (bounded rays)." << std::endl;
   std::cout << "                                        --remove_start_pos  - translate so first point is at 0,0,0" << std::endl;
+  std::cout << "                                        --compress          - save in the compressed .rcz ray cloud format" << std::endl;
   std::cout << "The output is a .ply file of the same name (or with suffix _raycloud if the input was a .ply file)." << std::endl;
   // clang-format on
   exit(exit_code);
@@ -37,14 +40,14 @@ int rayImport(int argc, char *argv[])
   ray::Vector3dArgument position, ray_vec;
   ray::TextArgument ray_text("ray");
   ray::OptionalKeyValueArgument max_intensity_option("max_intensity", 'm', &max_intensity);
-  ray::OptionalFlagArgument remove("remove_start_pos", 'r');
+  ray::OptionalFlagArgument remove("remove_start_pos", 'r'), compress("compress", 'c');
   ray::FileArgument cloud_file, trajectory_file;
-  bool standard_format =
-    ray::parseCommandLine(argc, argv, { &cloud_file, &trajectory_file }, { &max_intensity_option, &remove });
+  bool standard_format = ray::parseCommandLine(argc, argv, { &cloud_file, &trajectory_file },
+                                               { &max_intensity_option, &remove, &compress });
   bool position_format =
-    ray::parseCommandLine(argc, argv, { &cloud_file, &position }, { &max_intensity_option, &remove });
-  bool ray_format =
-    ray::parseCommandLine(argc, argv, { &cloud_file, &ray_text, &ray_vec }, { &max_intensity_option, &remove });
+    ray::parseCommandLine(argc, argv, { &cloud_file, &position }, { &max_intensity_option, &remove, &compress });
+  bool ray_format = ray::parseCommandLine(argc, argv, { &cloud_file, &ray_text, &ray_vec },
+                                          { &max_intensity_option, &remove, &compress });
   if (!standard_format && !position_format && !ray_format)
     usage();
 
@@ -91,14 +94,13 @@ int rayImport(int argc, char *argv[])
   if (cloud_file.nameExt() == "ply")
     save_file += "_raycloud";
   size_t num_bounded;
-  std::ofstream ofs;
-  ray::RayPlyBuffer buffer;
-  if (!ray::writeRayCloudChunkStart(save_file + ".ply", ofs))
+  ray::CloudWriter writer;
+  if (!writer.begin(save_file + (compress.isSet() ? ".rcz" : ".ply")))
     usage();
   Eigen::Vector3d start_pos(0, 0, 0);
-  bool has_warned = false;
   double min_time = std::numeric_limits<double>::max();
   double max_time = std::numeric_limits<double>::lowest();
+  bool trajectory_set = false;
   auto add_chunk = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
                        std::vector<double> &times, std::vector<ray::RGBA> &colours) 
   {
@@ -106,6 +108,20 @@ int rayImport(int argc, char *argv[])
     {
       start_pos = ends[0];
     }
+    // a .rcz file stores the starts as references to the trajectory, in the same frame as the rays
+    if (standard_format && compress.isSet() && !trajectory_set)
+    {
+      trajectory_set = true;
+      ray::Trajectory file_trajectory = trajectory;
+      if (remove.isSet())
+      {
+        for (auto &point : file_trajectory.points())
+        {
+          point -= start_pos;
+        }
+      }
+      writer.setTrajectory(file_trajectory);
+    }
     // user provides a single sensor location (e.g. for static scanners)
     if (position_format)
     {
@@ -164,7 +180,7 @@ int rayImport(int argc, char *argv[])
         c.alpha = 255;
       }
     }
-    if (!ray::writeRayCloudChunk(ofs, buffer, starts, ends, times, colours, has_warned))
+    if (!writer.writeChunk(starts, ends, times, colours))
     {
       usage();
     }
@@ -173,8 +189,8 @@ int rayImport(int argc, char *argv[])
   if (cloud_file.nameExt() == "ply")
   {
     bool can_times_be_missing = position_format || ray_format;
-    if (!ray::readPly(cloud_file.name(), false, add_chunk,
-                      maximum_intensity, can_times_be_missing))  // special case of reading a non-ray-cloud ply
+    if (!ray::readPly(cloud_file.name(), false, add_chunk, maximum_intensity, can_times_be_missing, 1000000,
+                      ray::kPRMMapped, ray::Threads::threadCount()))  // special case of reading a non-ray-cloud ply
     {
       usage();
     }
@@ -217,7 +233,7 @@ int rayImport(int argc, char *argv[])
     std::cout << "If your sensor lacks intensity information, set them to full using:" << std::endl;
     std::cout << "rayimport <point cloud> <trajectory file> --max_intensity 0" << std::endl;
   }
-  ray::writeRayCloudChunkEnd(ofs);
+  writer.end();
   // if we remove the start position, then it is useful to print this value that is removed
   // so that the user hasn't lost information
   if (remove.isSet())
@@ -45,7 +45,7 @@ int rayRestore(int argc, char *argv[])
 
   ray::Cloud full_decimated;       // we need a decimated version of the full cloud, to compare to
   std::vector<int64_t> subsample;  // single buffer minimises memory allocations
-  std::set<Eigen::Vector3i, ray::Vector3iLess> voxel_set;
+  ray::VoxelSet voxel_set;
   full_decimated.reserve(decimated_cloud.ends.size());  // good guess at memory required
 
   // decimation functions
@@ -245,7 +245,7 @@ int rayRestore(int argc, char *argv[])
       {
         Eigen::Vector3i place(int(std::floor(ends[i][0] / voxel_width)), int(std::floor(ends[i][1] / voxel_width)),
                               int(std::floor(ends[i][2] / voxel_width)));
-        if (voxel_set.find(place) != voxel_set.end())
+        if (voxel_set.contains(place))
           chunk.addRay(transform * starts[i], transform * ends[i], times[i], colours[i]);
       }
     }
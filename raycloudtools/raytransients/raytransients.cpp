@@ -10,7 +10,6 @@
 #include "raylib/rayply.h"
 #include "raylib/rayprogress.h"
 #include "raylib/rayprogressthread.h"
-#include "raylib/raythreads.h"
 
 #include <chrono>
 #include <cstdio>
@@ -30,6 +29,10 @@ void usage(int exit_code = 1)
   std::cout << "              oldest - keeps the oldest geometry when there is a difference over time." << std::endl;
   std::cout << "              newest - uses the newest geometry when there is a difference over time." << std::endl;
   std::cout << " --colour     - also colours the clouds, to help tweak numRays. blue: opacity, green: pass throughs." << std::endl;
+  std::cout << " --memory_limit 8 - filter clouds larger than memory, in tiles that fit in 8 GB. Tiles run in parallel." << std::endl;
+  std::cout << " --tile_size 50   - filter in tiles of 50 m, as many at a time as fit in the memory limit." << std::endl;
+  std::cout << " --bvh        - find the rays through each ellipsoid by tracing them through a bounding volume hierarchy," << std::endl;
+  std::cout << "                rather than looking them up in a ray grid. Faster where many rays cross each voxel." << std::endl;
   // clang-format on
   exit(exit_code);
 }
@@ -40,21 +43,21 @@ int rayTransients(int argc, char *argv[])
   ray::FileArgument cloud_file;
   ray::DoubleArgument num_rays(0.1, 100.0);
   ray::TextArgument text("rays");
-  ray::OptionalFlagArgument colour("colour", 'c');
-  if (!ray::parseCommandLine(argc, argv, { &merge_type, &cloud_file, &num_rays, &text }, { &colour }))
+  ray::OptionalFlagArgument colour("colour", 'c'), bvh("bvh", 'b');
+  ray::DoubleArgument memory_limit(0.01, 100000.0), tile_size(0.01, 100000.0);
+  ray::OptionalKeyValueArgument memory_limit_option("memory_limit", 'm', &memory_limit);
+  ray::OptionalKeyValueArgument tile_size_option("tile_size", 't', &tile_size);
+  if (!ray::parseCommandLine(argc, argv, { &merge_type, &cloud_file, &num_rays, &text },
+                             { &colour, &memory_limit_option, &tile_size_option, &bvh }))
     usage();
 
-  ray::Cloud cloud;
-  if (!cloud.load(cloud_file.name()))
-    usage();
-
-  ray::Threads::init();
   ray::MergerConfig config;
   // Note: we actually get better multi-threaded performace with smaller voxels
   config.voxel_size = 0.0;
   config.num_rays_filter_threshold = num_rays.value();
   config.merge_type = ray::MergeType::Mininum;
   config.colour_cloud = colour.isSet();
+  config.engine = bvh.isSet() ? ray::MergeEngine::BVH : ray::MergeEngine::RayGrid;
 
   if (merge_type.selectedKey() == "oldest")
   {
@@ -75,15 +78,36 @@ int rayTransients(int argc, char *argv[])
 
   ray::Merger filter(config);
   ray::Progress progress;
-  ray::ProgressThread progress_thread(progress);
 
+  // the tiled filter streams the cloud from file, so it needn't fit in memory
+  if (memory_limit_option.isSet() || tile_size_option.isSet())
+  {
+    ray::TiledFilterConfig tiled_config;
+    if (memory_limit_option.isSet())
+      tiled_config.memory_limit = memory_limit.value();
+    if (tile_size_option.isSet())
+      tiled_config.tile_size = tile_size.value();
+    ray::ProgressThread progress_thread(progress);
+    const bool filtered = filter.filterTiled(cloud_file.name(), cloud_file.nameStub() + "_fixed.ply",
+                                             cloud_file.nameStub() + "_transient.ply", tiled_config, &progress);
+    progress_thread.requestQuit();
+    progress_thread.join();
+    return filtered ? 0 : 1;
+  }
+
+  // the single precision cloud holds the rays in about half the memory of ray::Cloud
+  ray::CompactCloud cloud;
+  if (!cloud.load(cloud_file.name()))
+    usage();
+
+  ray::ProgressThread progress_thread(progress);
   filter.filter(cloud, &progress);
 
   progress_thread.requestQuit();
   progress_thread.join();
 
-  const ray::Cloud &transient = filter.differenceCloud();
-  const ray::Cloud &fixed = filter.fixedCloud();
+  const ray::CompactCloud &transient = filter.compactDifferenceCloud();
+  const ray::CompactCloud &fixed = filter.compactFixedCloud();
 
   transient.save(cloud_file.nameStub() + "_transient.ply");
   fixed.save(cloud_file.nameStub() + "_fixed.ply");
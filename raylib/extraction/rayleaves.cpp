@@ -43,9 +43,8 @@ bool generateLeaves(const std::string &cloud_stub, const std::string &trees_file
   // it tends not to align leaves to really thick trunks.
   std::vector<int> tree_ids;
   std::vector<int> segment_ids;
-  std::vector<std::vector<int> > neighbour_segments; // this looks up into the above two structures
+  SparseGrid<std::vector<int> > neighbour_segments; // this looks up into the above two structures
   ForestStructure forest;
-  std::vector<int> dense_voxel_indices(grid.voxels().size(), -1);
   { // Tim: this block looks for the closest cylindrical branch segments to each voxel, in order to give the leaves a 'direction' value
     // The reason I use knn (K-nearest neighbour search) is that there is no maximum distance to worry about, and it is fast
     if (!forest.load(trees_file))
@@ -58,23 +57,21 @@ bool generateLeaves(const std::string &cloud_stub, const std::string &trees_file
     {
       num_segments += tree.segments().size() - 1;
     }
-    size_t num_dense_voxels = 0;
-    int i = 0;
-    for (auto &vox: grid.voxels())
+    std::vector<Eigen::Vector3i> dense_voxels;
+    grid.voxels().forEachActive([&](const Eigen::Vector3i &index, const DensityGrid::Voxel &vox)
     {
       if (vox.density() > 0.0)
       {
-        dense_voxel_indices[i] = (int)num_dense_voxels;
-        num_dense_voxels++;
+        dense_voxels.push_back(index);
       }
-      i++;
-    }
+    });
+    size_t num_dense_voxels = dense_voxels.size();
 
     const int search_size = 12; // find the twelve nearest branch segments. For larger voxels a larger value here would be helpful
     size_t p_size = num_segments;
     size_t q_size = num_dense_voxels;
     Eigen::MatrixXd points_p(3, p_size);
-    i = 0;
+    int i = 0;
     // 1. get branch centre positions
     for (int tree_id = 0; tree_id < (int)forest.trees.size(); tree_id++)
     {
@@ -91,24 +88,11 @@ bool generateLeaves(const std::string &cloud_stub, const std::string &trees_file
         segment_ids.push_back(segment_id);
       }
     }
-    // 2. get 
-    neighbour_segments.resize(grid.voxels().size());
+    // 2. get the dense voxel centres
     Eigen::MatrixXd points_q(3, q_size);
-    int c = 0;
-    for (int k = 0; k<dims[2]; k++)
+    for (int c = 0; c < (int)num_dense_voxels; c++)
     {
-      for (int j = 0; j<dims[1]; j++)
-      {
-        for (int i = 0; i<dims[0]; i++)
-        {
-          int index = grid.getIndex(Eigen::Vector3i(i,j,k));
-          double density = grid.voxels()[index].density();
-          if (density > 0.0)
-          {
-            points_q.col(c++) = grid_bounds.min_bound_ + vox_width * Eigen::Vector3d((double)i+0.5, (double)j+0.5, (double)k+0.5);
-          }         
-        }
-      }
+      points_q.col(c) = grid_bounds.min_bound_ + vox_width * (dense_voxels[c].cast<double>() + Eigen::Vector3d(0.5, 0.5, 0.5));
     }
     Nabo::NNSearchD *nns = Nabo::NNSearchD::createKDTreeLinearHeap(points_p, 3);
     Eigen::MatrixXi indices;
@@ -120,21 +104,18 @@ bool generateLeaves(const std::string &cloud_stub, const std::string &trees_file
     delete nns;
 
     // Convert these set of nearest neighbours into surfels
-    for (int i = 0; i < (int)grid.voxels().size(); i++)
+    for (int id = 0; id < (int)num_dense_voxels; id++)
     {
-      int id = dense_voxel_indices[i];
-      if (id != -1)
+      std::vector<int> &segments = neighbour_segments.voxel(dense_voxels[id]);
+      for (int j = 0; j < search_size && indices(j, id) != Nabo::NNSearchD::InvalidIndex; j++) 
       {
-        for (int j = 0; j < search_size && indices(j, id) != Nabo::NNSearchD::InvalidIndex; j++) 
-        {
-          neighbour_segments[i].push_back(indices(j, id));
-        }
+        segments.push_back(indices(j, id));
       }
     }
   }
 
 
-  // the density is now stored in grid.voxels()[grid.getIndex(Eigen::Vector3i )].density().
+  // the density is now stored in grid.voxel(Eigen::Vector3i).density().
   struct Leaf
   {
     Eigen::Vector3d centre;
@@ -143,12 +124,8 @@ bool generateLeaves(const std::string &cloud_stub, const std::string &trees_file
     double grad0;
   };
   std::vector<Leaf> leaves;
-  std::vector<double> leaf_counter(grid.voxels().size());
+  SparseGrid<double> leaf_counter; // set on first use
   std::srand(1);
-  for (size_t i = 0; i<grid.voxels().size(); i++)
-  {
-    leaf_counter[i] = (double)(std::rand()%10000) / 10000.0; // a random start stops regions of low density have 0 leaves
-  }
 
 
   // for each point in the cloud, possible add leaves...
@@ -159,8 +136,8 @@ bool generateLeaves(const std::string &cloud_stub, const std::string &trees_file
     {
       if (colours[i].alpha == 0)
         continue;
-      int index = grid.getIndexFromPos(ends[i]);
-      auto &voxel = grid.voxels()[index];
+      const Eigen::Vector3i index = grid.getIndexFromPos(ends[i]);
+      auto &voxel = grid.voxel(index);
       double leaf_area_per_voxel_volume = voxel.density();
       if (leaf_area_per_voxel_volume <= 0.0)
       {
@@ -169,7 +146,13 @@ bool generateLeaves(const std::string &cloud_stub, const std::string &trees_file
       double desired_leaf_area = leaf_area_per_voxel_volume * vox_width * vox_width * vox_width;
       double num_leaves_d = desired_leaf_area / leaf_area;
       double num_points = (double)voxel.numHits();
-      double &count = leaf_counter[index];
+      double *counter = leaf_counter.find(index);
+      if (!counter)
+      {
+        counter = &leaf_counter.voxel(index);
+        *counter = (double)(std::rand()%10000) / 10000.0; // a random start stops regions of low density have 0 leaves
+      }
+      double &count = *counter;
       count += num_leaves_d / num_points;
       bool add_leaf = false;
       if (count >= 1.0)
@@ -185,7 +168,9 @@ bool generateLeaves(const std::string &cloud_stub, const std::string &trees_file
 
         double min_dist = 1e10;
         Eigen::Vector3d closest_point_on_branch(0,0,0);
-        for (auto &ind: neighbour_segments[index])
+        static const std::vector<int> no_segments;
+        const std::vector<int> *segments = neighbour_segments.find(index);
+        for (auto &ind: segments ? *segments : no_segments)
         {
           auto &tree =  forest.trees[tree_ids[ind]];
           // get a more accurate distance to each branch segment....
@@ -128,17 +128,20 @@ void connectPointsShortestPath(
 
 /// Converts a ray cloud to a set of points @c points connected by the shortest path to the ground @c mesh
 /// the returned vector of index sets provides the root points for each separated tree
-std::vector<std::vector<int>> getRootsAndSegment(std::vector<Vertex> &points, const Cloud &cloud, const Mesh &mesh,
-                                                 double max_diameter, double distance_limit, double height_min,
-                                                 double gravity_factor)
+namespace
+{
+template <class CloudT>
+std::vector<std::vector<int>> getCloudRootsAndSegment(std::vector<Vertex> &points, const CloudT &cloud,
+                                                      const Mesh &mesh, double max_diameter, double distance_limit,
+                                                      double height_min, double gravity_factor)
 {
   // first fill in the basic attributes of the points structure
-  points.reserve(cloud.ends.size());
-  for (unsigned int i = 0; i < cloud.ends.size(); i++)
+  points.reserve(cloud.rayCount());
+  for (unsigned int i = 0; i < cloud.rayCount(); i++)
   {
     if (cloud.rayBounded(i))
     {
-      points.push_back(Vertex(cloud.ends[i], cloud.starts[i]));
+      points.push_back(Vertex(cloud.end(i), cloud.start(i)));
     }
   }
 
@@ -297,5 +300,27 @@ std::vector<std::vector<int>> getRootsAndSegment(std::vector<Vertex> &points, co
 
   return roots_set;
 }
+}  // namespace
+
+std::vector<std::vector<int>> getRootsAndSegment(std::vector<Vertex> &points, const Cloud &cloud, const Mesh &mesh,
+                                                 double max_diameter, double distance_limit, double height_min,
+                                                 double gravity_factor)
+{
+  return getCloudRootsAndSegment(points, cloud, mesh, max_diameter, distance_limit, height_min, gravity_factor);
+}
+
+std::vector<std::vector<int>> getRootsAndSegment(std::vector<Vertex> &points, const CompactCloud &cloud,
+                                                 const Mesh &mesh, double max_diameter, double distance_limit,
+                                                 double height_min, double gravity_factor)
+{
+  return getCloudRootsAndSegment(points, cloud, mesh, max_diameter, distance_limit, height_min, gravity_factor);
+}
+
+std::vector<std::vector<int>> getRootsAndSegment(std::vector<Vertex> &points, const TrajectoryCloud &cloud,
+                                                 const Mesh &mesh, double max_diameter, double distance_limit,
+                                                 double height_min, double gravity_factor)
+{
+  return getCloudRootsAndSegment(points, cloud, mesh, max_diameter, distance_limit, height_min, gravity_factor);
+}
 
 }  // namespace ray
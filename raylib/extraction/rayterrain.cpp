@@ -6,14 +6,10 @@
 #include "rayterrain.h"
 #include "../rayconvexhull.h"
 #include "../raymesh.h"
+#include "../rayparallel.h"
 #include "../rayply.h"
 #include "../rayprogress.h"
 #include "../rayprogressthread.h"
-
-#if RAYLIB_WITH_TBB
-#include <tbb/enumerable_thread_specific.h>
-#include <tbb/parallel_for.h>
-#endif  // RAYLIB_WITH_TBB
 static int num_visits = 0;
 static int num_cone_tests = 0;
 
@@ -174,15 +170,7 @@ void Terrain::getParetoFront(const std::vector<Vector4d> &points, std::vector<Ve
     else
       nodes[n].is_set = 1;
   };
-#if RAYLIB_WITH_TBB
-  tbb::parallel_for<size_t>(0, nodes.size(), process_rays);
-#else
-  #pragma omp parallel for
-  for (size_t n = 0; n < nodes.size(); n++)
-  {
-    process_rays(n);
-  }
-#endif
+  parallelFor(0, nodes.size(), process_rays);
   for (auto &node : nodes)
   {
     if (node.is_set)
@@ -352,8 +340,27 @@ void Terrain::growUpwardsFast(const std::vector<Eigen::Vector3d> &ends, double p
 #endif
 }
 
-// Convert the @c cloud input to the mesh_ member variable. 
 void Terrain::extract(const Cloud &cloud, const Eigen::Vector3d &offset, const std::string &file_prefix, double gradient, bool verbose)
+{
+  extractCloud(cloud, offset, file_prefix, gradient, verbose);
+}
+
+void Terrain::extract(const CompactCloud &cloud, const Eigen::Vector3d &offset, const std::string &file_prefix,
+                      double gradient, bool verbose)
+{
+  extractCloud(cloud, offset, file_prefix, gradient, verbose);
+}
+
+void Terrain::extract(const TrajectoryCloud &cloud, const Eigen::Vector3d &offset, const std::string &file_prefix,
+                      double gradient, bool verbose)
+{
+  extractCloud(cloud, offset, file_prefix, gradient, verbose);
+}
+
+// Convert the @c cloud input to the mesh_ member variable. 
+template <class CloudT>
+void Terrain::extractCloud(const CloudT &cloud, const Eigen::Vector3d &offset, const std::string &file_prefix,
+                           double gradient, bool verbose)
 {
 #if RAYLIB_WITH_QHULL
   // preprocessing to make the cloud smaller.
@@ -362,11 +369,11 @@ void Terrain::extract(const Cloud &cloud, const Eigen::Vector3d &offset, const s
   const double spacing = cloud.estimatePointSpacing();
   const double pixel_width = 2.0 * spacing;
   std::vector<Eigen::Vector3d> ends;
-  for (size_t i = 0; i < cloud.ends.size(); i++)
+  for (size_t i = 0; i < cloud.rayCount(); i++)
   {
     if (cloud.rayBounded(i))
     {
-      ends.push_back(cloud.ends[i]);
+      ends.push_back(cloud.end(i));
     }
   }
   growUpwardsFast(ends, pixel_width, min_bound, max_bound, gradient);
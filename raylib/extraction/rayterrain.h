@@ -28,6 +28,10 @@ public:
   /// The input is the @c cloud and its @c file_prefix (to name debug outputs), and a specified @c gradient
   /// The output is the stored mesh, which is accessed with the mesh() accessor.
   void extract(const Cloud &cloud, const Eigen::Vector3d &offset, const std::string &file_prefix, double gradient, bool verbose);
+  void extract(const CompactCloud &cloud, const Eigen::Vector3d &offset, const std::string &file_prefix, double gradient,
+               bool verbose);
+  void extract(const TrajectoryCloud &cloud, const Eigen::Vector3d &offset, const std::string &file_prefix,
+               double gradient, bool verbose);
 
   /// Direct extraction of the pareto front points
   void growUpwards(const std::vector<Eigen::Vector3d> &positions, double gradient);
@@ -42,6 +46,10 @@ public:
   const Mesh &mesh() const { return mesh_; }
 
 private:
+  template <class CloudT>
+  void extractCloud(const CloudT &cloud, const Eigen::Vector3d &offset, const std::string &file_prefix, double gradient,
+                    bool verbose);
+
   Mesh mesh_;
   static void getParetoFront(const std::vector<Vector4d> &points, std::vector<Vector4d> &front);
 };
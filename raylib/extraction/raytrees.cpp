@@ -25,10 +25,29 @@ TreesParams::TreesParams()
   , global_taper_factor(0.3)
 {}
 
+Trees::Trees(Cloud &cloud, const Eigen::Vector3d &offset, const Mesh &mesh, const TreesParams &params, bool verbose)
+{
+  reconstruct(cloud, offset, mesh, params, verbose);
+}
+
+Trees::Trees(CompactCloud &cloud, const Eigen::Vector3d &offset, const Mesh &mesh, const TreesParams &params,
+             bool verbose)
+{
+  reconstruct(cloud, offset, mesh, params, verbose);
+}
+
+Trees::Trees(TrajectoryCloud &cloud, const Eigen::Vector3d &offset, const Mesh &mesh, const TreesParams &params,
+             bool verbose)
+{
+  reconstruct(cloud, offset, mesh, params, verbose);
+}
+
 /// The main reconstruction algorithm
 /// It is based on finding the shortest paths using Djikstra's algorithm, followed
 /// by an agglomeration of paths, with repeated splitting from root to tips
-Trees::Trees(Cloud &cloud, const Eigen::Vector3d &offset, const Mesh &mesh, const TreesParams &params, bool verbose)
+template <class CloudT>
+void Trees::reconstruct(CloudT &cloud, const Eigen::Vector3d &offset, const Mesh &mesh, const TreesParams &params,
+                        bool verbose)
 {
   // firstly, get the full set of shortest paths from ground to tips, and the set of roots
   params_ = &params;
@@ -283,7 +302,7 @@ Trees::Trees(Cloud &cloud, const Eigen::Vector3d &offset, const Mesh &mesh, cons
     removeOutOfBoundSections(cloud, min_bound, max_bound, offset);
   }
 
-  std::vector<int> root_segs(cloud.ends.size(), -1);
+  std::vector<int> root_segs(cloud.rayCount(), -1);
   // now colour the ray cloud based on the segmentation
   segmentCloud(cloud, root_segs, section_ids);
 
@@ -1046,7 +1065,8 @@ void Trees::generateLocalSectionIds()
   std::cout << num << " trees saved" << std::endl;
 }
 
-void Trees::removeOutOfBoundSections(const Cloud &cloud, Eigen::Vector3d &min_bound, Eigen::Vector3d &max_bound, const Eigen::Vector3d &offset)
+template <class CloudT>
+void Trees::removeOutOfBoundSections(const CloudT &cloud, Eigen::Vector3d &min_bound, Eigen::Vector3d &max_bound, const Eigen::Vector3d &offset)
 {
   const double width = params_->grid_width;
   cloud.calcBounds(&min_bound, &max_bound);
@@ -1074,7 +1094,8 @@ void Trees::removeOutOfBoundSections(const Cloud &cloud, Eigen::Vector3d &min_bo
 }
 
 // colour the cloud by tree id, or by branch segment id
-void Trees::segmentCloud(Cloud &cloud, std::vector<int> &root_segs, const std::vector<int> &section_ids)
+template <class CloudT>
+void Trees::segmentCloud(CloudT &cloud, std::vector<int> &root_segs, const std::vector<int> &section_ids)
 {
   contiguous_section_ids_.resize(sections_.size(), -1); // these are different to the root section IDs as they exclude empty trees
   int num_trees = 0;
@@ -1096,7 +1117,7 @@ void Trees::segmentCloud(Cloud &cloud, std::vector<int> &root_segs, const std::v
   }
 
   int j = -1;
-  for (size_t i = 0; i < cloud.ends.size(); i++)
+  for (size_t i = 0; i < cloud.rayCount(); i++)
   {
     RGBA &colour = cloud.colours[i];
     if (cloud.rayBounded(i))
@@ -1117,7 +1138,7 @@ void Trees::segmentCloud(Cloud &cloud, std::vector<int> &root_segs, const std::v
         dir.normalize();
         const double grad = 2.0; // larger cuts out a steeper (narrower) cone
         Eigen::Vector3d base = sections_[seg].tip - grad*dir*radius(sections_[seg]);
-        Eigen::Vector3d dif = cloud.ends[i] - base;
+        Eigen::Vector3d dif = cloud.end(i) - base;
         double h = dif.dot(dir);
         double w = (dif - dir*h).norm();
         if (grad*w > h)
@@ -1150,23 +1171,36 @@ void Trees::segmentCloud(Cloud &cloud, std::vector<int> &root_segs, const std::v
   }
 }
 
+namespace
+{
+// move the start of the last ray in @c cloud to index @c i, as part of removing ray @c i
+template <class CloudT>
+void replaceStartWithLast(CloudT &cloud, int i)
+{
+  cloud.starts[i] = cloud.starts.back();
+  cloud.starts.pop_back();
+}
+// the starts of a trajectory cloud are interpolated from its trajectory, so there are none to move
+void replaceStartWithLast(TrajectoryCloud &, int) {}
+}  // namespace
+
 // remove rays from the ray cloud where the end points are out of bounds
-void Trees::removeOutOfBoundRays(Cloud &cloud, const Eigen::Vector3d &min_bound, const Eigen::Vector3d &max_bound,
+template <class CloudT>
+void Trees::removeOutOfBoundRays(CloudT &cloud, const Eigen::Vector3d &min_bound, const Eigen::Vector3d &max_bound,
                                  const std::vector<int> &root_segs)
 {
-  for (int i = static_cast<int>(cloud.ends.size()) - 1; i >= 0; i--)
+  for (int i = static_cast<int>(cloud.rayCount()) - 1; i >= 0; i--)
   {
     if (!cloud.rayBounded(i))
     {
       continue;
     }
-    const Eigen::Vector3d pos = root_segs[i] == -1 ? cloud.ends[i] : sections_[root_segs[i]].tip;
+    const Eigen::Vector3d pos = root_segs[i] == -1 ? cloud.end(i) : sections_[root_segs[i]].tip;
 
     if (pos[0] < min_bound[0] || pos[0] > max_bound[0] || pos[1] < min_bound[1] ||
         pos[1] > max_bound[1])  // nope, can't do this here!
     {
-      cloud.starts[i] = cloud.starts.back();
-      cloud.starts.pop_back();
+      replaceStartWithLast(cloud, i);
       cloud.ends[i] = cloud.ends.back();
       cloud.ends.pop_back();
       cloud.colours[i] = cloud.colours.back();
@@ -46,6 +46,9 @@ public:
   /// Constructs the piecewise cylindrical tree structures from the input ray cloud @c cloud
   /// The ground @c mesh defines the ground and @params are used to control the reconstruction
   Trees(Cloud &cloud, const Eigen::Vector3d &offset, const Mesh &mesh, const TreesParams &params, bool verbose);
+  Trees(CompactCloud &cloud, const Eigen::Vector3d &offset, const Mesh &mesh, const TreesParams &params, bool verbose);
+  Trees(TrajectoryCloud &cloud, const Eigen::Vector3d &offset, const Mesh &mesh, const TreesParams &params,
+        bool verbose);
 
   /// save the trees representation to a text file
   bool save(const std::string &filename, const Eigen::Vector3d &offset, bool verbose) const;
@@ -54,6 +57,11 @@ private:
   /// The piecewise cylindrical represenation of all of the trees
   std::vector<BranchSection> sections_;
 
+  /// the reconstruction, shared by the constructors, @c CloudT is @c Cloud, @c CompactCloud or @c TrajectoryCloud
+  template <class CloudT>
+  void reconstruct(CloudT &cloud, const Eigen::Vector3d &offset, const Mesh &mesh, const TreesParams &params,
+                   bool verbose);
+
   /// calculate the distance to farthest connected branch tip, for each point in the cloud
   void calculatePointDistancesToEnd();
   /// create the start branch segments at the root positions
@@ -87,11 +95,14 @@ private:
   /// set ids that are locel (0-based) per tree
   void generateLocalSectionIds();
   /// if using an overlapping grid, then remove trees with base outside the non-overlapping cell bounds
-  void removeOutOfBoundSections(const Cloud &cloud, Eigen::Vector3d &min_bound, Eigen::Vector3d &max_bound, const Eigen::Vector3d &offset);
+  template <class CloudT>
+  void removeOutOfBoundSections(const CloudT &cloud, Eigen::Vector3d &min_bound, Eigen::Vector3d &max_bound, const Eigen::Vector3d &offset);
   /// colour the cloud based on the section id for each point
-  void segmentCloud(Cloud &cloud, std::vector<int> &root_segs, const std::vector<int> &section_ids);
+  template <class CloudT>
+  void segmentCloud(CloudT &cloud, std::vector<int> &root_segs, const std::vector<int> &section_ids);
   /// remove points from the ray cloud if outside of the non-overlapping grid cell bounds
-  void removeOutOfBoundRays(Cloud &cloud, const Eigen::Vector3d &min_bound, const Eigen::Vector3d &max_bound,
+  template <class CloudT>
+  void removeOutOfBoundRays(CloudT &cloud, const Eigen::Vector3d &min_bound, const Eigen::Vector3d &max_bound,
                             const std::vector<int> &root_segs);
   /// estimate the mean taper for the specified section
   double meanTaper(const BranchSection &section) const;
@@ -0,0 +1,172 @@
+// Copyright (c) 2026
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#include "raybvh.h"
+
+#include <algorithm>
+
+namespace ray
+{
+constexpr int BVH::kMaxDepth;
+
+namespace
+{
+/// the number of candidate split positions per axis in the SAH build
+const int kNumBins = 16;
+
+/// half the surface area of a box, which is proportional to the chance of a random ray hitting it
+inline double halfArea(const Eigen::Vector3d &min_bound, const Eigen::Vector3d &max_bound)
+{
+  const Eigen::Vector3d extent = (max_bound - min_bound).cwiseMax(Eigen::Vector3d::Zero());
+  return extent[0] * extent[1] + extent[1] * extent[2] + extent[2] * extent[0];
+}
+
+/// an accumulated bounding box
+struct Bounds
+{
+  Bounds()
+    : min_bound(std::numeric_limits<double>::max(), std::numeric_limits<double>::max(),
+                std::numeric_limits<double>::max())
+    , max_bound(std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(),
+                std::numeric_limits<double>::lowest())
+  {}
+  void add(const Eigen::Vector3d &min_point, const Eigen::Vector3d &max_point)
+  {
+    min_bound = minVector(min_bound, min_point);
+    max_bound = maxVector(max_bound, max_point);
+  }
+  double halfArea() const { return ray::halfArea(min_bound, max_bound); }
+  Eigen::Vector3d min_bound, max_bound;
+};
+}  // namespace
+
+void BVH::build(const std::vector<Eigen::Vector3d> &min_bounds, const std::vector<Eigen::Vector3d> &max_bounds,
+                int max_leaf_size)
+{
+  nodes_.clear();
+  items_.clear();
+  item_min_bounds_.clear();
+  item_max_bounds_.clear();
+  const size_t num_items = min_bounds.size();
+  if (num_items == 0)
+  {
+    return;
+  }
+  items_.resize(num_items);
+  std::vector<Eigen::Vector3d> centres(num_items);
+  for (size_t i = 0; i < num_items; i++)
+  {
+    items_[i] = static_cast<uint32_t>(i);
+    centres[i] = 0.5 * (min_bounds[i] + max_bounds[i]);
+  }
+  nodes_.reserve(2 * num_items);
+  nodes_.push_back(Node{ Eigen::Vector3d::Zero(), Eigen::Vector3d::Zero(), 0, static_cast<uint32_t>(num_items) });
+
+  // the nodes still to be split, with their depths
+  std::vector<std::pair<uint32_t, int>> to_split(1, std::make_pair(0u, 0));
+  while (!to_split.empty())
+  {
+    const uint32_t node_id = to_split.back().first;
+    const int depth = to_split.back().second;
+    to_split.pop_back();
+    const uint32_t first = nodes_[node_id].first;
+    const uint32_t count = nodes_[node_id].count;
+    Bounds bounds, centre_bounds;
+    for (uint32_t i = first; i < first + count; i++)
+    {
+      bounds.add(min_bounds[items_[i]], max_bounds[items_[i]]);
+      centre_bounds.add(centres[items_[i]], centres[items_[i]]);
+    }
+    nodes_[node_id].min_bound = bounds.min_bound;
+    nodes_[node_id].max_bound = bounds.max_bound;
+    if (count <= static_cast<uint32_t>(max_leaf_size) || depth >= kMaxDepth)
+    {
+      continue;
+    }
+
+    // find the lowest cost split, binning the boxes by their centres along each axis
+    double best_cost = std::numeric_limits<double>::max();
+    int best_axis = -1, best_bin = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+      const double axis_min = centre_bounds.min_bound[axis];
+      const double axis_width = centre_bounds.max_bound[axis] - axis_min;
+      if (axis_width <= 0.0)
+      {
+        continue;
+      }
+      Bounds bins[kNumBins];
+      uint32_t bin_counts[kNumBins] = { 0 };
+      for (uint32_t i = first; i < first + count; i++)
+      {
+        const uint32_t item = items_[i];
+        const int bin = std::min(kNumBins - 1, (int)((centres[item][axis] - axis_min) * kNumBins / axis_width));
+        bins[bin].add(min_bounds[item], max_bounds[item]);
+        bin_counts[bin]++;
+      }
+      // the areas and counts to the right of each split, accumulated from the right
+      double right_areas[kNumBins];
+      uint32_t right_counts[kNumBins];
+      Bounds right;
+      uint32_t right_count = 0;
+      for (int bin = kNumBins - 1; bin > 0; bin--)
+      {
+        right.add(bins[bin].min_bound, bins[bin].max_bound);
+        right_count += bin_counts[bin];
+        right_areas[bin] = right.halfArea();
+        right_counts[bin] = right_count;
+      }
+      Bounds left;
+      uint32_t left_count = 0;
+      for (int bin = 1; bin < kNumBins; bin++)
+      {
+        left.add(bins[bin - 1].min_bound, bins[bin - 1].max_bound);
+        left_count += bin_counts[bin - 1];
+        if (left_count == 0 || right_counts[bin] == 0)
+        {
+          continue;
+        }
+        const double cost = left.halfArea() * left_count + right_areas[bin] * right_counts[bin];
+        if (cost < best_cost)
+        {
+          best_cost = cost;
+          best_axis = axis;
+          best_bin = bin;
+        }
+      }
+    }
+    // stay a leaf if no split is cheaper than testing each box, counting a node test as the cost of a box test
+    const double leaf_cost = bounds.halfArea() * count;
+    if (best_axis < 0 || best_cost + bounds.halfArea() >= leaf_cost)
+    {
+      continue;
+    }
+
+    const double axis_min = centre_bounds.min_bound[best_axis];
+    const double axis_width = centre_bounds.max_bound[best_axis] - axis_min;
+    uint32_t *middle =
+      std::partition(items_.data() + first, items_.data() + first + count, [&](uint32_t item) {
+        return std::min(kNumBins - 1, (int)((centres[item][best_axis] - axis_min) * kNumBins / axis_width)) <
+               best_bin;
+      });
+    const uint32_t left_count = static_cast<uint32_t>(middle - (items_.data() + first));
+    const uint32_t left_id = static_cast<uint32_t>(nodes_.size());
+    nodes_.push_back(Node{ Eigen::Vector3d::Zero(), Eigen::Vector3d::Zero(), first, left_count });
+    nodes_.push_back(Node{ Eigen::Vector3d::Zero(), Eigen::Vector3d::Zero(), first + left_count, count - left_count });
+    nodes_[node_id].first = left_id;
+    nodes_[node_id].count = 0;
+    to_split.push_back(std::make_pair(left_id, depth + 1));
+    to_split.push_back(std::make_pair(left_id + 1, depth + 1));
+  }
+
+  item_min_bounds_.resize(num_items);
+  item_max_bounds_.resize(num_items);
+  for (size_t i = 0; i < num_items; i++)
+  {
+    item_min_bounds_[i] = min_bounds[items_[i]];
+    item_max_bounds_[i] = max_bounds[items_[i]];
+  }
+}
+}  // namespace ray
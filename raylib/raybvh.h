@@ -0,0 +1,127 @@
+// Copyright (c) 2026
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#ifndef RAYLIB_RAYBVH_H
+#define RAYLIB_RAYBVH_H
+
+#include "raylib/raylibconfig.h"
+
+#include "rayutils.h"
+
+#include <limits>
+#include <vector>
+
+namespace ray
+{
+/// A bounding volume hierarchy over axis aligned boxes, for finding the boxes that a line segment passes through.
+/// It is built top down, splitting each node where the surface area heuristic (SAH) estimates the lowest cost of
+/// tracing rays through its two halves. Unlike a voxel grid, its cost doesn't depend on a chosen cell size, and it
+/// adapts to boxes that vary in size and density.
+class RAYLIB_EXPORT BVH
+{
+public:
+  /// the maximum depth of the tree, which bounds the traversal stack
+  static constexpr int kMaxDepth = 48;
+
+  /// A node of the tree. The two children of an internal node are adjacent, and a leaf holds a range of @c items()
+  struct Node
+  {
+    Eigen::Vector3d min_bound, max_bound;
+    /// the first child for an internal node, or the first item for a leaf
+    uint32_t first;
+    /// the number of items in a leaf, zero for an internal node
+    uint32_t count;
+  };
+
+  BVH() = default;
+
+  /// Builds the tree over the boxes from @c min_bounds[i] to @c max_bounds[i]. Leaves hold up to @c max_leaf_size
+  /// boxes, or more if the boxes can't be split
+  void build(const std::vector<Eigen::Vector3d> &min_bounds, const std::vector<Eigen::Vector3d> &max_bounds,
+             int max_leaf_size = 4);
+
+  /// Calls @c visit(i) for the index i of each box that the segment from @c start to @c end overlaps.
+  /// The boxes are visited in an unspecified order.
+  template <class VisitFunction>
+  void intersectSegment(const Eigen::Vector3d &start, const Eigen::Vector3d &end, VisitFunction visit) const;
+
+  inline const std::vector<Node> &nodes() const { return nodes_; }
+  /// the box indices, in leaf order
+  inline const std::vector<uint32_t> &items() const { return items_; }
+  inline bool empty() const { return nodes_.empty(); }
+
+private:
+  /// whether the segment from @c start, with inverse direction @c inv_dir, overlaps the box from @c min_bound to
+  /// @c max_bound
+  static inline bool overlaps(const Eigen::Vector3d &min_bound, const Eigen::Vector3d &max_bound,
+                              const Eigen::Vector3d &start, const Eigen::Vector3d &inv_dir);
+
+  std::vector<Node> nodes_;
+  std::vector<uint32_t> items_;
+  /// the box of each of @c items_ , in leaf order, so that a leaf's boxes are tested individually
+  std::vector<Eigen::Vector3d> item_min_bounds_, item_max_bounds_;
+};
+
+inline bool BVH::overlaps(const Eigen::Vector3d &min_bound, const Eigen::Vector3d &max_bound,
+                          const Eigen::Vector3d &start, const Eigen::Vector3d &inv_dir)
+{
+  double t_min = 0.0, t_max = 1.0;
+  for (int axis = 0; axis < 3; axis++)
+  {
+    double t0 = (min_bound[axis] - start[axis]) * inv_dir[axis];
+    double t1 = (max_bound[axis] - start[axis]) * inv_dir[axis];
+    if (t0 > t1)
+    {
+      std::swap(t0, t1);
+    }
+    t_min = std::max(t_min, t0);
+    t_max = std::min(t_max, t1);
+  }
+  return t_min <= t_max;
+}
+
+template <class VisitFunction>
+void BVH::intersectSegment(const Eigen::Vector3d &start, const Eigen::Vector3d &end, VisitFunction visit) const
+{
+  if (nodes_.empty())
+  {
+    return;
+  }
+  // a huge rather than infinite inverse for axis aligned segments, so that a start on a box face gives no NaNs
+  const double huge = std::numeric_limits<double>::max();
+  const Eigen::Vector3d dir = end - start;
+  const Eigen::Vector3d inv_dir(dir[0] == 0.0 ? huge : 1.0 / dir[0], dir[1] == 0.0 ? huge : 1.0 / dir[1],
+                                dir[2] == 0.0 ? huge : 1.0 / dir[2]);
+  uint32_t stack[kMaxDepth + 1];
+  int stack_size = 0;
+  stack[stack_size++] = 0;
+  while (stack_size > 0)
+  {
+    const Node &node = nodes_[stack[--stack_size]];
+    if (!overlaps(node.min_bound, node.max_bound, start, inv_dir))
+    {
+      continue;
+    }
+    if (node.count > 0)
+    {
+      // a leaf's box can be much larger than its boxes, so each is tested too
+      for (uint32_t i = node.first; i < node.first + node.count; i++)
+      {
+        if (overlaps(item_min_bounds_[i], item_max_bounds_[i], start, inv_dir))
+        {
+          visit(items_[i]);
+        }
+      }
+    }
+    else
+    {
+      stack[stack_size++] = node.first + 1;
+      stack[stack_size++] = node.first;
+    }
+  }
+}
+}  // namespace ray
+
+#endif  // RAYLIB_RAYBVH_H
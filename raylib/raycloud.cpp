@@ -5,12 +5,18 @@
 // Author: Thomas Lowe
 #include "raycloud.h"
 
+#include "raycloudwriter.h"
+#include "rayindex.h"
 #include "raylaz.h"
 #include "rayply.h"
 #include "rayprogress.h"
+#include "rayrcz.h"
+#include "raythreads.h"
 
 #include <nabo/nabo.h>
 
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <limits>
 #include <set>
@@ -29,23 +35,49 @@ void Cloud::clear()
 void Cloud::save(const std::string &file_name) const
 {
   std::string name = file_name;
-  writePlyRayCloud(name, starts, ends, times, colours);
+  // a cloud without colours is coloured by time
+  std::vector<RGBA> time_colours;
+  if (colours.empty())
+  {
+    time_colours.resize(times.size());
+    colourByTime(times, time_colours);
+  }
+  const std::vector<RGBA> &saved_colours = colours.empty() ? time_colours : colours;
+  if (isRczFile(name))
+  {
+    if (!writeRczRayCloud(name, starts, ends, times, saved_colours))
+    {
+      std::cerr << "Error: cannot save " << name << std::endl;
+    }
+    return;
+  }
+  // written through the cloud writer, so that the saved file gets its spatial index and info cache
+  CloudWriter writer;
+  const bool begun = writer.begin(name);
+  bool saved = begun && writer.writeChunk(starts, ends, times, saved_colours);
+  // ended on failure too, which closes the file without writing its sidecars
+  saved = begun && writer.end() && saved;
+  if (!saved)
+  {
+    std::cerr << "Error: cannot save " << name << std::endl;
+  }
 }
 
 bool Cloud::load(const std::string &file_name, bool check_extension, int min_num_rays)
 {
   // look first for the raycloud PLY
-  if (file_name.substr(file_name.size() - 4) == ".ply" || !check_extension)
+  if (file_name.substr(file_name.size() - 4) == ".ply" || isRczFile(file_name) || !check_extension)
     return loadPLY(file_name, min_num_rays);
 
-  std::cerr << "Attempting to load ray cloud " << file_name << " which doesn't have expected file extension .ply"
-            << std::endl;
+  std::cerr << "Attempting to load ray cloud " << file_name
+            << " which doesn't have expected file extension .ply or .rcz" << std::endl;
   return false;
 }
 
 bool Cloud::loadPLY(const std::string &file, int min_num_rays)
 {
-  bool res = readPly(file, starts, ends, times, colours, true);
+  bool res = isRczFile(file) ? readRcz(file, starts, ends, times, colours)
+                             : readPly(file, starts, ends, times, colours, true);
   if ((int)ends.size() < min_num_rays)
     return false;
 #if defined OUTPUT_CLOUD_MOMENTS // Only used to supply data to unit tests
@@ -84,17 +116,20 @@ Eigen::Vector3d Cloud::calcMaxBound() const
   return max_v;
 }
 
-bool Cloud::calcBounds(Eigen::Vector3d *min_bounds, Eigen::Vector3d *max_bounds, unsigned flags,
-                       Progress *progress) const
+namespace
+{
+template <class CloudT>
+bool calcCloudBounds(const CloudT &cloud, Eigen::Vector3d *min_bounds, Eigen::Vector3d *max_bounds, unsigned flags,
+                     Progress *progress)
 {
-  if (rayCount() == 0)
+  if (cloud.rayCount() == 0)
   {
     return false;
   }
 
   if (progress)
   {
-    progress->begin("calcBounds", rayCount());
+    progress->begin("calcBounds", cloud.rayCount());
   }
 
   *min_bounds = Eigen::Vector3d(std::numeric_limits<double>::max(), std::numeric_limits<double>::max(),
@@ -102,20 +137,20 @@ bool Cloud::calcBounds(Eigen::Vector3d *min_bounds, Eigen::Vector3d *max_bounds,
   *max_bounds = Eigen::Vector3d(std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(),
                                 std::numeric_limits<double>::lowest());
   bool invalid_bounds = true;
-  for (size_t i = 0; i < rayCount(); ++i)
+  for (size_t i = 0; i < cloud.rayCount(); ++i)
   {
-    if (rayBounded(i))
+    if (cloud.rayBounded(i))
     {
       invalid_bounds = false;
       if (flags & kBFEnd)
       {
-        *min_bounds = minVector(*min_bounds, ends[i]);
-        *max_bounds = maxVector(*max_bounds, ends[i]);
+        *min_bounds = minVector(*min_bounds, cloud.end(i));
+        *max_bounds = maxVector(*max_bounds, cloud.end(i));
       }
       if (flags & kBFStart)
       {
-        *min_bounds = minVector(*min_bounds, starts[i]);
-        *max_bounds = maxVector(*max_bounds, starts[i]);
+        *min_bounds = minVector(*min_bounds, cloud.start(i));
+        *max_bounds = maxVector(*max_bounds, cloud.start(i));
       }
     }
 
@@ -128,64 +163,19 @@ bool Cloud::calcBounds(Eigen::Vector3d *min_bounds, Eigen::Vector3d *max_bounds,
   return !invalid_bounds;
 }
 
-void Cloud::transform(const Pose &pose, double time_delta)
-{
-  for (int i = 0; i < (int)starts.size(); i++)
-  {
-    starts[i] = pose * starts[i];
-    ends[i] = pose * ends[i];
-    times[i] += time_delta;
-  }
-}
-
-void Cloud::removeUnboundedRays()
-{
-  std::vector<int> valids;
-  for (int i = 0; i < (int)ends.size(); i++)
-    if (rayBounded(i))
-      valids.push_back(i);
-  for (int i = 0; i < (int)valids.size(); i++)
-  {
-    starts[i] = starts[valids[i]];
-    ends[i] = ends[valids[i]];
-    times[i] = times[valids[i]];
-    colours[i] = colours[valids[i]];
-  }
-  starts.resize(valids.size());
-  ends.resize(valids.size());
-  times.resize(valids.size());
-  colours.resize(valids.size());
-}
-
-void Cloud::decimate(double voxel_width, std::set<Eigen::Vector3i, Vector3iLess> &voxel_set)
-{
-  std::vector<int64_t> subsample;
-  voxelSubsample(ends, voxel_width, subsample, voxel_set);
-  for (int64_t i = 0; i < (int64_t)subsample.size(); i++)
-  {
-    const int64_t id = subsample[i];
-    starts[i] = starts[id];
-    ends[i] = ends[id];
-    colours[i] = colours[id];
-    times[i] = times[id];
-  }
-  starts.resize(subsample.size());
-  ends.resize(subsample.size());
-  colours.resize(subsample.size());
-  times.resize(subsample.size());
-}
-
-void Cloud::eigenSolve(const std::vector<int> &ray_ids, const Eigen::MatrixXi &indices, int index, int num_neighbours,
-                       Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> &solver, Eigen::Vector3d &centroid) const
+// Convert the set of neighbouring indices into a eigen solution, which is an ellipsoid of best fit.
+template <class CloudT>
+void eigenSolve(const CloudT &cloud, const std::vector<int> &ray_ids, const Eigen::MatrixXi &indices, int index,
+                int num_neighbours, Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> &solver, Eigen::Vector3d &centroid)
 {
   int ray_id = ray_ids[index];
-  centroid = ends[ray_id];
-  for (int j = 0; j < num_neighbours; j++) centroid += ends[ray_ids[indices(j, index)]];
+  centroid = cloud.end(ray_id);
+  for (int j = 0; j < num_neighbours; j++) centroid += cloud.end(ray_ids[indices(j, index)]);
   centroid /= (double)(num_neighbours + 1);
-  Eigen::Matrix3d scatter = (ends[ray_id] - centroid) * (ends[ray_id] - centroid).transpose();
+  Eigen::Matrix3d scatter = (cloud.end(ray_id) - centroid) * (cloud.end(ray_id) - centroid).transpose();
   for (int j = 0; j < num_neighbours; j++)
   {
-    Eigen::Vector3d offset = ends[ray_ids[indices(j, index)]] - centroid;
+    Eigen::Vector3d offset = cloud.end(ray_ids[indices(j, index)]) - centroid;
     scatter += offset * offset.transpose();
   }
   scatter /= (double)(num_neighbours + 1);
@@ -193,27 +183,29 @@ void Cloud::eigenSolve(const std::vector<int> &ray_ids, const Eigen::MatrixXi &i
   ASSERT(solver.info() == Eigen::ComputationInfo::Success);
 }
 
-void Cloud::getSurfels(int search_size, std::vector<Eigen::Vector3d> *centroids, std::vector<Eigen::Vector3d> *normals,
-                       std::vector<Eigen::Vector3d> *dimensions, std::vector<Eigen::Matrix3d> *mats,
-                       Eigen::MatrixXi *neighbour_indices, double max_distance, bool reject_back_facing_rays) const
+template <class CloudT>
+void getCloudSurfels(const CloudT &cloud, int search_size, std::vector<Eigen::Vector3d> *centroids,
+                     std::vector<Eigen::Vector3d> *normals, std::vector<Eigen::Vector3d> *dimensions,
+                     std::vector<Eigen::Matrix3d> *mats, Eigen::MatrixXi *neighbour_indices, double max_distance,
+                     bool reject_back_facing_rays)
 {
   // simplest scheme... find 3 nearest neighbours and do cross product
   if (centroids)
-    centroids->resize(ends.size());
+    centroids->resize(cloud.rayCount());
   if (normals)
-    normals->resize(ends.size());
+    normals->resize(cloud.rayCount());
   if (dimensions)
-    dimensions->resize(ends.size());
+    dimensions->resize(cloud.rayCount());
   if (mats)
-    mats->resize(ends.size());
+    mats->resize(cloud.rayCount());
   Nabo::NNSearchD *nns;
   std::vector<int> ray_ids;
-  ray_ids.reserve(ends.size());
-  for (unsigned int i = 0; i < ends.size(); i++)
-    if (rayBounded(i))
+  ray_ids.reserve(cloud.rayCount());
+  for (unsigned int i = 0; i < cloud.rayCount(); i++)
+    if (cloud.rayBounded(i))
       ray_ids.push_back(i);
   Eigen::MatrixXd points_p(3, ray_ids.size());
-  for (unsigned int i = 0; i < ray_ids.size(); i++) points_p.col(i) = ends[ray_ids[i]];
+  for (unsigned int i = 0; i < ray_ids.size(); i++) points_p.col(i) = cloud.end(ray_ids[i]);
   nns = Nabo::NNSearchD::createKDTreeLinearHeap(points_p, 3);
 
   // Run the search
@@ -229,7 +221,7 @@ void Cloud::getSurfels(int search_size, std::vector<Eigen::Vector3d> *centroids,
 
   if (neighbour_indices)
   {
-    neighbour_indices->resize(search_size, ends.size());
+    neighbour_indices->resize(search_size, cloud.rayCount());
     for (int i = 0; i<neighbour_indices->rows(); i++)
     {
       for (int j = 0; j < neighbour_indices->cols(); j++)
@@ -256,17 +248,17 @@ void Cloud::getSurfels(int search_size, std::vector<Eigen::Vector3d> *centroids,
       for (num_neighbours = 0; num_neighbours < search_size && indices(num_neighbours, i) != Nabo::NNSearchD::InvalidIndex; num_neighbours++){}
 
       Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigen_solver(3);
-      eigenSolve(ray_ids, indices, i, num_neighbours, eigen_solver, centroid);
+      eigenSolve(cloud, ray_ids, indices, i, num_neighbours, eigen_solver, centroid);
       if (reject_back_facing_rays)
       {
         Eigen::Vector3d normal = eigen_solver.eigenvectors().col(0);
-        if ((ends[ray_id] - starts[ray_id]).dot(normal) > 0.0)
+        if ((cloud.end(ray_id) - cloud.start(ray_id)).dot(normal) > 0.0)
           normal = -normal;
         bool changed = false;
         for (int j = num_neighbours - 1; j >= 0; j--)
         {
           int id = ray_ids[indices(j, i)];
-          if ((ends[id] - starts[id]).dot(normal) > 0.0)
+          if ((cloud.end(id) - cloud.start(id)).dot(normal) > 0.0)
           {
             indices(j, i) = indices(--num_neighbours, i);
             changed = true;
@@ -274,7 +266,7 @@ void Cloud::getSurfels(int search_size, std::vector<Eigen::Vector3d> *centroids,
         }
         if (changed)
         {
-          eigenSolve(ray_ids, indices, i, num_neighbours, eigen_solver, centroid);
+          eigenSolve(cloud, ray_ids, indices, i, num_neighbours, eigen_solver, centroid);
         }
       }   
       if (centroids)
@@ -282,7 +274,7 @@ void Cloud::getSurfels(int search_size, std::vector<Eigen::Vector3d> *centroids,
       if (normals)
       {
         Eigen::Vector3d normal = eigen_solver.eigenvectors().col(0);
-        if ((ends[ray_id] - starts[ray_id]).dot(normal) > 0.0)
+        if ((cloud.end(ray_id) - cloud.start(ray_id)).dot(normal) > 0.0)
           normal = -normal;
         (*normals)[ray_id] = normal;
       }
@@ -298,6 +290,108 @@ void Cloud::getSurfels(int search_size, std::vector<Eigen::Vector3d> *centroids,
   }
 }
 
+template <class CloudT>
+double estimateCloudPointSpacing(const CloudT &cloud)
+{
+  // two-iteration estimation, modelling the point distribution by the below exponent.
+  // larger exponents (towards 2.5) match thick forests, lower exponents (towards 2) match smooth terrain and surfaces
+  const double cloud_exponent = 2.0;  // model num_points = (cloud_width/voxel_width)^cloud_exponent
+
+  Eigen::Vector3d min_bound, max_bound;
+  calcCloudBounds(cloud, &min_bound, &max_bound, kBFEnd, nullptr);
+  Eigen::Vector3d extent = max_bound - min_bound;
+  int num_points = 0;
+  for (unsigned int i = 0; i < cloud.rayCount(); i++)
+    if (cloud.rayBounded(i))
+      num_points++;
+  double cloud_width = pow(extent[0] * extent[1] * extent[2], 1.0 / 3.0);  // an average
+  double voxel_width = cloud_width / pow((double)num_points, 1.0 / cloud_exponent);
+  voxel_width *=
+    5.0;  // we want to use a larger width because this process only works when the width is an overestimation
+  std::cout << "initial voxel width estimate: " << voxel_width << std::endl;
+  double num_voxels = 0;
+  VoxelSet test_set;
+  for (unsigned int i = 0; i < cloud.rayCount(); i++)
+  {
+    if (cloud.rayBounded(i))
+    {
+      const Eigen::Vector3d point = cloud.end(i);
+      Eigen::Vector3i place(int(std::floor(point[0] / voxel_width)), int(std::floor(point[1] / voxel_width)),
+                            int(std::floor(point[2] / voxel_width)));
+      if (test_set.insert(place))
+      {
+        num_voxels++;
+      }
+    }
+  }
+  double points_per_voxel = (double)num_points / num_voxels;
+  double width = voxel_width / pow(points_per_voxel, 1.0 / cloud_exponent);
+  std::cout << "estimated point spacing: " << width << std::endl;
+  return width;
+}
+}  // namespace
+
+bool Cloud::calcBounds(Eigen::Vector3d *min_bounds, Eigen::Vector3d *max_bounds, unsigned flags,
+                       Progress *progress) const
+{
+  return calcCloudBounds(*this, min_bounds, max_bounds, flags, progress);
+}
+
+void Cloud::transform(const Pose &pose, double time_delta)
+{
+  for (int i = 0; i < (int)starts.size(); i++)
+  {
+    starts[i] = pose * starts[i];
+    ends[i] = pose * ends[i];
+    times[i] += time_delta;
+  }
+}
+
+void Cloud::removeUnboundedRays()
+{
+  std::vector<int> valids;
+  for (int i = 0; i < (int)ends.size(); i++)
+    if (rayBounded(i))
+      valids.push_back(i);
+  for (int i = 0; i < (int)valids.size(); i++)
+  {
+    starts[i] = starts[valids[i]];
+    ends[i] = ends[valids[i]];
+    times[i] = times[valids[i]];
+    colours[i] = colours[valids[i]];
+  }
+  starts.resize(valids.size());
+  ends.resize(valids.size());
+  times.resize(valids.size());
+  colours.resize(valids.size());
+}
+
+void Cloud::decimate(double voxel_width, VoxelSet &voxel_set)
+{
+  std::vector<int64_t> subsample;
+  voxelSubsample(ends, voxel_width, subsample, voxel_set);
+  for (int64_t i = 0; i < (int64_t)subsample.size(); i++)
+  {
+    const int64_t id = subsample[i];
+    starts[i] = starts[id];
+    ends[i] = ends[id];
+    colours[i] = colours[id];
+    times[i] = times[id];
+  }
+  starts.resize(subsample.size());
+  ends.resize(subsample.size());
+  colours.resize(subsample.size());
+  times.resize(subsample.size());
+}
+
+void Cloud::getSurfels(int search_size, std::vector<Eigen::Vector3d> *centroids, std::vector<Eigen::Vector3d> *normals,
+                       std::vector<Eigen::Vector3d> *dimensions, std::vector<Eigen::Matrix3d> *mats,
+                       Eigen::MatrixXi *neighbour_indices, double max_distance, bool reject_back_facing_rays) const
+{
+  getCloudSurfels(*this, search_size, centroids, normals, dimensions, mats, neighbour_indices, max_distance,
+                  reject_back_facing_rays);
+}
+
 // starts are required to get the normal the right way around
 std::vector<Eigen::Vector3d> Cloud::generateNormals(int search_size)
 {
@@ -306,58 +400,175 @@ std::vector<Eigen::Vector3d> Cloud::generateNormals(int search_size)
   return normals;
 }
 
-bool RAYLIB_EXPORT Cloud::getInfo(const std::string &file_name, Info &info)
+void Cloud::Info::clear()
 {
   double min_s = std::numeric_limits<double>::max();
   double max_s = std::numeric_limits<double>::lowest();
   Eigen::Vector3d min_v(min_s, min_s, min_s);
   Eigen::Vector3d max_v(max_s, max_s, max_s);
   Cuboid unbounded(min_v, max_v);
-  info.ends_bound = info.starts_bound = info.rays_bound = unbounded;
-  info.num_rays = info.num_bounded = 0;
-  info.min_time = min_s;
-  info.max_time = max_s;
-  info.centroid.setZero();
-  info.start_pos.setZero();
-  info.end_pos.setZero();
-  auto find_bounds = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
-                         std::vector<double> &times, std::vector<ray::RGBA> &colours) {
-    for (size_t i = 0; i < ends.size(); i++)
+  ends_bound = starts_bound = rays_bound = unbounded;
+  num_rays = num_bounded = 0;
+  min_time = min_s;
+  max_time = max_s;
+  centroid.setZero();
+  start_pos.setZero();
+  end_pos.setZero();
+  point_spacing = 0.0;
+}
+
+void Cloud::Info::add(const std::vector<Eigen::Vector3d> &starts, const std::vector<Eigen::Vector3d> &ends,
+                      const std::vector<double> &times, const std::vector<RGBA> &colours)
+{
+  for (size_t i = 0; i < ends.size(); i++)
+  {
+    if (colours[i].alpha > 0)
     {
-      if (colours[i].alpha > 0)
-      {
-        info.ends_bound.min_bound_ = minVector(info.ends_bound.min_bound_, ends[i]);
-        info.ends_bound.max_bound_ = maxVector(info.ends_bound.max_bound_, ends[i]);
-        info.num_bounded++;
-        info.centroid += ends[i];
-      }
-      info.num_rays++;
-      info.starts_bound.min_bound_ = minVector(info.starts_bound.min_bound_, starts[i]);
-      info.starts_bound.max_bound_ = maxVector(info.starts_bound.max_bound_, starts[i]);
-      info.rays_bound.min_bound_ = minVector(info.rays_bound.min_bound_, ends[i]);
-      info.rays_bound.max_bound_ = maxVector(info.rays_bound.max_bound_, ends[i]);
-      if (times[i] < info.min_time)
-      {
-        info.start_pos = starts[i];
-      }
-      info.min_time = std::min(info.min_time, times[i]);
-      if (times[i] > info.max_time)
-      {
-        info.end_pos = starts[i];
-      }
-      info.max_time = std::max(info.max_time, times[i]);
+      ends_bound.min_bound_ = minVector(ends_bound.min_bound_, ends[i]);
+      ends_bound.max_bound_ = maxVector(ends_bound.max_bound_, ends[i]);
+      num_bounded++;
+      centroid += ends[i];
+    }
+    num_rays++;
+    starts_bound.min_bound_ = minVector(starts_bound.min_bound_, starts[i]);
+    starts_bound.max_bound_ = maxVector(starts_bound.max_bound_, starts[i]);
+    rays_bound.min_bound_ = minVector(rays_bound.min_bound_, ends[i]);
+    rays_bound.max_bound_ = maxVector(rays_bound.max_bound_, ends[i]);
+    if (times[i] < min_time)
+    {
+      start_pos = starts[i];
+    }
+    min_time = std::min(min_time, times[i]);
+    if (times[i] > max_time)
+    {
+      end_pos = starts[i];
     }
-    info.rays_bound.min_bound_ = minVector(info.rays_bound.min_bound_, info.starts_bound.min_bound_);
-    info.rays_bound.max_bound_ = maxVector(info.rays_bound.max_bound_, info.starts_bound.max_bound_);
+    max_time = std::max(max_time, times[i]);
+  }
+  rays_bound.min_bound_ = minVector(rays_bound.min_bound_, starts_bound.min_bound_);
+  rays_bound.max_bound_ = maxVector(rays_bound.max_bound_, starts_bound.max_bound_);
+}
+
+void Cloud::Info::finish()
+{
+  centroid /= static_cast<double>(num_bounded);
+}
+
+bool RAYLIB_EXPORT Cloud::getInfo(const std::string &file_name, Info &info)
+{
+  if (loadInfo(file_name, info))
+  {
+    return true;
+  }
+  info.clear();
+  auto find_bounds = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                         std::vector<double> &times, std::vector<ray::RGBA> &colours) {
+    info.add(starts, ends, times, colours);
   };
-  bool success = readPly(file_name, true, find_bounds, 0);
-  info.centroid /= static_cast<double>(info.num_bounded);
+  bool success = Cloud::read(file_name, find_bounds);
+  info.finish();
   return success;
 }
 
+namespace
+{
+const char kInfoMagic[4] = { 'R', 'I', 'N', 'F' };
+const uint32_t kInfoVersion = 1;
+
+/// The info values, in their order in the cache file
+std::vector<double *> infoValues(Cloud::Info &info)
+{
+  std::vector<double *> values;
+  for (Cuboid *bound : { &info.ends_bound, &info.starts_bound, &info.rays_bound })
+  {
+    for (int i = 0; i < 3; i++) values.push_back(&bound->min_bound_[i]);
+    for (int i = 0; i < 3; i++) values.push_back(&bound->max_bound_[i]);
+  }
+  values.push_back(&info.min_time);
+  values.push_back(&info.max_time);
+  for (Eigen::Vector3d *vec : { &info.centroid, &info.start_pos, &info.end_pos })
+  {
+    for (int i = 0; i < 3; i++) values.push_back(&(*vec)[i]);
+  }
+  values.push_back(&info.point_spacing);
+  return values;
+}
+}  // namespace
+
+bool RAYLIB_EXPORT Cloud::saveInfo(const std::string &file_name, const Info &info)
+{
+  FileStamp stamp;
+  if (!stamp.get(file_name))
+  {
+    return false;
+  }
+  std::ofstream out(infoFileName(file_name), std::ios::binary | std::ios::out);
+  if (out.fail())
+  {
+    return false;
+  }
+  Info copy = info;
+  const int32_t counts[2] = { info.num_bounded, info.num_rays };
+  out.write(kInfoMagic, 4);
+  out.write((const char *)&kInfoVersion, sizeof(kInfoVersion));
+  out.write((const char *)&stamp.size, sizeof(stamp.size));
+  out.write((const char *)&stamp.modified, sizeof(stamp.modified));
+  out.write((const char *)counts, sizeof(counts));
+  for (double *value : infoValues(copy)) out.write((const char *)value, sizeof(double));
+  return out.good();
+}
+
+bool RAYLIB_EXPORT Cloud::loadInfo(const std::string &file_name, Info &info)
+{
+  FileStamp stamp;
+  if (!stamp.get(file_name))
+  {
+    return false;
+  }
+  std::ifstream in(infoFileName(file_name), std::ios::binary | std::ios::in);
+  if (in.fail())
+  {
+    return false;
+  }
+  char magic[4];
+  uint32_t version = 0;
+  FileStamp cached_stamp;
+  int32_t counts[2];
+  in.read(magic, 4);
+  in.read((char *)&version, sizeof(version));
+  in.read((char *)&cached_stamp.size, sizeof(cached_stamp.size));
+  in.read((char *)&cached_stamp.modified, sizeof(cached_stamp.modified));
+  in.read((char *)counts, sizeof(counts));
+  if (!in || memcmp(magic, kInfoMagic, 4) != 0 || version != kInfoVersion || !(cached_stamp == stamp))
+  {
+    return false;  // not an info cache, or a stale one
+  }
+  Info cached;
+  cached.num_bounded = counts[0];
+  cached.num_rays = counts[1];
+  for (double *value : infoValues(cached)) in.read((char *)value, sizeof(double));
+  if (!in)
+  {
+    return false;
+  }
+  info = cached;
+  return true;
+}
 
 double Cloud::estimatePointSpacing(const std::string &file_name, const Cuboid &bounds, int num_points)
 {
+  // the cached spacing is for the whole file, so is only used when the arguments describe the whole file
+  auto describes_file = [&](const Info &info) {
+    return info.num_bounded == num_points && info.ends_bound.min_bound_ == bounds.min_bound_ &&
+           info.ends_bound.max_bound_ == bounds.max_bound_;
+  };
+  Info info;
+  const bool has_info = loadInfo(file_name, info) && describes_file(info);
+  if (has_info && info.point_spacing > 0.0)
+  {
+    std::cout << "estimated point spacing: " << info.point_spacing << std::endl;
+    return info.point_spacing;
+  }
   // two-iteration estimation, modelling the point distribution by the below exponent.
   // larger exponents (towards 2.5) match thick forests, lower exponents (towards 2) match smooth terrain and surfaces
   const double cloud_exponent = 2.0;  // model num_points = (cloud_width/voxel_width)^cloud_exponent
@@ -369,7 +580,7 @@ double Cloud::estimatePointSpacing(const std::string &file_name, const Cuboid &b
     5.0;  // we want to use a larger width because this process only works when the width is an overestimation
   std::cout << "initial voxel width estimate: " << voxel_width << std::endl;
   double num_voxels = 0;
-  std::set<Eigen::Vector3i, Vector3iLess> test_set;
+  VoxelSet test_set;
 
   auto estimate_size = [&](std::vector<Eigen::Vector3d> &, std::vector<Eigen::Vector3d> &ends, std::vector<double> &,
                            std::vector<ray::RGBA> &colours) {
@@ -381,58 +592,29 @@ double Cloud::estimatePointSpacing(const std::string &file_name, const Cuboid &b
       const Eigen::Vector3d &point = ends[i];
       Eigen::Vector3i place(int(std::floor(point[0] / voxel_width)), int(std::floor(point[1] / voxel_width)),
                             int(std::floor(point[2] / voxel_width)));
-      if (test_set.insert(place).second)
+      if (test_set.insert(place))
       {
         num_voxels++;
       }
     }
   };
-  if (!readPly(file_name, true, estimate_size, 0))
+  if (!Cloud::read(file_name, estimate_size))
     return 0;
 
   double points_per_voxel = (double)num_points / num_voxels;
   double width = voxel_width / pow(points_per_voxel, 1.0 / cloud_exponent);
   std::cout << "estimated point spacing: " << width << std::endl;
+  if (has_info && loadInfo(file_name, info))  // reloaded, in case the file has changed while reading it
+  {
+    info.point_spacing = width;
+    saveInfo(file_name, info);
+  }
   return width;
 }
 
 double Cloud::estimatePointSpacing() const
 {
-  // two-iteration estimation, modelling the point distribution by the below exponent.
-  // larger exponents (towards 2.5) match thick forests, lower exponents (towards 2) match smooth terrain and surfaces
-  const double cloud_exponent = 2.0;  // model num_points = (cloud_width/voxel_width)^cloud_exponent
-
-  Eigen::Vector3d min_bound, max_bound;
-  calcBounds(&min_bound, &max_bound, kBFEnd);
-  Eigen::Vector3d extent = max_bound - min_bound;
-  int num_points = 0;
-  for (unsigned int i = 0; i < ends.size(); i++)
-    if (rayBounded(i))
-      num_points++;
-  double cloud_width = pow(extent[0] * extent[1] * extent[2], 1.0 / 3.0);  // an average
-  double voxel_width = cloud_width / pow((double)num_points, 1.0 / cloud_exponent);
-  voxel_width *=
-    5.0;  // we want to use a larger width because this process only works when the width is an overestimation
-  std::cout << "initial voxel width estimate: " << voxel_width << std::endl;
-  double num_voxels = 0;
-  std::set<Eigen::Vector3i, Vector3iLess> test_set;
-  for (unsigned int i = 0; i < ends.size(); i++)
-  {
-    if (rayBounded(i))
-    {
-      const Eigen::Vector3d &point = ends[i];
-      Eigen::Vector3i place(int(std::floor(point[0] / voxel_width)), int(std::floor(point[1] / voxel_width)),
-                            int(std::floor(point[2] / voxel_width)));
-      if (test_set.insert(place).second)
-      {
-        num_voxels++;
-      }
-    }
-  }
-  double points_per_voxel = (double)num_points / num_voxels;
-  double width = voxel_width / pow(points_per_voxel, 1.0 / cloud_exponent);
-  std::cout << "estimated point spacing: " << width << std::endl;
-  return width;
+  return estimateCloudPointSpacing(*this);
 }
 
 void Cloud::split(Cloud &cloud1, Cloud &cloud2, std::function<bool(int i)> fptr)
@@ -523,11 +705,305 @@ Eigen::Array<double, 22, 1> Cloud::getMoments() const
 }
 
 bool Cloud::read(const std::string &file_name,
+                 std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                                    std::vector<double> &times, std::vector<RGBA> &colours)>
+                   apply,
+                 int prefetch_depth)
+{
+  if (isRczFile(file_name))
+    return readRcz(file_name, apply, 1000000, Threads::threadCount());
+  return readPly(file_name, true, apply, 0, false, 1000000, kPRMMapped, Threads::threadCount(), prefetch_depth);
+}
+
+bool Cloud::read(const std::string &file_name, const Cuboid &region,
                  std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
                                     std::vector<double> &times, std::vector<RGBA> &colours)>
                    apply)
 {
-  return readPly(file_name, true, apply, 0);
+  // keep only the rays that intersect the region, in place
+  auto apply_in_region = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                             std::vector<double> &times, std::vector<RGBA> &colours) {
+    size_t num_kept = 0;
+    for (size_t i = 0; i < ends.size(); i++)
+    {
+      Eigen::Vector3d start = starts[i], end = ends[i];
+      if (!region.clipRay(start, end))
+        continue;
+      starts[num_kept] = starts[i];
+      ends[num_kept] = ends[i];
+      times[num_kept] = times[i];
+      colours[num_kept] = colours[i];
+      num_kept++;
+    }
+    starts.resize(num_kept);
+    ends.resize(num_kept);
+    times.resize(num_kept);
+    colours.resize(num_kept);
+    if (num_kept > 0)
+      apply(starts, ends, times, colours);
+  };
+
+  RayIndex index;
+  if (isRczFile(file_name) || !index.load(file_name))
+  {
+    return read(file_name, apply_in_region);
+  }
+  // read the overlapping blocks, joining consecutive ones into chunks of up to the usual chunk size
+  const size_t max_chunk_rays = 1000000;
+  std::vector<std::pair<size_t, size_t>> ranges;
+  size_t num_blocks = 0;
+  for (auto &block : index.blocks())
+  {
+    if (!block.bounds.overlaps(region))
+      continue;
+    num_blocks++;
+    if (!ranges.empty() && ranges.back().first + ranges.back().second == block.first_ray &&
+        ranges.back().second + block.num_rays <= max_chunk_rays)
+      ranges.back().second += block.num_rays;
+    else
+      ranges.push_back(std::make_pair(block.first_ray, block.num_rays));
+  }
+  std::cout << "reading " << num_blocks << " of " << index.blocks().size() << " indexed blocks of " << file_name
+            << std::endl;
+  return readPlyRanges(file_name, ranges, apply_in_region);
+}
+
+void CompactCloud::clear()
+{
+  starts.clear();
+  ends.clear();
+  times.clear();
+  colours.clear();
+}
+
+void CompactCloud::reserve(size_t size)
+{
+  starts.reserve(size);
+  ends.reserve(size);
+  times.reserve(size);
+  colours.reserve(size);
+}
+
+void CompactCloud::addRay(const Eigen::Vector3d &start, const Eigen::Vector3d &end, double time, const RGBA &colour)
+{
+  if (ends.empty() && origin.squaredNorm() == 0.0)
+  {
+    origin = Eigen::Vector3d(std::round(start[0]), std::round(start[1]), std::round(start[2]));
+  }
+  starts.push_back((start - origin).cast<float>());
+  ends.push_back((end - origin).cast<float>());
+  times.push_back(time);
+  colours.push_back(colour);
+}
+
+void CompactCloud::addRay(const CompactCloud &other_cloud, size_t index)
+{
+  addRay(other_cloud.start(index), other_cloud.end(index), other_cloud.times[index], other_cloud.colours[index]);
+}
+
+void CompactCloud::save(const std::string &file_name) const
+{
+  CloudWriter writer;
+  if (!writer.begin(file_name))
+  {
+    return;
+  }
+  // converted back to double precision one chunk at a time
+  const size_t chunk_size = 1000000;
+  Cloud chunk;
+  for (size_t first = 0; first < rayCount(); first += chunk_size)
+  {
+    const size_t num = std::min(chunk_size, rayCount() - first);
+    chunk.resize(num);
+    for (size_t i = 0; i < num; i++)
+    {
+      chunk.starts[i] = start(first + i);
+      chunk.ends[i] = end(first + i);
+      chunk.times[i] = times[first + i];
+      chunk.colours[i] = colours[first + i];
+    }
+    writer.writeChunk(chunk);
+  }
+  writer.end();
+}
+
+bool CompactCloud::load(const std::string &file_name, int min_num_rays)
+{
+  clear();
+  origin.setZero();
+  Cloud::Info info;
+  if (Cloud::loadInfo(file_name, info))
+  {
+    reserve(static_cast<size_t>(info.num_rays));
+  }
+  auto add_chunk = [this](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                          std::vector<double> &times, std::vector<RGBA> &colours) {
+    for (size_t i = 0; i < ends.size(); i++) addRay(starts[i], ends[i], times[i], colours[i]);
+  };
+  if (!Cloud::read(file_name, add_chunk))
+  {
+    return false;
+  }
+  return (int)ends.size() >= min_num_rays;
+}
+
+void CompactCloud::getSurfels(int search_size, std::vector<Eigen::Vector3d> *centroids,
+                              std::vector<Eigen::Vector3d> *normals, std::vector<Eigen::Vector3d> *dimensions,
+                              std::vector<Eigen::Matrix3d> *mats, Eigen::MatrixXi *neighbour_indices,
+                              double max_distance, bool reject_back_facing_rays) const
+{
+  getCloudSurfels(*this, search_size, centroids, normals, dimensions, mats, neighbour_indices, max_distance,
+                  reject_back_facing_rays);
+}
+
+double CompactCloud::estimatePointSpacing() const
+{
+  return estimateCloudPointSpacing(*this);
+}
+
+bool CompactCloud::calcBounds(Eigen::Vector3d *min_bounds, Eigen::Vector3d *max_bounds, unsigned flags,
+                              Progress *progress) const
+{
+  return calcCloudBounds(*this, min_bounds, max_bounds, flags, progress);
+}
+
+void TrajectoryCloud::clear()
+{
+  ends.clear();
+  times.clear();
+  colours.clear();
+}
+
+void TrajectoryCloud::reserve(size_t size)
+{
+  ends.reserve(size);
+  times.reserve(size);
+  colours.reserve(size);
+}
+
+void TrajectoryCloud::addRay(const Eigen::Vector3d &end, double time, const RGBA &colour)
+{
+  ends.push_back(end);
+  times.push_back(time);
+  colours.push_back(colour);
+}
+
+void TrajectoryCloud::addRay(const TrajectoryCloud &other_cloud, size_t index)
+{
+  addRay(other_cloud.ends[index], other_cloud.times[index], other_cloud.colours[index]);
+}
+
+Eigen::Vector3d TrajectoryCloud::removeStartPos()
+{
+  Eigen::Vector3d offset(0, 0, 0);
+  if (!ends.empty())
+  {
+    offset = ends[0];
+    translate(-offset);
+  }
+  return offset;
+}
+
+void TrajectoryCloud::translate(const Eigen::Vector3d &offset)
+{
+  if (offset.squaredNorm() != 0.0)
+  {
+    for (auto &end : ends)
+    {
+      end += offset;
+    }
+    // the starts are interpolated from the trajectory, so move with it
+    for (auto &point : trajectory.points())
+    {
+      point += offset;
+    }
+  }
+}
+
+void TrajectoryCloud::save(const std::string &file_name) const
+{
+  CloudWriter writer;
+  if (!writer.begin(file_name))
+  {
+    return;
+  }
+  writer.setTrajectory(trajectory);
+  writer.writeChunk(*this);
+  writer.end();
+}
+
+bool TrajectoryCloud::load(const std::string &file_name, const Trajectory *trajectory, double max_error,
+                           int min_num_rays)
+{
+  clear();
+  if (trajectory)
+  {
+    this->trajectory = *trajectory;
+  }
+  else if (!isRczFile(file_name) || !readRczTrajectory(file_name, this->trajectory))
+  {
+    std::cerr << "Error: a trajectory is needed to load " << file_name << " as a trajectory cloud" << std::endl;
+    return false;
+  }
+  if (this->trajectory.points().empty())
+  {
+    std::cerr << "Error: " << file_name << " does not store a trajectory" << std::endl;
+    return false;
+  }
+  Cloud::Info info;
+  if (Cloud::loadInfo(file_name, info))
+  {
+    reserve(static_cast<size_t>(info.num_rays));
+  }
+  bool on_trajectory = true;
+  std::vector<Eigen::Vector3d> trajectory_starts;
+  auto add_chunk = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &chunk_ends,
+                       std::vector<double> &chunk_times, std::vector<RGBA> &chunk_colours) {
+    trajectory_starts.resize(chunk_ends.size());
+    this->trajectory.linear(chunk_times.data(), chunk_times.size(), trajectory_starts.data());
+    for (size_t i = 0; i < chunk_ends.size() && on_trajectory; i++)
+    {
+      if ((starts[i] - trajectory_starts[i]).squaredNorm() > max_error * max_error)
+      {
+        std::cerr << "Error: the start of ray " << ends.size() + i << " in " << file_name << " is "
+                  << (starts[i] - trajectory_starts[i]).norm() << " m from the trajectory" << std::endl;
+        on_trajectory = false;
+      }
+    }
+    if (!on_trajectory)
+    {
+      return;
+    }
+    ends.insert(ends.end(), chunk_ends.begin(), chunk_ends.end());
+    times.insert(times.end(), chunk_times.begin(), chunk_times.end());
+    colours.insert(colours.end(), chunk_colours.begin(), chunk_colours.end());
+  };
+  if (!Cloud::read(file_name, add_chunk) || !on_trajectory)
+  {
+    clear();
+    return false;
+  }
+  return (int)ends.size() >= min_num_rays;
+}
+
+void TrajectoryCloud::getSurfels(int search_size, std::vector<Eigen::Vector3d> *centroids,
+                                 std::vector<Eigen::Vector3d> *normals, std::vector<Eigen::Vector3d> *dimensions,
+                                 std::vector<Eigen::Matrix3d> *mats, Eigen::MatrixXi *neighbour_indices,
+                                 double max_distance, bool reject_back_facing_rays) const
+{
+  getCloudSurfels(*this, search_size, centroids, normals, dimensions, mats, neighbour_indices, max_distance,
+                  reject_back_facing_rays);
+}
+
+double TrajectoryCloud::estimatePointSpacing() const
+{
+  return estimateCloudPointSpacing(*this);
+}
+
+bool TrajectoryCloud::calcBounds(Eigen::Vector3d *min_bounds, Eigen::Vector3d *max_bounds, unsigned flags,
+                                 Progress *progress) const
+{
+  return calcCloudBounds(*this, min_bounds, max_bounds, flags, progress);
 }
 
 }  // namespace ray
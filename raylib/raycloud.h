@@ -12,6 +12,7 @@
 #include <set>
 #include "raygrid.h"
 #include "raypose.h"
+#include "raytrajectory.h"
 #include "rayutils.h"
 
 namespace ray
@@ -53,9 +54,15 @@ public:
 
   /// the number of rays
   inline size_t rayCount() const { return ends.size(); }
+  /// the start point of ray @c i. This and @c end(i) give the same access to the rays as CompactCloud, for the
+  /// algorithms that accept both
+  inline const Eigen::Vector3d &start(size_t i) const { return starts[i]; }
+  /// the end point of ray @c i
+  inline const Eigen::Vector3d &end(size_t i) const { return ends[i]; }
 
+  /// save a ray cloud file, in the compressed format (see rayrcz.h) if @c file_name has the .rcz extension
   void save(const std::string &file_name) const;
-  /// load a ray cloud file. @c check_extension checks the file extension before proceeding
+  /// load a .ply or .rcz ray cloud file. @c check_extension checks the file extension before proceeding
   bool load(const std::string &file_name, bool check_extension = true, int min_num_rays = 4);
 
   /// minimum bounds of all bounded rays
@@ -92,7 +99,7 @@ public:
   /// apply a Euclidean transform and time shift to the ray cloud
   void transform(const Pose &pose, double time_delta);
   /// spatial decimation of the ray cloud, into one end point per voxel of width @c voxel_width
-  void decimate(double voxel_width, std::set<Eigen::Vector3i, Vector3iLess> &voxel_set);
+  void decimate(double voxel_width, VoxelSet &voxel_set);
   /// add a new ray to the ray cloud
   void addRay(const Eigen::Vector3d &start, const Eigen::Vector3d &end, double time, const RGBA &colour);
   /// add a new ray to the ray cloud, from another cloud
@@ -140,6 +147,9 @@ public:
   /// Static functions. These operate on the cloud file, and so do not require the full file to fit in memory
 
   /// Version for estimating the spacing between points for raycloud files.
+  /// If the file has an up to date info cache (see getInfo), and @c bounds and @c num_points are its ends_bound and
+  /// num_bounded, then the estimate is stored in it, and later calls return the stored estimate without reading the
+  /// file.
   static double estimatePointSpacing(const std::string &file_name, const Cuboid &bounds, int num_points);
 
   /// Calculate the key information of a ray cloud, such as its bounds
@@ -158,21 +168,160 @@ public:
     double max_time;
     Eigen::Vector3d centroid;
     Eigen::Vector3d start_pos, end_pos;
+    double point_spacing;  // estimated spacing between the end points, 0 if it has not been estimated
+
+    /// reset to the info of an empty cloud
+    void clear();
+    /// include the rays of one chunk. Call finish() after the last chunk
+    void add(const std::vector<Eigen::Vector3d> &starts, const std::vector<Eigen::Vector3d> &ends,
+             const std::vector<double> &times, const std::vector<RGBA> &colours);
+    /// complete the averaged values, once all of the rays have been added
+    void finish();
   };
+  /// Gets the info of the ray cloud file. This reads the whole file, unless the file has an up to date info cache,
+  /// which is a small sidecar file written by CloudWriter. The cache is ignored once the file has been changed.
   static bool RAYLIB_EXPORT getInfo(const std::string &file_name, Info &info);
+  /// the file name of the info cache for the ray cloud @c file_name
+  static std::string infoFileName(const std::string &file_name) { return file_name + ".info"; }
+  /// write the info cache for the ray cloud file @c file_name, which must be complete
+  static bool RAYLIB_EXPORT saveInfo(const std::string &file_name, const Info &info);
+  /// read the info cache of @c file_name. Returns false if there is no cache, or it is out of date
+  static bool RAYLIB_EXPORT loadInfo(const std::string &file_name, Info &info);
 
   /// Reads a ray cloud from file, and calls the function for each ray
   /// This forwards the call to a function appropriate to the ray cloud file format
+  /// @c prefetch_depth is the number of chunks read ahead on a background thread while @c apply is running on the
+  /// current chunk. 0 reads and applies strictly in turn, which uses the least memory. .rcz files are not prefetched.
   static bool read(const std::string &file_name,
+                   std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                                      std::vector<double> &times, std::vector<RGBA> &colours)>
+                     apply,
+                   int prefetch_depth = 1);
+
+  /// Reads just the rays that intersect @c region, and calls the function for each chunk of these rays.
+  /// If the file has an up to date index (see rayindex.h), as written by CloudWriter, only the parts of the file that
+  /// may overlap the region are read, otherwise the whole file is read and the other rays are skipped
+  static bool read(const std::string &file_name, const Cuboid &region,
                    std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
                                       std::vector<double> &times, std::vector<RGBA> &colours)>
                      apply);
 
 private:
   bool loadPLY(const std::string &file, int min_num_rays);
-  // Convert the set of neighbouring indices into a eigen solution, which is an ellipsoid of best fit.
-  inline void eigenSolve(const std::vector<int> &ray_ids, const Eigen::MatrixXi &indices, int index, int num_neighbours,
-                         Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> &solver, Eigen::Vector3d &centroid) const;
+};
+
+/// A ray cloud in single precision. The ray starts and ends are stored as floats relative to a double precision
+/// @c origin, and the times remain doubles, which is 36 bytes per ray rather than the 60 bytes of Cloud.
+/// With an origin within the cloud, the positions keep sub-millimetre precision for clouds up to 10 km across.
+/// The algorithms that accept it (getSurfels, Merger::filter, generateEllipsoids, Trees and Terrain) are templated on
+/// the cloud type, and access the rays through @c start(i) and @c end(i), which Cloud also provides.
+class RAYLIB_EXPORT CompactCloud
+{
+public:
+  Eigen::Vector3d origin;
+  std::vector<Eigen::Vector3f> starts;  // relative to origin
+  std::vector<Eigen::Vector3f> ends;    // relative to origin
+  std::vector<double> times;
+  std::vector<RGBA> colours;
+
+  CompactCloud()
+    : origin(0, 0, 0)
+  {}
+
+  void clear();
+  /// reserve the cloud's vectors
+  void reserve(size_t size);
+
+  /// the start point of ray @c i
+  inline Eigen::Vector3d start(size_t i) const { return origin + starts[i].cast<double>(); }
+  /// the end point of ray @c i
+  inline Eigen::Vector3d end(size_t i) const { return origin + ends[i].cast<double>(); }
+  /// is the ray at index @c i bounded. Unbounded rays are non-returns, typically due to exceeding lidar range.
+  inline bool rayBounded(size_t i) const { return colours[i].alpha > 0; }
+  /// the number of rays
+  inline size_t rayCount() const { return ends.size(); }
+
+  /// add a new ray to the ray cloud. The first ray sets the origin, if it has not been set
+  void addRay(const Eigen::Vector3d &start, const Eigen::Vector3d &end, double time, const RGBA &colour);
+  /// add a new ray to the ray cloud, from another cloud
+  void addRay(const CompactCloud &other_cloud, size_t index);
+
+  /// save a ray cloud file, in the compressed format (see rayrcz.h) if @c file_name has the .rcz extension
+  void save(const std::string &file_name) const;
+  /// load a .ply or .rcz ray cloud file, chunk by chunk, so the double precision cloud is never held in memory.
+  /// The origin is set from the first ray in the file
+  bool load(const std::string &file_name, int min_num_rays = 4);
+
+  /// surfels of the ray end points, see Cloud::getSurfels
+  void getSurfels(int search_size, std::vector<Eigen::Vector3d> *centroids, std::vector<Eigen::Vector3d> *normals,
+                  std::vector<Eigen::Vector3d> *dimensions, std::vector<Eigen::Matrix3d> *mats,
+                  Eigen::MatrixXi *neighbour_indices, double max_distance = 0.0,
+                  bool reject_back_facing_rays = true) const;
+  /// estimate the average spacing between end points of the ray cloud, see Cloud::estimatePointSpacing
+  double estimatePointSpacing() const;
+  /// Calculate the ray cloud bounds, see Cloud::calcBounds
+  bool calcBounds(Eigen::Vector3d *min_bounds, Eigen::Vector3d *max_bounds, unsigned flags = kBFEnd,
+                  Progress *progress = nullptr) const;
+};
+
+/// A ray cloud whose ray starts lie on a sensor trajectory, as for mobile lidar. Only the trajectory is stored, rather
+/// than a start per ray, and the starts are interpolated from it at the ray times, singly with @c start(i) or in
+/// batches with @c calculateStarts. This is 36 bytes per ray rather than the 60 bytes of Cloud.
+/// Like CompactCloud, it is accepted by getSurfels, generateEllipsoids, Trees and Terrain, and it can be merged with
+/// Merger::mergeMultiple. raycombine and rayextract trees load .rcz files that store a trajectory as one.
+class RAYLIB_EXPORT TrajectoryCloud
+{
+public:
+  Trajectory trajectory;
+  std::vector<Eigen::Vector3d> ends;
+  std::vector<double> times;
+  std::vector<RGBA> colours;
+
+  void clear();
+  /// reserve the cloud's vectors
+  void reserve(size_t size);
+
+  /// the start point of ray @c i, interpolated from the trajectory
+  inline Eigen::Vector3d start(size_t i) const { return trajectory.linear(times[i]); }
+  /// the end point of ray @c i
+  inline const Eigen::Vector3d &end(size_t i) const { return ends[i]; }
+  /// is the ray at index @c i bounded. Unbounded rays are non-returns, typically due to exceeding lidar range.
+  inline bool rayBounded(size_t i) const { return colours[i].alpha > 0; }
+  /// the number of rays
+  inline size_t rayCount() const { return ends.size(); }
+  /// the start points of the @c count rays from index @c first
+  inline void calculateStarts(size_t first, size_t count, Eigen::Vector3d *starts) const
+  {
+    trajectory.linear(times.data() + first, count, starts);
+  }
+
+  /// add a new ray to the ray cloud, its start is on the trajectory at @c time
+  void addRay(const Eigen::Vector3d &end, double time, const RGBA &colour);
+  /// add a new ray to the ray cloud, from another cloud on the same trajectory
+  void addRay(const TrajectoryCloud &other_cloud, size_t index);
+
+  /// moves the cloud and its trajectory so that the first end point is at the origin, returning the offset removed
+  Eigen::Vector3d removeStartPos();
+  /// translate the cloud and its trajectory by @c offset
+  void translate(const Eigen::Vector3d &offset);
+
+  /// save a ray cloud file. A .rcz file stores the trajectory and references it in place of the ray starts
+  void save(const std::string &file_name) const;
+  /// load a ray cloud file whose starts lie on @c trajectory, or on the trajectory stored in the file when
+  /// @c trajectory is null. This fails if any ray start is further than @c max_error from the trajectory
+  bool load(const std::string &file_name, const Trajectory *trajectory = nullptr, double max_error = 0.001,
+            int min_num_rays = 4);
+
+  /// surfels of the ray end points, see Cloud::getSurfels
+  void getSurfels(int search_size, std::vector<Eigen::Vector3d> *centroids, std::vector<Eigen::Vector3d> *normals,
+                  std::vector<Eigen::Vector3d> *dimensions, std::vector<Eigen::Matrix3d> *mats,
+                  Eigen::MatrixXi *neighbour_indices, double max_distance = 0.0,
+                  bool reject_back_facing_rays = true) const;
+  /// estimate the average spacing between end points of the ray cloud, see Cloud::estimatePointSpacing
+  double estimatePointSpacing() const;
+  /// Calculate the ray cloud bounds, see Cloud::calcBounds
+  bool calcBounds(Eigen::Vector3d *min_bounds, Eigen::Vector3d *max_bounds, unsigned flags = kBFEnd,
+                  Progress *progress = nullptr) const;
 };
 
 }  // namespace ray
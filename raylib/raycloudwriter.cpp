@@ -6,9 +6,54 @@
 #include "raycloudwriter.h"
 #include "raycloud.h"
 
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
 namespace ray
 {
-bool CloudWriter::begin(const std::string &file_name)
+/// The ring of chunk buffers shared between the calling thread, which fills them, and the writer thread, which
+/// encodes and writes them to file in order.
+struct CloudWriter::AsyncState
+{
+  struct Chunk
+  {
+    std::vector<Eigen::Vector3d> starts, ends;
+    std::vector<double> times;
+    std::vector<RGBA> colours;
+  };
+  Chunk chunks[kAsyncBuffers];
+  size_t num_queued = 0;   // total chunks handed to the writer thread
+  size_t num_written = 0;  // total chunks written by the writer thread
+  bool finished = false;   // no more chunks will be queued
+  bool failed = false;     // a write has failed, so writeChunk and end return false
+  std::mutex mutex;
+  std::condition_variable chunk_queued, chunk_written;
+  std::thread thread;
+};
+
+CloudWriter::CloudWriter()
+  : info_valid_(false)
+  , has_warned_(false)
+{}
+
+CloudWriter::CloudWriter(CloudWriter &&) = default;
+
+CloudWriter::~CloudWriter()
+{
+  if (async_)  // end() was not called, the queued chunks are still written, but the vertex count is not set
+  {
+    {
+      std::lock_guard<std::mutex> lock(async_->mutex);
+      async_->finished = true;
+    }
+    async_->chunk_queued.notify_all();
+    async_->thread.join();
+  }
+}
+
+bool CloudWriter::begin(const std::string &file_name, bool asynchronous)
 {
   if (file_name.empty())
   {
@@ -17,28 +62,232 @@ bool CloudWriter::begin(const std::string &file_name)
   }
   has_warned_ = false;
   file_name_ = file_name;
-  if (!writeRayCloudChunkStart(file_name_, ofs_))
+  index_.clear();
+  info_.clear();
+  info_valid_ = true;
+  if (isRczFile(file_name_))
+  {
+    rcz_.reset(new RczWriter);
+    if (!rcz_->begin(file_name_))
+    {
+      return false;
+    }
+  }
+  else if (!writeRayCloudChunkStart(file_name_, ofs_, header_))
   {
     return false;
   }
+  if (asynchronous)
+  {
+    async_.reset(new AsyncState);
+    AsyncState &async = *async_;
+    async.thread = std::thread([this, &async]() {
+      while (true)
+      {
+        {
+          std::unique_lock<std::mutex> lock(async.mutex);
+          async.chunk_queued.wait(lock, [&] { return async.num_written < async.num_queued || async.finished; });
+          if (async.num_written == async.num_queued)
+            return;
+        }
+        // the calling thread does not touch this chunk until it has been written
+        AsyncState::Chunk &chunk = async.chunks[async.num_written % kAsyncBuffers];
+        const bool success = writeRays(chunk.starts, chunk.ends, chunk.times, chunk.colours);
+        {
+          std::lock_guard<std::mutex> lock(async.mutex);
+          async.failed = async.failed || !success;
+          async.num_written++;
+        }
+        async.chunk_written.notify_all();
+      }
+    });
+  }
   return true;
 }
 
-void CloudWriter::end()
+bool CloudWriter::end()
 {
   if (file_name_.empty())  // no effect if begin has not been called
   {
-    return;
+    return true;
+  }
+  bool failed = false;
+  if (async_)
+  {
+    {
+      std::lock_guard<std::mutex> lock(async_->mutex);
+      async_->finished = true;
+    }
+    async_->chunk_queued.notify_all();
+    async_->thread.join();
+    // a failure writing the last chunks is only known here, as no writeChunk call follows them
+    failed = async_->failed;
+    async_.reset();
+  }
+  unsigned long num_rays;
+  if (rcz_)
+  {
+    failed = !rcz_->end() || failed;
+    num_rays = rcz_->rayCount();
+    rcz_.reset();
+    if (failed)
+    {
+      std::cerr << "failed to finish writing " << file_name_ << std::endl;
+      return false;
+    }
+  }
+  else
+  {
+    num_rays = ray::writeRayCloudChunkEnd(ofs_, header_);
+    failed = failed || !ofs_.good();
+    ofs_.close();
+    if (failed || ofs_.fail())
+    {
+      // the sidecars are not written, so the truncated file isn't taken to be complete
+      std::cerr << "failed to finish writing " << file_name_ << std::endl;
+      return false;
+    }
+    index_.save(file_name_);
+    if (info_valid_)
+    {
+      info_.finish();
+      Cloud::saveInfo(file_name_, info_);
+    }
   }
-  const unsigned long num_rays = ray::writeRayCloudChunkEnd(ofs_);
   std::cout << num_rays << " rays saved to " << file_name_ << std::endl;
-  ofs_.close();
+  return true;
+}
+
+void CloudWriter::setTrajectory(const Trajectory &trajectory)
+{
+  if (rcz_)
+  {
+    rcz_->setTrajectory(trajectory);
+  }
 }
 
 bool CloudWriter::writeChunk(const Cloud &chunk)
 {
-  return writeRayCloudChunk(ofs_, buffer_, chunk.starts, chunk.ends, chunk.times, chunk.colours, has_warned_);
+  return writeChunk(chunk.starts, chunk.ends, chunk.times, chunk.colours);
+}
+
+bool CloudWriter::writeChunk(const TrajectoryCloud &chunk)
+{
+  // the starts are calculated a million at a time, so the whole cloud is never duplicated
+  const size_t piece_size = 1000000;
+  Cloud piece;
+  for (size_t first = 0; first < chunk.rayCount(); first += piece_size)
+  {
+    const size_t num = std::min(piece_size, chunk.rayCount() - first);
+    piece.resize(num);
+    chunk.calculateStarts(first, num, piece.starts.data());
+    std::copy(chunk.ends.begin() + first, chunk.ends.begin() + first + num, piece.ends.begin());
+    std::copy(chunk.times.begin() + first, chunk.times.begin() + first + num, piece.times.begin());
+    std::copy(chunk.colours.begin() + first, chunk.colours.begin() + first + num, piece.colours.begin());
+    if (!writeChunk(piece))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool CloudWriter::writeChunk(const std::vector<Eigen::Vector3d> &starts, const std::vector<Eigen::Vector3d> &ends,
+                             const std::vector<double> &times, const std::vector<RGBA> &colours)
+{
+  if (!async_)
+  {
+    return writeRays(starts, ends, times, colours);
+  }
+  if (ends.empty())
+  {
+    return true;
+  }
+  AsyncState &async = *async_;
+  {
+    std::unique_lock<std::mutex> lock(async.mutex);
+    async.chunk_written.wait(lock, [&] { return async.num_queued < async.num_written + kAsyncBuffers; });
+    if (async.failed)
+    {
+      return false;
+    }
+  }
+  // the writer thread does not touch this chunk until it has been queued
+  AsyncState::Chunk &chunk = async.chunks[async.num_queued % kAsyncBuffers];
+  chunk.starts = starts;
+  chunk.ends = ends;
+  chunk.times = times;
+  chunk.colours = colours;
+  {
+    std::lock_guard<std::mutex> lock(async.mutex);
+    async.num_queued++;
+  }
+  async.chunk_queued.notify_one();
+  return true;
+}
+
+bool CloudWriter::writeRays(const std::vector<Eigen::Vector3d> &starts, const std::vector<Eigen::Vector3d> &ends,
+                            const std::vector<double> &times, const std::vector<RGBA> &colours)
+{
+  if (rcz_)
+  {
+    return rcz_->writeChunk(starts, ends, times, colours);
+  }
+  if (!writeRayCloudChunk(ofs_, header_, buffer_, starts, ends, times, colours, has_warned_))
+  {
+    return false;
+  }
+  addStoredRays(times, colours);
+  return true;
 }
 
+void CloudWriter::addStoredRays(const std::vector<double> &times, const std::vector<RGBA> &colours)
+{
+  // the index and the cached info must match reading the file, so they use the positions as they were stored in
+  // buffer_. The index has every ray of the file, while the info leaves out the rays with nans, as readPly does
+  stored_starts_.resize(times.size());
+  stored_ends_.resize(times.size());
+  stored_times_.clear();
+  stored_colours_.clear();
+  bool bad_normal = false;
+  for (size_t i = 0; i < times.size(); i++)
+  {
+    const RayPlyEntry &vertex = buffer_[i];
+#if RAYLIB_DOUBLE_RAYS
+    double coords[3];
+    memcpy(coords, vertex.data(), sizeof(coords));
+    const Eigen::Vector3d end(coords[0], coords[1], coords[2]);
+    const Eigen::Vector3d normal(vertex[8], vertex[9], vertex[10]);
+#else
+    const Eigen::Vector3d end(vertex[0], vertex[1], vertex[2]);
+    const Eigen::Vector3d normal(vertex[5], vertex[6], vertex[7]);
+#endif
+    stored_starts_[i] = end + normal;
+    stored_ends_[i] = end;
+    bad_normal = bad_normal || std::abs(normal[0]) > 100000.0;
+  }
+  index_.add(stored_starts_, stored_ends_);
+  if (bad_normal)
+  {
+    info_valid_ = false;  // bad input, which readPly warns about but keeps. Leave the info to be read from the file
+    return;
+  }
+  size_t num_stored = 0;
+  for (size_t i = 0; i < times.size(); i++)
+  {
+    if (!(stored_ends_[i] == stored_ends_[i]) || !(stored_starts_[i] == stored_starts_[i]))
+    {
+      continue;
+    }
+    stored_starts_[num_stored] = stored_starts_[i];
+    stored_ends_[num_stored] = stored_ends_[i];
+    stored_times_.push_back(times[i]);
+    stored_colours_.push_back(colours[i]);
+    num_stored++;
+  }
+  stored_starts_.resize(num_stored);
+  stored_ends_.resize(num_stored);
+  info_.add(stored_starts_, stored_ends_, stored_times_, stored_colours_);
+}
 
 }  // namespace ray
@@ -7,43 +7,90 @@
 #define RAYLIB_RAYCLOUDWRITER_H
 
 #include "raylib/raylibconfig.h"
+#include "raycloud.h"
+#include "rayindex.h"
 #include "rayply.h"
+#include "rayrcz.h"
+
+#include <memory>
 
 namespace ray
 {
 /// This helper class is for writing a ray cloud to a file, one chunk at a time
 /// These chunks can be any size, even 0
+/// In asynchronous mode the rays are copied into a small ring of buffers and encoded and written to disk by a
+/// background thread, so the caller can carry on processing the next chunk while the last one is being written.
 class RAYLIB_EXPORT CloudWriter
 {
 public:
-  /// Open the file to write to
-  bool begin(const std::string &file_name);
+  CloudWriter();
+  /// moving is only supported before begin() or after end() for asynchronous writers
+  CloudWriter(CloudWriter &&);
+  ~CloudWriter();
+
+  /// Open the file to write to. This is written in the compressed format (see rayrcz.h) if @c file_name has the .rcz
+  /// extension, otherwise it is a .ply file. @c asynchronous writes the chunks on a background thread.
+  /// This uses a thread and up to kAsyncBuffers chunks of memory per writer, so it is intended for tools with just a
+  /// few output files
+  bool begin(const std::string &file_name, bool asynchronous = false);
+
+  /// for .rcz files, the ray starts that lie on @c trajectory are stored as references to it, so cost no space in the
+  /// file. Call after begin() and before writing any rays. It has no effect on .ply files
+  void setTrajectory(const Trajectory &trajectory);
 
   /// write a set of rays to the file
   bool writeChunk(const class Cloud &chunk);
+  /// write the rays of a trajectory cloud to the file, with their starts interpolated from its trajectory
+  bool writeChunk(const TrajectoryCloud &chunk);
 
   /// write a set of rays to the file, direct arguments
-  bool writeChunk(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends, std::vector<double> &times,
-                  std::vector<RGBA> &colours)
-  {
-    return writeRayCloudChunk(ofs_, buffer_, starts, ends, times, colours, has_warned_);
-  }
+  bool writeChunk(const std::vector<Eigen::Vector3d> &starts, const std::vector<Eigen::Vector3d> &ends,
+                  const std::vector<double> &times, const std::vector<RGBA> &colours);
 
-  /// finish writing, and adjust the vertex count at the start.
-  void end();
+  /// finish writing, and adjust the vertex count at the start. For .ply files this also writes the spatial index
+  /// sidecar file, which allows fast reading of sub-regions with Cloud::read, and the info cache used by
+  /// Cloud::getInfo. Returns false if any of the rays could not be written or the file could not be finished, in
+  /// which case the sidecar files are not written.
+  bool end();
+
+  /// number of chunks that can be queued for writing in asynchronous mode, before writeChunk waits for the disk
+  static constexpr int kAsyncBuffers = 2;
 
   /// return the stored file name
   const std::string &fileName() { return file_name_; }
 
 private:
+  /// write the rays to the file in its format
+  bool writeRays(const std::vector<Eigen::Vector3d> &starts, const std::vector<Eigen::Vector3d> &ends,
+                 const std::vector<double> &times, const std::vector<RGBA> &colours);
+  /// add the rays just written to a .ply file, which are in buffer_, to index_ and info_
+  void addStoredRays(const std::vector<double> &times, const std::vector<RGBA> &colours);
+
   /// store the output file stream
   std::ofstream ofs_;
+  /// the positions in the file header, needed to write the chunks and finish the file
+  PlyChunkHeader header_;
+  /// spatial index of the rays written, saved next to .ply files on end()
+  RayIndex index_;
+  /// info of the rays written, as they will be read back from the file, saved next to .ply files on end()
+  Cloud::Info info_;
+  /// false if the file will not read back cleanly, so its info is not cached
+  bool info_valid_;
+  /// the rays as they are stored in the file, used to accumulate index_ and info_
+  std::vector<Eigen::Vector3d> stored_starts_, stored_ends_;
+  std::vector<double> stored_times_;
+  std::vector<RGBA> stored_colours_;
   /// store the file name, in order to provide a clear 'saved' message on end()
   std::string file_name_;
   /// ray buffer to avoid repeated reallocations
   RayPlyBuffer buffer_;
   /// whether a warning has been issued or not. This prevents multiple warnings.
   bool has_warned_;
+  /// the compressed file writer, only present when writing a .rcz file
+  std::unique_ptr<RczWriter> rcz_;
+  /// the buffer ring and writer thread, only present in asynchronous mode
+  struct AsyncState;
+  std::unique_ptr<AsyncState> async_;
 };
 
 }  // namespace ray
@@ -4,23 +4,51 @@
 //
 // Author: Thomas Lowe
 #include "raydecimation.h"
+#include <algorithm>
 #include <iostream>
 #include <limits>
 #include <map>
+#include <sstream>
 #include "raycloudwriter.h"
+#include "rayparallel.h"
 
 namespace ray
 {
+namespace
+{
+inline Eigen::Vector3i voxelIndex(const Eigen::Vector3d &point, double voxel_width)
+{
+  return Eigen::Vector3i(int(std::floor(point[0] / voxel_width)), int(std::floor(point[1] / voxel_width)),
+                         int(std::floor(point[2] / voxel_width)));
+}
+
+/// A hash of the file index of a ray. It is a bijection (the splitmix64 finaliser), so no two rays have the same hash
+inline uint64_t rayIndexHash(uint64_t index)
+{
+  index = (index ^ (index >> 30)) * 0xbf58476d1ce4e5b9ull;
+  index = (index ^ (index >> 27)) * 0x94d049bb133111ebull;
+  return index ^ (index >> 31);
+}
+
+/// the output file name for the pyramid level of @c vox_width cm
+std::string pyramidFileName(const std::string &file_stub, double vox_width)
+{
+  std::stringstream name;
+  name << file_stub << "_decimated_" << vox_width << "cm.ply";
+  return name.str();
+}
+}  // namespace
+
 bool decimateSpatial(const std::string &file_stub, double vox_width)
 {
   ray::CloudWriter writer;
-  if (!writer.begin(file_stub + "_decimated.ply"))
+  if (!writer.begin(file_stub + "_decimated.ply", true))
     return false;
 
   // By maintaining these buffers below, we avoid almost all memory fragmentation
   ray::Cloud chunk;
   std::vector<int64_t> subsample;
-  std::set<Eigen::Vector3i, ray::Vector3iLess> voxel_set;
+  ray::VoxelSet voxel_set;
 
   auto decimate = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
                       std::vector<double> &times, std::vector<ray::RGBA> &colours) 
@@ -46,10 +74,115 @@ bool decimateSpatial(const std::string &file_stub, double vox_width)
   return true;
 }
 
+bool decimateSpatialParallel(const std::string &file_stub, double vox_width)
+{
+  const double width = 0.01 * vox_width;
+  // firstly find the smallest ray index hash in each voxel
+  ray::ConcurrentVoxelMap voxel_map;
+  uint64_t first_index = 0;
+  auto chooseRays = [&](std::vector<Eigen::Vector3d> &, std::vector<Eigen::Vector3d> &ends, std::vector<double> &,
+                        std::vector<ray::RGBA> &) {
+    voxel_map.reserve(ends.size());
+    ray::parallelFor(0, ends.size(), [&](size_t i) {
+      voxel_map.keepMinimum(voxelIndex(ends[i], width), rayIndexHash(first_index + i));
+    });
+    first_index += ends.size();
+  };
+  if (!ray::Cloud::read(file_stub + ".ply", chooseRays))
+    return false;
+
+  // then write out the chosen rays, in file order
+  ray::CloudWriter writer;
+  if (!writer.begin(file_stub + "_decimated.ply", true))
+    return false;
+  ray::Cloud chunk;
+  std::vector<char> chosen;
+  first_index = 0;
+  auto decimate = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                      std::vector<double> &times, std::vector<ray::RGBA> &colours) {
+    chosen.resize(ends.size());
+    ray::parallelFor(0, ends.size(), [&](size_t i) {
+      chosen[i] = voxel_map.value(voxelIndex(ends[i], width)) == rayIndexHash(first_index + i);
+    });
+    first_index += ends.size();
+    chunk.clear();
+    for (size_t i = 0; i < ends.size(); i++)
+    {
+      if (chosen[i])
+        chunk.addRay(starts[i], ends[i], times[i], colours[i]);
+    }
+    writer.writeChunk(chunk);
+  };
+  if (!ray::Cloud::read(file_stub + ".ply", decimate))
+    return false;
+  writer.end();
+  return true;
+}
+
+bool decimateSpatialPyramid(const std::string &file_stub, const std::vector<double> &vox_widths)
+{
+  std::vector<double> widths = vox_widths;
+  std::sort(widths.begin(), widths.end());
+  widths.erase(std::unique(widths.begin(), widths.end()), widths.end());
+  if (widths.empty())
+    return false;
+
+  // asynchronous writers encode and write each level on its own thread, while the next chunk is decimated
+  std::vector<ray::CloudWriter> writers(widths.size());
+  size_t num_begun = 0;
+  while (num_begun < widths.size() && writers[num_begun].begin(pyramidFileName(file_stub, widths[num_begun]), true))
+    num_begun++;
+  if (num_begun < widths.size())
+  {
+    for (size_t level = 0; level < num_begun; level++) writers[level].end();
+    return false;
+  }
+
+  // By maintaining these buffers below, we avoid almost all memory fragmentation
+  ray::Cloud chunk;
+  std::vector<std::vector<int64_t>> subsamples(widths.size());
+  std::vector<ray::VoxelSet> voxel_sets(widths.size());
+  bool written = true;
+
+  auto decimate = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                      std::vector<double> &times, std::vector<ray::RGBA> &colours) {
+    for (size_t level = 0; level < widths.size(); level++)
+    {
+      const double width = 0.01 * widths[level];
+      std::vector<int64_t> &subsample = subsamples[level];
+      subsample.clear();
+      if (level == 0)
+        voxelSubsample(ends, width, subsample, voxel_sets[0]);
+      else  // only the rays that survived the finer level are candidates
+      {
+        for (auto &id : subsamples[level - 1])
+        {
+          if (voxel_sets[level].insert(voxelIndex(ends[id], width)))
+            subsample.push_back(id);
+        }
+      }
+      chunk.resize(subsample.size());
+      for (size_t i = 0; i < subsample.size(); i++)
+      {
+        int64_t id = subsample[i];
+        chunk.starts[i] = starts[id];
+        chunk.ends[i] = ends[id];
+        chunk.colours[i] = colours[id];
+        chunk.times[i] = times[id];
+      }
+      written = writers[level].writeChunk(chunk) && written;
+    }
+  };
+
+  const bool read = ray::Cloud::read(file_stub + ".ply", decimate);
+  for (auto &writer : writers) written = writer.end() && written;
+  return read && written;
+}
+
 bool decimateTemporal(const std::string &file_stub, int num_rays)
 {
   ray::CloudWriter writer;
-  if (!writer.begin(file_stub + "_decimated.ply"))
+  if (!writer.begin(file_stub + "_decimated.ply", true))
     return false;
 
   // By maintaining these buffers below, we avoid almost all memory fragmentation
@@ -79,7 +212,7 @@ bool decimateTemporal(const std::string &file_stub, int num_rays)
 bool decimateSpatioTemporal(const std::string &file_stub, double vox_width, int num_rays)
 {
   ray::CloudWriter writer;
-  if (!writer.begin(file_stub + "_decimated.ply"))
+  if (!writer.begin(file_stub + "_decimated.ply", true))
     return false;
 
   // By maintaining these buffers below, we avoid almost all memory fragmentation
@@ -168,7 +301,7 @@ bool decimateSpatioTemporal(const std::string &file_stub, double vox_width, int
 bool decimateRaysSpatial(const std::string &file_stub, double vox_width)
 {
   ray::CloudWriter writer;
-  if (!writer.begin(file_stub + "_decimated.ply"))
+  if (!writer.begin(file_stub + "_decimated.ply", true))
     return false;
 
   // By maintaining these buffers below, we avoid almost all memory fragmentation
@@ -211,15 +344,15 @@ bool decimateRaysSpatial(const std::string &file_stub, double vox_width)
 bool decimateAngular(const std::string &file_stub, double radius_per_length)
 {
   ray::CloudWriter writer;
-  if (!writer.begin(file_stub + "_decimated.ply"))
+  if (!writer.begin(file_stub + "_decimated.ply", true))
     return false;
 
   ray::Cloud chunk;
 
   int min_index = -20; // about a millimetre
   int max_index = 50;
-  std::vector<std::set<Eigen::Vector3i, ray::Vector3iLess>> voxel_sets(max_index + 1 - min_index);
-  std::vector<std::set<Eigen::Vector3i, ray::Vector3iLess>> visiteds(max_index + 1 - min_index);
+  std::vector<ray::VoxelSet> voxel_sets(max_index + 1 - min_index);
+  std::vector<ray::VoxelSet> visiteds(max_index + 1 - min_index);
   std::vector<int> candidate_indices;  
   const double root2 = std::sqrt(2.0);
   const double logroot2 = std::log(root2);
@@ -241,10 +374,10 @@ bool decimateAngular(const std::string &file_stub, double radius_per_length)
       Eigen::Vector3d coords = ends[i] / voxel_widths[map_index - min_index];
       Eigen::Vector3i coordsi = Eigen::Vector3d(std::floor(coords[0]), std::floor(coords[1]), std::floor(coords[2])).cast<int>();
       int ind = map_index - min_index;
-      if (visiteds[ind].find(coordsi) != visiteds[ind].end()) // this level map has already been visited by a child (smaller ray length)
+      if (visiteds[ind].contains(coordsi)) // this level map has already been visited by a child (smaller ray length)
         continue;
 
-      if (voxel_sets[ind].insert(coordsi).second)
+      if (voxel_sets[ind].insert(coordsi))
       {
         candidate_indices.push_back(index);
         // now insert visiteds to suppress longer rays
@@ -252,7 +385,7 @@ bool decimateAngular(const std::string &file_stub, double radius_per_length)
         double scale = root2;
         pos = Eigen::Vector3d(std::floor((double)coordsi[0]/scale), std::floor((double)coordsi[1]/scale), std::floor((double)coordsi[2]/scale)).cast<int>();
         ind++;
-        while (ind < (int)visiteds.size() && visiteds[ind].insert(pos).second)
+        while (ind < (int)visiteds.size() && visiteds[ind].insert(pos))
         {
           ind++;
           scale *= root2;
@@ -287,7 +420,7 @@ bool decimateAngular(const std::string &file_stub, double radius_per_length)
       Eigen::Vector3d coords = ends[i] / voxel_widths[map_index - min_index];
       Eigen::Vector3i coordsi = Eigen::Vector3d(std::floor(coords[0]), std::floor(coords[1]), std::floor(coords[2])).cast<int>();
       int ind = map_index - min_index;
-      if (visiteds[ind].find(coordsi) == visiteds[ind].end()) 
+      if (!visiteds[ind].contains(coordsi)) 
       {
         chunk.starts.push_back(starts[i]);
         chunk.ends.push_back(ends[i]);
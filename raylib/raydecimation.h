@@ -17,6 +17,21 @@ namespace ray
 /// This is a spatially even subsampling, but also emphasises outlier as a side-effect
 bool RAYLIB_EXPORT decimateSpatial(const std::string &file_stub, double vox_width);
 
+/// @brief subsample to 1 point per @c vox_width wide voxel in metres, using all threads
+/// Rather than the first ray in each voxel, this keeps the ray whose file index has the smallest hash, which is a
+/// pseudo-random choice that does not depend on the order that the rays are processed in. So the result is the same
+/// for any number of threads. It reads the file twice, and is not supported in rayrestore
+bool RAYLIB_EXPORT decimateSpatialParallel(const std::string &file_stub, double vox_width);
+
+/// @brief spatially decimate to each of the voxel widths @c vox_widths in cm, in a single read of the cloud
+/// This writes a level of detail pyramid, with one file per width, named e.g. cloud_decimated_10cm.ply. The finest
+/// level is the same as decimateSpatial. Each coarser level keeps the first ray in each voxel out of the rays that
+/// the next finer level kept, so every level is a subset of the finer ones, with at most one ray per voxel. When each
+/// width is a multiple of the finer widths (e.g. 5,10,20) the voxels nest, and each occupied voxel keeps one ray.
+/// Otherwise a finer voxel can straddle coarser ones, so a coarse voxel whose rays were all dropped at the finer level
+/// keeps none
+bool RAYLIB_EXPORT decimateSpatialPyramid(const std::string &file_stub, const std::vector<double> &vox_widths);
+
 /// @brief subsample to every @c num_rays rays
 /// This is an unbiased subsampling, but will be over-sampled in stationary areas as a side-effect
 /// Note that while this is called temporal decimation, it decimates evenly in file order, which isn't 
@@ -42,7 +57,7 @@ struct Subsampler
 {
   inline bool operator()(const Eigen::Vector3i &p, const Eigen::Vector3i &/*target*/, double /*in_length*/, double /*out_length*/, double /*max_length*/)
   {
-    if (voxel_set.insert(p).second)
+    if (voxel_set.insert(p))
     {
       subsample.push_back(index);
       return true;
@@ -50,7 +65,7 @@ struct Subsampler
     return false;
   }
   std::vector<int64_t> subsample;
-  std::set<Eigen::Vector3i, ray::Vector3iLess> voxel_set;
+  ray::VoxelSet voxel_set;
   int index;
 };
 }  // namespace ray
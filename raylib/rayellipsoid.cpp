@@ -6,20 +6,21 @@
 #include "rayellipsoid.h"
 
 #include "raycloud.h"
+#include "rayparallel.h"
 #include "rayprogress.h"
+#include "raysimd.h"
 
 #include <nabo/nabo.h>
 
 #include <memory>
 
-#if RAYLIB_WITH_TBB
-#include <tbb/parallel_for.h>
-#endif  // RAYLIB_WITH_TBB
-
 namespace ray
 {
-void generateEllipsoids(std::vector<Ellipsoid> *ellipsoids, Eigen::Vector3d *bounds_min, Eigen::Vector3d *bounds_max,
-                        const Cloud &cloud, Progress *progress)
+namespace
+{
+template <class CloudT>
+void generateCloudEllipsoids(std::vector<Ellipsoid> *ellipsoids, Eigen::Vector3d *bounds_min,
+                             Eigen::Vector3d *bounds_max, const CloudT &cloud, Progress *progress)
 {
   ellipsoids->clear();
   ellipsoids->resize(cloud.rayCount());
@@ -34,10 +35,10 @@ void generateEllipsoids(std::vector<Ellipsoid> *ellipsoids, Eigen::Vector3d *bou
     progress->begin("generateEllipsoids - KDTree", 2);
   }
 
-  Eigen::MatrixXd points_p(3, cloud.ends.size());
+  Eigen::MatrixXd points_p(3, cloud.rayCount());
   for (size_t i = 0; i < cloud.rayCount(); ++i)
   {
-    points_p.col(i) = cloud.ends[i];
+    points_p.col(i) = cloud.end(i);
   }
   std::unique_ptr<Nabo::NNSearchD> nns(Nabo::NNSearchD::createKDTreeLinearHeap(points_p, 3));
 
@@ -58,7 +59,7 @@ void generateEllipsoids(std::vector<Ellipsoid> *ellipsoids, Eigen::Vector3d *bou
   {
     progress->increment();
     progress->end();
-    progress->begin("generateEllipsoids", cloud.ends.size());
+    progress->begin("generateEllipsoids", cloud.rayCount());
   }
   const auto generate_ellipsoid = [&](size_t i)  //
   {
@@ -87,7 +88,7 @@ void generateEllipsoids(std::vector<Ellipsoid> *ellipsoids, Eigen::Vector3d *bou
       int index = indices(j, i);
       if (cloud.rayBounded(index))
       {
-        centroid += cloud.ends[index];
+        centroid += cloud.end(index);
         num_neighbours++;
       }
     }
@@ -101,7 +102,7 @@ void generateEllipsoids(std::vector<Ellipsoid> *ellipsoids, Eigen::Vector3d *bou
       int index = indices(j, i);
       if (cloud.rayBounded(index))
       {
-        Eigen::Vector3d offset = cloud.ends[index] - centroid;
+        Eigen::Vector3d offset = cloud.end(index) - centroid;
         scatter += offset * offset.transpose();
       }
     }
@@ -125,8 +126,7 @@ void generateEllipsoids(std::vector<Ellipsoid> *ellipsoids, Eigen::Vector3d *bou
     ellipsoid.setExtents(eigen_vector, eigen_value);
   };
 
-#if RAYLIB_WITH_TBB
-  tbb::parallel_for<size_t>(0, cloud.rayCount(), generate_ellipsoid);
+  parallelFor(0, cloud.rayCount(), generate_ellipsoid);
 
   for (size_t i = 0; i < ellipsoids->size(); ++i)
   {
@@ -141,36 +141,180 @@ void generateEllipsoids(std::vector<Ellipsoid> *ellipsoids, Eigen::Vector3d *bou
     ellipsoids_max.y() = std::max(ellipsoids_max.y(), ellipsoid_max.y());
     ellipsoids_max.z() = std::max(ellipsoids_max.z(), ellipsoid_max.z());
   }
-#else   // RAYLIB_WITH_TBB
-  const size_t count = cloud.rayCount();
-  #pragma omp parallel for schedule(static)
-  for (size_t i = 0; i < count; ++i)
+
+  if (bounds_min)
   {
-    generate_ellipsoid(i);
+    *bounds_min = ellipsoids_min;
   }
-  for (size_t i = 0; i < ellipsoids->size(); ++i)
+
+  if (bounds_max)
   {
-    Ellipsoid &ellipsoid = (*ellipsoids)[i];
-    const auto ellipsoid_min = ellipsoid.pos - ellipsoid.extents.cast<double>();
-    const auto ellipsoid_max = ellipsoid.pos + ellipsoid.extents.cast<double>();
+    *bounds_max = ellipsoids_max;
+  }
+}
 
-    ellipsoids_min.x() = std::min(ellipsoids_min.x(), ellipsoid_min.x());
-    ellipsoids_min.y() = std::min(ellipsoids_min.y(), ellipsoid_min.y());
-    ellipsoids_min.z() = std::min(ellipsoids_min.z(), ellipsoid_min.z());
-    ellipsoids_max.x() = std::max(ellipsoids_max.x(), ellipsoid_max.x());
-    ellipsoids_max.y() = std::max(ellipsoids_max.y(), ellipsoid_max.y());
-    ellipsoids_max.z() = std::max(ellipsoids_max.z(), ellipsoid_max.z());
+/// the distance that a ray must pass beyond an ellipsoid to pass through it, as in Ellipsoid::intersect
+const double kPassDistance = 0.05;
+
+/// Ellipsoid::intersect on a packet of 4 (ray, ellipsoid) pairs, with the operations in the same order so the results
+/// are identical. @c to_sphere is from each ray start to its ellipsoid centre, @c mat the ellipsoid matrix
+/// coefficients in row major order, and @c pass_scale is 1 - kPassDistance / ray length. Sets @c results[0 .. num)
+void intersectPacket(const simd::Double4 to_sphere[3], const simd::Double4 mat[9], const simd::Double4 dirs[3],
+                     simd::Double4 pass_scale, int num, IntersectResult *results)
+{
+  using simd::Double4;
+  const Double4 one = simd::set(1.0);
+  Double4 ray[3], to[3];
+  for (int k = 0; k < 3; k++)
+  {
+    ray[k] = mat[3 * k] * dirs[0] + mat[3 * k + 1] * dirs[1] + mat[3 * k + 2] * dirs[2];
+    to[k] = mat[3 * k] * to_sphere[0] + mat[3 * k + 1] * to_sphere[1] + mat[3 * k + 2] * to_sphere[2];
   }
-#endif  // RAYLIB_WITH_TBB
+  const Double4 ray_length_sqr = ray[0] * ray[0] + ray[1] * ray[1] + ray[2] * ray[2];
+  Double4 d = (to[0] * ray[0] + to[1] * ray[1] + to[2] * ray[2]) / ray_length_sqr;
+  Double4 offset[3];
+  for (int k = 0; k < 3; k++)
+  {
+    offset[k] = to[k] - ray[k] * d;
+  }
+  const Double4 dist2 = offset[0] * offset[0] + offset[1] * offset[1] + offset[2] * offset[2];
+  // NaN for the lanes that miss, whose comparisons below are then false
+  const Double4 along_dist = simd::sqrt(one - dist2);
+  const Double4 ray_length = simd::sqrt(ray_length_sqr);
+  d = d * ray_length;
+  const int miss = simd::moveMask(simd::less(one, dist2)) | simd::moveMask(simd::less(ray_length, d - along_dist));
+  const int pass_through = simd::moveMask(simd::less(d + along_dist, ray_length * pass_scale));
+  for (int lane = 0; lane < num; lane++)
+  {
+    const int bit = 1 << lane;
+    const IntersectResult inside = (pass_through & bit) ? IntersectResult::Passthrough : IntersectResult::Hit;
+    results[lane] = (miss & bit) ? IntersectResult::Miss : inside;
+  }
+}
+}  // namespace
 
-  if (bounds_min)
+void EllipsoidArrays::assign(const std::vector<Ellipsoid> &ellipsoids, const std::vector<uint32_t> &ids)
+{
+  for (int i = 0; i < 3; i++)
   {
-    *bounds_min = ellipsoids_min;
+    pos_[i].resize(ids.size());
   }
+  for (int i = 0; i < 9; i++)
+  {
+    mat_[i].resize(ids.size());
+  }
+  for (size_t i = 0; i < ids.size(); i++)
+  {
+    const Ellipsoid &ellipsoid = ellipsoids[ids[i]];
+    for (int j = 0; j < 3; j++)
+    {
+      pos_[j][i] = ellipsoid.pos[j];
+      for (int k = 0; k < 3; k++)
+      {
+        mat_[3 * j + k][i] = static_cast<double>(ellipsoid.eigen_mat(j, k));
+      }
+    }
+  }
+}
 
-  if (bounds_max)
+void EllipsoidArrays::intersectBatch(const Eigen::Vector3d &start, const Eigen::Vector3d &end,
+                                     const uint32_t *candidate_ids, size_t count, IntersectResult *results) const
+{
+  using simd::Double4;
+  const Eigen::Vector3d dir = end - start;
+  const Double4 starts[3] = { simd::set(start[0]), simd::set(start[1]), simd::set(start[2]) };
+  const Double4 dirs[3] = { simd::set(dir[0]), simd::set(dir[1]), simd::set(dir[2]) };
+  const Double4 pass_scale = simd::set(1.0 - kPassDistance / dir.norm());
+
+  // the components of each candidate in the batch, padded by repeating the last candidate
+  alignas(32) double lanes[12][kEllipsoidBatchSize];
+  for (size_t first = 0; first < count; first += kEllipsoidBatchSize)
   {
-    *bounds_max = ellipsoids_max;
+    const size_t num = std::min(count - first, static_cast<size_t>(kEllipsoidBatchSize));
+    for (size_t j = 0; j < kEllipsoidBatchSize; j++)
+    {
+      const uint32_t id = candidate_ids[first + std::min(j, num - 1)];
+      for (int k = 0; k < 3; k++)
+      {
+        lanes[k][j] = pos_[k][id];
+      }
+      for (int k = 0; k < 9; k++)
+      {
+        lanes[3 + k][j] = mat_[k][id];
+      }
+    }
+    for (int half = 0; half < static_cast<int>(num); half += 4)
+    {
+      Double4 to_sphere[3], mat[9];
+      for (int k = 0; k < 3; k++)
+      {
+        to_sphere[k] = simd::load(lanes[k] + half) - starts[k];
+      }
+      for (int k = 0; k < 9; k++)
+      {
+        mat[k] = simd::load(lanes[3 + k] + half);
+      }
+      intersectPacket(to_sphere, mat, dirs, pass_scale, std::min(4, static_cast<int>(num) - half),
+                      results + first + half);
+    }
   }
 }
+
+void EllipsoidArrays::intersectBatch(uint32_t id, const Eigen::Vector3d *starts, const Eigen::Vector3d *ends,
+                                     size_t count, IntersectResult *results) const
+{
+  using simd::Double4;
+  Double4 pos[3], mat[9];
+  for (int k = 0; k < 3; k++)
+  {
+    pos[k] = simd::set(pos_[k][id]);
+  }
+  for (int k = 0; k < 9; k++)
+  {
+    mat[k] = simd::set(mat_[k][id]);
+  }
+
+  // the start, direction and pass scale of each ray in the packet, padded by repeating the last ray
+  alignas(32) double lanes[7][4];
+  for (size_t first = 0; first < count; first += 4)
+  {
+    const size_t num = std::min(count - first, size_t(4));
+    for (size_t j = 0; j < 4; j++)
+    {
+      const size_t i = first + std::min(j, num - 1);
+      const Eigen::Vector3d dir = ends[i] - starts[i];
+      for (int k = 0; k < 3; k++)
+      {
+        lanes[k][j] = starts[i][k];
+        lanes[3 + k][j] = dir[k];
+      }
+      lanes[6][j] = 1.0 - kPassDistance / dir.norm();
+    }
+    Double4 to_sphere[3], dirs[3];
+    for (int k = 0; k < 3; k++)
+    {
+      to_sphere[k] = pos[k] - simd::load(lanes[k]);
+      dirs[k] = simd::load(lanes[3 + k]);
+    }
+    intersectPacket(to_sphere, mat, dirs, simd::load(lanes[6]), static_cast<int>(num), results + first);
+  }
+}
+
+void generateEllipsoids(std::vector<Ellipsoid> *ellipsoids, Eigen::Vector3d *bounds_min, Eigen::Vector3d *bounds_max,
+                        const Cloud &cloud, Progress *progress)
+{
+  generateCloudEllipsoids(ellipsoids, bounds_min, bounds_max, cloud, progress);
+}
+
+void generateEllipsoids(std::vector<Ellipsoid> *ellipsoids, Eigen::Vector3d *bounds_min, Eigen::Vector3d *bounds_max,
+                        const CompactCloud &cloud, Progress *progress)
+{
+  generateCloudEllipsoids(ellipsoids, bounds_min, bounds_max, cloud, progress);
+}
+
+void generateEllipsoids(std::vector<Ellipsoid> *ellipsoids, Eigen::Vector3d *bounds_min, Eigen::Vector3d *bounds_max,
+                        const TrajectoryCloud &cloud, Progress *progress)
+{
+  generateCloudEllipsoids(ellipsoids, bounds_min, bounds_max, cloud, progress);
+}
 }  // namespace ray
@@ -11,11 +11,14 @@
 #include <Eigen/Dense>
 
 #include <cmath>
+#include <cstdint>
 #include <vector>
 
 namespace ray
 {
 class Cloud;
+class CompactCloud;
+class TrajectoryCloud;
 class Progress;
 
 enum class RAYLIB_EXPORT IntersectResult
@@ -43,10 +46,45 @@ public:
   IntersectResult intersect(const Eigen::Vector3d &start, const Eigen::Vector3d &end) const;
 };
 
+/// the number of ellipsoids that EllipsoidArrays::intersectBatch tests together
+constexpr int kEllipsoidBatchSize = 8;
+
+/// A set of ellipsoids in structure of arrays form, for intersecting a ray with many ellipsoids at once, or an
+/// ellipsoid with many rays. Each component of the positions and of the matrices (already in double precision) is a
+/// contiguous array, so that intersectBatch can load the same component of a batch of ellipsoids into SIMD registers.
+class RAYLIB_EXPORT EllipsoidArrays
+{
+public:
+  /// stores @c ellipsoids[ids[i]] as element i
+  void assign(const std::vector<Ellipsoid> &ellipsoids, const std::vector<uint32_t> &ids);
+  inline size_t size() const { return pos_[0].size(); }
+
+  /// Intersects the ray from @c start to @c end with the elements @c candidate_ids[0 .. count), setting
+  /// @c results[i] to the result for element @c candidate_ids[i], which is the same as Ellipsoid::intersect gives.
+  /// The candidates are tested kEllipsoidBatchSize at a time, as packets of 4 doubles (see raysimd.h).
+  void intersectBatch(const Eigen::Vector3d &start, const Eigen::Vector3d &end, const uint32_t *candidate_ids,
+                      size_t count, IntersectResult *results) const;
+  /// Intersects element @c id with the @c count rays from @c starts[i] to @c ends[i], setting @c results[i] to the
+  /// result for ray i, which is the same as Ellipsoid::intersect gives. The rays are tested 4 at a time.
+  void intersectBatch(uint32_t id, const Eigen::Vector3d *starts, const Eigen::Vector3d *ends, size_t count,
+                      IntersectResult *results) const;
+
+private:
+  std::vector<double> pos_[3];
+  /// the matrix coefficients in row major order, each row is a scaled eigenvector
+  std::vector<double> mat_[9];
+};
+
 /// Convert the cloud into a list of ellipsoids, which represent a volume around each cloud point,
 /// shaped by the distribution of its neighbouring points.
 void RAYLIB_EXPORT generateEllipsoids(std::vector<Ellipsoid> *ellipsoids, Eigen::Vector3d *bounds_min,
                                       Eigen::Vector3d *bounds_max, const Cloud &cloud, Progress *progress = nullptr);
+void RAYLIB_EXPORT generateEllipsoids(std::vector<Ellipsoid> *ellipsoids, Eigen::Vector3d *bounds_min,
+                                      Eigen::Vector3d *bounds_max, const CompactCloud &cloud,
+                                      Progress *progress = nullptr);
+void RAYLIB_EXPORT generateEllipsoids(std::vector<Ellipsoid> *ellipsoids, Eigen::Vector3d *bounds_min,
+                                      Eigen::Vector3d *bounds_max, const TrajectoryCloud &cloud,
+                                      Progress *progress = nullptr);
 
 inline void Ellipsoid::clear()
 {
@@ -8,16 +8,19 @@
 
 #include "raylib/raylibconfig.h"
 
+#include "rayparallel.h"
 #include "rayutils.h"
 
+#include <algorithm>
 #include <functional>
 
-#if RAYLIB_WITH_TBB
+// parallelFor runs in parallel in all builds, so the grids lock their changes unless this is set to 0
+#ifndef RAYLIB_PARALLEL_GRID
 #define RAYLIB_PARALLEL_GRID 1
+#endif  // RAYLIB_PARALLEL_GRID
 #if RAYLIB_PARALLEL_GRID
-#include <tbb/spin_mutex.h>
+#include <atomic>
 #endif  // RAYLIB_PARALLEL_GRID
-#endif  // RAYLIB_WITH_TBB
 
 namespace ray
 {
@@ -37,7 +40,7 @@ class Grid
 {
 public:
 #if RAYLIB_PARALLEL_GRID
-  using Mutex = tbb::spin_mutex;
+  using Mutex = SpinMutex;
 #endif  // RAYLIB_PARALLEL_GRID
 
   class Cell
@@ -235,6 +238,24 @@ public:
     }
   }
 
+  /// sorts the data of each cell, so that cells filled in an interleaved order match a fill in increasing order
+  void sortCells()
+  {
+#if RAYLIB_PARALLEL_GRID
+    parallelFor(0, buckets_.size(), [this](size_t id) {
+      for (auto &cell : buckets_[id].cells) std::sort(cell.data.begin(), cell.data.end());
+    });
+#else   // RAYLIB_PARALLEL_GRID
+    for (auto &bucket : buckets_)
+    {
+      for (auto &cell : bucket.cells)
+      {
+        std::sort(cell.data.begin(), cell.data.end());
+      }
+    }
+#endif  // RAYLIB_PARALLEL_GRID
+  }
+
   /// debugging statistics on the grid structure. This can be used to assess how efficient this grid
   /// structure is for a given @c voxel_width.
   void report()
@@ -301,6 +322,495 @@ protected:
   Cell null_cell_;
 };
 
+/// 3D grid container with the same interface as @c Grid, but built on an open-addressing hash table of 4x4x4 voxel
+/// bricks, and with the cell payloads stored together in one arena rather than in a vector per cell.
+/// Each brick holds the cell ids of its 64 voxels directly, so neighbouring voxels along a ray cost one hash probe,
+/// and empty voxels are rejected without a bucket scan. The table of bricks is small enough to stay in cache.
+/// Each cell's data is a contiguous span of the arena, which is moved to a region of double the size when it fills.
+/// The freed regions are reused by later cells. Voxel indices must be within +-2^20 in each axis.
+template <class T>
+class FlatGrid
+{
+public:
+#if RAYLIB_PARALLEL_GRID
+  using Mutex = SpinMutex;
+#endif  // RAYLIB_PARALLEL_GRID
+
+  /// a cell's contiguous span of the grid's arena, with the iteration interface of std::vector
+  class CellData
+  {
+  public:
+    inline T *begin() { return arena_->data() + first_; }
+    inline T *end() { return begin() + size_; }
+    inline const T *begin() const { return arena_->data() + first_; }
+    inline const T *end() const { return begin() + size_; }
+    inline size_t size() const { return size_; }
+    inline bool empty() const { return size_ == 0; }
+    inline T &operator[](size_t i) { return begin()[i]; }
+    inline const T &operator[](size_t i) const { return begin()[i]; }
+
+  private:
+    friend class FlatGrid<T>;
+    std::vector<T> *arena_ = nullptr;
+    size_t first_ = 0;
+    uint32_t size_ = 0;
+    uint32_t capacity_ = 0;
+  };
+
+  class Cell
+  {
+  public:
+    CellData data;
+    Eigen::Vector3i index;
+  };
+
+  using WalkCellsVisitFunction = std::function<void(const FlatGrid<T> &, const Cell &)>;
+
+  FlatGrid() { rebind(); }
+  FlatGrid(const Eigen::Vector3d &box_min, const Eigen::Vector3d &box_max, double voxel_width)
+  {
+    init(box_min, box_max, voxel_width);
+  }
+  /// the cells refer to the arena, so are rebound on copying or moving
+  FlatGrid(const FlatGrid &other) { *this = other; }
+  FlatGrid(FlatGrid &&other) { *this = std::move(other); }
+  FlatGrid &operator=(const FlatGrid &other)
+  {
+    copyFields(other);
+    slots_ = other.slots_;
+    bricks_ = other.bricks_;
+    cells_ = other.cells_;
+    arena_ = other.arena_;
+    free_lists_ = other.free_lists_;
+    rebind();
+    return *this;
+  }
+  FlatGrid &operator=(FlatGrid &&other)
+  {
+    copyFields(other);
+    slots_ = std::move(other.slots_);
+    bricks_ = std::move(other.bricks_);
+    cells_ = std::move(other.cells_);
+    arena_ = std::move(other.arena_);
+    free_lists_ = std::move(other.free_lists_);
+    rebind();
+    return *this;
+  }
+
+  /// Generate a grid indexer from a spatial position, see Grid::index
+  Eigen::Vector3i index(const Eigen::Vector3d &spatial_pos, bool clamp = true) const
+  {
+    Eigen::Vector3d coord = spatial_pos;
+    for (int i = 0; i < 3; ++i)
+    {
+      if (coord(i) < box_min(i) || coord(i) > box_max(i))
+      {
+        if (!clamp)
+        {
+          return Eigen::Vector3i(-1, -1, -1);
+        }
+        coord(i) = std::max(box_min(i), std::min(coord(i), box_max(i)));
+      }
+      coord(i) = (coord(i) - box_min(i)) / voxel_width;
+    }
+    return coord.cast<int>();
+  }
+
+  Eigen::Vector3d voxelCentre(const Eigen::Vector3i &index) const
+  {
+    return box_min + voxel_width * Eigen::Vector3d(index[0] + 0.5, index[1] + 0.5, index[2] + 0.5);
+  }
+
+  /// the grid is axis aligned, so initialised from a bounding box and a voxel width
+  void init(const Eigen::Vector3d &box_min, const Eigen::Vector3d &box_max, double voxel_width)
+  {
+    this->box_min = box_min;
+    this->box_max = box_max;
+    this->voxel_width = voxel_width;
+    Eigen::Vector3d diff = (box_max - box_min) / voxel_width;
+    dims = Eigen::Vector3i(diff.array().ceil().cast<int>());
+    slots_.assign(kInitialTableSize, Slot());
+    bricks_.clear();
+    cells_.clear();
+    arena_.clear();
+    free_lists_.clear();
+    warned_out_of_range_ = false;
+    rebind();
+  }
+
+  Cell &cell(int x, int y, int z) { return cell(Eigen::Vector3i(x, y, z)); }
+  Cell &cell(const Eigen::Vector3i &index)
+  {
+    const uint32_t id = find(index);
+    return id == kNoCell ? null_cell_ : cells_[id];
+  }
+  const Cell &cell(int x, int y, int z) const { return cell(Eigen::Vector3i(x, y, z)); }
+  const Cell &cell(const Eigen::Vector3i &index) const
+  {
+    const uint32_t id = find(index);
+    return id == kNoCell ? null_cell_ : cells_[id];
+  }
+
+  void insert(int x, int y, int z, const T &value) { insert(Eigen::Vector3i(x, y, z), value); }
+  void insert(const Eigen::Vector3i &index, const T &value)
+  {
+#if RAYLIB_PARALLEL_GRID
+    Mutex::scoped_lock lock(mutex_);
+#endif  // RAYLIB_PARALLEL_GRID
+    const uint32_t id = findOrAdd(index);
+    if (id != kNoCell)
+    {
+      append(cells_[id], value);
+    }
+  }
+
+  /// add an empty cell at @c index, if it is not already present. Indices outside the key range (each component
+  /// within +-2^20) are not added, with a warning
+  void addCell(const Eigen::Vector3i &index)
+  {
+#if RAYLIB_PARALLEL_GRID
+    Mutex::scoped_lock lock(mutex_);
+#endif  // RAYLIB_PARALLEL_GRID
+    findOrAdd(index);
+  }
+
+  // only inserts into a cell that exists
+  void insertIfCellExists(const Eigen::Vector3i &index, const T &value)
+  {
+#if RAYLIB_PARALLEL_GRID
+    Mutex::scoped_lock lock(mutex_);
+#endif  // RAYLIB_PARALLEL_GRID
+    const uint32_t id = find(index);
+    if (id != kNoCell)
+    {
+      append(cells_[id], value);
+    }
+  }
+
+  /// Fills the existing cells as compressed sparse rows, in place of @c insertIfCellExists calls. A counting pass
+  /// sizes each cell, a prefix sum over the counts lays the cells out contiguously in the arena, and a second pass
+  /// writes the values in place. Neither pass takes a lock, so with RAYLIB_PARALLEL_GRID both run in parallel, and the
+  /// rows are then sorted so that the result matches a serial fill.
+  /// @c walk(i, visit) calls @c visit(index, value) for each cell that item @c i inserts into, for i in [0, count),
+  /// and must visit the same cells on each call. Any data already in the cells is replaced.
+  template <class WalkFunction>
+  void fillRows(unsigned count, const WalkFunction &walk)
+  {
+#if RAYLIB_PARALLEL_GRID
+    std::vector<std::atomic<uint32_t>> counts(cells_.size());
+    for (auto &c : counts) c.store(0, std::memory_order_relaxed);
+#else   // RAYLIB_PARALLEL_GRID
+    std::vector<uint32_t> counts(cells_.size(), 0);
+#endif  // RAYLIB_PARALLEL_GRID
+    const auto count_item = [this, &walk, &counts](unsigned i)
+    {
+      walk(i, [this, &counts](const Eigen::Vector3i &index, const T &)
+      {
+        const uint32_t id = find(index);
+        if (id != kNoCell)
+        {
+          counts[id]++;
+        }
+      });
+    };
+    const auto fill_item = [this, &walk, &counts](unsigned i)
+    {
+      walk(i, [this, &counts](const Eigen::Vector3i &index, const T &value)
+      {
+        const uint32_t id = find(index);
+        if (id != kNoCell)
+        {
+          CellData &data = cells_[id].data;
+          arena_[data.first_ + counts[id]++] = value;
+        }
+      });
+    };
+
+#if RAYLIB_PARALLEL_GRID
+    parallelFor(0, count, [&count_item](size_t i) { count_item(static_cast<unsigned>(i)); });
+#else   // RAYLIB_PARALLEL_GRID
+    for (unsigned i = 0; i < count; i++)
+    {
+      count_item(i);
+    }
+#endif  // RAYLIB_PARALLEL_GRID
+
+    size_t first = 0;
+    for (size_t id = 0; id < cells_.size(); id++)
+    {
+      CellData &data = cells_[id].data;
+      data.first_ = first;
+      data.size_ = data.capacity_ = counts[id];
+      first += data.size_;
+      counts[id] = 0;
+    }
+    arena_.resize(first);
+    free_lists_.clear();
+
+#if RAYLIB_PARALLEL_GRID
+    parallelFor(0, count, [&fill_item](size_t i) { fill_item(static_cast<unsigned>(i)); });
+    sortCells();
+#else   // RAYLIB_PARALLEL_GRID
+    for (unsigned i = 0; i < count; i++)
+    {
+      fill_item(i);
+    }
+#endif  // RAYLIB_PARALLEL_GRID
+  }
+
+  /// sorts the data of each cell, so that cells filled in an interleaved order match a fill in increasing order
+  void sortCells()
+  {
+#if RAYLIB_PARALLEL_GRID
+    parallelFor(0, cells_.size(), [this](size_t id) { std::sort(cells_[id].data.begin(), cells_[id].data.end()); });
+#else   // RAYLIB_PARALLEL_GRID
+    for (auto &cell : cells_)
+    {
+      std::sort(cell.data.begin(), cell.data.end());
+    }
+#endif  // RAYLIB_PARALLEL_GRID
+  }
+
+  /// debugging statistics on the grid structure, see Grid::report
+  void report() const
+  {
+    size_t data_count = 0;
+    for (auto &cell : cells_)
+    {
+      data_count += cell.data.size();
+    }
+    std::cout << "voxels filled: " << cells_.size() << " in " << bricks_.size() / kBrickSize << " bricks, in a table of "
+              << slots_.size() << " slots" << std::endl;
+    std::cout << "average data per filled voxel: " << (double)data_count / (double)cells_.size() << std::endl;
+    std::cout << "total data stored: " << data_count << " in an arena of " << arena_.size() << std::endl;
+  }
+
+  /// applies the @c visit function for all cells in the grid, in the order that they were added
+  void walkCells(const WalkCellsVisitFunction &visit) const
+  {
+    for (const auto &cell : cells_)
+    {
+      visit(*this, cell);
+    }
+  }
+
+  /// the number of cells in the grid
+  size_t cellCount() const { return cells_.size(); }
+
+  Eigen::Vector3d box_min, box_max;
+  double voxel_width;
+  Eigen::Vector3i dims;
+
+private:
+  static constexpr uint64_t kEmptyKey = ~uint64_t(0);
+  static constexpr uint32_t kNoCell = ~uint32_t(0);
+  static constexpr size_t kInitialTableSize = 1024;
+  static constexpr int kKeyBits = 21;
+  static constexpr int kKeyOffset = 1 << (kKeyBits - 1);
+  /// the number of voxels in each 4x4x4 brick
+  static constexpr size_t kBrickSize = 64;
+  /// the capacity of the first region of each cell, the regions double from here
+  static constexpr uint32_t kMinCapacity = 4;
+
+  /// packs the brick containing @c index into a 64 bit key, and sets @c local to the voxel's position in the brick.
+  /// Returns kEmptyKey if out of the key range
+  static inline uint64_t key(const Eigen::Vector3i &index, size_t &local)
+  {
+    const uint64_t x = static_cast<uint64_t>(static_cast<int64_t>(index[0]) + kKeyOffset);
+    const uint64_t y = static_cast<uint64_t>(static_cast<int64_t>(index[1]) + kKeyOffset);
+    const uint64_t z = static_cast<uint64_t>(static_cast<int64_t>(index[2]) + kKeyOffset);
+    if ((x | y | z) >> kKeyBits)
+    {
+      return kEmptyKey;
+    }
+    local = static_cast<size_t>((x & 3) | ((y & 3) << 2) | ((z & 3) << 4));
+    return (x >> 2) | ((y >> 2) << kKeyBits) | ((z >> 2) << (2 * kKeyBits));
+  }
+  /// The slot for a brick key, from the 64 bit finaliser of MurmurHash3
+  static inline size_t hash(uint64_t key)
+  {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return static_cast<size_t>(key);
+  }
+
+  /// the id of the cell at @c index, or kNoCell
+  uint32_t find(const Eigen::Vector3i &index) const
+  {
+    size_t local = 0;
+    const uint64_t k = key(index, local);
+    if (k == kEmptyKey || slots_.empty())
+    {
+      return kNoCell;
+    }
+    const size_t mask = slots_.size() - 1;
+    for (size_t slot = hash(k) & mask;; slot = (slot + 1) & mask)
+    {
+      if (slots_[slot].key == k)
+        return bricks_[slots_[slot].first + local];
+      if (slots_[slot].key == kEmptyKey)
+        return kNoCell;
+    }
+  }
+
+  /// the id of the cell at @c index, which is added if not already present. Returns kNoCell, with a warning on the
+  /// first occurrence, if @c index is out of the key range
+  uint32_t findOrAdd(const Eigen::Vector3i &index)
+  {
+    size_t local = 0;
+    const uint64_t k = key(index, local);
+    if (k == kEmptyKey)
+    {
+      if (!warned_out_of_range_)
+      {
+        std::cout << "warning: grid index " << index[0] << ", " << index[1] << ", " << index[2]
+                  << " is out of range, the grid spans at most 2^" << kKeyBits
+                  << " voxels in each axis. Cells out of range are ignored" << std::endl;
+        warned_out_of_range_ = true;
+      }
+      return kNoCell;
+    }
+    if (slots_.empty())
+    {
+      slots_.assign(kInitialTableSize, Slot());
+    }
+    const size_t mask = slots_.size() - 1;
+    size_t slot = hash(k) & mask;
+    for (; slots_[slot].key != kEmptyKey && slots_[slot].key != k; slot = (slot + 1) & mask)
+      ;
+    if (slots_[slot].key == kEmptyKey)
+    {
+      slots_[slot].key = k;
+      slots_[slot].first = bricks_.size();
+      bricks_.resize(bricks_.size() + kBrickSize, kNoCell);
+    }
+    uint32_t &id = bricks_[slots_[slot].first + local];
+    if (id == kNoCell)
+    {
+      id = static_cast<uint32_t>(cells_.size());
+      cells_.emplace_back();
+      Cell &new_cell = cells_.back();
+      new_cell.index = index;
+      new_cell.data.arena_ = &arena_;
+      if (2 * bricks_.size() > kBrickSize * slots_.size())  // keep the load factor at most a half, for short probes
+      {
+        grow();
+      }
+    }
+    return id;
+  }
+
+  void grow()
+  {
+    std::vector<Slot> old_slots(slots_.size() * 2, Slot());
+    old_slots.swap(slots_);
+    const size_t mask = slots_.size() - 1;
+    for (auto &old_slot : old_slots)
+    {
+      if (old_slot.key == kEmptyKey)
+        continue;
+      size_t slot = hash(old_slot.key) & mask;
+      while (slots_[slot].key != kEmptyKey) slot = (slot + 1) & mask;
+      slots_[slot] = old_slot;
+    }
+  }
+
+  void append(Cell &cell, const T &value)
+  {
+    CellData &data = cell.data;
+    if (data.size_ == data.capacity_)
+    {
+      // move to a region of twice the capacity, from the free list for that size or the end of the arena
+      const uint32_t capacity = std::max(kMinCapacity, 2 * data.capacity_);
+      size_t size_class = 0;
+      while ((kMinCapacity << size_class) < capacity) size_class++;
+      if (free_lists_.size() <= size_class)
+      {
+        free_lists_.resize(size_class + 1);
+      }
+      size_t first;
+      if (!free_lists_[size_class].empty())
+      {
+        first = free_lists_[size_class].back();
+        free_lists_[size_class].pop_back();
+      }
+      else
+      {
+        first = arena_.size();
+        arena_.resize(arena_.size() + capacity);
+      }
+      std::copy(arena_.begin() + data.first_, arena_.begin() + data.first_ + data.size_, arena_.begin() + first);
+      if (data.capacity_ > 0)
+      {
+        free_lists_[size_class - 1].push_back(data.first_);
+      }
+      data.first_ = first;
+      data.capacity_ = capacity;
+    }
+    arena_[data.first_ + data.size_++] = value;
+  }
+
+  void copyFields(const FlatGrid &other)
+  {
+    box_min = other.box_min;
+    box_max = other.box_max;
+    voxel_width = other.voxel_width;
+    dims = other.dims;
+    warned_out_of_range_ = other.warned_out_of_range_;
+  }
+
+  /// point the cells at this grid's arena
+  void rebind()
+  {
+    for (auto &cell : cells_)
+    {
+      cell.data.arena_ = &arena_;
+    }
+    null_cell_.data.arena_ = &arena_;
+    null_cell_.index = Eigen::Vector3i(-1, -1, -1);
+  }
+
+  /// the open addressing table, of packed brick keys and the start of the brick in bricks_
+  struct Slot
+  {
+    uint64_t key = kEmptyKey;
+    uint64_t first = 0;
+  };
+  std::vector<Slot> slots_;
+  /// the cell ids of the voxels in each brick, kBrickSize at a time, kNoCell where the voxel has no cell
+  std::vector<uint32_t> bricks_;
+  std::vector<Cell> cells_;
+  /// the storage of all of the cells' data
+  std::vector<T> arena_;
+  /// the start of the unused arena regions, per size class of kMinCapacity * 2^i values
+  std::vector<std::vector<size_t>> free_lists_;
+  Cell null_cell_;
+  /// whether an out of range index has been warned about, so that it is only reported once
+  bool warned_out_of_range_ = false;
+#if RAYLIB_PARALLEL_GRID
+  /// the table and arena are shared by all cells, so a single lock covers the changes to them
+  Mutex mutex_;
+#endif  // RAYLIB_PARALLEL_GRID
+};
+
+template <class T>
+constexpr uint64_t FlatGrid<T>::kEmptyKey;
+template <class T>
+constexpr uint32_t FlatGrid<T>::kNoCell;
+template <class T>
+constexpr size_t FlatGrid<T>::kInitialTableSize;
+template <class T>
+constexpr int FlatGrid<T>::kKeyBits;
+template <class T>
+constexpr int FlatGrid<T>::kKeyOffset;
+template <class T>
+constexpr size_t FlatGrid<T>::kBrickSize;
+template <class T>
+constexpr uint32_t FlatGrid<T>::kMinCapacity;
+
 template <class T>
 class ContiguousGrid
 {
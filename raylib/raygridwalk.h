@@ -0,0 +1,181 @@
+// Copyright (c) 2026
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#ifndef RAYLIB_RAYGRIDWALK_H
+#define RAYLIB_RAYGRIDWALK_H
+
+#include "raylib/raylibconfig.h"
+
+#include "raysimd.h"
+#include "rayutils.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace ray
+{
+/// the number of rays that walkGridPacket steps through the grid together
+constexpr int kWalkPacketSize = 4;
+
+/// One step of a packet of rays through the grid. Each lane whose bit is set in @c active has entered voxel
+/// (x,y,z), and the values match the arguments of a walkGrid visitor, for the ray with index @c ray
+struct alignas(32) WalkBatch
+{
+  double in_length[kWalkPacketSize];
+  double out_length[kWalkPacketSize];
+  double max_length[kWalkPacketSize];
+  int x[kWalkPacketSize], y[kWalkPacketSize], z[kWalkPacketSize];
+  int target_x[kWalkPacketSize], target_y[kWalkPacketSize], target_z[kWalkPacketSize];
+  int ray[kWalkPacketSize];
+  int active;
+
+  inline Eigen::Vector3i voxel(int lane) const { return Eigen::Vector3i(x[lane], y[lane], z[lane]); }
+  inline Eigen::Vector3i target(int lane) const
+  {
+    return Eigen::Vector3i(target_x[lane], target_y[lane], target_z[lane]);
+  }
+};
+
+/// Adapts a walkGrid visitor, @c object(p, target, in_length, out_length, max_length), to walkGridPacket, by
+/// calling it on each active lane of the batch in turn
+template <class T>
+class WalkBatchAdapter
+{
+public:
+  explicit WalkBatchAdapter(T &object)
+    : object_(object)
+  {}
+  inline int operator()(const WalkBatch &batch)
+  {
+    int stop = 0;
+    for (int lane = 0; lane < kWalkPacketSize; lane++)
+    {
+      if ((batch.active & (1 << lane)) &&
+          object_(batch.voxel(lane), batch.target(lane), batch.in_length[lane], batch.out_length[lane],
+                  batch.max_length[lane]))
+      {
+        stop |= 1 << lane;
+      }
+    }
+    return stop;
+  }
+
+private:
+  T &object_;
+};
+
+/// Walks the rays from @c starts to @c ends (in voxel units) through the grid, @c kWalkPacketSize rays at a time
+/// with SIMD instructions. @c object(batch) is called with each step of the packet, see WalkBatch, and returns a bit
+/// mask of the lanes whose rays should stop walking, as returning true does for a walkGrid visitor.
+/// Each ray visits the same voxels with the same lengths as walkGrid, but the visits of different rays are
+/// interleaved, so the visitor should not depend on the order of the rays. As rays finish, the next rays take their
+/// lanes, so that the lanes are kept busy when the ray lengths vary.
+template <class T>
+void walkGridPacket(const Eigen::Vector3d *starts, const Eigen::Vector3d *ends, size_t count, T &object)
+{
+  using namespace simd;
+  // lane state, the lengths are along the ray to the next boundary on each axis
+  alignas(32) double lengths[3][kWalkPacketSize] = {};
+  alignas(32) double length_deltas[3][kWalkPacketSize] = {};
+  alignas(16) int steps[3][kWalkPacketSize] = {};
+  // lane masks, as whole 64 bit and 32 bit lanes
+  alignas(32) static const uint64_t kDoubleMasks[16][kWalkPacketSize] = {
+    { 0, 0, 0, 0 },    { ~0ull, 0, 0, 0 },    { 0, ~0ull, 0, 0 },    { ~0ull, ~0ull, 0, 0 },
+    { 0, 0, ~0ull, 0 }, { ~0ull, 0, ~0ull, 0 }, { 0, ~0ull, ~0ull, 0 }, { ~0ull, ~0ull, ~0ull, 0 },
+    { 0, 0, 0, ~0ull }, { ~0ull, 0, 0, ~0ull }, { 0, ~0ull, 0, ~0ull }, { ~0ull, ~0ull, 0, ~0ull },
+    { 0, 0, ~0ull, ~0ull }, { ~0ull, 0, ~0ull, ~0ull }, { 0, ~0ull, ~0ull, ~0ull }, { ~0ull, ~0ull, ~0ull, ~0ull }
+  };
+  WalkBatch batch;
+  batch.active = 0;
+  size_t next = 0;
+  for (;;)
+  {
+    // start new rays in the free lanes, as walkGrid does
+    int fresh = 0;
+    for (int lane = 0; lane < kWalkPacketSize && next < count; lane++)
+    {
+      if (batch.active & (1 << lane))
+      {
+        continue;
+      }
+      const Eigen::Vector3d &start = starts[next];
+      const Eigen::Vector3d &end = ends[next];
+      Eigen::Vector3d direction = end - start;
+      const double max_length = direction.norm();
+      const Eigen::Vector3i p =
+        Eigen::Vector3d(std::floor(start[0]), std::floor(start[1]), std::floor(start[2])).cast<int>();
+      const Eigen::Vector3i target =
+        Eigen::Vector3d(std::floor(end[0]), std::floor(end[1]), std::floor(end[2])).cast<int>();
+      const Eigen::Vector3i step(sign(direction[0]), sign(direction[1]), sign(direction[2]));
+      direction /= max_length;
+      for (int j = 0; j < 3; j++)
+      {
+        const double to = std::abs(start[j] - p[j] - (double)std::max(0, step[j]));
+        const double dir = std::max(std::numeric_limits<double>::epsilon(), std::abs(direction[j]));
+        lengths[j][lane] = to / dir;
+        length_deltas[j][lane] = 1.0 / dir;
+        steps[j][lane] = step[j];
+      }
+      batch.x[lane] = p[0];
+      batch.y[lane] = p[1];
+      batch.z[lane] = p[2];
+      batch.target_x[lane] = target[0];
+      batch.target_y[lane] = target[1];
+      batch.target_z[lane] = target[2];
+      batch.in_length[lane] = 0.0;
+      batch.out_length[lane] = std::min(std::min(lengths[0][lane], lengths[1][lane]), lengths[2][lane]);
+      batch.max_length[lane] = max_length;
+      batch.ray[lane] = static_cast<int>(next++);
+      fresh |= 1 << lane;
+    }
+    if (!(batch.active | fresh))
+    {
+      break;
+    }
+
+    // step the other active lanes along the axis of the nearest boundary, as walkGrid does
+    const int stepping = batch.active & ~fresh;
+    if (stepping)
+    {
+      const Double4 lane_mask = load(reinterpret_cast<const double *>(kDoubleMasks[stepping]));
+      const Double4 lx = load(lengths[0]), ly = load(lengths[1]), lz = load(lengths[2]);
+      const Double4 axis_x = less(lx, ly) & less(lx, lz);
+      const Double4 axis_y = andNot(axis_x, less(ly, lz));
+      const Double4 axis_z = andNot(axis_x, andNot(axis_y, lane_mask));
+      const Double4 mask_x = axis_x & lane_mask, mask_y = axis_y & lane_mask;
+      const Double4 new_lx = lx + (load(length_deltas[0]) & mask_x);
+      const Double4 new_ly = ly + (load(length_deltas[1]) & mask_y);
+      const Double4 new_lz = lz + (load(length_deltas[2]) & axis_z);
+      store(lengths[0], new_lx);
+      store(lengths[1], new_ly);
+      store(lengths[2], new_lz);
+      // the out length is the new nearest boundary, and the in length the one just crossed
+      const Double4 old_out = load(batch.out_length);
+      const Double4 new_out = min(min(new_lx, new_ly), new_lz);
+      store(batch.in_length, andNot(lane_mask, load(batch.in_length)) + (old_out & lane_mask));
+      store(batch.out_length, andNot(lane_mask, old_out) + (new_out & lane_mask));
+      store(batch.x, load(batch.x) + (load(steps[0]) & narrow(mask_x)));
+      store(batch.y, load(batch.y) + (load(steps[1]) & narrow(mask_y)));
+      store(batch.z, load(batch.z) + (load(steps[2]) & narrow(axis_z)));
+    }
+    batch.active |= fresh;
+
+    const int stop = object(batch);
+    const Int4 at_target = equal(load(batch.x), load(batch.target_x)) & equal(load(batch.y), load(batch.target_y)) &
+                           equal(load(batch.z), load(batch.target_z));
+    batch.active &= ~(stop | moveMask(at_target));
+  }
+}
+
+/// walkGridPacket for a walkGrid visitor, see WalkBatchAdapter
+template <class T>
+void walkGridPacketRays(const Eigen::Vector3d *starts, const Eigen::Vector3d *ends, size_t count, T &object)
+{
+  WalkBatchAdapter<T> adapter(object);
+  walkGridPacket(starts, ends, count, adapter);
+}
+}  // namespace ray
+
+#endif  // RAYLIB_RAYGRIDWALK_H
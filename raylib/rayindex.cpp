@@ -0,0 +1,137 @@
+// Copyright (c) 2026
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#include "rayindex.h"
+
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+
+namespace ray
+{
+namespace
+{
+const char kIndexMagic[4] = { 'R', 'I', 'D', 'X' };
+const uint32_t kIndexVersion = 1;
+}  // namespace
+
+bool FileStamp::get(const std::string &file_name)
+{
+  struct stat file_stat;
+  if (stat(file_name.c_str(), &file_stat) != 0)
+  {
+    return false;
+  }
+  size = static_cast<uint64_t>(file_stat.st_size);
+#if defined(__linux__)
+  modified = static_cast<int64_t>(file_stat.st_mtim.tv_sec) * 1000000000 + file_stat.st_mtim.tv_nsec;
+#else
+  modified = static_cast<int64_t>(file_stat.st_mtime);
+#endif
+  return true;
+}
+
+void RayIndex::clear()
+{
+  blocks_.clear();
+  num_rays_ = 0;
+}
+
+void RayIndex::add(const std::vector<Eigen::Vector3d> &starts, const std::vector<Eigen::Vector3d> &ends)
+{
+  for (size_t i = 0; i < ends.size(); i++)
+  {
+    if (blocks_.empty() || blocks_.back().num_rays == kBlockSize)
+    {
+      Block block;
+      block.first_ray = num_rays_;
+      block.num_rays = 0;
+      block.bounds = Cuboid(minVector(starts[i], ends[i]), maxVector(starts[i], ends[i]));
+      blocks_.push_back(block);
+    }
+    Cuboid &bounds = blocks_.back().bounds;
+    bounds.min_bound_ = minVector(bounds.min_bound_, minVector(starts[i], ends[i]));
+    bounds.max_bound_ = maxVector(bounds.max_bound_, maxVector(starts[i], ends[i]));
+    blocks_.back().num_rays++;
+    num_rays_++;
+  }
+}
+
+bool RayIndex::save(const std::string &cloud_file)
+{
+  FileStamp stamp;
+  if (!stamp.get(cloud_file))
+  {
+    return false;
+  }
+  std::ofstream out(fileName(cloud_file), std::ios::binary | std::ios::out);
+  if (out.fail())
+  {
+    return false;
+  }
+  const uint64_t num_blocks = blocks_.size();
+  out.write(kIndexMagic, 4);
+  out.write((const char *)&kIndexVersion, sizeof(kIndexVersion));
+  out.write((const char *)&stamp.size, sizeof(stamp.size));
+  out.write((const char *)&stamp.modified, sizeof(stamp.modified));
+  out.write((const char *)&num_rays_, sizeof(num_rays_));
+  out.write((const char *)&num_blocks, sizeof(num_blocks));
+  for (auto &block : blocks_)
+  {
+    out.write((const char *)&block.first_ray, sizeof(block.first_ray));
+    out.write((const char *)&block.num_rays, sizeof(block.num_rays));
+    out.write((const char *)block.bounds.min_bound_.data(), 3 * sizeof(double));
+    out.write((const char *)block.bounds.max_bound_.data(), 3 * sizeof(double));
+  }
+  return out.good();
+}
+
+bool RayIndex::load(const std::string &cloud_file)
+{
+  clear();
+  FileStamp stamp;
+  if (!stamp.get(cloud_file))
+  {
+    return false;
+  }
+  std::ifstream in(fileName(cloud_file), std::ios::binary | std::ios::in);
+  if (in.fail())
+  {
+    return false;
+  }
+  char magic[4];
+  uint32_t version = 0;
+  FileStamp indexed_stamp;
+  uint64_t num_blocks = 0;
+  in.read(magic, 4);
+  in.read((char *)&version, sizeof(version));
+  in.read((char *)&indexed_stamp.size, sizeof(indexed_stamp.size));
+  in.read((char *)&indexed_stamp.modified, sizeof(indexed_stamp.modified));
+  in.read((char *)&num_rays_, sizeof(num_rays_));
+  in.read((char *)&num_blocks, sizeof(num_blocks));
+  if (!in || memcmp(magic, kIndexMagic, 4) != 0 || version != kIndexVersion || !(indexed_stamp == stamp))
+  {
+    num_rays_ = 0;
+    return false;  // not an index, or a stale one
+  }
+  uint64_t total_rays = 0;
+  for (uint64_t i = 0; i < num_blocks && in; i++)
+  {
+    Block block;
+    in.read((char *)&block.first_ray, sizeof(block.first_ray));
+    in.read((char *)&block.num_rays, sizeof(block.num_rays));
+    in.read((char *)block.bounds.min_bound_.data(), 3 * sizeof(double));
+    in.read((char *)block.bounds.max_bound_.data(), 3 * sizeof(double));
+    total_rays += block.num_rays;
+    blocks_.push_back(block);
+  }
+  if (!in || total_rays != num_rays_)
+  {
+    clear();
+    return false;
+  }
+  return true;
+}
+}  // namespace ray
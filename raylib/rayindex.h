@@ -0,0 +1,69 @@
+// Copyright (c) 2026
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#ifndef RAYLIB_RAYINDEX_H
+#define RAYLIB_RAYINDEX_H
+
+#include "raylib/raylibconfig.h"
+
+#include "raycuboid.h"
+#include "rayutils.h"
+
+namespace ray
+{
+/// Identifies one version of a file, by its size and modification time. Sidecar files store this for the file that
+/// they describe, so that they can be ignored once that file has changed.
+struct RAYLIB_EXPORT FileStamp
+{
+  uint64_t size = 0;
+  int64_t modified = 0;  // nanoseconds where supported, otherwise seconds
+
+  /// fill in the stamp of @c file_name, returns false if the file does not exist
+  bool get(const std::string &file_name);
+  inline bool operator==(const FileStamp &other) const { return size == other.size && modified == other.modified; }
+};
+
+/// A spatial index of a ray cloud file. The rays are grouped in file order into blocks of kBlockSize rays, and the
+/// bounds of each block (of its starts and ends) are stored in a small sidecar file next to the ray cloud.
+/// Since neighbouring rays in a scan are close in time, and so in space, the blocks of a large cloud are local, and
+/// reading a small region only needs the few blocks whose bounds overlap it.
+class RAYLIB_EXPORT RayIndex
+{
+public:
+  /// number of rays per indexed block
+  static constexpr uint64_t kBlockSize = 1 << 16;
+
+  struct Block
+  {
+    uint64_t first_ray;
+    uint64_t num_rays;
+    Cuboid bounds;
+  };
+
+  RayIndex() { clear(); }
+
+  /// the sidecar index file name for the ray cloud @c cloud_file
+  static std::string fileName(const std::string &cloud_file) { return cloud_file + ".index"; }
+
+  /// start a new index
+  void clear();
+  /// add the next rays of the file to the index
+  void add(const std::vector<Eigen::Vector3d> &starts, const std::vector<Eigen::Vector3d> &ends);
+  /// write the index for the finished ray cloud @c cloud_file
+  bool save(const std::string &cloud_file);
+  /// load the index of @c cloud_file. Returns false if there is no index, or if the file has changed since it was
+  /// indexed
+  bool load(const std::string &cloud_file);
+
+  inline const std::vector<Block> &blocks() const { return blocks_; }
+  inline uint64_t rayCount() const { return num_rays_; }
+
+private:
+  std::vector<Block> blocks_;
+  uint64_t num_rays_;
+};
+}  // namespace ray
+
+#endif  // RAYLIB_RAYINDEX_H
@@ -6,8 +6,15 @@
 #include "raylaz.h"
 #include "raylib/rayprogress.h"
 #include "raylib/rayprogressthread.h"
+#include "raymappedfile.h"
+#include "rayparallel.h"
 #include "rayunused.h"
 
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
 #if RAYLIB_WITH_LAS
 #include <liblas/factory.hpp>
 #include <liblas/point.hpp>
@@ -15,7 +22,242 @@
 
 namespace ray
 {
-bool readLas(const std::string &file_name,
+namespace
+{
+/// size of the LAS 1.4 public header block, the largest of the supported versions
+const uint16_t kLas14HeaderSize = 375;
+/// the minimum record length of each of the point data formats 0 to 10
+const uint16_t kLasRecordLengths[11] = { 20, 28, 26, 34, 57, 63, 30, 36, 38, 59, 67 };
+/// the point data format written by LasWriter: positions, intensity and GPS time
+const uint8_t kLasWriteFormat = 1;
+/// the coordinate scale written by LasWriter, in metres
+const double kLasWriteScale = 1e-4;
+
+template <typename T>
+inline T lasValue(const unsigned char *data, int offset)
+{
+  T value;
+  memcpy(static_cast<void *>(&value), data + offset, sizeof(T));
+  return value;
+}
+
+template <typename T>
+inline void setLasValue(unsigned char *data, int offset, const T &value)
+{
+  memcpy(data + offset, static_cast<const void *>(&value), sizeof(T));
+}
+
+/// The fields of the LAS public header block that are needed to decode the point records
+struct LasHeader
+{
+  int version_major = 0;
+  int version_minor = 0;
+  uint32_t point_offset = 0;
+  int point_format = 0;
+  uint16_t record_length = 0;
+  uint64_t num_points = 0;
+  Eigen::Vector3d scale;
+  Eigen::Vector3d offset;
+  int time_offset = -1;    // offset of the GPS time in the point record, -1 if the format has no time
+  int colour_offset = -1;  // offset of the RGB values in the point record, -1 if the format has no colour
+
+  /// whether the point records are laszip compressed, which sets the top bits of the point format
+  bool compressed() const { return (point_format & 0xC0) != 0; }
+};
+
+/// read the public header block of a LAS file, of versions 1.0 to 1.4
+bool readLasHeader(const std::string &file_name, LasHeader &header)
+{
+  std::ifstream input(file_name, std::ios::in | std::ios::binary);
+  unsigned char data[kLas14HeaderSize] = {};
+  input.read(reinterpret_cast<char *>(data), kLas14HeaderSize);
+  const std::streamsize num_read = input.gcount();
+  if (num_read < 227 || memcmp(data, "LASF", 4) != 0)
+  {
+    std::cerr << "readLas: " << file_name << " is not a LAS file" << std::endl;
+    return false;
+  }
+  header.version_major = data[24];
+  header.version_minor = data[25];
+  const uint16_t header_size = lasValue<uint16_t>(data, 94);
+  header.point_offset = lasValue<uint32_t>(data, 96);
+  header.point_format = data[104];
+  header.record_length = lasValue<uint16_t>(data, 105);
+  header.num_points = lasValue<uint32_t>(data, 107);
+  for (int i = 0; i < 3; i++)
+  {
+    header.scale[i] = lasValue<double>(data, 131 + 8 * i);
+    header.offset[i] = lasValue<double>(data, 155 + 8 * i);
+  }
+  if (header.version_major == 1 && header.version_minor >= 4 && header_size >= kLas14HeaderSize &&
+      num_read >= kLas14HeaderSize)
+  {
+    const uint64_t num_points = lasValue<uint64_t>(data, 247);
+    if (num_points > 0)  // the legacy point count is 0 when the count does not fit into 32 bits
+      header.num_points = num_points;
+  }
+  if (header.compressed())
+  {
+    return true;
+  }
+  if (header.version_major != 1 || header.version_minor > 4 || header.point_format > 10 ||
+      header.record_length < kLasRecordLengths[header.point_format])
+  {
+    std::cerr << "readLas: unsupported LAS version " << header.version_major << "." << header.version_minor
+              << " or point format " << header.point_format << " in " << file_name << std::endl;
+    return false;
+  }
+  const int format = header.point_format;
+  if (format >= 6)
+    header.time_offset = 22;
+  else if (format == 1 || format >= 3)
+    header.time_offset = 20;
+  if (format == 2)
+    header.colour_offset = 20;
+  else if (format == 3 || format == 5)
+    header.colour_offset = 28;
+  else if (format == 7 || format == 8 || format == 10)
+    header.colour_offset = 30;
+  return true;
+}
+
+/// Decode @c num_points LAS point records into the presized arrays. The records are independent so they are
+/// decoded in parallel. Returns the number of points with non-zero intensity
+size_t decodeLasPoints(const LasHeader &header, const unsigned char *records, size_t num_points,
+                       double max_intensity, std::vector<Eigen::Vector3d> &ends, std::vector<double> &times,
+                       std::vector<RGBA> &colours)
+{
+  // the records are independent, and the points with intensity are counted per worker
+  return parallelReduce(
+    size_t(0), num_points, size_t(0),
+    [&](size_t i, size_t &num_bounded)
+    {
+      const unsigned char *record = records + static_cast<size_t>(i) * header.record_length;
+      const Eigen::Vector3d scaled(static_cast<double>(lasValue<int32_t>(record, 0)),
+                                   static_cast<double>(lasValue<int32_t>(record, 4)),
+                                   static_cast<double>(lasValue<int32_t>(record, 8)));
+      ends[i] = header.offset + scaled.cwiseProduct(header.scale);
+      times[i] = lasValue<double>(record, header.time_offset);
+      RGBA &colour = colours[i];
+      if (header.colour_offset != -1)
+      {
+        // LAS colours are 16 bit, these are cast to 8 bits in the same way as the liblas reader
+        colour.red = static_cast<uint8_t>(lasValue<uint16_t>(record, header.colour_offset));
+        colour.green = static_cast<uint8_t>(lasValue<uint16_t>(record, header.colour_offset + 2));
+        colour.blue = static_cast<uint8_t>(lasValue<uint16_t>(record, header.colour_offset + 4));
+      }
+      const double normalised_intensity = (255.0 * static_cast<double>(lasValue<uint16_t>(record, 12))) / max_intensity;
+      colour.alpha = static_cast<uint8_t>(std::min(normalised_intensity, 255.0));
+      if (colour.alpha > 0)
+        num_bounded++;
+    },
+    [](size_t &num_bounded, const size_t &other_num_bounded) { num_bounded += other_num_bounded; });
+}
+
+/// Read an uncompressed LAS file without liblas. The point records are decoded directly from the memory mapped
+/// file, or through a stream where memory mapping is not available
+bool readLasNative(const std::string &file_name, const LasHeader &header,
+                   std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                                      std::vector<double> &times, std::vector<RGBA> &colours)>
+                     apply,
+                   size_t &num_bounded, double max_intensity, size_t chunk_size)
+{
+  if (header.time_offset == -1)
+  {
+    std::cerr << "No timestamps found on laz file, these are required" << std::endl;
+    return false;
+  }
+  const size_t number_of_points = static_cast<size_t>(header.num_points);
+  const size_t data_size = number_of_points * header.record_length;
+  MappedFile mapped;
+  std::ifstream input;
+  if (mapped.open(file_name))
+  {
+    if (mapped.size() < header.point_offset + data_size)
+    {
+      std::cerr << "readLas: " << file_name << " is shorter than its " << number_of_points << " points" << std::endl;
+      return false;
+    }
+  }
+  else
+  {
+    input.open(file_name, std::ios::in | std::ios::binary);
+    input.seekg(header.point_offset);
+    if (input.fail())
+    {
+      std::cerr << "readLas: failed to open stream" << std::endl;
+      return false;
+    }
+  }
+
+  ray::Progress progress;
+  ray::ProgressThread progress_thread(progress);
+  chunk_size = std::max(std::min(number_of_points, chunk_size), static_cast<size_t>(1));
+  const size_t num_chunks = (number_of_points + (chunk_size - 1)) / chunk_size;
+  progress.begin("read and process", num_chunks);
+
+  std::vector<Eigen::Vector3d> starts;
+  std::vector<Eigen::Vector3d> ends;
+  std::vector<double> times;
+  std::vector<RGBA> colours;
+  std::vector<unsigned char> stream_buffer;
+  num_bounded = 0;
+  bool success = true;
+  for (size_t first = 0; first < number_of_points; first += chunk_size)
+  {
+    const size_t num_points = std::min(chunk_size, number_of_points - first);
+    const unsigned char *records;
+    if (mapped.isOpen())
+    {
+      records = mapped.data() + header.point_offset + first * header.record_length;
+    }
+    else
+    {
+      stream_buffer.resize(num_points * header.record_length);
+      input.read(reinterpret_cast<char *>(stream_buffer.data()), static_cast<std::streamsize>(stream_buffer.size()));
+      if (input.fail())
+      {
+        std::cerr << "readLas: " << file_name << " is shorter than its " << number_of_points << " points" << std::endl;
+        success = false;
+        break;
+      }
+      records = stream_buffer.data();
+    }
+    ends.resize(num_points);
+    times.resize(num_points);
+    colours.resize(num_points);
+    num_bounded += decodeLasPoints(header, records, num_points, max_intensity, ends, times, colours);
+    if (header.colour_offset == -1)
+    {
+      std::vector<RGBA> time_colours(num_points);
+      colourByTime(times, time_colours);
+      for (size_t i = 0; i < num_points; i++)  // keep the intensity in the alpha channel
+      {
+        time_colours[i].alpha = colours[i].alpha;
+      }
+      colours.swap(time_colours);
+    }
+    starts = ends;  // equal to position for las files, as we do not store the start points
+    apply(starts, ends, times, colours);
+    if (mapped.isOpen())
+    {
+      mapped.release(header.point_offset + first * header.record_length, num_points * header.record_length);
+    }
+    progress.increment();
+  }
+
+  progress.end();
+  progress_thread.requestQuit();
+  progress_thread.join();
+  if (success)
+  {
+    std::cout << "loaded " << file_name << " with " << number_of_points << " points" << std::endl;
+  }
+  return success;
+}
+
+/// Read a compressed .laz file using liblas
+bool readLaz(const std::string &file_name,
              std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
                                 std::vector<double> &times, std::vector<RGBA> &colours)>
                apply,
@@ -133,11 +375,37 @@ bool readLas(const std::string &file_name,
   RAYLIB_UNUSED(apply);
   RAYLIB_UNUSED(num_bounded);
   RAYLIB_UNUSED(chunk_size);
-  RAYLIB_UNUSED(max_intensity);
-  std::cerr << "readLas: cannot read file as WITHLAS not enabled. Enable using: cmake .. -DWITH_LAS=true" << std::endl;
+  RAYLIB_UNUSED(offset_to_remove);
+  std::cerr << "readLas: cannot read compressed file as WITHLAS not enabled. Enable using: cmake .. -DWITH_LAS=true"
+            << std::endl;
   return false;
 #endif  // RAYLIB_WITH_LAS
 }
+}  // namespace
+
+bool readLas(const std::string &file_name,
+             std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                                std::vector<double> &times, std::vector<RGBA> &colours)>
+               apply,
+             size_t &num_bounded, double max_intensity, Eigen::Vector3d *offset_to_remove, size_t chunk_size)
+{
+  LasHeader header;
+  if (!readLasHeader(file_name, header))
+  {
+    return false;
+  }
+  if (header.compressed())
+  {
+    return readLaz(file_name, apply, num_bounded, max_intensity, offset_to_remove, chunk_size);
+  }
+  std::cout << "readLas: filename: " << file_name << std::endl;
+  if (offset_to_remove)
+  {
+    *offset_to_remove = header.offset;
+    std::cout << "offset to remove: " << header.offset.transpose() << std::endl;
+  }
+  return readLasNative(file_name, header, apply, num_bounded, max_intensity, chunk_size);
+}
 
 bool readLas(std::string file_name, std::vector<Eigen::Vector3d> &positions, std::vector<double> &times,
              std::vector<RGBA> &colours, double max_intensity, Eigen::Vector3d *offset_to_remove)
@@ -166,59 +434,71 @@ bool readLas(std::string file_name, std::vector<Eigen::Vector3d> &positions, std
 bool RAYLIB_EXPORT writeLas(std::string file_name, const std::vector<Eigen::Vector3d> &points,
                             const std::vector<double> &times, const std::vector<RGBA> &colours)
 {
-#if RAYLIB_WITH_LAS
-  std::cout << "saving LAZ file" << std::endl;
-
-  liblas::Header header;
-  header.SetDataFormatId(liblas::ePointFormat1);  // Time only
-
-  if (file_name.find(".laz") != std::string::npos)
-    header.SetCompressed(true);
-
-  std::cout << "Saving points to " << file_name << std::endl;
-
-  std::ofstream ofs;
-  ofs.open(file_name.c_str(), std::ios::out | std::ios::binary);
-  if (ofs.fail())
-  {
-    std::cerr << "Error: cannot open " << file_name << " for writing." << std::endl;
-    return false;
-  }
-
-  const double scale = 1e-4;
-  header.SetScale(scale, scale, scale);
+  LasWriter writer(file_name);
+  const bool success = writer.writeChunk(points, times, colours);
+  return writer.end() && success;
+}
 
-  liblas::Writer writer(ofs, header);
-  liblas::Point point(&header);
-  point.SetHeader(&header);  // TODO HACK Version 1.7.0 does not correctly resize the data. Commit
-                             // 6e8657336ba445fcec3c9e70c2ebcd2e25af40b9 (1.8.0 3 July fixes it)
-  for (unsigned int i = 0; i < points.size(); i++)
+namespace
+{
+/// write a LAS 1.4 public header block for point format kLasWriteFormat, with no variable length records
+bool writeLasHeader(std::ofstream &out, uint64_t num_points, const Eigen::Vector3d &offset,
+                    const Eigen::Vector3d &min_bound, const Eigen::Vector3d &max_bound)
+{
+  unsigned char data[kLas14HeaderSize] = {};
+  memcpy(data, "LASF", 4);
+  data[24] = 1;  // version 1.4
+  data[25] = 4;
+  const char software[] = "raycloudtools";
+  memcpy(data + 26, software, sizeof(software));  // system identifier
+  memcpy(data + 58, software, sizeof(software));  // generating software
+  setLasValue<uint16_t>(data, 94, kLas14HeaderSize);
+  setLasValue<uint32_t>(data, 96, kLas14HeaderSize);  // offset to the point data
+  data[104] = kLasWriteFormat;
+  setLasValue<uint16_t>(data, 105, kLasRecordLengths[kLasWriteFormat]);
+  // the legacy counts are for readers of earlier versions, and are 0 when the count does not fit
+  const uint32_t legacy_num_points =
+    num_points <= std::numeric_limits<uint32_t>::max() ? static_cast<uint32_t>(num_points) : 0;
+  setLasValue<uint32_t>(data, 107, legacy_num_points);
+  setLasValue<uint32_t>(data, 111, legacy_num_points);  // all are first returns
+  for (int i = 0; i < 3; i++)
   {
-    point.SetCoordinates(points[i][0], points[i][1], points[i][2]);
-    point.SetIntensity(colours[i].alpha);
-    if (!times.empty())
-      point.SetTime(times[i]);
-    writer.WritePoint(point);
+    setLasValue<double>(data, 131 + 8 * i, kLasWriteScale);
+    setLasValue<double>(data, 155 + 8 * i, offset[i]);
+    setLasValue<double>(data, 179 + 16 * i, max_bound[i]);
+    setLasValue<double>(data, 187 + 16 * i, min_bound[i]);
   }
-  return true;
-#else   // RAYLIB_WITH_LAS
-  RAYLIB_UNUSED(file_name);
-  RAYLIB_UNUSED(points);
-  RAYLIB_UNUSED(times);
-  RAYLIB_UNUSED(colours);
-  std::cerr << "writeLas: cannot write file as WITHLAS not enabled. Enable using: cmake .. -DWITH_LAS=true"
-            << std::endl;
-  return false;
-#endif  // RAYLIB_WITH_LAS
+  setLasValue<uint64_t>(data, 247, num_points);
+  setLasValue<uint64_t>(data, 255, num_points);  // all are first returns
+  out.write(reinterpret_cast<const char *>(data), kLas14HeaderSize);
+  return out.good();
 }
+}  // namespace
 
-#if RAYLIB_WITH_LAS
 LasWriter::LasWriter(const std::string &file_name)
   : file_name_(file_name)
+  , native_(file_name.find(".laz") == std::string::npos)
+  , num_points_(0)
+  , offset_(0, 0, 0)
+  , min_bound_(0, 0, 0)
+  , max_bound_(0, 0, 0)
+  , has_warned_(false)
+  , ended_(false)
 {
-  header_.SetDataFormatId(liblas::ePointFormat1);  // Time only
-  if (file_name_.find(".laz") != std::string::npos)
+#if RAYLIB_WITH_LAS
+  writer_ = nullptr;
+#endif  // RAYLIB_WITH_LAS
+  if (!native_)
+  {
+#if RAYLIB_WITH_LAS
+    header_.SetDataFormatId(liblas::ePointFormat1);  // Time only
     header_.SetCompressed(true);
+#else   // RAYLIB_WITH_LAS
+    std::cerr << "writeLas: cannot write compressed file as WITHLAS not enabled. Enable using: cmake .. -DWITH_LAS=true"
+              << std::endl;
+    return;
+#endif  // RAYLIB_WITH_LAS
+  }
 
   std::cout << "Saving points to " << file_name_ << std::endl;
   out_.open(file_name_.c_str(), std::ios::out | std::ios::binary);
@@ -227,43 +507,69 @@ LasWriter::LasWriter(const std::string &file_name)
     std::cerr << "Error: cannot open " << file_name << " for writing." << std::endl;
     return;
   }
-  const double scale = 1e-4;
-  header_.SetScale(scale, scale, scale);
+  if (native_)
+  {
+    // a placeholder header, which is completed in end()
+    writeLasHeader(out_, 0, offset_, min_bound_, max_bound_);
+    return;
+  }
+#if RAYLIB_WITH_LAS
+  header_.SetScale(kLasWriteScale, kLasWriteScale, kLasWriteScale);
   writer_ = new liblas::Writer(out_, header_);
+#endif  // RAYLIB_WITH_LAS
 }
-#else   // RAYLIB_WITH_LAS
-LasWriter::LasWriter(const std::string &file_name)
-  : file_name_(file_name)
+
+LasWriter::~LasWriter()
 {
-  RAYLIB_UNUSED(file_name);
-  std::cerr << "writeLas: cannot write file as WITHLAS not enabled. Enable using: cmake .. -DWITH_LAS=true"
-            << std::endl;
+  end();
 }
-#endif  // RAYLIB_WITH_LAS
 
-LasWriter::~LasWriter()
+bool LasWriter::end()
 {
+  if (ended_)
+  {
+    return true;
+  }
+  ended_ = true;
 #if RAYLIB_WITH_LAS
   delete writer_;
-#else
-  std::cerr << "writeLas: cannot write file as WITHLAS not enabled. Enable using: cmake .. -DWITH_LAS=true"
-            << std::endl;
-#endif
+  writer_ = nullptr;
+#endif  // RAYLIB_WITH_LAS
+  if (!out_.is_open() || out_.fail())
+  {
+    return false;
+  }
+  if (native_)
+  {
+    out_.seekp(0);
+    if (!writeLasHeader(out_, num_points_, offset_, min_bound_, max_bound_))
+    {
+      std::cerr << "Error: cannot write to " << file_name_ << std::endl;
+      return false;
+    }
+    std::cout << num_points_ << " points saved to " << file_name_ << std::endl;
+  }
+  out_.close();
+  return true;
 }
 
 bool LasWriter::writeChunk(const std::vector<Eigen::Vector3d> &points, const std::vector<double> &times,
                            const std::vector<RGBA> &colours)
 {
-#if RAYLIB_WITH_LAS
   if (points.size() == 0)
   {
     return true;  // this is acceptable behaviour. It avoids calling function checking for emptiness each time
   }
-  if (out_.fail())
+  if (ended_ || !out_.is_open() || out_.fail())
   {
     std::cerr << "Error: cannot open " << file_name_ << " for writing." << std::endl;
     return false;
   }
+  if (native_)
+  {
+    return writeNativeChunk(points, times, colours);
+  }
+#if RAYLIB_WITH_LAS
   liblas::Point point(&header_);
   point.SetHeader(&header_);  // TODO HACK Version 1.7.0 does not correctly resize the data. Commit
                               // 6e8657336ba445fcec3c9e70c2ebcd2e25af40b9 (1.8.0 3 July fixes it)
@@ -277,13 +583,59 @@ bool LasWriter::writeChunk(const std::vector<Eigen::Vector3d> &points, const std
   }
   return true;
 #else   // RAYLIB_WITH_LAS
-  RAYLIB_UNUSED(points);
-  RAYLIB_UNUSED(times);
-  RAYLIB_UNUSED(colours);
-  std::cerr << "writeLas: cannot write file as WITHLAS not enabled. Enable using: cmake .. -DWITH_LAS=true"
-            << std::endl;
   return false;
 #endif  // RAYLIB_WITH_LAS
 }
 
+bool LasWriter::writeNativeChunk(const std::vector<Eigen::Vector3d> &points, const std::vector<double> &times,
+                                 const std::vector<RGBA> &colours)
+{
+  if (num_points_ == 0)
+  {
+    // the offset keeps the scaled integer coordinates small, for georeferenced clouds
+    const double offset_step = 1000.0;
+    for (int i = 0; i < 3; i++)
+      offset_[i] = std::isfinite(points[0][i]) ? offset_step * std::round(points[0][i] / offset_step) : 0.0;
+    min_bound_ = max_bound_ = points[0];
+  }
+  const uint16_t record_length = kLasRecordLengths[kLasWriteFormat];
+  buffer_.assign(points.size() * record_length, 0);
+  const double max_coord = static_cast<double>(std::numeric_limits<int32_t>::max());
+  // each record is written by one worker, and any coordinates out of range are flagged per worker
+  const bool out_of_range = parallelReduce(
+    size_t(0), points.size(), false,
+    [&](size_t i, bool &out_of_range)
+    {
+      unsigned char *record = buffer_.data() + static_cast<size_t>(i) * record_length;
+      for (int j = 0; j < 3; j++)
+      {
+        double coord = std::round((points[i][j] - offset_[j]) / kLasWriteScale);
+        if (!(std::abs(coord) <= max_coord))
+        {
+          out_of_range = true;
+          coord = coord == coord ? std::max(-max_coord, std::min(coord, max_coord)) : 0.0;
+        }
+        setLasValue<int32_t>(record, 4 * j, static_cast<int32_t>(coord));
+      }
+      setLasValue<uint16_t>(record, 12, colours[i].alpha);
+      record[14] = 1 | (1 << 3);  // return 1 of 1
+      setLasValue<double>(record, 20, times.empty() ? 0.0 : times[i]);
+    },
+    [](bool &out_of_range, const bool &other_out_of_range) { out_of_range = out_of_range || other_out_of_range; });
+  if (out_of_range && !has_warned_)
+  {
+    std::cout << "warning: points beyond " << max_coord * kLasWriteScale << " m of " << offset_.transpose()
+              << " cannot be stored in " << file_name_ << ", these are clamped" << std::endl;
+    has_warned_ = true;
+  }
+  for (auto &point : points)
+  {
+    min_bound_ = minVector(min_bound_, point);
+    max_bound_ = maxVector(max_bound_, point);
+  }
+  out_.write(reinterpret_cast<const char *>(buffer_.data()), static_cast<std::streamsize>(buffer_.size()));
+  num_points_ += points.size();
+  return out_.good();
+}
+
 }  // namespace ray
@@ -17,11 +17,13 @@
 namespace ray
 {
 /// Read a laz or las file, into the fields passed by reference.
+/// Uncompressed LAS 1.0 to 1.4 files, with point formats 0 to 10, are read directly. Compressed files need liblas.
 bool RAYLIB_EXPORT readLas(std::string file_name, std::vector<Eigen::Vector3d> &positions, std::vector<double> &times,
                            std::vector<RGBA> &colours, double max_intensity,
                            Eigen::Vector3d *offset_to_remove = nullptr);
 
-/// Chunk-based version of readLas. This calls @c apply for every @c chunk_size points loaded
+/// Chunk-based version of readLas. This calls @c apply for every @c chunk_size points loaded.
+/// Uncompressed files are memory mapped where possible, and the points of each chunk are decoded in parallel
 bool RAYLIB_EXPORT readLas(const std::string &file_name,
                            std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
                                               std::vector<double> &times, std::vector<RGBA> &colours)>
@@ -31,6 +33,7 @@ bool RAYLIB_EXPORT readLas(const std::string &file_name,
 
 
 /// Write to a laz or las file. The intensity is the only part that is extracted from the @c colours argument.
+/// .las files are written directly as LAS 1.4 point format 1. Compressed .laz files need liblas.
 bool RAYLIB_EXPORT writeLas(std::string file_name, const std::vector<Eigen::Vector3d> &points,
                             const std::vector<double> &times, const std::vector<RGBA> &colours);
 
@@ -40,15 +43,32 @@ class RAYLIB_EXPORT LasWriter
 public:
   /// construct the class with a file name, which is stored
   LasWriter(const std::string &file_name);
-  /// the destructor
+  /// the destructor, this calls end() if it has not been called
   ~LasWriter();
   /// write a chunk of points to the file, described by the vector arguments
   bool writeChunk(const std::vector<Eigen::Vector3d> &points, const std::vector<double> &times,
                   const std::vector<RGBA> &colours);
+  /// finish the file, filling in the point count and bounds in the header of .las files
+  bool end();
 
 private:
-  const std::string &file_name_;
+  /// encode and write the points to a .las file
+  bool writeNativeChunk(const std::vector<Eigen::Vector3d> &points, const std::vector<double> &times,
+                        const std::vector<RGBA> &colours);
+
+  std::string file_name_;
   std::ofstream out_;
+  /// whether the file is written directly, rather than through liblas
+  bool native_;
+  uint64_t num_points_;
+  /// the offset of the stored coordinates, chosen from the first point
+  Eigen::Vector3d offset_;
+  Eigen::Vector3d min_bound_, max_bound_;
+  /// encoded point records, kept to avoid repeated reallocations
+  std::vector<unsigned char> buffer_;
+  /// whether a warning has been issued or not. This prevents multiple warnings.
+  bool has_warned_;
+  bool ended_;
 #if RAYLIB_WITH_LAS
   liblas::Header header_;
   liblas::Writer *writer_;
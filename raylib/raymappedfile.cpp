@@ -0,0 +1,94 @@
+// Copyright (c) 2026
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#include "raymappedfile.h"
+#include "rayunused.h"
+
+#include <algorithm>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif  // !defined(_WIN32)
+
+namespace ray
+{
+MappedFile::~MappedFile()
+{
+  close();
+}
+
+bool MappedFile::open(const std::string &file_name, bool sequential)
+{
+  close();
+#if defined(_WIN32)
+  RAYLIB_UNUSED(file_name);
+  RAYLIB_UNUSED(sequential);
+  return false;  // not supported, use the stream readers instead
+#else
+  int fd = ::open(file_name.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0)
+  {
+    ::close(fd);
+    return false;
+  }
+  size_t size = static_cast<size_t>(file_stat.st_size);
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);  // the mapping keeps its own reference to the file
+  if (data == MAP_FAILED)
+  {
+    return false;
+  }
+  if (sequential)
+  {
+    madvise(data, size, MADV_SEQUENTIAL);
+  }
+  data_ = static_cast<const unsigned char *>(data);
+  size_ = size;
+  return true;
+#endif  // defined(_WIN32)
+}
+
+void MappedFile::close()
+{
+#if !defined(_WIN32)
+  if (data_)
+  {
+    munmap(const_cast<unsigned char *>(data_), size_);
+  }
+#endif  // !defined(_WIN32)
+  data_ = nullptr;
+  size_ = 0;
+}
+
+void MappedFile::release(size_t offset, size_t length) const
+{
+#if defined(_WIN32)
+  RAYLIB_UNUSED(offset);
+  RAYLIB_UNUSED(length);
+#else
+  if (!data_ || offset >= size_)
+  {
+    return;
+  }
+  // madvise works on whole pages, so only release the pages that are entirely within the range
+  const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  const size_t begin = ((offset + page_size - 1) / page_size) * page_size;
+  const size_t end = std::min(offset + length, size_) / page_size * page_size;
+  if (end > begin)
+  {
+    madvise(const_cast<unsigned char *>(data_) + begin, end - begin, MADV_DONTNEED);
+  }
+#endif  // defined(_WIN32)
+}
+
+}  // namespace ray
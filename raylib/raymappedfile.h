@@ -0,0 +1,48 @@
+// Copyright (c) 2026
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#ifndef RAYLIB_RAYMAPPEDFILE_H
+#define RAYLIB_RAYMAPPEDFILE_H
+
+#include "raylib/raylibconfig.h"
+
+#include <cstddef>
+#include <string>
+
+namespace ray
+{
+/// Read-only memory mapping of a whole file. This exposes the file contents directly as a byte array, so large binary
+/// bodies can be decoded in place, without a copy through a stream buffer.
+/// Where memory mapping is not supported (or fails) @c open() returns false, and callers should fall back to streams.
+class RAYLIB_EXPORT MappedFile
+{
+public:
+  MappedFile() = default;
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  /// map the file @c file_name. @c sequential hints to the OS that the data will be read front to back, so it can
+  /// read ahead aggressively.
+  bool open(const std::string &file_name, bool sequential = true);
+  /// unmap the file. This is also done on destruction
+  void close();
+
+  /// tell the OS that the byte range will not be needed again, so its pages can be dropped. This keeps the resident
+  /// size down when streaming through files that are larger than RAM.
+  void release(size_t offset, size_t length) const;
+
+  inline bool isOpen() const { return data_ != nullptr; }
+  inline const unsigned char *data() const { return data_; }
+  inline size_t size() const { return size_; }
+
+private:
+  const unsigned char *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+}  // namespace ray
+
+#endif  // RAYLIB_RAYMAPPEDFILE_H
@@ -5,29 +5,27 @@
 // Author: Kazys Stepanas, Tom Lowe
 #include "raymerger.h"
 
+#include "raybvh.h"
+#include "raycloudwriter.h"
 #include "raygrid.h"
+#include "raygridwalk.h"
+#include "rayindex.h"
+#include "raymergestate.h"
+#include "rayparallel.h"
 #include "rayprogress.h"
+#include "rayrcz.h"
 #include "rayunused.h"
 
-#if RAYLIB_WITH_TBB
-#include <tbb/enumerable_thread_specific.h>
-#include <tbb/parallel_for.h>
-#endif  // RAYLIB_WITH_TBB
-
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <numeric>
 #include <set>
-
-#if RAYLIB_WITH_TBB
-// With threads we use std::atomic_bool for the transient marks. These are default initialised to false. No additional
-// argument required
-#define MARKER_BOOL_INIT
-#else  // RAYLIB_WITH_TBB
-// Without threads, we use bool for the transient marks. There is no default construction, so we must provide the
-// initialisation argument
-#define MARKER_BOOL_INIT , false
-#endif  // RAYLIB_WITH_TBB
+#include <unordered_map>
+#include <unordered_set>
 
 namespace ray
 {
@@ -45,6 +43,8 @@ public:
   /// The @p ellipsoid is considered transient if sufficient rays pass through or near it.
   ///
   /// @param ellipsoid The ellipsoid to check for transient marks.
+  /// @param ellipsoid_arrays The ellipsoids, with the @p ellipsoid as element @p ellipsoid_id , which its candidate
+  /// rays are batch intersected with.
   /// @param transient_ray_marks Array marking which rays from @p cloud are transient and should be removed.
   /// @param ray_grid The voxelised representation of @p cloud .
   /// @param num_rays Thresholding value indicating the number of nearby rays required to mark the ellipsoid as
@@ -52,21 +52,45 @@ public:
   /// @param merge_type The merging strategy.
   /// @param self_transient True when the @p ellipsoid was generated from @p cloud and we are looking for transient
   /// points within this cloud.
-  void mark(Ellipsoid *ellipsoid, std::vector<Merger::Bool> *transient_ray_marks, const Cloud &cloud,
-            const Grid<unsigned> &ray_grid, double num_rays, MergeType merge_type, bool self_transient,
-            bool ellipsoid_cloud_first);
+  template <class CloudT, class GridT>
+  void mark(Ellipsoid *ellipsoid, const EllipsoidArrays &ellipsoid_arrays, uint32_t ellipsoid_id,
+            std::vector<Merger::Bool> *transient_ray_marks, const CloudT &cloud, const GridT &ray_grid,
+            double num_rays, MergeType merge_type, bool self_transient, bool ellipsoid_cloud_first);
+
+  /// As @c mark() , for the BVH engine, which has already found the rays that intersect the @p ellipsoid .
+  /// @p intersections are the ids of these rays in increasing order, with @c kHitBit set on those that hit it.
+  template <class CloudT>
+  void markIntersections(Ellipsoid *ellipsoid, std::vector<Merger::Bool> *transient_ray_marks, const CloudT &cloud,
+                         const uint64_t *intersections, size_t num_intersections, double num_rays,
+                         MergeType merge_type, bool self_transient, bool ellipsoid_cloud_first);
+
+  /// the flag in a BVH intersection for a ray that hits the ellipsoid, rather than passing through it. The ray ids
+  /// are 64 bit, so the flag never overlaps them
+  static constexpr uint64_t kHitBit = uint64_t(1) << 63;
 
 private:
+  /// Resolves whether the @p ellipsoid or the rays passing through it (in @c pass_through_ids) are transient, from
+  /// the number of rays that hit it and the time range of those hits.
+  template <class CloudT>
+  void resolve(Ellipsoid *ellipsoid, std::vector<Merger::Bool> *transient_ray_marks, const CloudT &cloud,
+               unsigned hits, double first_intersection_time, double last_intersection_time, double num_rays,
+               MergeType merge_type, bool self_transient, bool ellipsoid_cloud_first);
+
   // Working memory.
 
   /// Tracks which rays have been tested. Sized to match incoming cloud ray count.
   std::vector<bool> ray_tested;
   /// Ids of ray to test.
   std::vector<unsigned> test_ray_ids;
+  /// The rays to test, and their intersection results.
+  std::vector<Eigen::Vector3d> test_starts, test_ends;
+  std::vector<IntersectResult> test_results;
   /// Ids of rays which intersect the ellipsoid with a @c IntersectResult::Passthrough result.
-  std::vector<unsigned> pass_through_ids;
+  std::vector<size_t> pass_through_ids;
 };
 
+constexpr uint64_t EllipsoidTransientMarker::kHitBit;
+
 typedef Eigen::Matrix<double, 6, 1> Vector6i;
 class Vector6iLess
 {
@@ -87,6 +111,107 @@ public:
   }
 };
 
+/// the colour of a ray when colouring the filtered clouds. Blue is the opacity of its ellipsoid and green the number
+/// of rays that pass through it
+inline RGBA transientColour(const Ellipsoid &ellipsoid, RGBA colour)
+{
+  colour.red = (uint8_t)0;
+  colour.blue = (uint8_t)(ellipsoid.opacity * 255.0);
+  colour.green = (uint8_t)((double)ellipsoid.num_gone / ((double)ellipsoid.num_gone + 10.0) * 255.0);
+  return colour;
+}
+
+/// A key for a ray in the tiled filter, which is the same in each tile that reads the ray, and in the tile files.
+/// The incremental merge uses it to find rays in the map file. The end is rounded to single precision as in the tile
+/// and map files. Rays with the same end and time share a key.
+inline uint64_t tiledRayKey(const Eigen::Vector3d &end, double time)
+{
+  const float coords[3] = { (float)end[0], (float)end[1], (float)end[2] };
+  uint32_t words[3];
+  std::memcpy(words, coords, sizeof(words));
+  uint64_t key;
+  std::memcpy(&key, &time, sizeof(key));
+  for (const auto &word : words)
+  {
+    key ^= word + 0x9e3779b97f4a7c15ull + (key << 6) + (key >> 2);
+  }
+  // finalise, to spread the key over the hash set buckets
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdull;
+  key ^= key >> 33;
+  return key;
+}
+
+/// approximate memory per ray in a tile, for the ray, its ellipsoid, neighbour search and its entries in the ray grid
+const double kTileBytesPerRay = 600.0;
+
+/// Make the ray cloud @p file_name readable by region, for the tiles of the tiled filter. Without an index (see
+/// rayindex.h) each tile would read the whole file, so it is indexed here in a single pass, which also gives its
+/// @p info if that isn't cached. A .rcz file has no region index, so it is instead streamed once into the indexed .ply
+/// file @p copy_name . @p tiles_file_name is set to the file that the tiles read.
+bool indexTiledFile(const std::string &file_name, const std::string &copy_name, std::string *tiles_file_name,
+                    Cloud::Info *info)
+{
+  *tiles_file_name = file_name;
+  if (isRczFile(file_name))
+  {
+    CloudWriter writer;
+    if (!writer.begin(copy_name))
+    {
+      return false;
+    }
+    const bool read = Cloud::read(file_name, [&](std::vector<Eigen::Vector3d> &starts,
+                                                 std::vector<Eigen::Vector3d> &ends, std::vector<double> &times,
+                                                 std::vector<RGBA> &colours) {
+      writer.writeChunk(starts, ends, times, colours);
+    });
+    // the writer saves the index and info of the copy
+    const bool written = writer.end();
+    *tiles_file_name = copy_name;
+    return read && written && Cloud::getInfo(copy_name, *info);
+  }
+
+  RayIndex index;
+  const bool has_info = Cloud::loadInfo(file_name, *info);
+  if (index.load(file_name))
+  {
+    return has_info || Cloud::getInfo(file_name, *info);
+  }
+  if (!has_info)
+  {
+    info->clear();
+  }
+  const bool read = Cloud::read(file_name, [&](std::vector<Eigen::Vector3d> &starts,
+                                               std::vector<Eigen::Vector3d> &ends, std::vector<double> &times,
+                                               std::vector<RGBA> &colours) {
+    index.add(starts, ends);
+    if (!has_info)
+    {
+      info->add(starts, ends, times, colours);
+    }
+  });
+  if (!read)
+  {
+    return false;
+  }
+  if (!has_info)
+  {
+    info->finish();
+    Cloud::saveInfo(file_name, *info);
+  }
+  if (!index.save(file_name))
+  {
+    std::cout << "warning: could not save the index of " << file_name << ", so each tile reads the whole file"
+              << std::endl;
+  }
+  return true;
+}
+
+/// the number of (ellipsoid, ray) intersections that the BVH engine aims to hold at once, at 16 bytes each
+const size_t kBVHBatchIntersections = size_t(1) << 24;
+/// the number of ellipsoids in the BVH engine's first batch, before their number of intersections is known
+const size_t kBVHFirstBatchSize = size_t(1) << 18;
+
 // TODO: Make config value
 const double test_width = 0.01;  // allows a minor variation when checking for similarity of rays
 
@@ -106,8 +231,10 @@ void rayLookup(const Cloud *cloud, std::set<Vector6i, Vector6iLess> &ray_lookup)
   }
 }
 
-void EllipsoidTransientMarker::mark(Ellipsoid *ellipsoid, std::vector<Merger::Bool> *transient_ray_marks,
-                                    const Cloud &cloud, const Grid<unsigned> &ray_grid, double num_rays,
+template <class CloudT, class GridT>
+void EllipsoidTransientMarker::mark(Ellipsoid *ellipsoid, const EllipsoidArrays &ellipsoid_arrays,
+                                    uint32_t ellipsoid_id, std::vector<Merger::Bool> *transient_ray_marks,
+                                    const CloudT &cloud, const GridT &ray_grid, double num_rays,
                                     MergeType merge_type, bool self_transient, bool ellipsoid_cloud_first)
 {
   if (ellipsoid->transient)
@@ -171,14 +298,26 @@ void EllipsoidTransientMarker::mark(Ellipsoid *ellipsoid, std::vector<Merger::Bo
     }
   }
 
+  // the candidate rays are intersected in SIMD packets, in the order they were found
+  test_starts.resize(test_ray_ids.size());
+  test_ends.resize(test_ray_ids.size());
+  test_results.resize(test_ray_ids.size());
+  for (size_t i = 0; i < test_ray_ids.size(); i++)
+  {
+    ray_tested[test_ray_ids[i]] = false;
+    test_starts[i] = cloud.start(test_ray_ids[i]);
+    test_ends[i] = cloud.end(test_ray_ids[i]);
+  }
+  ellipsoid_arrays.intersectBatch(ellipsoid_id, test_starts.data(), test_ends.data(), test_ray_ids.size(),
+                                  test_results.data());
+
   double first_intersection_time = std::numeric_limits<double>::max();
   double last_intersection_time = std::numeric_limits<double>::lowest();
   unsigned hits = 0;
-  for (auto &ray_id : test_ray_ids)
+  for (size_t i = 0; i < test_ray_ids.size(); i++)
   {
-    ray_tested[ray_id] = false;
-
-    switch (ellipsoid->intersect(cloud.starts[ray_id], cloud.ends[ray_id]))
+    const unsigned ray_id = test_ray_ids[i];
+    switch (test_results[i])
     {
     default:
     case IntersectResult::Miss:
@@ -194,7 +333,44 @@ void EllipsoidTransientMarker::mark(Ellipsoid *ellipsoid, std::vector<Merger::Bo
       break;
     }
   }
+  resolve(ellipsoid, transient_ray_marks, cloud, hits, first_intersection_time, last_intersection_time, num_rays,
+          merge_type, self_transient, ellipsoid_cloud_first);
+}
+
+template <class CloudT>
+void EllipsoidTransientMarker::markIntersections(Ellipsoid *ellipsoid, std::vector<Merger::Bool> *transient_ray_marks,
+                                                 const CloudT &cloud, const uint64_t *intersections,
+                                                 size_t num_intersections, double num_rays, MergeType merge_type,
+                                                 bool self_transient, bool ellipsoid_cloud_first)
+{
+  pass_through_ids.clear();
+  double first_intersection_time = std::numeric_limits<double>::max();
+  double last_intersection_time = std::numeric_limits<double>::lowest();
+  unsigned hits = 0;
+  for (size_t i = 0; i < num_intersections; i++)
+  {
+    const size_t ray_id = static_cast<size_t>(intersections[i] & ~kHitBit);
+    if (intersections[i] & kHitBit)
+    {
+      ++hits;
+      first_intersection_time = std::min(first_intersection_time, cloud.times[ray_id]);
+      last_intersection_time = std::max(last_intersection_time, cloud.times[ray_id]);
+    }
+    else
+    {
+      pass_through_ids.push_back(ray_id);
+    }
+  }
+  resolve(ellipsoid, transient_ray_marks, cloud, hits, first_intersection_time, last_intersection_time, num_rays,
+          merge_type, self_transient, ellipsoid_cloud_first);
+}
 
+template <class CloudT>
+void EllipsoidTransientMarker::resolve(Ellipsoid *ellipsoid, std::vector<Merger::Bool> *transient_ray_marks,
+                                       const CloudT &cloud, unsigned hits, double first_intersection_time,
+                                       double last_intersection_time, double num_rays, MergeType merge_type,
+                                       bool self_transient, bool ellipsoid_cloud_first)
+{
   size_t num_before = 0, num_after = 0;
   ellipsoid->num_rays = hits + pass_through_ids.size();
   if (num_rays == 0 || self_transient)
@@ -304,7 +480,7 @@ void EllipsoidTransientMarker::mark(Ellipsoid *ellipsoid, std::vector<Merger::Bo
         continue;
       }
 
-      unsigned ray_id = pass_through_ids[j];
+      const size_t ray_id = pass_through_ids[j];
       if (!self_transient || cloud.times[ray_id] < first_intersection_time ||
           cloud.times[ray_id] > last_intersection_time)
       {
@@ -322,6 +498,17 @@ Merger::Merger(const MergerConfig &config)
 Merger::~Merger() = default;
 
 bool Merger::filter(const Cloud &cloud, Progress *progress)
+{
+  return filterCloud(cloud, progress);
+}
+
+bool Merger::filter(const CompactCloud &cloud, Progress *progress)
+{
+  return filterCloud(cloud, progress);
+}
+
+template <class CloudT>
+bool Merger::filterCloud(const CloudT &cloud, Progress *progress)
 {
   // Ensure we have a value progress pointer to update. This simplifies code below.
   Progress tracker;
@@ -335,18 +522,22 @@ bool Merger::filter(const Cloud &cloud, Progress *progress)
   Eigen::Vector3d bounds_min, bounds_max;
   generateEllipsoids(&ellipsoids_, &bounds_min, &bounds_max, cloud, progress);
 
-  const double voxel_size = voxelSizeForCloud(cloud);
-  if (config_.voxel_size == 0)
+  // the BVH engine traces the rays through the ellipsoids directly, so has no ray grid
+  FlatGrid<unsigned> ray_grid;
+  if (config_.engine == MergeEngine::RayGrid)
   {
-    std::cout << "estimated required voxel size: " << voxel_size << std::endl;
+    const double voxel_size = voxelSizeForCloud(cloud);
+    if (config_.voxel_size == 0)
+    {
+      std::cout << "estimated required voxel size: " << voxel_size << std::endl;
+    }
+    ray_grid.init(bounds_min, bounds_max, voxel_size);
+    seedRayGrid(&ray_grid, cloud);
+    fillRayGrid(&ray_grid, cloud, progress);
   }
 
-  Grid<unsigned> ray_grid(bounds_min, bounds_max, voxel_size);
-  seedRayGrid(&ray_grid, cloud);
-  fillRayGrid(&ray_grid, cloud, progress);
-
   // Atomic do not support assignment and construction so we can't really retain the vector memory.
-  std::vector<Bool> transient_ray_marks(cloud.rayCount() MARKER_BOOL_INIT);
+  std::vector<Bool> transient_ray_marks(cloud.rayCount());
   markIntersectedEllipsoids(cloud, ray_grid, &transient_ray_marks, config_.num_rays_filter_threshold, true, progress);
 
   finaliseFilter(cloud, transient_ray_marks);
@@ -356,7 +547,341 @@ bool Merger::filter(const Cloud &cloud, Progress *progress)
   return true;
 }
 
+bool Merger::filterTiled(const std::string &file_name, const std::string &fixed_file_name,
+                         const std::string &transient_file_name, const TiledFilterConfig &tiled_config,
+                         Progress *progress)
+{
+  Progress tracker;
+  if (!progress)
+  {
+    progress = &tracker;
+  }
+
+  clear();
+
+  // each tile reads the rays near it from tiles_file_name, which is file_name or an indexed copy of it
+  const std::string copy_file_name = fixed_file_name + ".indexed.ply";
+  std::string tiles_file_name;
+  Cloud::Info info;
+  const bool indexed = indexTiledFile(file_name, copy_file_name, &tiles_file_name, &info);
+  const auto remove_copy = [&]() {
+    if (tiles_file_name == copy_file_name)
+    {
+      std::remove(copy_file_name.c_str());
+      std::remove(RayIndex::fileName(copy_file_name).c_str());
+      std::remove(Cloud::infoFileName(copy_file_name).c_str());
+    }
+  };
+  if (!indexed)
+  {
+    remove_copy();
+    return false;
+  }
+  // a single voxel size for all of the tiles, so they match the filter of the whole cloud
+  double voxel_size = config_.voxel_size;
+  if (voxel_size <= 0)
+  {
+    voxel_size = info.num_bounded > 0 ?
+                   4.0 * Cloud::estimatePointSpacing(tiles_file_name, info.ends_bound, info.num_bounded) :
+                   0.25;
+    std::cout << "estimated required voxel size: " << voxel_size << std::endl;
+  }
+  const double halo = tiled_config.halo > 0 ? tiled_config.halo : 2.0 * voxel_size;
+
+  // the tiles are columns, as site scans are much wider than they are tall. The ray bounds contain all of the ends
+  const Eigen::Vector3d bounds_min = info.rays_bound.min_bound_;
+  const Eigen::Vector3d bounds_max = info.rays_bound.max_bound_;
+  const Eigen::Vector3d extent =
+    (bounds_max - bounds_min).cwiseMax(Eigen::Vector3d(voxel_size, voxel_size, voxel_size));
+  const double rays_per_area = (double)info.num_rays / (extent[0] * extent[1]);
+  const double max_tile_rays = std::max(1.0, tiled_config.memory_limit * 1e9 / kTileBytesPerRay);
+  int concurrency = parallelWorkerCount();
+  double tile_size = tiled_config.tile_size;
+  if (tile_size <= 0)
+  {
+    // the widest tiles that fit in memory. Fewer tiles are filtered at once rather than letting the halos dominate
+    for (;; concurrency--)
+    {
+      tile_size = std::sqrt(max_tile_rays / (concurrency * rays_per_area)) - 2.0 * halo;
+      if (tile_size >= 4.0 * halo || concurrency == 1)
+      {
+        break;
+      }
+    }
+    tile_size = std::max(tile_size, 4.0 * halo);
+  }
+  else
+  {
+    const double tile_rays = rays_per_area * (tile_size + 2.0 * halo) * (tile_size + 2.0 * halo);
+    concurrency = std::max(1, std::min(concurrency, (int)(max_tile_rays / tile_rays)));
+  }
+  const int tiles_x = std::max(1, (int)std::ceil(extent[0] / tile_size));
+  const int tiles_y = std::max(1, (int)std::ceil(extent[1] / tile_size));
+  const int num_tiles = tiles_x * tiles_y;
+  std::cout << "filtering " << num_tiles << " tiles of width " << tile_size << " m, " << concurrency
+            << " at a time" << std::endl;
+
+  // each ray is owned by the tile containing its end
+  const auto tile_of = [&](const Eigen::Vector3d &end) {
+    const int x = std::max(0, std::min((int)std::floor((end[0] - bounds_min[0]) / tile_size), tiles_x - 1));
+    const int y = std::max(0, std::min((int)std::floor((end[1] - bounds_min[1]) / tile_size), tiles_y - 1));
+    return x + tiles_x * y;
+  };
+
+  // the rays that are transient. A tile can mark rays owned by its neighbours, so these are only known at the end
+  std::unordered_set<uint64_t> transient_keys;
+  std::mutex transient_keys_mutex;
+  // coloured rays are written to a file per tile, as the colours depend on the ellipsoids of the owning tile
+  std::vector<std::string> tile_file_names;
+  std::vector<char> tile_file_written(num_tiles, false);
+  if (config_.colour_cloud)
+  {
+    for (int tile = 0; tile < num_tiles; tile++)
+    {
+      tile_file_names.push_back(fixed_file_name + ".tile" + std::to_string(tile) + ".ply");
+    }
+  }
+
+  const auto filter_tile = [&](int tile) {
+    const Eigen::Vector3d core_min =
+      bounds_min + tile_size * Eigen::Vector3d(double(tile % tiles_x), double(tile / tiles_x), 0.0);
+    const Eigen::Vector3d core_max = core_min + Eigen::Vector3d(tile_size, tile_size, extent[2]);
+    const Eigen::Vector3d margin(halo, halo, halo);
+    Cloud cloud;
+    std::vector<bool> owned;
+    bool any_owned = false;
+    const bool read = Cloud::read(tiles_file_name, Cuboid(core_min - margin, core_max + margin),
+                                  [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                                      std::vector<double> &times, std::vector<RGBA> &colours) {
+                                    for (size_t i = 0; i < ends.size(); i++)
+                                    {
+                                      cloud.addRay(starts[i], ends[i], times[i], colours[i]);
+                                      owned.push_back(tile_of(ends[i]) == tile);
+                                      any_owned = any_owned || owned.back();
+                                    }
+                                  });
+    if (!read || !any_owned)
+    {
+      return read;
+    }
+
+    Merger tile_merger(config_);
+    tile_merger.config_.voxel_size = voxel_size;
+    std::vector<Bool> transient_ray_marks(cloud.rayCount());
+    tile_merger.markTileTransients(cloud, owned, &transient_ray_marks);
+
+    std::vector<uint64_t> keys;
+    Cloud owned_cloud;
+    for (size_t i = 0; i < cloud.rayCount(); i++)
+    {
+      const Ellipsoid &ellipsoid = tile_merger.ellipsoids_[i];
+      if ((owned[i] && ellipsoid.transient) || transient_ray_marks[i])
+      {
+        keys.push_back(tiledRayKey(cloud.ends[i], cloud.times[i]));
+      }
+      if (owned[i] && config_.colour_cloud)
+      {
+        owned_cloud.addRay(cloud.starts[i], cloud.ends[i], cloud.times[i],
+                           transientColour(ellipsoid, cloud.colours[i]));
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(transient_keys_mutex);
+      transient_keys.insert(keys.begin(), keys.end());
+    }
+    if (config_.colour_cloud)
+    {
+      tile_file_written[tile] = writePlyRayCloud(tile_file_names[tile], owned_cloud.starts, owned_cloud.ends,
+                                                 owned_cloud.times, owned_cloud.colours);
+      return (bool)tile_file_written[tile];
+    }
+    return true;
+  };
+
+  // each worker takes the next tile until they are all done, so at most concurrency tiles are in memory at once
+  progress->begin("transient-tiles", num_tiles);
+  std::atomic_int next_tile(0);
+  std::atomic_bool success(true);
+  const auto filter_tiles = [&](size_t) {
+    for (int tile = next_tile++; tile < num_tiles; tile = next_tile++)
+    {
+      if (!filter_tile(tile))
+      {
+        success = false;
+      }
+      progress->increment();
+    }
+  };
+  if (concurrency > 1)
+  {
+    parallelFor(0, concurrency, filter_tiles);
+  }
+  else
+  {
+    // on the calling thread, so that the filter within the tile runs in parallel
+    filter_tiles(0);
+  }
+  progress->end();
+
+  // stream the rays into the fixed and transient files
+  CloudWriter fixed_writer, transient_writer;
+  bool fixed_begun = false, transient_begun = false;
+  if (success)
+  {
+    fixed_begun = fixed_writer.begin(fixed_file_name);
+    transient_begun = fixed_begun && transient_writer.begin(transient_file_name);
+    success = transient_begun;
+  }
+  Cloud fixed_chunk, transient_chunk;
+  const auto split = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                         std::vector<double> &times, std::vector<RGBA> &colours) {
+    fixed_chunk.clear();
+    transient_chunk.clear();
+    for (size_t i = 0; i < ends.size(); i++)
+    {
+      Cloud &chunk = transient_keys.count(tiledRayKey(ends[i], times[i])) ? transient_chunk : fixed_chunk;
+      chunk.addRay(starts[i], ends[i], times[i], colours[i]);
+    }
+    fixed_writer.writeChunk(fixed_chunk);
+    transient_writer.writeChunk(transient_chunk);
+  };
+  if (config_.colour_cloud)
+  {
+    for (int tile = 0; tile < num_tiles; tile++)
+    {
+      // tiles without any rays of their own have no file
+      if (!tile_file_written[tile])
+      {
+        continue;
+      }
+      if (success && !Cloud::read(tile_file_names[tile], split))
+      {
+        success = false;
+      }
+      std::remove(tile_file_names[tile].c_str());
+    }
+  }
+  else if (success && !Cloud::read(tiles_file_name, split))
+  {
+    success = false;
+  }
+  // the writers are ended on failure too, so that their files are closed
+  if (fixed_begun && !fixed_writer.end())
+  {
+    success = false;
+  }
+  if (transient_begun && !transient_writer.end())
+  {
+    success = false;
+  }
+  remove_copy();
+  if (success)
+  {
+    std::cout << transient_keys.size() << " transient rays" << std::endl;
+  }
+  return success;
+}
+
+void Merger::markTileTransients(const Cloud &cloud, const std::vector<bool> &owned,
+                                std::vector<Bool> *transient_ray_marks)
+{
+  Progress progress;
+  generateEllipsoids(&ellipsoids_, nullptr, nullptr, cloud, &progress);
+
+  // the other ellipsoids are left to the tiles that own them, which have the rays around them
+  const double max_double = std::numeric_limits<double>::max();
+  Eigen::Vector3d bounds_min(max_double, max_double, max_double);
+  Eigen::Vector3d bounds_max(-max_double, -max_double, -max_double);
+  for (size_t i = 0; i < ellipsoids_.size(); i++)
+  {
+    Ellipsoid &ellipsoid = ellipsoids_[i];
+    if (!owned[i])
+    {
+      ellipsoid.extents.setZero();
+    }
+    else if (ellipsoid.extents != Eigen::Vector3f::Zero())
+    {
+      bounds_min = minVector(bounds_min, Eigen::Vector3d(ellipsoid.pos - ellipsoid.extents.cast<double>()));
+      bounds_max = maxVector(bounds_max, Eigen::Vector3d(ellipsoid.pos + ellipsoid.extents.cast<double>()));
+    }
+  }
+  if (bounds_min[0] > bounds_max[0])
+  {
+    return;
+  }
+
+  FlatGrid<unsigned> ray_grid;
+  if (config_.engine == MergeEngine::RayGrid)
+  {
+    ray_grid.init(bounds_min, bounds_max, config_.voxel_size);
+    seedRayGrid(&ray_grid, cloud);
+    fillRayGrid(&ray_grid, cloud, &progress);
+  }
+  markIntersectedEllipsoids(cloud, ray_grid, transient_ray_marks, config_.num_rays_filter_threshold, true, &progress);
+}
+
 bool Merger::mergeMultiple(std::vector<Cloud> &clouds, Progress *progress)
+{
+  std::vector<std::vector<Bool>> transient_ray_marks;
+  markMergeTransients(clouds, &transient_ray_marks, progress);
+
+  for (size_t c = 0; c < clouds.size(); c++)
+  {
+    auto &cloud = clouds[c];
+    for (size_t i = 0; i < cloud.rayCount(); i++)
+    {
+      if (transient_ray_marks[c][i])
+      {
+        difference_.addRay(cloud, i);
+      }
+      else
+      {
+        fixed_.addRay(cloud, i);
+      }
+    }
+  }
+
+  return true;
+}
+
+bool Merger::mergeMultiple(std::vector<TrajectoryCloud> &clouds, std::vector<TrajectoryCloud> *differences,
+                           Progress *progress)
+{
+  std::vector<std::vector<Bool>> transient_ray_marks;
+  markMergeTransients(clouds, &transient_ray_marks, progress);
+
+  differences->resize(clouds.size());
+  for (size_t c = 0; c < clouds.size(); c++)
+  {
+    // the fixed rays are compacted to the front of the cloud, in order, so that no copy of the cloud is made
+    TrajectoryCloud &cloud = clouds[c];
+    TrajectoryCloud &difference = (*differences)[c];
+    difference.clear();
+    difference.trajectory = cloud.trajectory;
+    size_t num_fixed = 0;
+    for (size_t i = 0; i < cloud.rayCount(); i++)
+    {
+      if (transient_ray_marks[c][i])
+      {
+        difference.addRay(cloud, i);
+        continue;
+      }
+      cloud.ends[num_fixed] = cloud.ends[i];
+      cloud.times[num_fixed] = cloud.times[i];
+      cloud.colours[num_fixed] = cloud.colours[i];
+      num_fixed++;
+    }
+    cloud.ends.resize(num_fixed);
+    cloud.times.resize(num_fixed);
+    cloud.colours.resize(num_fixed);
+  }
+
+  return true;
+}
+
+template <class CloudT>
+void Merger::markMergeTransients(const std::vector<CloudT> &clouds, std::vector<std::vector<Bool>> *transient_ray_marks,
+                                 Progress *progress)
 {
   // Ensure we have a value progress pointer to update. This simplifies code below.
   Progress tracker;
@@ -367,31 +892,33 @@ bool Merger::mergeMultiple(std::vector<Cloud> &clouds, Progress *progress)
 
   clear();
 
-  std::vector<Grid<unsigned>> grids(clouds.size());
-  for (size_t c = 0; c < clouds.size(); c++)
+  std::vector<FlatGrid<unsigned>> grids(clouds.size());
+  for (size_t c = 0; c < clouds.size() && config_.engine == MergeEngine::RayGrid; c++)
   {
     const double voxel_size = voxelSizeForCloud(clouds[c]);
     if (config_.voxel_size == 0)
     {
       std::cout << "estimated required voxel size for cloud " << c << ": " << voxel_size << std::endl;
     }
-    grids[c].init(clouds[c].calcMinBound(), clouds[c].calcMaxBound(), voxel_size);
+    Eigen::Vector3d bounds_min, bounds_max;
+    clouds[c].calcBounds(&bounds_min, &bounds_max, kBFEnd | kBFStart);
+    grids[c].init(bounds_min, bounds_max, voxel_size);
     for (size_t d = 0; d < clouds.size(); d++)
     {
       seedRayGrid(&grids[c], clouds[d]);
     }
   }
 
-  for (size_t c = 0; c < clouds.size(); c++)
+  for (size_t c = 0; c < clouds.size() && config_.engine == MergeEngine::RayGrid; c++)
   {
     fillRayGrid(&grids[c], clouds[c], progress);
   }  
 
-  std::vector<std::vector<Bool>> transient_ray_marks;
-  transient_ray_marks.reserve(clouds.size());
+  transient_ray_marks->clear();
+  transient_ray_marks->reserve(clouds.size());
   for (size_t c = 0; c < clouds.size(); c++)
   {
-    transient_ray_marks.emplace_back(std::vector<Bool>(clouds[c].rayCount() MARKER_BOOL_INIT));
+    transient_ray_marks->emplace_back(std::vector<Bool>(clouds[c].rayCount()));
   }
 
   // now for each cloud, look for other clouds that penetrate it
@@ -399,7 +926,7 @@ bool Merger::mergeMultiple(std::vector<Cloud> &clouds, Progress *progress)
   {
     generateEllipsoids(&ellipsoids_, nullptr, nullptr, clouds[c], progress);
     // just set opacity
-    markIntersectedEllipsoids(clouds[c], grids[c], &transient_ray_marks[c], 0, false, progress);
+    markIntersectedEllipsoids(clouds[c], grids[c], &(*transient_ray_marks)[c], 0, false, progress);
 
     for (size_t d = 0; d < clouds.size(); d++)
     {
@@ -409,38 +936,255 @@ bool Merger::mergeMultiple(std::vector<Cloud> &clouds, Progress *progress)
       }
       const bool ellipsoid_cloud_first = c < d;  // used when argument order of the files is the merge type
       // use ellipsoid opacity to set transient flag true on transients
-      markIntersectedEllipsoids(clouds[d], grids[d], &transient_ray_marks[d], config_.num_rays_filter_threshold, false,
-                                progress, ellipsoid_cloud_first);
+      markIntersectedEllipsoids(clouds[d], grids[d], &(*transient_ray_marks)[d], config_.num_rays_filter_threshold,
+                                false, progress, ellipsoid_cloud_first);
     }
 
     for (size_t i = 0; i < clouds[c].rayCount(); i++)
     {
       if (ellipsoids_[i].transient)
       {
-        transient_ray_marks[c][i] = true;
+        (*transient_ray_marks)[c][i] = true;
       }
     }
   }
+}
 
-  for (size_t c = 0; c < clouds.size(); c++)
+bool Merger::mergeIncremental(const std::string &map_file, const Cloud &cloud, const std::string &combined_file,
+                              Progress *progress)
+{
+  Progress tracker;
+  if (!progress)
   {
-    auto &cloud = clouds[c];
-    for (size_t i = 0; i < cloud.rayCount(); i++)
+    progress = &tracker;
+  }
+
+  clear();
+
+  MergeState state;
+  if (!state.load(map_file))
+  {
+    std::cout << "no merge state for " << map_file << ", so building it from the whole cloud" << std::endl;
+    Cloud map;
+    if (!map.load(map_file, false))
     {
-      if (transient_ray_marks[c][i])
+      return false;
+    }
+    buildMergeState(map, &state, progress);
+  }
+  // the map ellipsoids that the new rays can reach, and the map rays of these ellipsoids
+  const Eigen::Vector3d cloud_min = cloud.calcMinBound();
+  const Eigen::Vector3d cloud_max = cloud.calcMaxBound();
+  std::vector<uint64_t> map_ids;
+  Cloud reached;
+  std::vector<Ellipsoid> map_ellipsoids;
+  state.ellipsoidsInBox(cloud_min, cloud_max, &map_ids, &reached, &map_ellipsoids);
+
+  // the ellipsoids of the new cloud, with their opacity from its own rays, as for each cloud in mergeMultiple
+  generateEllipsoids(&ellipsoids_, nullptr, nullptr, cloud, progress);
+  FlatGrid<unsigned> cloud_grid;
+  if (config_.engine == MergeEngine::RayGrid && cloud_min[0] <= cloud_max[0])
+  {
+    cloud_grid.init(cloud_min, cloud_max, state.voxelSize());
+    seedRayGrid(&cloud_grid, cloud);
+    seedRayGrid(&cloud_grid, reached);
+    fillRayGrid(&cloud_grid, cloud, progress);
+  }
+  std::vector<Bool> cloud_marks(cloud.rayCount());
+  markIntersectedEllipsoids(cloud, cloud_grid, &cloud_marks, 0, false, progress);
+  std::vector<Ellipsoid> cloud_ellipsoids;
+  cloud_ellipsoids.swap(ellipsoids_);
+
+  // the new rays against the map ellipsoids that they reach. The map is the first cloud in argument order
+  std::set<uint64_t> map_transient_ids;
+  Cloud map_transients;  // the rays of map_transient_ids, in the order they are found
+  std::vector<uint64_t> map_transient_order;
+  const auto add_map_transient = [&](uint64_t id, const Cloud &rays, size_t i) {
+    if (map_transient_ids.insert(id).second)
+    {
+      map_transient_order.push_back(id);
+      map_transients.addRay(rays, i);
+    }
+  };
+  ellipsoids_.swap(map_ellipsoids);
+  markIntersectedEllipsoids(cloud, cloud_grid, &cloud_marks, config_.num_rays_filter_threshold, false, progress,
+                            true);
+  for (size_t i = 0; i < map_ids.size(); i++)
+  {
+    if (ellipsoids_[i].transient)
+    {
+      add_map_transient(map_ids[i], reached, i);
+    }
+  }
+
+  // the map rays that pass through the voxels of the new ellipsoids, against them
+  ellipsoids_.swap(cloud_ellipsoids);
+  std::vector<Eigen::Vector3d> box_mins, box_maxs;
+  for (const auto &ellipsoid : ellipsoids_)
+  {
+    if (ellipsoid.extents != Eigen::Vector3f::Zero())
+    {
+      box_mins.push_back(ellipsoid.pos - ellipsoid.extents.cast<double>());
+      box_maxs.push_back(ellipsoid.pos + ellipsoid.extents.cast<double>());
+    }
+  }
+  std::vector<uint64_t> near_ids;
+  Cloud near_cloud;  // in map order, so that the rays are marked in the same order as in mergeMultiple
+  state.raysInBoxes(box_mins, box_maxs, &near_ids, &near_cloud);
+  if (near_cloud.rayCount() > 0)
+  {
+    FlatGrid<unsigned> near_grid;
+    if (config_.engine == MergeEngine::RayGrid)
+    {
+      near_grid.init(near_cloud.calcMinBound(), near_cloud.calcMaxBound(), state.voxelSize());
+      seedRayGrid(&near_grid, cloud);
+      fillRayGrid(&near_grid, near_cloud, progress);
+    }
+    std::vector<Bool> near_marks(near_cloud.rayCount());
+    markIntersectedEllipsoids(near_cloud, near_grid, &near_marks, config_.num_rays_filter_threshold, false,
+                              progress, false);
+    for (size_t i = 0; i < near_ids.size(); i++)
+    {
+      if (near_marks[i])
       {
-        difference_.addRay(cloud, i);
+        add_map_transient(near_ids[i], near_cloud, i);
       }
-      else
+    }
+  }
+  std::vector<bool> cloud_fixed(cloud.rayCount());
+  for (size_t i = 0; i < cloud.rayCount(); i++)
+  {
+    cloud_fixed[i] = !(cloud_marks[i] || ellipsoids_[i].transient);
+  }
+  if (!state.good())
+  {
+    return false;
+  }
+  std::cout << map_ids.size() << " map ellipsoids and " << near_ids.size() << " map rays of " << state.rayCount()
+            << " are around the new cloud, in " << state.loadedPageCount() << " of " << state.pageCount()
+            << " merge state pages" << std::endl;
+
+  // the map transients are found in the map file by their end and time, as their position in it isn't kept
+  std::unordered_map<uint64_t, size_t> transient_keys;
+  for (size_t i = 0; i < map_transients.rayCount(); i++)
+  {
+    transient_keys[tiledRayKey(map_transients.ends[i], map_transients.times[i])]++;
+  }
+
+  // stream the map into the combined cloud, then add the new rays. In place, the map is moved aside to be read
+  std::string read_file = map_file;
+  if (combined_file == map_file)
+  {
+    read_file = map_file + ".previous.ply";
+    if (std::rename(map_file.c_str(), read_file.c_str()) != 0)
+    {
+      std::cerr << "Error: cannot move " << map_file << " to " << read_file << std::endl;
+      return false;
+    }
+  }
+  CloudWriter writer;
+  const bool begun = writer.begin(combined_file);
+  bool success = begun, written = true;
+  size_t map_id = 0, num_removed = 0;
+  Cloud chunk;
+  const auto split = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                         std::vector<double> &times, std::vector<RGBA> &colours) {
+    chunk.clear();
+    for (size_t i = 0; i < ends.size(); i++, map_id++)
+    {
+      const auto found = transient_keys.find(tiledRayKey(ends[i], times[i]));
+      Cloud *destination = &chunk;
+      if (found != transient_keys.end() && found->second > 0)
       {
-        fixed_.addRay(cloud, i);
+        found->second--;
+        num_removed++;
+        destination = &difference_;
       }
+      destination->addRay(starts[i], ends[i], times[i], colours[i]);
+    }
+    written = writer.writeChunk(chunk) && written;
+  };
+  if (success && (!Cloud::read(read_file, split) || map_id != state.rayCount() ||
+                  num_removed != map_transients.rayCount()))
+  {
+    std::cerr << "Error: " << map_file << " does not match its merge state" << std::endl;
+    success = false;
+  }
+  if (success)
+  {
+    chunk.clear();
+    for (size_t i = 0; i < cloud.rayCount(); i++)
+    {
+      (cloud_fixed[i] ? chunk : difference_).addRay(cloud, i);
     }
+    written = writer.writeChunk(chunk) && written;
+  }
+  // ended on failure too, so that the file is closed before the map is moved back over it
+  if (begun && !writer.end())
+  {
+    written = false;
+  }
+  if (success && !written)
+  {
+    std::cerr << "Error: cannot write " << combined_file << std::endl;
+    success = false;
+  }
+  // the previous map is only removed once the combined cloud is complete
+  if (read_file != map_file)
+  {
+    if (success)
+    {
+      std::remove(read_file.c_str());
+    }
+    else
+    {
+      std::remove(map_file.c_str());
+      if (std::rename(read_file.c_str(), map_file.c_str()) != 0)
+      {
+        std::cerr << "Error: cannot move " << read_file << " back to " << map_file << std::endl;
+      }
+    }
+  }
+  if (!success)
+  {
+    return false;
   }
 
+  state.remove(map_transient_order, map_transients);
+  state.add(cloud, ellipsoids_, &cloud_fixed);
+  if (!state.save(combined_file))
+  {
+    std::cerr << "Error: cannot write the merge state " << MergeState::fileName(combined_file) << std::endl;
+    return false;
+  }
   return true;
 }
 
+void Merger::buildMergeState(const Cloud &map, MergeState *state, Progress *progress)
+{
+  generateEllipsoids(&ellipsoids_, nullptr, nullptr, map, progress);
+  const double voxel_size = voxelSizeForCloud(map);
+  if (config_.voxel_size == 0)
+  {
+    std::cout << "estimated required voxel size: " << voxel_size << std::endl;
+  }
+  const Eigen::Vector3d bounds_min = map.calcMinBound();
+  FlatGrid<unsigned> ray_grid;
+  if (config_.engine == MergeEngine::RayGrid)
+  {
+    ray_grid.init(bounds_min, map.calcMaxBound(), voxel_size);
+    seedRayGrid(&ray_grid, map);
+    fillRayGrid(&ray_grid, map, progress);
+  }
+  // just set the opacity, as for each cloud in mergeMultiple
+  std::vector<Bool> transient_ray_marks(map.rayCount());
+  markIntersectedEllipsoids(map, ray_grid, &transient_ray_marks, 0, false, progress);
+
+  state->init(bounds_min, voxel_size);
+  state->add(map, ellipsoids_);
+  ellipsoids_.clear();
+}
+
 bool Merger::mergeThreeWay(const Cloud &base_cloud, Cloud &cloud1, Cloud &cloud2, Progress *progress)
 {
   // The 3-way merge is similar to those performed on text files for version control systems. It attempts to apply the
@@ -524,8 +1268,8 @@ bool Merger::mergeThreeWay(const Cloud &base_cloud, Cloud &cloud1, Cloud &cloud2
   }
   // otherwise we run combine on the altered clouds
   // first, grid the rays for fast lookup
-  Grid<unsigned> grids[2];
-  for (int c = 0; c < 2; c++)
+  FlatGrid<unsigned> grids[2];
+  for (int c = 0; c < 2 && config_.engine == MergeEngine::RayGrid; c++)
   {
     grids[c].init(clouds[c]->calcMinBound(), clouds[c]->calcMaxBound(), voxelSizeForCloud(*clouds[c]));
     seedRayGrid(&grids[c], *clouds[0]); // to only fill rays in voxels occupied by cloud 0 or 1
@@ -533,8 +1277,8 @@ bool Merger::mergeThreeWay(const Cloud &base_cloud, Cloud &cloud1, Cloud &cloud2
     fillRayGrid(&grids[c], *clouds[c], progress);
   }
 
-  std::vector<Bool> transients[2] = { std::vector<Bool>(clouds[0]->rayCount() MARKER_BOOL_INIT),
-                                      std::vector<Bool>(clouds[1]->rayCount() MARKER_BOOL_INIT) };
+  std::vector<Bool> transients[2] = { std::vector<Bool>(clouds[0]->rayCount()),
+                                      std::vector<Bool>(clouds[1]->rayCount()) };
   // now for each cloud, represent the end points as ellipsoids, and ray cast the other cloud's rays against it
   for (int c = 0; c < 2; c++)
   {
@@ -586,91 +1330,174 @@ void Merger::clear()
 {
   difference_.clear();
   fixed_.clear();
+  compact_difference_.clear();
+  compact_fixed_.clear();
   ellipsoids_.clear();
 }
 
+void Merger::seedRayGrid(FlatGrid<unsigned> *grid, const Cloud &cloud)
+{
+  seedCloudRayGrid(grid, cloud);
+}
+
+void Merger::seedRayGrid(FlatGrid<unsigned> *grid, const CompactCloud &cloud)
+{
+  seedCloudRayGrid(grid, cloud);
+}
+
+void Merger::seedRayGrid(FlatGrid<unsigned> *grid, const TrajectoryCloud &cloud)
+{
+  seedCloudRayGrid(grid, cloud);
+}
+
 void Merger::seedRayGrid(Grid<unsigned> *grid, const Cloud &cloud)
 {
-  const auto seed_voxels = [grid, &cloud](unsigned i)
+  seedCloudRayGrid(grid, cloud);
+}
+
+void Merger::seedRayGrid(Grid<unsigned> *grid, const CompactCloud &cloud)
+{
+  seedCloudRayGrid(grid, cloud);
+}
+
+void Merger::seedRayGrid(Grid<unsigned> *grid, const TrajectoryCloud &cloud)
+{
+  seedCloudRayGrid(grid, cloud);
+}
+
+template <class GridT, class CloudT>
+void Merger::seedCloudRayGrid(GridT *grid, const CloudT &cloud)
+{
+  // the cells are added under a single lock, so only the indices are found in parallel
+  std::vector<Eigen::Vector3i> indices(cloud.rayCount());
+  parallelFor(0, cloud.rayCount(), [grid, &cloud, &indices](size_t i)
+  {
+    Eigen::Vector3d end = (cloud.end(i) - grid->box_min) / grid->voxel_width;
+    indices[i] = Eigen::Vector3i((int)floor(end[0]), (int)floor(end[1]), (int)floor(end[2]));
+  });
+  for (const auto &index : indices)
   {
-    Eigen::Vector3d end = (cloud.ends[i] - grid->box_min) / grid->voxel_width;
-    Eigen::Vector3i index((int)floor(end[0]), (int)floor(end[1]), (int)floor(end[2]));
     grid->addCell(index);
-  };
+  }
+}
+
+void Merger::fillRayGrid(FlatGrid<unsigned> *grid, const Cloud &cloud, Progress *progress)
+{
+  fillCloudRayGrid(grid, cloud, progress);
+}
+
+void Merger::fillRayGrid(FlatGrid<unsigned> *grid, const CompactCloud &cloud, Progress *progress)
+{
+  fillCloudRayGrid(grid, cloud, progress);
+}
+
+void Merger::fillRayGrid(FlatGrid<unsigned> *grid, const TrajectoryCloud &cloud, Progress *progress)
+{
+  fillCloudRayGrid(grid, cloud, progress);
+}
+
+void Merger::fillRayGrid(Grid<unsigned> *grid, const Cloud &cloud, Progress *progress)
+{
+  fillCloudRayGrid(grid, cloud, progress);
+}
+
+void Merger::fillRayGrid(Grid<unsigned> *grid, const CompactCloud &cloud, Progress *progress)
+{
+  fillCloudRayGrid(grid, cloud, progress);
+}
+
+void Merger::fillRayGrid(Grid<unsigned> *grid, const TrajectoryCloud &cloud, Progress *progress)
+{
+  fillCloudRayGrid(grid, cloud, progress);
+}
+
+template <class CloudT>
+void Merger::fillCloudRayGrid(FlatGrid<unsigned> *grid, const CloudT &cloud, Progress *progress)
+{
+  // filling as rows walks each ray twice, so it is only worth it with more than one thread
 #if RAYLIB_PARALLEL_GRID
-  tbb::parallel_for<unsigned>(0u, unsigned(cloud.rayCount()), seed_voxels);
+  const bool fill_rows = parallelWorkerCount() > 1;
 #else   // RAYLIB_PARALLEL_GRID
+  const bool fill_rows = false;
+#endif  // RAYLIB_PARALLEL_GRID
+  if (progress)
+  {
+    // the rows are walked once to count and once to fill
+    progress->begin("fillRayGrid", (fill_rows ? 2 : 1) * cloud.rayCount());
+  }
+
   const unsigned int count = static_cast<unsigned int>(cloud.rayCount());
-//  #pragma omp parallel for schedule(static)
-  for (unsigned int i = 0; i < count; ++i)
+  if (fill_rows)
   {
-    seed_voxels(i);
+    // calls visit(index, i) on each voxel that ray i passes through
+    const auto walk_ray = [grid, &cloud, progress](unsigned i, const auto &visit)  //
+    {
+      const auto visit_voxel = [&visit, i](const Eigen::Vector3i &index, const Eigen::Vector3i &, double, double,
+                                           double) {
+        visit(index, i);
+        return false;
+      };
+      walkGrid((cloud.start(i) - grid->box_min) / grid->voxel_width,
+               (cloud.end(i) - grid->box_min) / grid->voxel_width, visit_voxel);
+      if (progress)
+      {
+        progress->increment();
+      }
+    };
+    // lock free, as compressed sparse rows, at the cost of walking each ray twice
+    grid->fillRows(count, walk_ray);
+    return;
   }
-#endif  // RAYLIB_PARALLEL_GRID
+  walkCloudRayGrid(grid, cloud, progress);
 }
 
-void Merger::fillRayGrid(Grid<unsigned> *grid, const Cloud &cloud, Progress *progress)
+template <class CloudT>
+void Merger::fillCloudRayGrid(Grid<unsigned> *grid, const CloudT &cloud, Progress *progress)
 {
   if (progress)
   {
     progress->begin("fillRayGrid", cloud.rayCount());
   }
+  walkCloudRayGrid(grid, cloud, progress);
+}
 
-  const auto add_ray = [grid, &cloud, progress](unsigned i)  //
+template <class GridT, class CloudT>
+void Merger::walkCloudRayGrid(GridT *grid, const CloudT &cloud, Progress *progress)
+{
+  // walk the rays in SIMD packets, a block at a time. These visit the same voxels as walkGrid, but interleave the
+  // rays, so the cells are sorted afterwards to match the ray order
+  const unsigned int count = static_cast<unsigned int>(cloud.rayCount());
+  const unsigned int block_size = 1024;
+  std::vector<Eigen::Vector3d> starts(block_size), ends(block_size);
+  for (unsigned int first = 0; first < count; first += block_size)
   {
-    Eigen::Vector3d dir = cloud.ends[i] - cloud.starts[i];
-    Eigen::Vector3d dir_sign(sgn(dir[0]), sgn(dir[1]), sgn(dir[2]));
-    Eigen::Vector3d start = (cloud.starts[i] - grid->box_min) / grid->voxel_width;
-    Eigen::Vector3d end = (cloud.ends[i] - grid->box_min) / grid->voxel_width;
-    Eigen::Vector3i start_index((int)floor(start[0]), (int)floor(start[1]), (int)floor(start[2]));
-    Eigen::Vector3i end_index((int)floor(end[0]), (int)floor(end[1]), (int)floor(end[2]));
-    double length_sqr = (end_index - start_index).squaredNorm();
-    Eigen::Vector3i index = start_index;
-    for (;;)
+    const unsigned int num = std::min(block_size, count - first);
+    for (unsigned int j = 0; j < num; j++)
     {
-      grid->insertIfCellExists(index, i);
-      if (index == end_index || (index - start_index).squaredNorm() > length_sqr)
-      {
-        break;
-      }
-      Eigen::Vector3d mid =
-        grid->box_min + grid->voxel_width * Eigen::Vector3d(index[0] + 0.5, index[1] + 0.5, index[2] + 0.5);
-      Eigen::Vector3d next_boundary = mid + 0.5 * grid->voxel_width * dir_sign;
-      Eigen::Vector3d delta = next_boundary - cloud.starts[i];
-      Eigen::Vector3d d(delta[0] / dir[0], delta[1] / dir[1], delta[2] / dir[2]);
-      if (d[0] < d[1] && d[0] < d[2])
-      {
-        index[0] += int(dir_sign[0]);
-      }
-      else if (d[1] < d[0] && d[1] < d[2])
-      {
-        index[1] += int(dir_sign[1]);
-      }
-      else
+      starts[j] = (cloud.start(first + j) - grid->box_min) / grid->voxel_width;
+      ends[j] = (cloud.end(first + j) - grid->box_min) / grid->voxel_width;
+    }
+    const auto insert = [grid, first](const WalkBatch &batch) {
+      for (int lane = 0; lane < kWalkPacketSize; lane++)
       {
-        index[2] += int(dir_sign[2]);
+        if (batch.active & (1 << lane))
+        {
+          grid->insertIfCellExists(batch.voxel(lane), first + static_cast<unsigned>(batch.ray[lane]));
+        }
       }
-    }
-
+      return 0;
+    };
+    walkGridPacket(starts.data(), ends.data(), num, insert);
     if (progress)
     {
-      progress->increment();
+      progress->increment(num);
     }
-  };
-
-#if RAYLIB_PARALLEL_GRID
-  tbb::parallel_for<unsigned>(0u, unsigned(cloud.rayCount()), add_ray);
-#else   // RAYLIB_PARALLEL_GRID
-  const unsigned int count = static_cast<unsigned int>(cloud.rayCount());
-//  #pragma omp parallel for schedule(static)
-  for (unsigned int i = 0; i < count; ++i)
-  {
-    add_ray(i);
   }
-#endif  // RAYLIB_PARALLEL_GRID
+  grid->sortCells();
 }
 
-double Merger::voxelSizeForCloud(const Cloud &cloud) const
+template <class CloudT>
+double Merger::voxelSizeForCloud(const CloudT &cloud) const
 {
   double voxel_size = config_.voxel_size;
   if (voxel_size <= 0)
@@ -688,70 +1515,188 @@ double Merger::voxelSizeForCloud(const Cloud &cloud) const
   return voxel_size;
 }
 
-void Merger::markIntersectedEllipsoids(const Cloud &cloud, const Grid<unsigned> &ray_grid,
+template <class CloudT, class GridT>
+void Merger::markIntersectedEllipsoids(const CloudT &cloud, const GridT &ray_grid,
                                        std::vector<Bool> *transient_ray_marks, double num_rays, bool self_transient,
                                        Progress *progress, bool ellipsoid_cloud_first)
 {
+  if (config_.engine == MergeEngine::BVH)
+  {
+    markIntersectedEllipsoidsBVH(cloud, transient_ray_marks, num_rays, self_transient, progress,
+                                 ellipsoid_cloud_first);
+    return;
+  }
   progress->begin("transient-mark-ellipsoids", cloud.rayCount());
+  std::vector<uint32_t> ids(ellipsoids_.size());
+  std::iota(ids.begin(), ids.end(), 0u);
+  EllipsoidArrays ellipsoid_arrays;
+  ellipsoid_arrays.assign(ellipsoids_, ids);
+
+  // Check each ellipsoid against the ray grid for intersections, with a marker per worker for its working memory
+  parallelForLocal(0, ellipsoids_.size(), EllipsoidTransientMarker(cloud.rayCount()),
+                   [this, &cloud, &ray_grid, &ellipsoid_arrays, transient_ray_marks, &num_rays, ellipsoid_cloud_first,
+                    progress, self_transient](size_t ellipsoid_id, EllipsoidTransientMarker &marker)  //
+                   {
+                     marker.mark(&ellipsoids_[ellipsoid_id], ellipsoid_arrays, static_cast<uint32_t>(ellipsoid_id),
+                                 transient_ray_marks, cloud, ray_grid, num_rays, config_.merge_type, self_transient,
+                                 ellipsoid_cloud_first);
+                     progress->increment();
+                   });
+}
 
-  // Check each ellipsoid against the ray grid for intersections.
-#if RAYLIB_WITH_TBB
-  // Declare thread local for ellipsoid marking
-  using ThreadLocalRayMarkers = tbb::enumerable_thread_specific<EllipsoidTransientMarker>;
-  ThreadLocalRayMarkers thread_markers(EllipsoidTransientMarker(cloud.rayCount()));
-
-  auto tbb_process_ellipsoid = [this, &cloud, &ray_grid, transient_ray_marks, &num_rays, &thread_markers,
-                                ellipsoid_cloud_first, progress, self_transient](size_t ellipsoid_id)  //
+template <class CloudT>
+void Merger::markIntersectedEllipsoidsBVH(const CloudT &cloud, std::vector<Bool> *transient_ray_marks,
+                                          double num_rays, bool self_transient, Progress *progress,
+                                          bool ellipsoid_cloud_first)
+{
+  // the ellipsoids that can still be marked, as in EllipsoidTransientMarker::mark
+  std::vector<uint32_t> ids;
+  for (size_t i = 0; i < ellipsoids_.size(); i++)
   {
-    // Resolve the ray marker for this thread.
-    EllipsoidTransientMarker &marker = thread_markers.local();
-    marker.mark(&ellipsoids_[ellipsoid_id], transient_ray_marks, cloud, ray_grid, num_rays, config_.merge_type,
-                self_transient, ellipsoid_cloud_first);
-    progress->increment();
-  };
-  tbb::parallel_for<size_t>(0u, cloud.rayCount(), tbb_process_ellipsoid);
-#else   // RAYLIB_WITH_TBB
-  std::vector<bool> ray_tested;
-  ray_tested.resize(cloud.rayCount(), false);
-  EllipsoidTransientMarker ellipsoid_maker(cloud.rayCount());
- // #pragma omp parallel for schedule(static)
-  for (size_t i = 0; i < ellipsoids_.size(); ++i)
+    const Ellipsoid &ellipsoid = ellipsoids_[i];
+    if (ellipsoid.transient || ellipsoid.extents == Eigen::Vector3f::Zero())
+    {
+      continue;
+    }
+    ids.push_back(static_cast<uint32_t>(i));
+  }
+  EllipsoidArrays ellipsoid_arrays;
+  ellipsoid_arrays.assign(ellipsoids_, ids);
+
+  // An ellipsoid is marked from all of its intersections, so to bound the intersections held at once the ellipsoids
+  // are marked in batches, with all rays traced through each batch. Each batch is sized from the number of
+  // intersections per ellipsoid in the batch before
+  size_t batch_size = kBVHFirstBatchSize;
+  for (size_t first = 0; first < ids.size();)
   {
-    ellipsoid_maker.mark(&ellipsoids_[i], transient_ray_marks, cloud, ray_grid, num_rays, config_.merge_type,
-                         self_transient, ellipsoid_cloud_first);
-    progress->increment();
+    const size_t count = std::min(batch_size, ids.size() - first);
+    const size_t num_intersections = markEllipsoidBatchBVH(cloud, ids, ellipsoid_arrays, first, count,
+                                                           transient_ray_marks, num_rays, self_transient, progress,
+                                                           ellipsoid_cloud_first);
+    first += count;
+    const double intersections_per_ellipsoid = std::max(1.0, (double)num_intersections / (double)count);
+    batch_size = std::max(size_t(1), static_cast<size_t>((double)kBVHBatchIntersections / intersections_per_ellipsoid));
   }
-#endif  // RAYLIB_WITH_TBB
 }
 
-
-void Merger::finaliseFilter(const Cloud &cloud, const std::vector<Bool> &transient_ray_marks)
+template <class CloudT>
+size_t Merger::markEllipsoidBatchBVH(const CloudT &cloud, const std::vector<uint32_t> &ids,
+                                     const EllipsoidArrays &ellipsoid_arrays, size_t first, size_t count,
+                                     std::vector<Bool> *transient_ray_marks, double num_rays, bool self_transient,
+                                     Progress *progress, bool ellipsoid_cloud_first)
 {
-  // Lastly, generate the new ray clouds from this sphere information
-  for (size_t i = 0; i < ellipsoids_.size(); i++)
+  std::vector<Eigen::Vector3d> bounds_min(count), bounds_max(count);
+  for (size_t i = 0; i < count; i++)
   {
-    RGBA col = cloud.colours[i];
-    if (config_.colour_cloud)
+    const Ellipsoid &ellipsoid = ellipsoids_[ids[first + i]];
+    bounds_min[i] = ellipsoid.pos - ellipsoid.extents.cast<double>();
+    bounds_max[i] = ellipsoid.pos + ellipsoid.extents.cast<double>();
+  }
+  BVH bvh;
+  bvh.build(bounds_min, bounds_max);
+
+  progress->begin("transient-trace-ellipsoids", cloud.rayCount());
+  // trace the rays in parallel, collecting the (batch ellipsoid, ray) intersections per worker
+  using Intersection = std::pair<uint32_t, uint64_t>;
+  std::vector<std::vector<Intersection>> worker_intersections(static_cast<size_t>(parallelWorkerCount()));
+  parallelRanges(0, cloud.rayCount(), [&](size_t begin, size_t end, int worker) {
+    std::vector<Intersection> &intersections = worker_intersections[worker];
+    std::vector<uint32_t> candidates;
+    std::vector<IntersectResult> results;
+    for (size_t i = begin; i < end; i++)
     {
-      col.red = (uint8_t)0;
-      col.blue = (uint8_t)(ellipsoids_[i].opacity * 255.0);
-      col.green = (uint8_t)((double)ellipsoids_[i].num_gone / ((double)ellipsoids_[i].num_gone + 10.0) * 255.0);
+      const Eigen::Vector3d start = cloud.start(i);
+      const Eigen::Vector3d ray_end = cloud.end(i);
+      candidates.clear();
+      bvh.intersectSegment(start, ray_end, [&candidates, first](uint32_t item) {
+        candidates.push_back(static_cast<uint32_t>(first) + item);
+      });
+      results.resize(candidates.size());
+      ellipsoid_arrays.intersectBatch(start, ray_end, candidates.data(), candidates.size(), results.data());
+      for (size_t j = 0; j < candidates.size(); j++)
+      {
+        if (results[j] != IntersectResult::Miss)
+        {
+          const uint64_t hit = results[j] == IntersectResult::Hit ? EllipsoidTransientMarker::kHitBit : 0;
+          intersections.push_back(Intersection(candidates[j] - static_cast<uint32_t>(first), uint64_t(i) | hit));
+        }
+      }
     }
+    progress->increment(end - begin);
+  });
 
-    if (ellipsoids_[i].transient || transient_ray_marks[i])
+  // gather the intersections of each ellipsoid together, as compressed sparse rows
+  std::vector<size_t> offsets(count + 1, 0);
+  for (const auto &intersections : worker_intersections)
+  {
+    for (const auto &intersection : intersections)
     {
-      difference_.starts.emplace_back(cloud.starts[i]);
-      difference_.ends.emplace_back(cloud.ends[i]);
-      difference_.times.emplace_back(cloud.times[i]);
-      difference_.colours.emplace_back(col);
+      offsets[intersection.first + 1]++;
     }
-    else
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    offsets[i + 1] += offsets[i];
+  }
+  std::vector<uint64_t> rays(offsets.back());
+  {
+    std::vector<size_t> ends(offsets.begin(), offsets.end() - 1);
+    for (auto &intersections : worker_intersections)
     {
-      fixed_.starts.emplace_back(cloud.starts[i]);
-      fixed_.ends.emplace_back(cloud.ends[i]);
-      fixed_.times.emplace_back(cloud.times[i]);
-      fixed_.colours.emplace_back(col);
+      for (const auto &intersection : intersections)
+      {
+        rays[ends[intersection.first]++] = intersection.second;
+      }
+      std::vector<Intersection>().swap(intersections);
     }
   }
+
+  progress->begin("transient-mark-ellipsoids", count);
+  parallelForLocal(0, count, EllipsoidTransientMarker(0),
+                   [&](size_t i, EllipsoidTransientMarker &marker)  //
+                   {
+                     // in ray order, so the result doesn't depend on how the rays were shared among the workers
+                     uint64_t *first_ray = rays.data() + offsets[i];
+                     uint64_t *last_ray = rays.data() + offsets[i + 1];
+                     std::sort(first_ray, last_ray, [](uint64_t a, uint64_t b) {
+                       return (a & ~EllipsoidTransientMarker::kHitBit) < (b & ~EllipsoidTransientMarker::kHitBit);
+                     });
+                     marker.markIntersections(&ellipsoids_[ids[first + i]], transient_ray_marks, cloud, first_ray,
+                                              last_ray - first_ray, num_rays, config_.merge_type, self_transient,
+                                              ellipsoid_cloud_first);
+                     progress->increment();
+                   });
+  return rays.size();
+}
+
+void Merger::resultClouds(const Cloud &, Cloud **difference, Cloud **fixed)
+{
+  *difference = &difference_;
+  *fixed = &fixed_;
+}
+
+void Merger::resultClouds(const CompactCloud &cloud, CompactCloud **difference, CompactCloud **fixed)
+{
+  // the same origin, so the single precision rays are copied exactly
+  compact_difference_.origin = compact_fixed_.origin = cloud.origin;
+  *difference = &compact_difference_;
+  *fixed = &compact_fixed_;
+}
+
+template <class CloudT>
+void Merger::finaliseFilter(const CloudT &cloud, const std::vector<Bool> &transient_ray_marks)
+{
+  CloudT *difference, *fixed;
+  resultClouds(cloud, &difference, &fixed);
+  // Lastly, generate the new ray clouds from this sphere information
+  for (size_t i = 0; i < ellipsoids_.size(); i++)
+  {
+    const RGBA col = config_.colour_cloud ? transientColour(ellipsoids_[i], cloud.colours[i]) : cloud.colours[i];
+    CloudT &result = ellipsoids_[i].transient || transient_ray_marks[i] ? *difference : *fixed;
+    result.starts.emplace_back(cloud.starts[i]);
+    result.ends.emplace_back(cloud.ends[i]);
+    result.times.emplace_back(cloud.times[i]);
+    result.colours.emplace_back(col);
+  }
 }
 }  // namespace ray
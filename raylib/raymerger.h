@@ -13,11 +13,15 @@
 
 #include <atomic>
 #include <limits>
+#include <string>
 #include <vector>
 
 namespace ray
 {
 class Cloud;
+class CompactCloud;
+class TrajectoryCloud;
+class MergeState;
 class Progress;
 
 /// Mode selection for @c Merger
@@ -33,6 +37,16 @@ enum class RAYLIB_EXPORT MergeType : int
   All
 };
 
+/// How @c Merger finds the rays that intersect each ellipsoid
+enum class RAYLIB_EXPORT MergeEngine : int
+{
+  /// Looks up the rays in the ray grid voxels around each ellipsoid. Its cost grows with the number of rays per voxel
+  RayGrid,
+  /// Traces each ray through a bounding volume hierarchy of the ellipsoids (see raybvh.h), so is independent of
+  /// voxel_size
+  BVH
+};
+
 /// Parameter configuration structure for @c Merger
 struct RAYLIB_EXPORT MergerConfig
 {
@@ -40,6 +54,18 @@ struct RAYLIB_EXPORT MergerConfig
   double num_rays_filter_threshold = 20;
   MergeType merge_type = MergeType::Mininum;
   bool colour_cloud = true;
+  MergeEngine engine = MergeEngine::RayGrid;
+};
+
+/// Parameter configuration for the out-of-core transient filter, @c Merger::filterTiled
+struct RAYLIB_EXPORT TiledFilterConfig
+{
+  /// width of the square tiles, in metres. Zero uses the widest tiles that fit within @c memory_limit
+  double tile_size = 0;
+  /// the distance around each tile that its neighbourhoods can reach into. Zero uses two ray grid voxels
+  double halo = 0;
+  /// approximate memory for the tiles being filtered at the same time, in gigabytes
+  double memory_limit = 8;
 };
 
 /// A cloud merger which supports filtering 'transient' rays and merging from a ray clouds. A transient ray is one which
@@ -48,11 +74,8 @@ struct RAYLIB_EXPORT MergerConfig
 class RAYLIB_EXPORT Merger
 {
 public:
-#if RAYLIB_WITH_TBB
+  /// the ellipsoids are marked in parallel, so the ray marks are atomic. They are value initialised to false
   using Bool = std::atomic_bool;
-#else   // RAYLIB_WITH_TBB
-  using Bool = bool;
-#endif  // RAYLIB_WITH_TBB
 
   Merger(const MergerConfig &config);
   ~Merger();
@@ -63,12 +86,47 @@ public:
   inline const Cloud &differenceCloud() const { return difference_; }
   /// Query the preserved ray results. Empty before @c filter() is called.
   inline const Cloud &fixedCloud() const { return fixed_; }
+  /// Query the removed ray results of filtering a @c CompactCloud. These share the origin of the filtered cloud.
+  inline const CompactCloud &compactDifferenceCloud() const { return compact_difference_; }
+  /// Query the preserved ray results of filtering a @c CompactCloud.
+  inline const CompactCloud &compactFixedCloud() const { return compact_fixed_; }
 
   /// Perform the transient filtering on the given @p cloud .
   bool filter(const Cloud &cloud, Progress *progress = nullptr);
+  /// Perform the transient filtering on a single precision @p cloud . The results are single precision too, in
+  /// @c compactDifferenceCloud() and @c compactFixedCloud() .
+  bool filter(const CompactCloud &cloud, Progress *progress = nullptr);
+
+  /// Transient filtering of the ray cloud file @p file_name , which needn't fit in memory. The file is split into
+  /// columns (tiles) over its horizontal extent. Each tile reads just the rays that intersect it, grown by the halo,
+  /// and the ellipsoids of the points in the tile mark the transients among them. A file without an up to date index
+  /// (see rayindex.h) is indexed first, and a .rcz file is copied to an indexed .ply file next to @p fixed_file_name
+  /// while it is filtered, so the file is read once in full rather than once per tile. The tiles are filtered in
+  /// parallel, as many at a time as fit in the memory limit. The fixed and transient rays are then streamed to
+  /// @p fixed_file_name and @p transient_file_name . These are in the order of the input file, unless the
+  /// rays are coloured, in which case they are in tile order. @c differenceCloud() and @c fixedCloud() are unused.
+  bool filterTiled(const std::string &file_name, const std::string &fixed_file_name,
+                   const std::string &transient_file_name, const TiledFilterConfig &tiled_config,
+                   Progress *progress = nullptr);
 
   /// Multi-merge
   bool mergeMultiple(std::vector<Cloud> &clouds, Progress *progress = nullptr);
+  /// Multi-merge of clouds whose starts lie on their trajectories. The transient rays of each cloud are moved to the
+  /// cloud of the same index in @p differences , on the same trajectory, leaving just the fixed rays in @p clouds .
+  /// So no copy of the clouds is made, and @c differenceCloud() and @c fixedCloud() are unused.
+  bool mergeMultiple(std::vector<TrajectoryCloud> &clouds, std::vector<TrajectoryCloud> *differences,
+                     Progress *progress = nullptr);
+
+  /// Incremental merge of the new @p cloud into the combined ray cloud file @p map_file , writing the result to
+  /// @p combined_file , which can be @p map_file itself. This is the merge of the two clouds that mergeMultiple gives,
+  /// except that the ellipsoids of the map are those generated when each of its rays was merged in. These are kept
+  /// with a voxel index of the map's rays in a paged state file next to the combined cloud (see raymergestate.h), so
+  /// that only the new cloud, the map ellipsoids within its bounds and the map rays through its ellipsoids are
+  /// processed, and only the pages of the state that hold them are read. The map file itself is streamed.
+  /// Without an up to date state file, the state is first built from the whole map.
+  /// The transient rays are in @c differenceCloud() , and @c fixedCloud() is unused.
+  bool mergeIncremental(const std::string &map_file, const Cloud &cloud, const std::string &combined_file,
+                        Progress *progress = nullptr);
 
   /// Three way merger
   bool mergeThreeWay(const Cloud &base_cloud, Cloud &cloud1, Cloud &cloud2, Progress *progress = nullptr);
@@ -77,35 +135,92 @@ public:
   void clear();
 
   // seed the ray grid, to tell it which voxels it needs to add rays in
+  void seedRayGrid(FlatGrid<unsigned> *grid, const Cloud &cloud);
+  void seedRayGrid(FlatGrid<unsigned> *grid, const CompactCloud &cloud);
+  void seedRayGrid(FlatGrid<unsigned> *grid, const TrajectoryCloud &cloud);
   void seedRayGrid(Grid<unsigned> *grid, const Cloud &cloud);
+  void seedRayGrid(Grid<unsigned> *grid, const CompactCloud &cloud);
+  void seedRayGrid(Grid<unsigned> *grid, const TrajectoryCloud &cloud);
 
   /// Fill a @p grid with with rays from @p cloud . For each ray we add its index to each grid cell it traces through.
   ///
   /// The grid bounds must be set sufficiently large to hold the rays before calling. The grid resolution is also set
-  /// before calling
+  /// before calling. Only the cells added by @c seedRayGrid are filled. With RAYLIB_PARALLEL_GRID a FlatGrid is
+  /// filled lock free in two passes, see @c FlatGrid::fillRows. Either grid gives each cell's rays in increasing order.
   ///
   /// @param grid The grid to populate
   /// @param cloud The cloud which grid indices reference rays in.
   /// @param progress Optional progress tracker.
   /// @todo This needs a more global home
+  static void fillRayGrid(FlatGrid<unsigned> *grid, const Cloud &cloud, Progress *progress);
+  static void fillRayGrid(FlatGrid<unsigned> *grid, const CompactCloud &cloud, Progress *progress);
+  static void fillRayGrid(FlatGrid<unsigned> *grid, const TrajectoryCloud &cloud, Progress *progress);
   static void fillRayGrid(Grid<unsigned> *grid, const Cloud &cloud, Progress *progress);
+  static void fillRayGrid(Grid<unsigned> *grid, const CompactCloud &cloud, Progress *progress);
+  static void fillRayGrid(Grid<unsigned> *grid, const TrajectoryCloud &cloud, Progress *progress);
 
 private:
-  double voxelSizeForCloud(const Cloud &cloud) const;
+  /// The cloud type specific implementations, @c CloudT is @c Cloud, @c CompactCloud or @c TrajectoryCloud, and
+  /// @c GridT is @c FlatGrid<unsigned> or @c Grid<unsigned>
+  template <class CloudT>
+  bool filterCloud(const CloudT &cloud, Progress *progress);
+  template <class GridT, class CloudT>
+  void seedCloudRayGrid(GridT *grid, const CloudT &cloud);
+  template <class CloudT>
+  static void fillCloudRayGrid(FlatGrid<unsigned> *grid, const CloudT &cloud, Progress *progress);
+  template <class CloudT>
+  static void fillCloudRayGrid(Grid<unsigned> *grid, const CloudT &cloud, Progress *progress);
+  /// fill the grid by walking the rays in SIMD packets, then sorting the cells
+  template <class GridT, class CloudT>
+  static void walkCloudRayGrid(GridT *grid, const CloudT &cloud, Progress *progress);
+  template <class CloudT>
+  double voxelSizeForCloud(const CloudT &cloud) const;
+  /// Generate the ellipsoids of each of @p clouds in turn and mark the rays of the other clouds that pass through
+  /// them, giving the @p transient_ray_marks of each cloud. This is shared by the mergeMultiple overloads
+  template <class CloudT>
+  void markMergeTransients(const std::vector<CloudT> &clouds, std::vector<std::vector<Bool>> *transient_ray_marks,
+                           Progress *progress);
 
   /// For all ellipsoids_ intersect with rays in @c cloud (accelerated using @c ray_grid)
   /// depending on config.merge_type, either mark the ellipsoid object as removed, or
   /// mark the ray (through @c transient_ray_marks) as removed.
   /// @c ellipsoid_cloud_first is used only for the 'order' merge type, to choose which to mark
-  void markIntersectedEllipsoids(const Cloud &cloud, const Grid<unsigned> &ray_grid,
+  /// With the BVH engine @c ray_grid is unused, and can be empty.
+  template <class CloudT, class GridT>
+  void markIntersectedEllipsoids(const CloudT &cloud, const GridT &ray_grid,
                                  std::vector<Bool> *transient_ray_marks, double num_rays, bool self_transient,
                                  Progress *progress, bool ellipsoid_cloud_first = false);
-
-  /// Finalise the cloud filter and populate @c transientResults() and @c fixedResults() .
-  void finaliseFilter(const Cloud &cloud, const std::vector<Bool> &transient_ray_marks);
+  /// The BVH engine version of @c markIntersectedEllipsoids
+  template <class CloudT>
+  void markIntersectedEllipsoidsBVH(const CloudT &cloud, std::vector<Bool> *transient_ray_marks, double num_rays,
+                                    bool self_transient, Progress *progress, bool ellipsoid_cloud_first);
+  /// Mark the batch of ellipsoids @p ids[first .. first + count) with the BVH engine, which are elements
+  /// first .. first + count of @p ellipsoid_arrays . Returns the number of intersections of the batch
+  template <class CloudT>
+  size_t markEllipsoidBatchBVH(const CloudT &cloud, const std::vector<uint32_t> &ids,
+                               const EllipsoidArrays &ellipsoid_arrays, size_t first, size_t count,
+                               std::vector<Bool> *transient_ray_marks, double num_rays, bool self_transient,
+                               Progress *progress, bool ellipsoid_cloud_first);
+
+  /// Generate the ellipsoids of @p cloud and mark its transients, as filter() does, except that only the
+  /// ellipsoids of the @p owned rays are tested. This is the filter of a single tile in @c filterTiled()
+  void markTileTransients(const Cloud &cloud, const std::vector<bool> &owned, std::vector<Bool> *transient_ray_marks);
+
+  /// Generate the ellipsoids of the combined cloud @p map , with their opacities, and its voxel index, for
+  /// @c mergeIncremental()
+  void buildMergeState(const Cloud &map, MergeState *state, Progress *progress);
+
+  /// Finalise the cloud filter and populate the result clouds of its type, see @c resultClouds() .
+  template <class CloudT>
+  void finaliseFilter(const CloudT &cloud, const std::vector<Bool> &transient_ray_marks);
+  /// The clouds that the filter of @p cloud finalises into. These have the same type as @p cloud .
+  void resultClouds(const Cloud &cloud, Cloud **difference, Cloud **fixed);
+  void resultClouds(const CompactCloud &cloud, CompactCloud **difference, CompactCloud **fixed);
 
   Cloud difference_;
   Cloud fixed_;
+  CompactCloud compact_difference_;
+  CompactCloud compact_fixed_;
   MergerConfig config_;
   std::vector<Ellipsoid> ellipsoids_;
 };
@@ -0,0 +1,691 @@
+// Copyright (c) 2026
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#include "raymergestate.h"
+
+#include "raycloud.h"
+#include "rayindex.h"
+#include "rayparallel.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <tuple>
+
+namespace ray
+{
+namespace
+{
+const char kStateMagic[4] = { 'R', 'M', 'R', 'G' };
+const uint32_t kStateVersion = 2;
+/// voxel indices are stored in 21 bits per axis, so voxels further than this from the origin are not indexed
+const int kMaxVoxelIndex = 1 << 20;
+
+template <class T>
+void writeArray(std::ofstream &out, const std::vector<T> &array)
+{
+  const uint64_t size = array.size();
+  out.write((const char *)&size, sizeof(size));
+  out.write((const char *)array.data(), static_cast<std::streamsize>(size * sizeof(T)));
+}
+
+template <class T>
+bool readArray(std::ifstream &in, std::vector<T> &array)
+{
+  uint64_t size = 0;
+  in.read((char *)&size, sizeof(size));
+  if (!in)
+  {
+    return false;
+  }
+  array.resize(size);
+  in.read((char *)array.data(), static_cast<std::streamsize>(size * sizeof(T)));
+  return static_cast<bool>(in);
+}
+
+/// bounds that contain nothing, to grow
+Cuboid emptyBounds()
+{
+  const double max = std::numeric_limits<double>::max();
+  return Cuboid(Eigen::Vector3d(max, max, max), Eigen::Vector3d(-max, -max, -max));
+}
+
+/// grow @c bounds to contain the box around @c ellipsoid , if it has a size
+void growBounds(Cuboid *bounds, const Ellipsoid &ellipsoid)
+{
+  if (ellipsoid.extents == Eigen::Vector3f::Zero())
+  {
+    return;
+  }
+  const Eigen::Vector3d extents = ellipsoid.extents.cast<double>();
+  bounds->min_bound_ = minVector(bounds->min_bound_, Eigen::Vector3d(ellipsoid.pos - extents));
+  bounds->max_bound_ = maxVector(bounds->max_bound_, Eigen::Vector3d(ellipsoid.pos + extents));
+}
+}  // namespace
+
+inline uint64_t MergeState::voxelKey(const Eigen::Vector3i &index)
+{
+  const uint64_t mask = (1ull << 21) - 1;
+  return (static_cast<uint64_t>(index[0] + kMaxVoxelIndex) & mask) |
+         ((static_cast<uint64_t>(index[1] + kMaxVoxelIndex) & mask) << 21) |
+         ((static_cast<uint64_t>(index[2] + kMaxVoxelIndex) & mask) << 42);
+}
+
+inline uint64_t MergeState::pageKey(const Eigen::Vector3i &index)
+{
+  Eigen::Vector3i page_index;
+  for (int i = 0; i < 3; i++)
+  {
+    // rounded down, also for negative indices
+    page_index[i] = (index[i] >= 0 ? index[i] : index[i] - (kPageVoxels - 1)) / kPageVoxels;
+  }
+  return voxelKey(page_index);
+}
+
+inline uint64_t MergeState::endPageKey(const Eigen::Vector3d &end) const
+{
+  const Eigen::Vector3d voxel = ((end - origin_) / voxel_size_).array().floor();
+  const double max_index = static_cast<double>(kMaxVoxelIndex - 1);
+  const Eigen::Vector3d clamped = maxVector(Eigen::Vector3d(-max_index, -max_index, -max_index),
+                                            minVector(Eigen::Vector3d(max_index, max_index, max_index), voxel));
+  return pageKey(clamped.cast<int>());
+}
+
+void MergeState::init(const Eigen::Vector3d &origin, double voxel_size)
+{
+  clear();
+  origin_ = origin;
+  voxel_size_ = voxel_size;
+}
+
+void MergeState::clear()
+{
+  origin_.setZero();
+  voxel_size_ = 0.0;
+  num_rays_ = 0;
+  next_id_ = 0;
+  page_table_.clear();
+  file_name_.clear();
+  pages_.clear();
+  failed_ = false;
+}
+
+MergeState::Page &MergeState::page(uint64_t key)
+{
+  const auto loaded = pages_.find(key);
+  if (loaded != pages_.end())
+  {
+    return loaded->second;
+  }
+  Page &page = pages_[key];
+  page.voxel_offsets.assign(1, 0);
+  const auto entry = page_table_.find(key);
+  if (entry == page_table_.end())
+  {
+    PageEntry &new_entry = page_table_[key];
+    new_entry.offset = 0;
+    new_entry.size = 0;
+    new_entry.ellipsoid_bounds = emptyBounds();
+    return page;
+  }
+  if (entry->second.size == 0)
+  {
+    return page;
+  }
+
+  std::ifstream in(file_name_, std::ios::binary | std::ios::in);
+  in.seekg(static_cast<std::streamoff>(entry->second.offset));
+  std::vector<float> shapes;
+  std::vector<Eigen::Vector3d> positions;
+  if (!in || !readArray(in, page.ids) || !readArray(in, page.starts) || !readArray(in, page.ends) ||
+      !readArray(in, page.times) || !readArray(in, positions) || !readArray(in, shapes) ||
+      !readArray(in, page.crossing_ids) || !readArray(in, page.crossing_starts) ||
+      !readArray(in, page.crossing_ends) || !readArray(in, page.crossing_times) || !readArray(in, page.voxel_keys) ||
+      !readArray(in, page.voxel_offsets) || !readArray(in, page.voxel_rays) || page.starts.size() != page.ids.size() ||
+      page.ends.size() != page.ids.size() || page.times.size() != page.ids.size() ||
+      positions.size() != page.ids.size() || shapes.size() != 13 * page.ids.size() ||
+      page.crossing_starts.size() != page.crossing_ids.size() ||
+      page.crossing_ends.size() != page.crossing_ids.size() ||
+      page.crossing_times.size() != page.crossing_ids.size() ||
+      page.voxel_offsets.size() != page.voxel_keys.size() + 1 || page.voxel_offsets.back() != page.voxel_rays.size())
+  {
+    if (!failed_)
+    {
+      std::cerr << "Error: cannot read a page of the merge state " << file_name_ << std::endl;
+    }
+    failed_ = true;
+    page = Page();
+    page.voxel_offsets.assign(1, 0);
+    return page;
+  }
+  page.ellipsoids.resize(page.ids.size());
+  for (size_t i = 0; i < page.ellipsoids.size(); i++)
+  {
+    Ellipsoid &ellipsoid = page.ellipsoids[i];
+    ellipsoid.clear();
+    const float *shape = &shapes[13 * i];
+    ellipsoid.pos = positions[i];
+    std::memcpy(ellipsoid.eigen_mat.data(), shape, 9 * sizeof(float));
+    std::memcpy(ellipsoid.extents.data(), shape + 9, 3 * sizeof(float));
+    ellipsoid.opacity = shape[12];
+    ellipsoid.time = page.times[i];
+  }
+  return page;
+}
+
+void MergeState::rayVoxels(const Eigen::Vector3d &start, const Eigen::Vector3d &end,
+                           std::vector<std::pair<uint64_t, uint64_t>> *page_voxels) const
+{
+  auto visit = [&](const Eigen::Vector3i &p, const Eigen::Vector3i &, double, double, double) {
+    if (std::abs(p[0]) < kMaxVoxelIndex && std::abs(p[1]) < kMaxVoxelIndex && std::abs(p[2]) < kMaxVoxelIndex)
+    {
+      page_voxels->push_back(std::make_pair(pageKey(p), voxelKey(p)));
+    }
+    return false;
+  };
+  walkGrid((start - origin_) / voxel_size_, (end - origin_) / voxel_size_, visit);
+}
+
+void MergeState::add(const Cloud &cloud, const std::vector<Ellipsoid> &new_ellipsoids, const std::vector<bool> *keep)
+{
+  std::vector<size_t> added;  // the indices in cloud of the rays to add
+  for (size_t i = 0; i < cloud.rayCount(); i++)
+  {
+    if (!keep || (*keep)[i])
+    {
+      added.push_back(i);
+    }
+  }
+  const uint64_t first_id = next_id_;
+  for (const auto &i : added)
+  {
+    Page &owner = page(endPageKey(cloud.ends[i]));
+    owner.ids.push_back(next_id_++);
+    owner.starts.push_back(cloud.starts[i]);
+    owner.ends.push_back(cloud.ends[i]);
+    owner.times.push_back(cloud.times[i]);
+    owner.ellipsoids.push_back(new_ellipsoids[i]);
+    owner.ellipsoids.back().transient = false;
+    growBounds(&page_table_[endPageKey(cloud.ends[i])].ellipsoid_bounds, owner.ellipsoids.back());
+  }
+  num_rays_ += added.size();
+
+  // the (page key, voxel key, added ray) of each voxel that each new ray passes through
+  using Entry = std::tuple<uint64_t, uint64_t, uint32_t>;
+  std::vector<std::vector<Entry>> worker_entries(static_cast<size_t>(parallelWorkerCount()));
+  parallelRanges(0, added.size(), [&](size_t begin, size_t end, int worker) {
+    std::vector<std::pair<uint64_t, uint64_t>> page_voxels;
+    for (size_t i = begin; i < end; i++)
+    {
+      page_voxels.clear();
+      rayVoxels(cloud.starts[added[i]], cloud.ends[added[i]], &page_voxels);
+      for (const auto &page_voxel : page_voxels)
+      {
+        worker_entries[worker].push_back(Entry(page_voxel.first, page_voxel.second, static_cast<uint32_t>(i)));
+      }
+    }
+  });
+  std::vector<Entry> entries;
+  for (auto &worker : worker_entries)
+  {
+    entries.insert(entries.end(), worker.begin(), worker.end());
+    std::vector<Entry>().swap(worker);
+  }
+  std::sort(entries.begin(), entries.end());
+
+  for (size_t first = 0; first < entries.size();)
+  {
+    const uint64_t key = std::get<0>(entries[first]);
+    size_t last = first;
+    while (last < entries.size() && std::get<0>(entries[last]) == key)
+    {
+      last++;
+    }
+    Page &crossed = page(key);
+
+    // the new rays crossing the page. These have the highest ids, so go after the existing crossing rays
+    std::vector<uint32_t> crossing;
+    for (size_t j = first; j < last; j++)
+    {
+      crossing.push_back(std::get<2>(entries[j]));
+    }
+    std::sort(crossing.begin(), crossing.end());
+    crossing.erase(std::unique(crossing.begin(), crossing.end()), crossing.end());
+    const uint32_t first_local = static_cast<uint32_t>(crossed.crossing_ids.size());
+    for (const auto &i : crossing)
+    {
+      crossed.crossing_ids.push_back(first_id + i);
+      crossed.crossing_starts.push_back(cloud.starts[added[i]]);
+      crossed.crossing_ends.push_back(cloud.ends[added[i]]);
+      crossed.crossing_times.push_back(cloud.times[added[i]]);
+    }
+    const auto local = [&](uint32_t i) {
+      return first_local +
+             static_cast<uint32_t>(std::lower_bound(crossing.begin(), crossing.end(), i) - crossing.begin());
+    };
+
+    // merge the new entries into the index of the page, after the existing rays of each voxel
+    std::vector<uint64_t> keys, offsets(1, 0);
+    std::vector<uint32_t> rays;
+    keys.reserve(crossed.voxel_keys.size() + last - first);
+    rays.reserve(crossed.voxel_rays.size() + last - first);
+    size_t voxel = 0, entry = first;
+    while (voxel < crossed.voxel_keys.size() || entry < last)
+    {
+      uint64_t voxel_key;
+      if (entry == last ||
+          (voxel < crossed.voxel_keys.size() && crossed.voxel_keys[voxel] < std::get<1>(entries[entry])))
+      {
+        voxel_key = crossed.voxel_keys[voxel];
+      }
+      else
+      {
+        voxel_key = std::get<1>(entries[entry]);
+      }
+      if (voxel < crossed.voxel_keys.size() && crossed.voxel_keys[voxel] == voxel_key)
+      {
+        rays.insert(rays.end(),
+                    crossed.voxel_rays.begin() + static_cast<std::ptrdiff_t>(crossed.voxel_offsets[voxel]),
+                    crossed.voxel_rays.begin() + static_cast<std::ptrdiff_t>(crossed.voxel_offsets[voxel + 1]));
+        voxel++;
+      }
+      for (; entry < last && std::get<1>(entries[entry]) == voxel_key; entry++)
+      {
+        rays.push_back(local(std::get<2>(entries[entry])));
+      }
+      keys.push_back(voxel_key);
+      offsets.push_back(rays.size());
+    }
+    crossed.voxel_keys.swap(keys);
+    crossed.voxel_offsets.swap(offsets);
+    crossed.voxel_rays.swap(rays);
+    first = last;
+  }
+}
+
+void MergeState::remove(const std::vector<uint64_t> &ids, const Cloud &rays)
+{
+  // the ids to remove from each page that holds them, and from each page that they cross
+  std::map<uint64_t, std::vector<uint64_t>> owned_ids, crossing_ids;
+  std::vector<std::pair<uint64_t, uint64_t>> page_voxels;
+  for (size_t i = 0; i < ids.size(); i++)
+  {
+    owned_ids[endPageKey(rays.ends[i])].push_back(ids[i]);
+    page_voxels.clear();
+    rayVoxels(rays.starts[i], rays.ends[i], &page_voxels);
+    for (size_t j = 0; j < page_voxels.size(); j++)
+    {
+      std::vector<uint64_t> &page_ids = crossing_ids[page_voxels[j].first];
+      if (page_ids.empty() || page_ids.back() != ids[i])
+      {
+        page_ids.push_back(ids[i]);
+      }
+    }
+  }
+
+  for (auto &owned : owned_ids)
+  {
+    std::vector<uint64_t> &removed = owned.second;
+    std::sort(removed.begin(), removed.end());
+    Page &holder = page(owned.first);
+    size_t num_kept = 0;
+    for (size_t i = 0; i < holder.ids.size(); i++)
+    {
+      if (std::binary_search(removed.begin(), removed.end(), holder.ids[i]))
+      {
+        continue;
+      }
+      holder.ids[num_kept] = holder.ids[i];
+      holder.starts[num_kept] = holder.starts[i];
+      holder.ends[num_kept] = holder.ends[i];
+      holder.times[num_kept] = holder.times[i];
+      holder.ellipsoids[num_kept] = holder.ellipsoids[i];
+      num_kept++;
+    }
+    num_rays_ -= holder.ids.size() - num_kept;
+    holder.ids.resize(num_kept);
+    holder.starts.resize(num_kept);
+    holder.ends.resize(num_kept);
+    holder.times.resize(num_kept);
+    holder.ellipsoids.resize(num_kept);
+  }
+
+  for (auto &crossing : crossing_ids)
+  {
+    std::vector<uint64_t> &removed = crossing.second;
+    std::sort(removed.begin(), removed.end());
+    Page &crossed = page(crossing.first);
+    // the new local index of each crossing ray
+    const uint32_t kRemoved = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> new_locals(crossed.crossing_ids.size());
+    uint32_t num_kept = 0;
+    for (size_t i = 0; i < crossed.crossing_ids.size(); i++)
+    {
+      if (std::binary_search(removed.begin(), removed.end(), crossed.crossing_ids[i]))
+      {
+        new_locals[i] = kRemoved;
+        continue;
+      }
+      new_locals[i] = num_kept;
+      crossed.crossing_ids[num_kept] = crossed.crossing_ids[i];
+      crossed.crossing_starts[num_kept] = crossed.crossing_starts[i];
+      crossed.crossing_ends[num_kept] = crossed.crossing_ends[i];
+      crossed.crossing_times[num_kept] = crossed.crossing_times[i];
+      num_kept++;
+    }
+    crossed.crossing_ids.resize(num_kept);
+    crossed.crossing_starts.resize(num_kept);
+    crossed.crossing_ends.resize(num_kept);
+    crossed.crossing_times.resize(num_kept);
+
+    // renumber the index in place, which keeps the rays of each voxel in increasing order
+    size_t num_voxels = 0, num_rays = 0;
+    for (size_t voxel = 0; voxel < crossed.voxel_keys.size(); voxel++)
+    {
+      const size_t first = num_rays;
+      for (uint64_t j = crossed.voxel_offsets[voxel]; j < crossed.voxel_offsets[voxel + 1]; j++)
+      {
+        if (new_locals[crossed.voxel_rays[j]] != kRemoved)
+        {
+          crossed.voxel_rays[num_rays++] = new_locals[crossed.voxel_rays[j]];
+        }
+      }
+      if (num_rays > first)
+      {
+        crossed.voxel_keys[num_voxels++] = crossed.voxel_keys[voxel];
+        crossed.voxel_offsets[num_voxels] = num_rays;
+      }
+    }
+    crossed.voxel_keys.resize(num_voxels);
+    crossed.voxel_offsets.resize(num_voxels + 1);
+    crossed.voxel_rays.resize(num_rays);
+  }
+}
+
+void MergeState::ellipsoidsInBox(const Eigen::Vector3d &box_min, const Eigen::Vector3d &box_max,
+                                 std::vector<uint64_t> *ids, Cloud *rays, std::vector<Ellipsoid> *ellipsoids)
+{
+  const Cuboid box(box_min, box_max);
+  std::vector<uint64_t> keys;
+  for (const auto &entry : page_table_)
+  {
+    if (entry.second.ellipsoid_bounds.overlaps(box))
+    {
+      keys.push_back(entry.first);
+    }
+  }
+  // the (id, page, index in page) of each ellipsoid in the box
+  std::vector<std::tuple<uint64_t, const Page *, size_t>> found;
+  for (const auto &key : keys)
+  {
+    const Page &holder = page(key);
+    for (size_t i = 0; i < holder.ids.size(); i++)
+    {
+      const Ellipsoid &ellipsoid = holder.ellipsoids[i];
+      const Eigen::Vector3d extents = ellipsoid.extents.cast<double>();
+      if (ellipsoid.extents != Eigen::Vector3f::Zero() &&
+          box.overlaps(Cuboid(ellipsoid.pos - extents, ellipsoid.pos + extents)))
+      {
+        found.push_back(std::make_tuple(holder.ids[i], &holder, i));
+      }
+    }
+  }
+  std::sort(found.begin(), found.end());
+  ids->clear();
+  rays->clear();
+  ellipsoids->clear();
+  for (const auto &ellipsoid : found)
+  {
+    const Page &holder = *std::get<1>(ellipsoid);
+    const size_t i = std::get<2>(ellipsoid);
+    ids->push_back(std::get<0>(ellipsoid));
+    rays->addRay(holder.starts[i], holder.ends[i], holder.times[i], RGBA::white());
+    ellipsoids->push_back(holder.ellipsoids[i]);
+  }
+}
+
+void MergeState::raysInBoxes(const std::vector<Eigen::Vector3d> &box_mins, const std::vector<Eigen::Vector3d> &box_maxs,
+                             std::vector<uint64_t> *ids, Cloud *rays)
+{
+  // the (id, page, index in page) of each crossing ray in the boxes
+  std::vector<std::tuple<uint64_t, const Page *, uint32_t>> found;
+  const Eigen::Vector3i max_index(kMaxVoxelIndex - 1, kMaxVoxelIndex - 1, kMaxVoxelIndex - 1);
+  for (size_t i = 0; i < box_mins.size(); i++)
+  {
+    const Eigen::Vector3d min_voxel = (box_mins[i] - origin_) / voxel_size_;
+    const Eigen::Vector3d max_voxel = (box_maxs[i] - origin_) / voxel_size_;
+    const Eigen::Vector3i bmin =
+      maxVector(Eigen::Vector3i(-max_index), Eigen::Vector3i(min_voxel.array().floor().cast<int>()));
+    const Eigen::Vector3i bmax = minVector(max_index, Eigen::Vector3i(max_voxel.array().floor().cast<int>()));
+    for (int x = bmin[0]; x <= bmax[0]; x++)
+    {
+      for (int y = bmin[1]; y <= bmax[1]; y++)
+      {
+        for (int z = bmin[2]; z <= bmax[2]; z++)
+        {
+          const Eigen::Vector3i index(x, y, z);
+          const uint64_t page_key = pageKey(index);
+          if (page_table_.find(page_key) == page_table_.end())
+          {
+            continue;
+          }
+          const Page &crossed = page(page_key);
+          const uint64_t key = voxelKey(index);
+          const auto it = std::lower_bound(crossed.voxel_keys.begin(), crossed.voxel_keys.end(), key);
+          if (it == crossed.voxel_keys.end() || *it != key)
+          {
+            continue;
+          }
+          const size_t voxel = static_cast<size_t>(it - crossed.voxel_keys.begin());
+          for (uint64_t j = crossed.voxel_offsets[voxel]; j < crossed.voxel_offsets[voxel + 1]; j++)
+          {
+            const uint32_t local = crossed.voxel_rays[j];
+            found.push_back(std::make_tuple(crossed.crossing_ids[local], &crossed, local));
+          }
+        }
+      }
+    }
+  }
+  // a ray can be found in several pages, which hold the same ray
+  std::sort(found.begin(), found.end(), [](const std::tuple<uint64_t, const Page *, uint32_t> &a,
+                                           const std::tuple<uint64_t, const Page *, uint32_t> &b) {
+    return std::get<0>(a) < std::get<0>(b);
+  });
+  ids->clear();
+  rays->clear();
+  for (const auto &ray : found)
+  {
+    if (!ids->empty() && ids->back() == std::get<0>(ray))
+    {
+      continue;
+    }
+    const Page &crossed = *std::get<1>(ray);
+    const uint32_t local = std::get<2>(ray);
+    ids->push_back(std::get<0>(ray));
+    rays->addRay(crossed.crossing_starts[local], crossed.crossing_ends[local], crossed.crossing_times[local],
+                 RGBA::white());
+  }
+}
+
+bool MergeState::save(const std::string &cloud_file)
+{
+  FileStamp stamp;
+  if (!stamp.get(cloud_file) || failed_)
+  {
+    return false;
+  }
+  // written beside the state file, as the pages not loaded may be copied from it
+  const std::string state_file = fileName(cloud_file);
+  const std::string written_file = state_file + ".tmp";
+  std::map<uint64_t, PageEntry> saved_table;
+  {
+    std::ofstream out(written_file, std::ios::binary | std::ios::out);
+    if (out.fail())
+    {
+      return false;
+    }
+    std::ifstream in;
+    if (!file_name_.empty())
+    {
+      in.open(file_name_, std::ios::binary | std::ios::in);
+    }
+    uint64_t table_offset = 0;
+    out.write(kStateMagic, 4);
+    out.write((const char *)&kStateVersion, sizeof(kStateVersion));
+    out.write((const char *)&stamp.size, sizeof(stamp.size));
+    out.write((const char *)&stamp.modified, sizeof(stamp.modified));
+    out.write((const char *)origin_.data(), 3 * sizeof(double));
+    out.write((const char *)&voxel_size_, sizeof(voxel_size_));
+    out.write((const char *)&num_rays_, sizeof(num_rays_));
+    out.write((const char *)&next_id_, sizeof(next_id_));
+    const std::streamoff table_offset_position = out.tellp();
+    out.write((const char *)&table_offset, sizeof(table_offset));
+
+    std::vector<char> buffer;
+    for (const auto &entry : page_table_)
+    {
+      PageEntry saved = entry.second;
+      saved.offset = static_cast<uint64_t>(out.tellp());
+      const auto loaded = pages_.find(entry.first);
+      if (loaded == pages_.end())
+      {
+        // an unused page, copied as it is
+        buffer.resize(static_cast<size_t>(entry.second.size));
+        in.seekg(static_cast<std::streamoff>(entry.second.offset));
+        in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        if (!in)
+        {
+          std::cerr << "Error: cannot read a page of the merge state " << file_name_ << std::endl;
+          return false;
+        }
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+      }
+      else
+      {
+        const Page &page = loaded->second;
+        if (page.ids.empty() && page.crossing_ids.empty())
+        {
+          continue;
+        }
+        // only the ellipsoid's shape and opacity, its time is that of its ray
+        std::vector<float> shapes;
+        std::vector<Eigen::Vector3d> positions;
+        shapes.reserve(13 * page.ellipsoids.size());
+        positions.reserve(page.ellipsoids.size());
+        saved.ellipsoid_bounds = emptyBounds();
+        for (const auto &ellipsoid : page.ellipsoids)
+        {
+          positions.push_back(ellipsoid.pos);
+          shapes.insert(shapes.end(), ellipsoid.eigen_mat.data(), ellipsoid.eigen_mat.data() + 9);
+          shapes.insert(shapes.end(), ellipsoid.extents.data(), ellipsoid.extents.data() + 3);
+          shapes.push_back(ellipsoid.opacity);
+          growBounds(&saved.ellipsoid_bounds, ellipsoid);
+        }
+        writeArray(out, page.ids);
+        writeArray(out, page.starts);
+        writeArray(out, page.ends);
+        writeArray(out, page.times);
+        writeArray(out, positions);
+        writeArray(out, shapes);
+        writeArray(out, page.crossing_ids);
+        writeArray(out, page.crossing_starts);
+        writeArray(out, page.crossing_ends);
+        writeArray(out, page.crossing_times);
+        writeArray(out, page.voxel_keys);
+        writeArray(out, page.voxel_offsets);
+        writeArray(out, page.voxel_rays);
+      }
+      saved.size = static_cast<uint64_t>(out.tellp()) - saved.offset;
+      saved_table[entry.first] = saved;
+    }
+
+    table_offset = static_cast<uint64_t>(out.tellp());
+    const uint64_t num_pages = saved_table.size();
+    out.write((const char *)&num_pages, sizeof(num_pages));
+    for (const auto &entry : saved_table)
+    {
+      out.write((const char *)&entry.first, sizeof(entry.first));
+      out.write((const char *)&entry.second.offset, sizeof(entry.second.offset));
+      out.write((const char *)&entry.second.size, sizeof(entry.second.size));
+      out.write((const char *)entry.second.ellipsoid_bounds.min_bound_.data(), 3 * sizeof(double));
+      out.write((const char *)entry.second.ellipsoid_bounds.max_bound_.data(), 3 * sizeof(double));
+    }
+    out.seekp(table_offset_position);
+    out.write((const char *)&table_offset, sizeof(table_offset));
+    if (!out.good())
+    {
+      return false;
+    }
+  }
+  std::remove(state_file.c_str());
+  if (std::rename(written_file.c_str(), state_file.c_str()) != 0)
+  {
+    return false;
+  }
+  // the loaded pages are kept, and the rest are now in the new file
+  page_table_.swap(saved_table);
+  for (auto it = pages_.begin(); it != pages_.end();)
+  {
+    it = page_table_.count(it->first) ? std::next(it) : pages_.erase(it);
+  }
+  file_name_ = state_file;
+  return true;
+}
+
+bool MergeState::load(const std::string &cloud_file)
+{
+  clear();
+  FileStamp stamp;
+  if (!stamp.get(cloud_file))
+  {
+    return false;
+  }
+  std::ifstream in(fileName(cloud_file), std::ios::binary | std::ios::in);
+  if (in.fail())
+  {
+    return false;
+  }
+  char magic[4];
+  uint32_t version = 0;
+  FileStamp saved_stamp;
+  in.read(magic, 4);
+  in.read((char *)&version, sizeof(version));
+  in.read((char *)&saved_stamp.size, sizeof(saved_stamp.size));
+  in.read((char *)&saved_stamp.modified, sizeof(saved_stamp.modified));
+  if (!in || memcmp(magic, kStateMagic, 4) != 0 || version != kStateVersion || !(saved_stamp == stamp))
+  {
+    return false;  // not a merge state, or a stale one
+  }
+  uint64_t table_offset = 0, num_pages = 0;
+  in.read((char *)origin_.data(), 3 * sizeof(double));
+  in.read((char *)&voxel_size_, sizeof(voxel_size_));
+  in.read((char *)&num_rays_, sizeof(num_rays_));
+  in.read((char *)&next_id_, sizeof(next_id_));
+  in.read((char *)&table_offset, sizeof(table_offset));
+  in.seekg(static_cast<std::streamoff>(table_offset));
+  in.read((char *)&num_pages, sizeof(num_pages));
+  for (uint64_t i = 0; i < num_pages && in; i++)
+  {
+    uint64_t key;
+    PageEntry entry;
+    in.read((char *)&key, sizeof(key));
+    in.read((char *)&entry.offset, sizeof(entry.offset));
+    in.read((char *)&entry.size, sizeof(entry.size));
+    in.read((char *)entry.ellipsoid_bounds.min_bound_.data(), 3 * sizeof(double));
+    in.read((char *)entry.ellipsoid_bounds.max_bound_.data(), 3 * sizeof(double));
+    page_table_[key] = entry;
+  }
+  if (!in)
+  {
+    clear();
+    return false;
+  }
+  file_name_ = fileName(cloud_file);
+  return true;
+}
+}  // namespace ray
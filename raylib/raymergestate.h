@@ -0,0 +1,130 @@
+// Copyright (c) 2026
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#ifndef RAYLIB_RAYMERGESTATE_H
+#define RAYLIB_RAYMERGESTATE_H
+
+#include "raylib/raylibconfig.h"
+
+#include "raycuboid.h"
+#include "rayellipsoid.h"
+#include "rayutils.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace ray
+{
+class Cloud;
+
+/// The state of a combined ray cloud that is kept between incremental merges (see Merger::mergeIncremental).
+/// For each ray of the combined cloud it holds the ray (without its colour) and the ellipsoid that was generated for
+/// it, with its opacity, when the ray was merged in. It also holds a sparse voxel index of the rays passing through
+/// each voxel, so that the rays around a new scan can be found without tracing the whole cloud.
+/// Each ray has an id, in the order of the combined cloud, which it keeps while it is in the state.
+///
+/// The state is paged: it is split into cubes of @c kPageVoxels voxels, each holding the rays that end in it, with
+/// their ellipsoids, and the index of its voxels. It is stored in a sidecar file next to the combined cloud, and
+/// ignored once that cloud has changed. Loading the state just reads its table of pages, and each page is read from
+/// the file when it is first used, so a merge reads only the pages around the new scan.
+class RAYLIB_EXPORT MergeState
+{
+public:
+  /// the width of a page, in voxels
+  static const int kPageVoxels = 64;
+
+  MergeState() { clear(); }
+
+  /// the sidecar state file name for the ray cloud @c cloud_file
+  static std::string fileName(const std::string &cloud_file) { return cloud_file + ".merge"; }
+
+  /// an empty state, with an index of voxels of width @c voxel_size aligned to @c origin
+  void init(const Eigen::Vector3d &origin, double voxel_size);
+  void clear();
+  /// write the state for the finished ray cloud @c cloud_file . The pages that weren't used are copied from the loaded
+  /// state file, which can be the same file
+  bool save(const std::string &cloud_file);
+  /// load the table of pages of the state of @c cloud_file. Returns false if there is no state, or if the file has
+  /// changed since it was saved
+  bool load(const std::string &cloud_file);
+
+  /// append the rays of @c cloud for which @c keep is true (or all of them when it is null), with their
+  /// @c ellipsoids, and add them to the voxel index. They are given the next ids
+  void add(const Cloud &cloud, const std::vector<Ellipsoid> &ellipsoids, const std::vector<bool> *keep = nullptr);
+  /// remove the rays with @c ids , which are the rays of @c rays , as returned by @c ellipsoidsInBox() or
+  /// @c raysInBoxes(). Their rays give the pages that they are in
+  void remove(const std::vector<uint64_t> &ids, const Cloud &rays);
+  /// the @c ids , in increasing order, of the rays with ellipsoids of non-zero size that overlap the box from
+  /// @c box_min to @c box_max , with their @c rays and @c ellipsoids
+  void ellipsoidsInBox(const Eigen::Vector3d &box_min, const Eigen::Vector3d &box_max, std::vector<uint64_t> *ids,
+                       Cloud *rays, std::vector<Ellipsoid> *ellipsoids);
+  /// the @c ids , in increasing order, of the rays that pass through the voxels overlapping any of the boxes from
+  /// @c box_mins[i] to @c box_maxs[i] , with their @c rays
+  void raysInBoxes(const std::vector<Eigen::Vector3d> &box_mins, const std::vector<Eigen::Vector3d> &box_maxs,
+                   std::vector<uint64_t> *ids, Cloud *rays);
+
+  /// false if a page could not be read from the state file
+  inline bool good() const { return !failed_; }
+  inline size_t rayCount() const { return num_rays_; }
+  inline double voxelSize() const { return voxel_size_; }
+  /// the number of pages, and the number of them that have been read or created
+  inline size_t pageCount() const { return page_table_.size(); }
+  inline size_t loadedPageCount() const { return pages_.size(); }
+
+private:
+  /// the rays that end in a page, and the rays through its voxels
+  struct Page
+  {
+    std::vector<uint64_t> ids;
+    std::vector<Eigen::Vector3d> starts;
+    std::vector<Eigen::Vector3d> ends;
+    std::vector<double> times;
+    std::vector<Ellipsoid> ellipsoids;
+    /// the rays passing through the voxels of the page, in increasing id order
+    std::vector<uint64_t> crossing_ids;
+    std::vector<Eigen::Vector3d> crossing_starts;
+    std::vector<Eigen::Vector3d> crossing_ends;
+    std::vector<double> crossing_times;
+    /// the voxel index as compressed sparse rows. The crossing rays passing through the voxel with key
+    /// @c voxel_keys[i] are @c voxel_rays[voxel_offsets[i]] to @c voxel_rays[voxel_offsets[i + 1]] , in increasing
+    /// order
+    std::vector<uint64_t> voxel_keys;
+    std::vector<uint64_t> voxel_offsets;
+    std::vector<uint32_t> voxel_rays;
+  };
+  /// where a page is in the state file, and the bounds of its ellipsoids
+  struct PageEntry
+  {
+    uint64_t offset;
+    uint64_t size;  ///< zero for a page that is not in the file
+    Cuboid ellipsoid_bounds;
+  };
+
+  /// the key of the voxel with @c index , which is in voxels from the origin
+  static inline uint64_t voxelKey(const Eigen::Vector3i &index);
+  /// the key of the page containing the voxel with @c index
+  static inline uint64_t pageKey(const Eigen::Vector3i &index);
+  /// the key of the page that holds the ray ending at @c end
+  inline uint64_t endPageKey(const Eigen::Vector3d &end) const;
+  /// the page with @c key , read from the state file if it is not yet loaded, or added if there is no such page
+  Page &page(uint64_t key);
+  /// the keys of the voxels that the ray from @c start to @c end passes through, with the keys of their pages
+  void rayVoxels(const Eigen::Vector3d &start, const Eigen::Vector3d &end,
+                 std::vector<std::pair<uint64_t, uint64_t>> *page_voxels) const;
+
+  Eigen::Vector3d origin_;
+  double voxel_size_;
+  uint64_t num_rays_;
+  uint64_t next_id_;
+  /// the pages in the state, and the file that the pages not yet loaded are read from
+  std::map<uint64_t, PageEntry> page_table_;
+  std::string file_name_;
+  std::map<uint64_t, Page> pages_;
+  bool failed_;
+};
+}  // namespace ray
+
+#endif  // RAYLIB_RAYMERGESTATE_H
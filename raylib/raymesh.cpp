@@ -6,6 +6,7 @@
 #include "raymesh.h"
 
 #include "raylaz.h"
+#include "rayparallel.h"
 #include "rayply.h"
 #include "raycloudwriter.h"
 #include "rayunused.h"
@@ -319,9 +320,9 @@ bool Mesh::splitCloud(const std::string &cloud_name, double offset, const std::s
                     std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
                     std::vector<double> &times, std::vector<RGBA> &colours) 
   {
-    Cloud in_chunk, out_chunk;
-    #pragma omp parallel for
-    for (int i = 0; i < (int)ends.size(); i++)
+    // the rays are classified in parallel, then split in their original order
+    std::vector<char> inside(ends.size());
+    parallelFor(0, ends.size(), [&](size_t i)
     {
       int intersections = 0;
       Eigen::Vector3d start = (ends[i] - box_min) / voxel_width;
@@ -368,11 +369,13 @@ bool Mesh::splitCloud(const std::string &cloud_name, double offset, const std::s
           is_inside = inside_val;
         }
       }
-      Cloud &out = is_inside ? in_chunk : out_chunk;
-      #pragma omp critical
-      {
-        out.addRay(starts[i], ends[i], times[i], colours[i]);
-      }      
+      inside[i] = is_inside;
+    });
+    Cloud in_chunk, out_chunk;
+    for (size_t i = 0; i < ends.size(); i++)
+    {
+      Cloud &out = inside[i] ? in_chunk : out_chunk;
+      out.addRay(starts[i], ends[i], times[i], colours[i]);
     }
     in_cloud.writeChunk(in_chunk);
     out_cloud.writeChunk(out_chunk);
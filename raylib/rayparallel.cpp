@@ -0,0 +1,136 @@
+// Copyright (c) 2026
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#include "rayparallel.h"
+
+#include <thread>
+
+namespace ray
+{
+namespace
+{
+#if RAYLIB_WITH_TBB
+std::atomic<ParallelBackend> backend(ParallelBackend::TBB);
+#elif defined(_OPENMP)
+std::atomic<ParallelBackend> backend(ParallelBackend::OpenMP);
+#else
+std::atomic<ParallelBackend> backend(ParallelBackend::Threads);
+#endif
+
+/// set on the workers of the Threads backend, so that nested loops run on the calling worker
+thread_local bool in_parallel_ranges = false;
+
+/// a worker's remaining share of the range
+struct Share
+{
+  SpinMutex mutex;
+  size_t begin = 0;
+  size_t end = 0;
+};
+}  // namespace
+
+ParallelBackend parallelBackend()
+{
+  return backend.load(std::memory_order_relaxed);
+}
+
+bool setParallelBackend(ParallelBackend new_backend)
+{
+#if !RAYLIB_WITH_TBB
+  if (new_backend == ParallelBackend::TBB)
+  {
+    return false;
+  }
+#endif  // !RAYLIB_WITH_TBB
+#ifndef _OPENMP
+  if (new_backend == ParallelBackend::OpenMP)
+  {
+    return false;
+  }
+#endif  // _OPENMP
+  backend.store(new_backend, std::memory_order_relaxed);
+  return true;
+}
+
+void parallelRangesThreads(size_t begin, size_t end, const std::function<void(size_t, size_t, int)> &function)
+{
+  const size_t count = end - begin;
+  const int workers = static_cast<int>(std::min(static_cast<size_t>(Threads::threadCount()), count));
+  if (workers <= 1 || in_parallel_ranges)
+  {
+    function(begin, end, 0);
+    return;
+  }
+  // small chunks balance the load, and are large enough that the locking is negligible
+  const size_t grain = std::max<size_t>(1, count / (32 * static_cast<size_t>(workers)));
+  std::vector<Share> shares(workers);
+  for (int w = 0; w < workers; w++)
+  {
+    shares[w].begin = begin + count * w / workers;
+    shares[w].end = begin + count * (w + 1) / workers;
+  }
+
+  const auto work = [&](int worker) {
+    in_parallel_ranges = true;
+    Share &own = shares[worker];
+    for (;;)
+    {
+      size_t chunk_begin = 0, chunk_end = 0;
+      {
+        SpinMutex::scoped_lock lock(own.mutex);
+        chunk_begin = own.begin;
+        chunk_end = std::min(own.begin + grain, own.end);
+        own.begin = chunk_end;
+      }
+      if (chunk_begin < chunk_end)
+      {
+        function(chunk_begin, chunk_end, worker);
+        continue;
+      }
+      // steal the back half of the largest share
+      int victim = -1;
+      size_t most = 0;
+      for (int w = 0; w < workers; w++)
+      {
+        SpinMutex::scoped_lock lock(shares[w].mutex);
+        const size_t remaining = shares[w].end - shares[w].begin;
+        if (w != worker && remaining > most)
+        {
+          most = remaining;
+          victim = w;
+        }
+      }
+      if (victim < 0)
+      {
+        break;
+      }
+      size_t stolen_begin = 0, stolen_end = 0;
+      {
+        SpinMutex::scoped_lock lock(shares[victim].mutex);
+        Share &share = shares[victim];
+        stolen_end = share.end;
+        stolen_begin = share.begin + (share.end - share.begin) / 2;
+        share.end = stolen_begin;
+      }
+      SpinMutex::scoped_lock lock(own.mutex);
+      own.begin = stolen_begin;
+      own.end = stolen_end;
+    }
+    in_parallel_ranges = false;
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(workers - 1);
+  for (int w = 1; w < workers; w++)
+  {
+    threads.emplace_back(work, w);
+  }
+  work(0);
+  for (auto &thread : threads)
+  {
+    thread.join();
+  }
+}
+}  // namespace ray
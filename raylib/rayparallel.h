@@ -0,0 +1,192 @@
+// Copyright (c) 2026
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#ifndef RAYLIB_RAYPARALLEL_H
+#define RAYLIB_RAYPARALLEL_H
+
+#include "raylib/raylibconfig.h"
+
+#include "raythreads.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#if RAYLIB_WITH_TBB
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+#endif  // RAYLIB_WITH_TBB
+#ifdef _OPENMP
+#include <omp.h>
+#endif  // _OPENMP
+
+namespace ray
+{
+/// The implementations that parallelFor and parallelReduce can run on
+enum class RAYLIB_EXPORT ParallelBackend : int
+{
+  Serial,   ///< a plain loop on the calling thread
+  Threads,  ///< std::thread workers that steal work from each other, available in all builds
+  OpenMP,   ///< dynamically scheduled OpenMP loops, when compiled with OpenMP
+  TBB       ///< Intel TBB, when built WITH_TBB
+};
+
+/// The backend used by parallelFor and parallelReduce. This is TBB when built WITH_TBB, otherwise OpenMP when
+/// compiled with it, otherwise Threads.
+RAYLIB_EXPORT ParallelBackend parallelBackend();
+/// Chooses the backend, returning false and keeping the current one when @c backend is not available in this build
+RAYLIB_EXPORT bool setParallelBackend(ParallelBackend backend);
+
+/// The Threads backend. Calls @c function(begin, end, worker) on subranges covering [begin, end), with at most
+/// Threads::threadCount() workers. Each worker starts with an equal share of the range and takes small chunks from
+/// its front. When its share is used up it steals the back half of the largest remaining share, so uneven items
+/// (such as rays of different lengths) still keep all of the workers busy. Nested calls run on the calling worker.
+RAYLIB_EXPORT void parallelRangesThreads(size_t begin, size_t end,
+                                         const std::function<void(size_t, size_t, int)> &function);
+
+/// the number of workers that parallelRanges can use, its @c worker argument is below this
+inline int parallelWorkerCount()
+{
+  return parallelBackend() == ParallelBackend::Serial ? 1 : Threads::threadCount();
+}
+
+/// Calls @c function(begin, end, worker) on subranges covering [begin, end), in parallel on the current backend.
+/// No two calls with the same @c worker run at the same time, so it can index per worker storage.
+template <class RangeFunction>
+void parallelRanges(size_t begin, size_t end, const RangeFunction &function)
+{
+  if (end <= begin)
+  {
+    return;
+  }
+  switch (parallelBackend())
+  {
+#if RAYLIB_WITH_TBB
+  case ParallelBackend::TBB:
+    // the arena's thread indices are below its concurrency, which is Threads::threadCount()
+    Threads::arena().execute([begin, end, &function]() {
+      tbb::parallel_for(tbb::blocked_range<size_t>(begin, end), [&function](const tbb::blocked_range<size_t> &range) {
+        function(range.begin(), range.end(), tbb::this_task_arena::current_thread_index());
+      });
+    });
+    return;
+#endif  // RAYLIB_WITH_TBB
+#ifdef _OPENMP
+  case ParallelBackend::OpenMP:
+  {
+    const int workers = Threads::threadCount();
+    const size_t grain = std::max<size_t>(1, (end - begin) / (32 * static_cast<size_t>(workers)));
+    const long long num_chunks = static_cast<long long>((end - begin + grain - 1) / grain);
+#pragma omp parallel for schedule(dynamic) num_threads(workers)
+    for (long long chunk = 0; chunk < num_chunks; chunk++)
+    {
+      const size_t chunk_begin = begin + static_cast<size_t>(chunk) * grain;
+      function(chunk_begin, std::min(chunk_begin + grain, end), omp_get_thread_num());
+    }
+    return;
+  }
+#endif  // _OPENMP
+  case ParallelBackend::Threads:
+    parallelRangesThreads(begin, end, function);
+    return;
+  default:
+    function(begin, end, 0);
+    return;
+  }
+}
+
+/// Calls @c function(i) for each i in [begin, end), in parallel. The order of the calls is unspecified
+template <class Function>
+void parallelFor(size_t begin, size_t end, const Function &function)
+{
+  parallelRanges(begin, end, [&function](size_t range_begin, size_t range_end, int) {
+    for (size_t i = range_begin; i < range_end; i++)
+    {
+      function(i);
+    }
+  });
+}
+
+/// parallelFor with working memory per worker. @c function(i, local) is given the worker's own copy of @c local,
+/// so the copies needn't be locked, and are reused for all of the items that the worker processes.
+template <class T, class Function>
+void parallelForLocal(size_t begin, size_t end, const T &local, const Function &function)
+{
+  std::vector<T> locals(static_cast<size_t>(parallelWorkerCount()), local);
+  parallelRanges(begin, end, [&function, &locals](size_t range_begin, size_t range_end, int worker) {
+    T &worker_local = locals[worker];
+    for (size_t i = range_begin; i < range_end; i++)
+    {
+      function(i, worker_local);
+    }
+  });
+}
+
+/// Accumulates each i in [begin, end) into a value per worker with @c function(i, value), starting from
+/// @c identity, then combines the workers' values in worker order with @c combine(value, other_value) and returns
+/// the result. As the items are shared among the workers dynamically, floating point sums can vary in the last bits.
+template <class T, class Function, class CombineFunction>
+T parallelReduce(size_t begin, size_t end, const T &identity, const Function &function,
+                 const CombineFunction &combine)
+{
+  std::vector<T> values(static_cast<size_t>(parallelWorkerCount()), identity);
+  parallelRanges(begin, end, [&function, &values](size_t range_begin, size_t range_end, int worker) {
+    // accumulating on the worker's stack avoids false sharing between the values
+    T value = std::move(values[worker]);
+    for (size_t i = range_begin; i < range_end; i++)
+    {
+      function(i, value);
+    }
+    values[worker] = std::move(value);
+  });
+  T result = std::move(values[0]);
+  for (size_t i = 1; i < values.size(); i++)
+  {
+    combine(result, values[i]);
+  }
+  return result;
+}
+
+/// A minimal spin lock for short critical sections, with the scoped_lock interface of tbb::spin_mutex.
+/// A copy is a new unlocked mutex, so that containers of lockable items remain copyable.
+class RAYLIB_EXPORT SpinMutex
+{
+public:
+  class scoped_lock
+  {
+  public:
+    explicit scoped_lock(SpinMutex &mutex)
+      : mutex_(mutex)
+    {
+      mutex_.lock();
+    }
+    ~scoped_lock() { mutex_.unlock(); }
+    scoped_lock(const scoped_lock &) = delete;
+    scoped_lock &operator=(const scoped_lock &) = delete;
+
+  private:
+    SpinMutex &mutex_;
+  };
+
+  SpinMutex() = default;
+  SpinMutex(const SpinMutex &) {}
+  SpinMutex &operator=(const SpinMutex &) { return *this; }
+
+  inline void lock()
+  {
+    while (flag_.test_and_set(std::memory_order_acquire))
+    {
+    }
+  }
+  inline void unlock() { flag_.clear(std::memory_order_release); }
+
+private:
+  std::atomic_flag flag_ = ATOMIC_FLAG_INIT;
+};
+}  // namespace ray
+
+#endif  // RAYLIB_RAYPARALLEL_H
@@ -6,6 +6,7 @@
 #include "rayparse.h"
 #include <iostream>
 #include <limits>
+#include "raythreads.h"
 #include "rayutils.h"
 
 namespace ray
@@ -36,6 +37,10 @@ bool parseCommandLine(int argc, char *argv[], const std::vector<FixedArgument *>
   // set them) if the format matches.
   if (set_values_ && !parseCommandLine(argc, argv, fixed_arguments, optional_arguments, false))
     return false;
+  // every tool accepts the number of threads for its parallel loops, e.g. "--threads 4" or "-j 4"
+  IntArgument thread_count(1, 4096);
+  OptionalKeyValueArgument threads("threads", 'j', &thread_count);
+  optional_arguments.push_back(&threads);
   int c = 1;
   for (auto &l : fixed_arguments)
   {
@@ -59,6 +64,8 @@ bool parseCommandLine(int argc, char *argv[], const std::vector<FixedArgument *>
     if (!found)
       return false;  // no optional argument matches argument c
   }
+  if (set_values_ && threads.isSet())
+    Threads::init(thread_count.value());
   return true;
 }
 
@@ -293,6 +300,42 @@ bool Vector4dArgument::parse(int argc, char *argv[], int &index, bool set_value)
   return true;
 }
 
+DoubleListArgument::DoubleListArgument()
+{
+  max_value_ = std::numeric_limits<double>::max();
+  min_value_ = std::numeric_limits<double>::lowest();
+}
+
+bool DoubleListArgument::parse(int argc, char *argv[], int &index, bool set_value)
+{
+  if (index >= argc)
+    return false;
+  std::stringstream ss(argv[index]);
+  std::string field;
+  std::vector<double> values;
+  while (std::getline(ss, field, ','))
+  {
+    char *endptr;
+    const char *str = field.c_str();
+    double val = std::strtod(str, &endptr);
+    if (field.empty() || endptr != str + std::strlen(str))  // if the double is badly formed
+      return false;
+    if (set_value && (val < min_value_ || val > max_value_))
+    {
+      std::cout << "Please set argument " << index << " within the range: " << min_value_ << " to " << max_value_
+                << std::endl;
+      return false;
+    }
+    values.push_back(val);
+  }
+  if (values.empty())
+    return false;
+  if (set_value)
+    value_ = values;
+  index++;
+  return true;
+}
+
 bool FileArgumentList::parse(int argc, char *argv[], int &index, bool set_value)
 {
   FileArgument arg(check_extension_);
@@ -39,6 +39,9 @@ std::string RAYLIB_EXPORT getFileNameExtension(const std::string &name);
 /// if (!format1 && !format2)
 ///   print_usage_and_exit();
 /// Values are set only for the parseCommandLine that returned true. e.g. scale_val.value() is used if format1
+///
+/// Every format also accepts "--threads N" (or "-j N"), which sets the number of threads used by the parallel loops,
+/// see Threads::init.
 bool RAYLIB_EXPORT
   parseCommandLine(int argc, char *argv[], const std::vector<struct FixedArgument *> &fixed_arguments,
                    std::vector<struct OptionalArgument *> optional_arguments = std::vector<struct OptionalArgument *>(),
@@ -197,6 +200,23 @@ private:
   Eigen::Vector4d value_;
 };
 
+/// For a list of one or more real values, example: "2,5,10.5"
+class RAYLIB_EXPORT DoubleListArgument : public ValueArgument
+{
+public:
+  DoubleListArgument();
+  DoubleListArgument(double min_element_value, double max_element_value)
+    : min_value_(min_element_value)
+    , max_value_(max_element_value)
+  {}
+  virtual bool parse(int argc, char *argv[], int &index, bool set_value);
+  inline const std::vector<double> &value() const { return value_; }
+
+private:
+  double min_value_, max_value_;
+  std::vector<double> value_;
+};
+
 /// Parses a list of file names, e.g. "cloud1.ply cloudB.ply cloud_x.ply"
 class RAYLIB_EXPORT FileArgumentList : public FixedArgument
 {
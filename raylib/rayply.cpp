@@ -6,22 +6,25 @@
 #include "rayply.h"
 #include "raylib/rayprogress.h"
 #include "raylib/rayprogressthread.h"
+#include "raycloud.h"
+#include "rayindex.h"
+#include "raymappedfile.h"
 #include "raymesh.h"
 
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <type_traits>
 // #define OUTPUT_MOMENTS // useful when setting up unit test expected ray clouds
 
 namespace ray
 {
 namespace
 {
-// these are set once and are constant after that
-unsigned long chunk_header_length = 0;
-unsigned long point_cloud_chunk_header_length = 0;
-unsigned long vertex_size_pos = 0;
-unsigned long point_cloud_vertex_size_pos = 0;
-
 enum DataType
 {
   kDTfloat,
@@ -33,9 +36,12 @@ enum DataType
 };
 }  // namespace
 
-bool writeRayCloudChunkStart(const std::string &file_name, std::ofstream &out)
+bool writeRayCloudChunkStart(const std::string &file_name, std::ofstream &out, PlyChunkHeader &header)
 {
   int num_zeros = std::numeric_limits<unsigned long>::digits10;
+  // any index or info cache of a previous file of this name is now invalid
+  std::remove(RayIndex::fileName(file_name).c_str());
+  std::remove(Cloud::infoFileName(file_name).c_str());
   out.open(file_name, std::ios::binary | std::ios::out);
   if (out.fail())
   {
@@ -48,7 +54,7 @@ bool writeRayCloudChunkStart(const std::string &file_name, std::ofstream &out)
   out << "element vertex ";
   for (int i = 0; i < num_zeros; i++)
     out << "0";  // fill in with zeros. I will replace rightmost characters later, to give actual number
-  vertex_size_pos = out.tellp();
+  header.vertex_count_pos = out.tellp();
   out << std::endl;
 #if RAYLIB_DOUBLE_RAYS
   out << "property double x" << std::endl;
@@ -74,20 +80,20 @@ bool writeRayCloudChunkStart(const std::string &file_name, std::ofstream &out)
   out << "property uchar blue" << std::endl;
   out << "property uchar alpha" << std::endl;
   out << "end_header" << std::endl;
-  chunk_header_length = out.tellp();
+  header.length = out.tellp();
   return true;
 }
 
-bool writeRayCloudChunk(std::ofstream &out, RayPlyBuffer &vertices, const std::vector<Eigen::Vector3d> &starts,
-                        const std::vector<Eigen::Vector3d> &ends, const std::vector<double> &times,
-                        const std::vector<RGBA> &colours, bool &has_warned)
+bool writeRayCloudChunk(std::ofstream &out, const PlyChunkHeader &header, RayPlyBuffer &vertices,
+                        const std::vector<Eigen::Vector3d> &starts, const std::vector<Eigen::Vector3d> &ends,
+                        const std::vector<double> &times, const std::vector<RGBA> &colours, bool &has_warned)
 {
   if (ends.size() == 0)
   {
     // this is not an error. Allowing empty chunks avoids wrapping every call to writeRayCloudChunk in a condition
     return true;
   }
-  if (out.tellp() < (long)chunk_header_length)
+  if (header.length == 0 || out.tellp() < (long)header.length)
   {
     std::cerr << "Error: file header has not been written, use writeRayCloudChunkStart" << std::endl;
     return false;
@@ -148,14 +154,14 @@ bool writeRayCloudChunk(std::ofstream &out, RayPlyBuffer &vertices, const std::v
   return true;
 }
 
-unsigned long writeRayCloudChunkEnd(std::ofstream &out)
+unsigned long writeRayCloudChunkEnd(std::ofstream &out, const PlyChunkHeader &header)
 {
-  const unsigned long size = static_cast<unsigned long>(out.tellp()) - chunk_header_length;
+  const unsigned long size = static_cast<unsigned long>(out.tellp()) - header.length;
   const unsigned long number_of_rays = size / sizeof(RayPlyEntry);
   std::stringstream stream;
   stream << number_of_rays;
   std::string str = stream.str();
-  out.seekp(vertex_size_pos - str.length());
+  out.seekp(header.vertex_count_pos - str.length());
   out << str;
   return number_of_rays;
 }
@@ -172,23 +178,24 @@ bool writePlyRayCloud(const std::string &file_name, const std::vector<Eigen::Vec
     colourByTime(times, rgb);
 
   std::ofstream ofs;
-  if (!writeRayCloudChunkStart(file_name, ofs))
+  PlyChunkHeader header;
+  if (!writeRayCloudChunkStart(file_name, ofs, header))
     return false;
   RayPlyBuffer buffer;
   bool has_warned = false;
   // TODO: could split this into chunks aswell, it would allow saving out files roughly twice as large
-  if (!writeRayCloudChunk(ofs, buffer, starts, ends, times, rgb, has_warned))
+  if (!writeRayCloudChunk(ofs, header, buffer, starts, ends, times, rgb, has_warned))
   {
     return false;
   }
-  const unsigned long num_rays = ray::writeRayCloudChunkEnd(ofs);
+  const unsigned long num_rays = ray::writeRayCloudChunkEnd(ofs, header);
   std::cout << num_rays << " rays saved to " << file_name << std::endl;
   return true;
 }
 
 // Point cloud chunked writing
 
-bool writePointCloudChunkStart(const std::string &file_name, std::ofstream &out)
+bool writePointCloudChunkStart(const std::string &file_name, std::ofstream &out, PlyChunkHeader &header)
 {
   int num_zeros = std::numeric_limits<unsigned long>::digits10;
   std::cout << "saving to " << file_name << " ..." << std::endl;
@@ -204,7 +211,7 @@ bool writePointCloudChunkStart(const std::string &file_name, std::ofstream &out)
   out << "element vertex ";
   for (int i = 0; i < num_zeros; i++)
     out << "0";  // fill in with zeros. I will replace rightmost characters later, to give actual number
-  point_cloud_vertex_size_pos = out.tellp();  // same value as for ray cloud, so we can use the same varia
+  header.vertex_count_pos = out.tellp();
   out << std::endl;
 #if RAYLIB_DOUBLE_RAYS
   out << "property double x" << std::endl;
@@ -221,21 +228,22 @@ bool writePointCloudChunkStart(const std::string &file_name, std::ofstream &out)
   out << "property uchar blue" << std::endl;
   out << "property uchar alpha" << std::endl;
   out << "end_header" << std::endl;
-  point_cloud_chunk_header_length = out.tellp();
+  header.length = out.tellp();
   return true;
 }
 
-bool writePointCloudChunk(std::ofstream &out, PointPlyBuffer &vertices, const std::vector<Eigen::Vector3d> &points,
-                          const std::vector<double> &times, const std::vector<RGBA> &colours, bool &has_warned)
+bool writePointCloudChunk(std::ofstream &out, const PlyChunkHeader &header, PointPlyBuffer &vertices,
+                          const std::vector<Eigen::Vector3d> &points, const std::vector<double> &times,
+                          const std::vector<RGBA> &colours, bool &has_warned)
 {
   if (points.size() == 0)
   {
     std::cerr << "Error: saving out ray file chunk with zero rays" << std::endl;
     return false;
   }
-  if (out.tellp() < (long)point_cloud_chunk_header_length)
+  if (header.length == 0 || out.tellp() < (long)header.length)
   {
-    std::cerr << "Error: file header has not been written, use writeRayCloudChunkStart" << std::endl;
+    std::cerr << "Error: file header has not been written, use writePointCloudChunkStart" << std::endl;
     return false;
   }
   vertices.resize(points.size());  // allocates the chunk size the first time, and nullop on subsequent chunks
@@ -286,14 +294,14 @@ bool writePointCloudChunk(std::ofstream &out, PointPlyBuffer &vertices, const st
   return true;
 }
 
-void writePointCloudChunkEnd(std::ofstream &out)
+void writePointCloudChunkEnd(std::ofstream &out, const PlyChunkHeader &header)
 {
-  const unsigned long size = static_cast<unsigned long>(out.tellp()) - point_cloud_chunk_header_length;
+  const unsigned long size = static_cast<unsigned long>(out.tellp()) - header.length;
   const unsigned long number_of_points = size / sizeof(PointPlyEntry);
   std::stringstream stream;
   stream << number_of_points;
   std::string str = stream.str();
-  out.seekp(point_cloud_vertex_size_pos - str.length());
+  out.seekp(header.vertex_count_pos - str.length());
   out << str;
   std::cout << "... saved out " << number_of_points << " points." << std::endl;
 }
@@ -313,40 +321,41 @@ bool writePlyPointCloud(const std::string &file_name, const std::vector<Eigen::V
   }
 
   std::ofstream ofs;
-  if (!writePointCloudChunkStart(file_name, ofs))
+  PlyChunkHeader header;
+  if (!writePointCloudChunkStart(file_name, ofs, header))
     return false;
   PointPlyBuffer buffer;
   bool has_warned = false;
   // TODO: could split this into chunks aswell, it would allow saving out files roughly twice as large
-  if (!writePointCloudChunk(ofs, buffer, points, times, rgb, has_warned))
+  if (!writePointCloudChunk(ofs, header, buffer, points, times, rgb, has_warned))
   {
     return false;
   }
-  writePointCloudChunkEnd(ofs);
+  writePointCloudChunkEnd(ofs, header);
   return true;
 }
 
-bool readPly(const std::string &file_name, bool is_ray_cloud,
-             std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
-                                std::vector<double> &times, std::vector<RGBA> &colours)>
-               apply, 
-             double max_intensity, bool times_optional, size_t chunk_size)
+namespace
+{
+/// The location and type of each field in the vertex rows of a binary .ply file, as described by its header
+struct PlyLayout
 {
-  std::cout << "reading: " << file_name << std::endl;
-  std::ifstream input(file_name.c_str(), std::ios::in | std::ios::binary);
-  if (input.fail())
-  {
-    std::cerr << "Couldn't open file: " << file_name << std::endl;
-    return false;
-  }
-  std::string line;
   int row_size = 0;
-  int offset = -1, normal_offset = -1, time_offset = -1, colour_offset = -1;
+  int offset = -1;
+  int normal_offset = -1;
+  int time_offset = -1;
+  int colour_offset = -1;
   int intensity_offset = -1;
   bool time_is_float = false;
   bool pos_is_float = false;
   bool normal_is_float = false;
   DataType intensity_type = kDTnone;
+};
+
+/// read the header of a binary .ply file, leaving @c input at the start of the vertex data
+bool readPlyHeader(std::ifstream &input, const std::string &file_name, PlyLayout &layout)
+{
+  std::string line;
   int rowsteps[] = { int(sizeof(float)), int(sizeof(double)), int(sizeof(unsigned short)), int(sizeof(unsigned char)), int(sizeof(int)),
                      0 };  // to match each DataType enum
 
@@ -378,152 +387,195 @@ bool readPly(const std::string &file_name, bool is_ray_cloud,
 
     if (line == "property float x" || line == "property double x")
     {
-      offset = row_size;
+      layout.offset = layout.row_size;
       if (line.find("float") != std::string::npos)
-        pos_is_float = true;
+        layout.pos_is_float = true;
     }
     if (line == "property float rayx" || line == "property double rayx")
     {
 #if RAYLIB_WITH_NORMAL_FIELD
-      if (normal_offset == -1)
+      if (layout.normal_offset == -1)
 #endif
       {
-        normal_offset = row_size;
-        normal_is_float = line.find("float") != std::string::npos;
+        layout.normal_offset = layout.row_size;
+        layout.normal_is_float = line.find("float") != std::string::npos;
       }
     }
     if (line == "property float nx" || line == "property double nx")
     {
 #if !RAYLIB_WITH_NORMAL_FIELD
-      if (normal_offset == -1)
+      if (layout.normal_offset == -1)
 #endif
       {
-        normal_offset = row_size;
-        normal_is_float = line.find("float") != std::string::npos;
+        layout.normal_offset = layout.row_size;
+        layout.normal_is_float = line.find("float") != std::string::npos;
       }
     }
     if (line.find("time") != std::string::npos)
     {
-      time_offset = row_size;
+      layout.time_offset = layout.row_size;
       if (line.find("float") != std::string::npos)
-        time_is_float = true;
+        layout.time_is_float = true;
     }
     if (line.find("intensity") != std::string::npos)
     {
-      intensity_offset = row_size;
-      intensity_type = data_type;
+      layout.intensity_offset = layout.row_size;
+      layout.intensity_type = data_type;
     }
     if (line == "property uchar red" || line == "property uint8 red")
-      colour_offset = row_size;
+      layout.colour_offset = layout.row_size;
 
-    row_size += rowsteps[data_type];
+    layout.row_size += rowsteps[data_type];
   }
-  if (offset == -1)
+  return true;
+}
+
+/// reads a value of type T from the (unaligned) binary row data at @c offset
+template <class T>
+inline T rowValue(const unsigned char *row, int offset)
+{
+  T value;
+  memcpy(static_cast<void *>(&value), row + offset, sizeof(T));
+  return value;
+}
+
+/// The decoded rays of one chunk of rows, before any processing that depends on the preceding chunks
+struct PlyChunk
+{
+  std::vector<Eigen::Vector3d> starts;
+  std::vector<Eigen::Vector3d> ends;
+  std::vector<double> times;
+  std::vector<RGBA> colours;
+  std::vector<uint8_t> intensities;
+  /// the first warning found while decoding the chunk, or empty if there was none
+  std::string warning;
+  bool warning_is_error = false;
+
+  void reserve(size_t size, const PlyLayout &layout)
   {
-    std::cerr << "could not find position properties of file: " << file_name << std::endl;
-    return false;
+    ends.reserve(size);
+    starts.reserve(size);
+    times.reserve(size);
+    if (layout.colour_offset != -1)
+      colours.reserve(size);
+    if (layout.intensity_offset != -1)
+      intensities.reserve(size);
   }
-  if (is_ray_cloud && normal_offset == -1)
+  void clear()
   {
-    std::cerr << "could not find normal properties of file: " << file_name << std::endl;
-    std::cerr << "ray clouds store the ray starts using the normal field" << std::endl;
-    return false;
+    starts.clear();
+    ends.clear();
+    times.clear();
+    colours.clear();
+    intensities.clear();
+    warning.clear();
+    warning_is_error = false;
   }
+};
 
-  std::streampos start = input.tellg();
-  input.seekg(0, input.end);
-  size_t length = input.tellg() - start;
-  input.seekg(start);
-  size_t size = length / row_size;
-
-  ray::Progress progress;
-  ray::ProgressThread progress_thread(progress);
-  size_t num_chunks = (size + (chunk_size - 1)) / chunk_size;
-  progress.begin("read and process", num_chunks);
+/// The ray cloud row layout written by writeRayCloudChunkStart, with positions of type @c PosT:
+/// x, y, z, double time, float nx, ny, nz (the ray start relative to the end), uchar red, green, blue, alpha
+template <class PosT>
+struct RayCloudRow
+{
+  static constexpr int kTimeOffset = 3 * sizeof(PosT);
+  static constexpr int kNormalOffset = kTimeOffset + sizeof(double);
+  static constexpr int kColourOffset = kNormalOffset + 3 * sizeof(float);
+  static constexpr int kSize = kColourOffset + sizeof(RGBA);
 
-  std::vector<unsigned char> vertices(row_size);
-  bool warning_set = false;
-  if (size == 0)
+  static bool matches(const PlyLayout &layout)
   {
-    std::cerr << "no entries found in ply file" << std::endl;
-    return false;
+    return layout.row_size == kSize && layout.offset == 0 && layout.pos_is_float == std::is_same<PosT, float>::value &&
+           layout.time_offset == kTimeOffset && !layout.time_is_float && layout.normal_offset == kNormalOffset &&
+           layout.normal_is_float && layout.colour_offset == kColourOffset && layout.intensity_offset == -1;
   }
-  if (time_offset == -1)
-  {
-    if (times_optional)
-    {
-      std::cout << "Warning: no times provided in file, applying 1 second difference per ray consecutively, starting at 0 seconds" << std::endl;
-    }
-    else
-    {
-      std::cerr << "error: no time information found in " << file_name << std::endl;
-      return false;
-    }
-  }
-  if (colour_offset == -1)
+};
+
+/// Decode ray cloud rows in the RayCloudRow<PosT> layout into @c chunk. The offsets are compile-time constants and
+/// there is no per-field branching, so the loop is a straight conversion that the compiler can vectorise.
+/// Returns false, leaving @c chunk as it was, if any row needs the warnings or NaN removal of the general decoder.
+template <class PosT>
+bool decodeRayCloudRows(const unsigned char *rows, size_t num_rows, PlyChunk &chunk)
+{
+  using Row = RayCloudRow<PosT>;
+  const size_t old_size = chunk.ends.size();
+  chunk.starts.resize(old_size + num_rows);
+  chunk.ends.resize(old_size + num_rows);
+  chunk.times.resize(old_size + num_rows);
+  chunk.colours.resize(old_size + num_rows);
+  Eigen::Vector3d *starts = &chunk.starts[old_size];
+  Eigen::Vector3d *ends = &chunk.ends[old_size];
+  double *times = &chunk.times[old_size];
+  RGBA *colours = &chunk.colours[old_size];
+  bool unusual = false;
+  for (size_t r = 0; r < num_rows; r++)
   {
-    std::cout << "warning: no colour information found in " << file_name
-              << ", setting colours red->green->blue based on time" << std::endl;
+    const unsigned char *row = rows + r * Row::kSize;
+    PosT pos[3];
+    float normal[3];
+    memcpy(pos, row, sizeof(pos));
+    memcpy(normal, row + Row::kNormalOffset, sizeof(normal));
+    memcpy(&times[r], row + Row::kTimeOffset, sizeof(double));
+    memcpy(static_cast<void *>(&colours[r]), row + Row::kColourOffset, sizeof(RGBA));
+    const Eigen::Vector3d end(pos[0], pos[1], pos[2]);
+    const Eigen::Vector3d start = end + Eigen::Vector3d(normal[0], normal[1], normal[2]);
+    ends[r] = end;
+    starts[r] = start;
+    // NaNs fail the comparisons, so this flags them as well as the suspiciously large values
+    unusual |= !(std::abs(end[0]) <= 100000.0) | !(std::abs(normal[0]) <= 100000.0f) | !(end == end) | !(start == start);
   }
-  if (!is_ray_cloud && intensity_offset != -1)
+  if (unusual)
   {
-    if (colour_offset != -1)
-    {
-      std::cout << "warning: intensity and colour information both found in file. Replacing alpha with intensity value."
-                << std::endl;
-    }
-    else
-    {
-      std::cout << "intensity information found in file, storing this in the ray cloud 8-bit alpha channel."
-                << std::endl;
-    }
+    chunk.starts.resize(old_size);
+    chunk.ends.resize(old_size);
+    chunk.times.resize(old_size);
+    chunk.colours.resize(old_size);
+    return false;
   }
+  return true;
+}
 
-  // pre-reserving avoids memory fragmentation
-  std::vector<Eigen::Vector3d> ends;
-  std::vector<Eigen::Vector3d> starts;
-  std::vector<double> times;
-  std::vector<ray::RGBA> colours;
-  std::vector<uint8_t> intensities;
-  size_t reserve_size = std::min(chunk_size, size);
-  ends.reserve(reserve_size);
-  starts.reserve(reserve_size);
-  if (time_offset != -1)
-    times.reserve(reserve_size);
-  if (colour_offset != -1)
-    colours.reserve(reserve_size);
-  if (intensity_offset != -1)
-    intensities.reserve(reserve_size);
-  bool any_returns = false;
-  int identical_times = 0;
-  double last_time = std::numeric_limits<double>::lowest();
-  double last_unique_time = std::numeric_limits<double>::lowest();
-  
-  for (size_t i = 0; i < size; i++)
+/// The general decoder, for any supported layout. See decodePlyRows
+void decodeAnyPlyRows(const PlyLayout &layout, const unsigned char *rows, size_t first_row, size_t num_rows,
+                      bool is_ray_cloud, double max_intensity, PlyChunk &chunk)
+{
+  const int row_size = layout.row_size;
+  const int offset = layout.offset, normal_offset = layout.normal_offset, time_offset = layout.time_offset;
+  const int colour_offset = layout.colour_offset, intensity_offset = layout.intensity_offset;
+  bool warning_set = false;
+  auto warn = [&](const std::stringstream &message, bool is_error) {
+    chunk.warning = message.str();
+    chunk.warning_is_error = is_error;
+    warning_set = true;
+  };
+  for (size_t r = 0; r < num_rows; r++)
   {
-    input.read((char *)&vertices[0], row_size);
+    const size_t i = first_row + r;
+    const unsigned char *row = rows + r * row_size;
     Eigen::Vector3d end;
-    if (pos_is_float)
+    if (layout.pos_is_float)
     {
-      Eigen::Vector3f e = (Eigen::Vector3f &)vertices[offset];
+      Eigen::Vector3f e = rowValue<Eigen::Vector3f>(row, offset);
       end = Eigen::Vector3d(e[0], e[1], e[2]);
     }
     else
     {
-      end = (Eigen::Vector3d &)vertices[offset];
+      end = rowValue<Eigen::Vector3d>(row, offset);
     }
     bool end_valid = end == end;
     if (!warning_set)
     {
       if (!end_valid)
       {
-        std::cout << "warning, NANs in point " << i << ", removing all NANs." << std::endl;
-        warning_set = true;
+        std::stringstream message;
+        message << "warning, NANs in point " << i << ", removing all NANs.";
+        warn(message, false);
       }
-      if (std::abs(end[0]) > 100000.0)
+      else if (std::abs(end[0]) > 100000.0)
       {
-        std::cout << "warning: very large data in point " << i << ", suspicious: " << end.transpose() << std::endl;
-        warning_set = true;
+        std::stringstream message;
+        message << "warning: very large data in point " << i << ", suspicious: " << end.transpose();
+        warn(message, false);
       }
     }
     if (!end_valid)
@@ -532,80 +584,67 @@ bool readPly(const std::string &file_name, bool is_ray_cloud,
     Eigen::Vector3d normal(0, 0, 0);
     if (is_ray_cloud)
     {
-      if (normal_is_float)
+      if (layout.normal_is_float)
       {
-        Eigen::Vector3f n = (Eigen::Vector3f &)vertices[normal_offset];
+        Eigen::Vector3f n = rowValue<Eigen::Vector3f>(row, normal_offset);
         normal = Eigen::Vector3d(n[0], n[1], n[2]);
       }
       else
       {
-        normal = (Eigen::Vector3d &)vertices[normal_offset];
+        normal = rowValue<Eigen::Vector3d>(row, normal_offset);
       }
       bool norm_valid = normal == normal;
       if (!warning_set)
       {
         if (!norm_valid)
         {
-          std::cout << "warning, NANs in raystart stored in normal " << i << ", removing all such rays." << std::endl;
-          warning_set = true;
+          std::stringstream message;
+          message << "warning, NANs in raystart stored in normal " << i << ", removing all such rays.";
+          warn(message, false);
+        }
+        else if (std::abs(normal[0]) > 100000.0)
+        {
+          std::stringstream message;
+          message << "Error: very large ray length in ray index " << i << " " << normal.transpose() << ", bad input."
+                  << std::endl;
+          message << "Use rayexport then rayimport the exported point cloud with a fixed trajectory file";
+          warn(message, true);
         }
       }
       if (!norm_valid)
         continue;
-      if (std::abs(normal[0]) > 100000.0 && !warning_set)
-      {
-        std::cerr << "Error: very large ray length in ray index " << i << " " << normal.transpose() << ", bad input." << std::endl;
-        std::cerr << "Use rayexport then rayimport the exported point cloud with a fixed trajectory file" << std::endl;
-        warning_set = true;
-      }        
     }
 
-    starts.push_back(end + normal);
-    ends.push_back(end);
+    chunk.starts.push_back(end + normal);
+    chunk.ends.push_back(end);
     if (time_offset != -1)
     {
-      double time;
-      if (time_is_float)
-      {
-        time = (double)((float &)vertices[time_offset]);
-      }
+      if (layout.time_is_float)
+        chunk.times.push_back((double)rowValue<float>(row, time_offset));
       else
-      {  
-        time = (double &)vertices[time_offset];
-      }
-      if (!is_ray_cloud)
-      {
-        if (time==last_unique_time)
-        {
-          const double time_delta = 1e-6; // this is a sufficient difference for rayrestore (see time_eps in rayrestore.cpp)
-          time = last_time + time_delta;
-          identical_times++;
-        }
-        else
-        {
-          last_unique_time = time;
-        }
-        last_time = time;
-      }
-      times.push_back(time);
+        chunk.times.push_back(rowValue<double>(row, time_offset));
+    }
+    else
+    {
+      // the times synthesised by earlier versions: the index of the chunk's last row, plus the index in the chunk
+      chunk.times.push_back((double)(first_row + num_rows - 1 + chunk.times.size()));
     }
 
     if (colour_offset != -1)
     {
-      RGBA colour = (RGBA &)vertices[colour_offset];
-      colours.push_back(colour);
+      chunk.colours.push_back(rowValue<RGBA>(row, colour_offset));
     }
     if (!is_ray_cloud)
     {
       if (intensity_offset != -1)
       {
         double intensity;
-        if (intensity_type == kDTfloat)
-          intensity = (double)((float &)vertices[intensity_offset]);
-        else if (intensity_type == kDTdouble)
-          intensity = (double &)vertices[intensity_offset];
+        if (layout.intensity_type == kDTfloat)
+          intensity = (double)rowValue<float>(row, intensity_offset);
+        else if (layout.intensity_type == kDTdouble)
+          intensity = rowValue<double>(row, intensity_offset);
         else  // (intensity_type == kDTushort)
-          intensity = (double)((unsigned short &)vertices[intensity_offset]);
+          intensity = (double)rowValue<unsigned short>(row, intensity_offset);
         if (intensity >= 0.0)
         {
           // only intensity exactly 0 will be used for alpha=0 in uint_8 format.
@@ -623,77 +662,313 @@ bool readPly(const std::string &file_name, bool is_ray_cloud,
         {
           intensity = 1.0;
         }
-        intensities.push_back(static_cast<uint8_t>(intensity));
+        chunk.intensities.push_back(static_cast<uint8_t>(intensity));
       }
     }
-    if (ends.size() == chunk_size || i == size - 1)
+  }
+}
+
+/// Decode the @c num_rows binary rows at @c rows, whose first row has index @c first_row in the file, into @c chunk.
+/// This depends only on the rows themselves, so separate chunks can be decoded concurrently.
+void decodePlyRows(const PlyLayout &layout, const unsigned char *rows, size_t first_row, size_t num_rows,
+                   bool is_ray_cloud, double max_intensity, PlyChunk &chunk)
+{
+  // almost all ray clouds are in the layout written by this library, so that has a specialised decoder
+  if (is_ray_cloud)
+  {
+    if (RayCloudRow<float>::matches(layout) && decodeRayCloudRows<float>(rows, num_rows, chunk))
+      return;
+    if (RayCloudRow<double>::matches(layout) && decodeRayCloudRows<double>(rows, num_rows, chunk))
+      return;
+  }
+  decodeAnyPlyRows(layout, rows, first_row, num_rows, is_ray_cloud, max_intensity, chunk);
+}
+}  // namespace
+
+bool readPly(const std::string &file_name, bool is_ray_cloud,
+             std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                                std::vector<double> &times, std::vector<RGBA> &colours)>
+               apply, 
+             double max_intensity, bool times_optional, size_t chunk_size, PlyReadMode read_mode, int num_threads,
+             int prefetch_depth)
+{
+  std::cout << "reading: " << file_name << std::endl;
+  std::ifstream input(file_name.c_str(), std::ios::in | std::ios::binary);
+  if (input.fail())
+  {
+    std::cerr << "Couldn't open file: " << file_name << std::endl;
+    return false;
+  }
+  PlyLayout layout;
+  if (!readPlyHeader(input, file_name, layout))
+  {
+    return false;
+  }
+  const int row_size = layout.row_size;
+  if (layout.offset == -1)
+  {
+    std::cerr << "could not find position properties of file: " << file_name << std::endl;
+    return false;
+  }
+  if (is_ray_cloud && layout.normal_offset == -1)
+  {
+    std::cerr << "could not find normal properties of file: " << file_name << std::endl;
+    std::cerr << "ray clouds store the ray starts using the normal field" << std::endl;
+    return false;
+  }
+
+  std::streampos start = input.tellg();
+  input.seekg(0, input.end);
+  size_t length = input.tellg() - start;
+  input.seekg(start);
+  size_t size = length / row_size;
+
+  if (size == 0)
+  {
+    std::cerr << "no entries found in ply file" << std::endl;
+    return false;
+  }
+  if (layout.time_offset == -1)
+  {
+    if (times_optional)
+    {
+      std::cout << "Warning: no times provided in file, applying 1 second difference per ray consecutively, starting at 0 seconds" << std::endl;
+    }
+    else
+    {
+      std::cerr << "error: no time information found in " << file_name << std::endl;
+      return false;
+    }
+  }
+  if (layout.colour_offset == -1)
+  {
+    std::cout << "warning: no colour information found in " << file_name
+              << ", setting colours red->green->blue based on time" << std::endl;
+  }
+  if (!is_ray_cloud && layout.intensity_offset != -1)
+  {
+    if (layout.colour_offset != -1)
+    {
+      std::cout << "warning: intensity and colour information both found in file. Replacing alpha with intensity value."
+                << std::endl;
+    }
+    else
     {
-      if (time_offset == -1)
+      std::cout << "intensity information found in file, storing this in the ray cloud 8-bit alpha channel."
+                << std::endl;
+    }
+  }
+
+  // the binary body is either decoded in place from the mapped file, or read one chunk at a time from the stream
+  MappedFile mapped_file;
+  const unsigned char *body = nullptr;
+  const size_t body_start = static_cast<size_t>(start);
+  if (read_mode == kPRMMapped && mapped_file.open(file_name) && mapped_file.size() >= body_start + size * row_size)
+  {
+    body = mapped_file.data() + body_start;
+    input.close();
+  }
+  chunk_size = std::max(std::min(chunk_size, size), size_t(1));
+  const size_t num_chunks = (size + (chunk_size - 1)) / chunk_size;
+  auto chunk_rows = [&](size_t chunk_id) { return std::min(chunk_size, size - chunk_id * chunk_size); };
+  // returns the binary rows of the chunk, reading them into @c buffer if the file is not mapped
+  auto load_chunk = [&](size_t chunk_id, std::vector<unsigned char> &buffer) -> const unsigned char * {
+    if (body)
+      return body + chunk_id * chunk_size * row_size;
+    buffer.resize(chunk_rows(chunk_id) * row_size);
+    input.read((char *)&buffer[0], buffer.size());
+    return &buffer[0];
+  };
+
+  ray::Progress progress;
+  ray::ProgressThread progress_thread(progress);
+  progress.begin("read and process", num_chunks);
+
+  // The parts below depend on the previous chunks, so are done in file order, before passing each chunk to apply
+  bool warning_set = false;
+  bool any_returns = false;
+  int identical_times = 0;
+  double last_time = std::numeric_limits<double>::lowest();
+  double last_unique_time = std::numeric_limits<double>::lowest();
+  auto process_chunk = [&](size_t chunk_id, PlyChunk &chunk) {
+    if (!warning_set && !chunk.warning.empty())
+    {
+      (chunk.warning_is_error ? std::cerr : std::cout) << chunk.warning << std::endl;
+      warning_set = true;
+    }
+    std::vector<double> &times = chunk.times;
+    std::vector<RGBA> &colours = chunk.colours;
+    if (!is_ray_cloud && layout.time_offset != -1)
+    {
+      for (auto &time : times)
       {
-        times.resize(ends.size());
-        for (size_t j = 0; j < times.size(); j++) 
+        if (time==last_unique_time)
+        {
+          const double time_delta = 1e-6; // this is a sufficient difference for rayrestore (see time_eps in rayrestore.cpp)
+          time = last_time + time_delta;
+          identical_times++;
+        }
+        else
         {
-          times[j] = (double)(i + j);
+          last_unique_time = time;
         }
+        last_time = time;
       }
-      if (colour_offset == -1)
+    }
+    if (layout.colour_offset == -1)
+    {
+      colourByTime(times, colours);
+    }
+    if (!is_ray_cloud)
+    {
+      if (layout.intensity_offset != -1)
       {
-        colourByTime(times, colours);
+        std::vector<uint8_t> &intensities = chunk.intensities;
+        for (size_t j = 0; j < intensities.size(); j++)
+        {
+          colours[j].alpha = intensities[j];
+          // colour zero-intensity rays black. This is a helpful debug tool.
+          if (intensities[j] == 0)
+          {
+            colours[j].red = colours[j].green = colours[j].blue = 0;
+          }
+          else
+          {
+            any_returns = true;
+          }
+        }
       }
-      if (!is_ray_cloud)
+      else
       {
-        if (intensity_offset != -1)
+        for (size_t j = 0; j < colours.size(); j++)
         {
-          for (size_t j = 0; j < intensities.size(); j++)
+          if (colours[j].alpha == 0)
           {
-            colours[j].alpha = intensities[j];
             // colour zero-intensity rays black. This is a helpful debug tool.
-            if (intensities[j] == 0)
-            {
-              colours[j].red = colours[j].green = colours[j].blue = 0;
-            }
-            else
-            {
-              any_returns = true;
-            }
+            colours[j].red = colours[j].green = colours[j].blue = 0;
           }
-        }
-        else
-        {
-          for (size_t j = 0; j < colours.size(); j++)
+          else
           {
-            if (colours[j].alpha == 0)
-            {
-              // colour zero-intensity rays black. This is a helpful debug tool.
-              colours[j].red = colours[j].green = colours[j].blue = 0;
-            }
-            else
-            {
-              any_returns = true;
-            }
+            any_returns = true;
           }
         }
       }
-      apply(starts, ends, times, colours);
-      starts.clear();
-      ends.clear();
-      times.clear();
-      colours.clear();
-      intensities.clear();
-      progress.increment();
+    }
+    apply(chunk.starts, chunk.ends, times, colours);
+    chunk.clear();
+    progress.increment();
+    if (body)
+    {
+      // these pages have been decoded, so there is no need for them to stay resident
+      mapped_file.release(body_start + chunk_id * chunk_size * row_size, chunk_rows(chunk_id) * row_size);
+    }
+  };
 
-      if (!is_ray_cloud && i==size-1 && identical_times > 0)
+  num_threads = static_cast<int>(std::min(static_cast<size_t>(std::max(num_threads, 1)), num_chunks));
+  if (num_chunks == 1)
+  {
+    prefetch_depth = 0;  // nothing to overlap with
+  }
+  if (num_threads == 1 && prefetch_depth <= 0)
+  {
+    PlyChunk chunk;
+    chunk.reserve(chunk_size, layout);
+    std::vector<unsigned char> buffer;
+    for (size_t c = 0; c < num_chunks; c++)
+    {
+      const unsigned char *rows = load_chunk(c, buffer);
+      decodePlyRows(layout, rows, c * chunk_size, chunk_rows(c), is_ray_cloud, max_intensity, chunk);
+      process_chunk(c, chunk);
+    }
+  }
+  else
+  {
+    // Each worker thread reads and decodes whole chunks into a ring of slots, while this thread passes the decoded
+    // chunks to apply in file order. A worker only starts on a chunk once its slot has been processed, which bounds the
+    // memory use to num_slots chunks: the one in apply, plus up to max(num_threads, prefetch_depth) ready or in decode.
+    const size_t num_slots = static_cast<size_t>(std::max(num_threads, prefetch_depth)) + 1;
+    std::vector<PlyChunk> slots(num_slots);
+    std::vector<bool> slot_ready(num_slots, false);
+    std::mutex mutex;
+    std::condition_variable chunk_decoded, slot_freed;
+    size_t next_chunk = 0;
+    size_t num_processed = 0;
+    bool abort = false;
+    auto decode_chunks = [&]() {
+      std::vector<unsigned char> buffer;
+      while (true)
       {
-        std::cout << std::endl;
-        std::cout << "warning: " << identical_times << "/" << size << " rays have identical times," << std::endl;
-        std::cout << "since rayrestore relies on unique time stamps, a 1 microsecond increment has been applied for these times." << std::endl;
+        size_t c;
+        const unsigned char *rows;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          slot_freed.wait(lock, [&] { return abort || next_chunk >= num_chunks || next_chunk < num_processed + num_slots; });
+          if (abort || next_chunk >= num_chunks)
+            return;
+          c = next_chunk++;
+          rows = load_chunk(c, buffer);  // inside the lock, so that the stream is read in order
+        }
+        PlyChunk &chunk = slots[c % num_slots];
+        chunk.reserve(chunk_size, layout);
+        decodePlyRows(layout, rows, c * chunk_size, chunk_rows(c), is_ray_cloud, max_intensity, chunk);
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          slot_ready[c % num_slots] = true;
+        }
+        chunk_decoded.notify_all();
       }
+    };
+    std::vector<std::thread> workers;
+    for (int i = 0; i < num_threads; i++) 
+    {
+      workers.emplace_back(decode_chunks);
     }
+    auto stop_workers = [&]() {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        abort = true;
+      }
+      slot_freed.notify_all();
+      for (auto &worker : workers) 
+      {
+        worker.join();
+      }
+    };
+    try
+    {
+      for (size_t c = 0; c < num_chunks; c++)
+      {
+        const size_t slot = c % num_slots;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          chunk_decoded.wait(lock, [&] { return slot_ready[slot]; });
+        }
+        process_chunk(c, slots[slot]);
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          slot_ready[slot] = false;
+          num_processed++;
+        }
+        slot_freed.notify_all();
+      }
+    }
+    catch (...)  // e.g. memory allocation failure in apply. The workers must be joined before leaving
+    {
+      stop_workers();
+      throw;
+    }
+    stop_workers();
   }
   progress.end();
   progress_thread.requestQuit();
   progress_thread.join();
 
+  if (!is_ray_cloud && identical_times > 0)
+  {
+    std::cout << std::endl;
+    std::cout << "warning: " << identical_times << "/" << size << " rays have identical times," << std::endl;
+    std::cout << "since rayrestore relies on unique time stamps, a 1 microsecond increment has been applied for these times." << std::endl;
+  }
   if (!is_ray_cloud && any_returns == false) // no return rays
   {
     std::cerr << "Error: ray cloud has no identified points; all rays are zero-intensity non-returns," << std::endl;
@@ -705,6 +980,64 @@ bool readPly(const std::string &file_name, bool is_ray_cloud,
   return true;
 }
 
+bool readPlyRanges(const std::string &file_name, const std::vector<std::pair<size_t, size_t>> &ranges,
+                   std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                                      std::vector<double> &times, std::vector<RGBA> &colours)>
+                     apply)
+{
+  std::ifstream input(file_name.c_str(), std::ios::in | std::ios::binary);
+  if (input.fail())
+  {
+    std::cerr << "Couldn't open file: " << file_name << std::endl;
+    return false;
+  }
+  PlyLayout layout;
+  if (!readPlyHeader(input, file_name, layout))
+  {
+    return false;
+  }
+  if (layout.offset == -1 || layout.normal_offset == -1)
+  {
+    std::cerr << "could not find position and normal properties of ray cloud file: " << file_name << std::endl;
+    return false;
+  }
+  const std::streampos start = input.tellg();
+  input.seekg(0, input.end);
+  const size_t size = static_cast<size_t>(input.tellg() - start) / layout.row_size;
+
+  PlyChunk chunk;
+  std::vector<unsigned char> buffer;
+  bool warning_set = false;
+  for (auto &range : ranges)
+  {
+    const size_t first = std::min(range.first, size);
+    const size_t num_rows = std::min(range.second, size - first);
+    if (num_rows == 0)
+      continue;
+    buffer.resize(num_rows * layout.row_size);
+    input.seekg(start + static_cast<std::streamoff>(first * layout.row_size));
+    input.read((char *)&buffer[0], buffer.size());
+    if (!input)
+    {
+      std::cerr << "error reading rays " << first << " to " << first + num_rows << " of " << file_name << std::endl;
+      return false;
+    }
+    decodePlyRows(layout, &buffer[0], first, num_rows, true, 0.0, chunk);
+    if (!warning_set && !chunk.warning.empty())
+    {
+      (chunk.warning_is_error ? std::cerr : std::cout) << chunk.warning << std::endl;
+      warning_set = true;
+    }
+    if (layout.colour_offset == -1)
+    {
+      colourByTime(chunk.times, chunk.colours);
+    }
+    apply(chunk.starts, chunk.ends, chunk.times, chunk.colours);
+    chunk.clear();
+  }
+  return true;
+}
+
 bool readPly(const std::string &file_name, std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
              std::vector<double> &times, std::vector<RGBA> &colours, bool is_ray_cloud, double max_intensity)
 {
@@ -1014,7 +1347,8 @@ bool convertCloud(const std::string &in_name, const std::string &out_name,
                   std::function<void(Eigen::Vector3d &start, Eigen::Vector3d &ends, double &time, RGBA &colour)> apply)
 {
   std::ofstream ofs;
-  if (!writeRayCloudChunkStart(out_name, ofs))
+  PlyChunkHeader header;
+  if (!writeRayCloudChunkStart(out_name, ofs, header))
   {
     return false;
   }
@@ -1022,7 +1356,7 @@ bool convertCloud(const std::string &in_name, const std::string &out_name,
 
   bool has_warned = false;
   // run the function 'apply' on each ray as it is read in, and write it out, one chunk at a time
-  auto applyToChunk = [&apply, &buffer, &ofs, &has_warned](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+  auto applyToChunk = [&apply, &buffer, &ofs, &header, &has_warned](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
                                               std::vector<double> &times, std::vector<ray::RGBA> &colours) {
     for (size_t i = 0; i < ends.size(); i++)
     {
@@ -1030,13 +1364,13 @@ bool convertCloud(const std::string &in_name, const std::string &out_name,
       // side effects
       apply(starts[i], ends[i], times[i], colours[i]);
     }
-    ray::writeRayCloudChunk(ofs, buffer, starts, ends, times, colours, has_warned);
+    ray::writeRayCloudChunk(ofs, header, buffer, starts, ends, times, colours, has_warned);
   };
   if (!ray::readPly(in_name, true, applyToChunk, 0))
   {
     return false;
   }
-  ray::writeRayCloudChunkEnd(ofs);
+  ray::writeRayCloudChunkEnd(ofs, header);
   return true;
 }
 
@@ -34,16 +34,40 @@ bool RAYLIB_EXPORT readPlyMesh(const std::string &file, class Mesh &mesh);
 /// write a .ply file representing a triangular mesh
 bool RAYLIB_EXPORT writePlyMesh(const std::string &file_name, const class Mesh &mesh, bool flip_normals = false);
 
+/// How the binary body of a .ply file is accessed when reading
+enum PlyReadMode
+{
+  /// read through an ifstream, one block of rows at a time
+  kPRMStream,
+  /// decode directly from a read-only memory mapping of the file. Falls back to kPRMStream if mapping fails
+  kPRMMapped
+};
+
 /// ready in a ray cloud or point cloud .ply file, and call the @c apply function one chunk at a time,
 /// @c chunk_size is the number of rays to read at one time. This method can be used on large clouds where
 /// the full set of rays is not required to be in memory at one time.
 /// @c times_optional flag allows clouds to be read with no time stamps
+/// @c read_mode selects how the file body is accessed, this has no effect on the chunks passed to @c apply
+/// @c num_threads greater than 1 decodes that many chunks concurrently on worker threads. The chunks are still passed
+/// to @c apply in file order, on the calling thread, at the cost of up to @c num_threads+1 chunks held in memory.
+/// Each chunk is decoded from @c chunk_size rows of the file, so it has fewer rays if the file contains NaN rays.
+/// @c prefetch_depth greater than 0 reads and decodes chunks on a background thread while @c apply is running, with up
+/// to this many chunks waiting ahead of the one being applied. This overlaps the file reading with the processing.
 bool RAYLIB_EXPORT readPly(const std::string &file_name, bool is_ray_cloud,
                            std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
                                               std::vector<double> &times, std::vector<RGBA> &colours)>
-                             apply, 
-                           double max_intensity, bool times_optional = false, size_t chunk_size = 1000000);
+                             apply,
+                           double max_intensity, bool times_optional = false, size_t chunk_size = 1000000,
+                           PlyReadMode read_mode = kPRMMapped, int num_threads = 1,
+                           int prefetch_depth = 0);
 
+/// read only the given ranges of rays from a ray cloud .ply file, calling @c apply once per range. Each range is a
+/// (first ray, number of rays) pair, in file order. This is used for reading sub-regions of indexed ray clouds.
+bool RAYLIB_EXPORT readPlyRanges(const std::string &file_name, const std::vector<std::pair<size_t, size_t>> &ranges,
+                                 std::function<void(std::vector<Eigen::Vector3d> &starts,
+                                                    std::vector<Eigen::Vector3d> &ends, std::vector<double> &times,
+                                                    std::vector<RGBA> &colours)>
+                                   apply);
 
 /// write a .ply file representing a point cloud
 bool RAYLIB_EXPORT writePlyPointCloud(const std::string &file_name, const std::vector<Eigen::Vector3d> &points,
@@ -54,20 +78,30 @@ bool RAYLIB_EXPORT writePlyRayCloud(const std::string &file_name, const std::vec
                                     const std::vector<Eigen::Vector3d> &ends, const std::vector<double> &times,
                                     const std::vector<RGBA> &colours);
 
+/// Where the chunk writing functions are in the header of a .ply file that is being written. This is filled in by
+/// the ChunkStart functions and passed to the others, so there is one per file and files can be written concurrently.
+struct PlyChunkHeader
+{
+  /// file position of the end of the header, where the vertex data starts
+  unsigned long length = 0;
+  /// file position just after the zero padded vertex count, which is filled in by the ChunkEnd functions
+  unsigned long vertex_count_pos = 0;
+};
+
 /// Chunked version of writePlyRayCloud
-bool RAYLIB_EXPORT writeRayCloudChunkStart(const std::string &file_name, std::ofstream &out);
-bool RAYLIB_EXPORT writeRayCloudChunk(std::ofstream &out, RayPlyBuffer &vertices,
+bool RAYLIB_EXPORT writeRayCloudChunkStart(const std::string &file_name, std::ofstream &out, PlyChunkHeader &header);
+bool RAYLIB_EXPORT writeRayCloudChunk(std::ofstream &out, const PlyChunkHeader &header, RayPlyBuffer &vertices,
                                       const std::vector<Eigen::Vector3d> &starts,
                                       const std::vector<Eigen::Vector3d> &ends, const std::vector<double> &times,
                                       const std::vector<RGBA> &colours, bool &has_warned);
-unsigned long RAYLIB_EXPORT writeRayCloudChunkEnd(std::ofstream &out);
+unsigned long RAYLIB_EXPORT writeRayCloudChunkEnd(std::ofstream &out, const PlyChunkHeader &header);
 
 /// Chunked version of writePlyPointCloud
-bool RAYLIB_EXPORT writePointCloudChunkStart(const std::string &file_name, std::ofstream &out);
-bool RAYLIB_EXPORT writePointCloudChunk(std::ofstream &out, PointPlyBuffer &vertices,
+bool RAYLIB_EXPORT writePointCloudChunkStart(const std::string &file_name, std::ofstream &out, PlyChunkHeader &header);
+bool RAYLIB_EXPORT writePointCloudChunk(std::ofstream &out, const PlyChunkHeader &header, PointPlyBuffer &vertices,
                                         const std::vector<Eigen::Vector3d> &points, const std::vector<double> &times,
                                         const std::vector<RGBA> &colours, bool &has_warned);
-void RAYLIB_EXPORT writePointCloudChunkEnd(std::ofstream &out);
+void RAYLIB_EXPORT writePointCloudChunkEnd(std::ofstream &out, const PlyChunkHeader &header);
 
 /// Simple function for converting a ray cloud according to the per-ray function @c apply
 bool convertCloud(const std::string &in_name, const std::string &out_name,
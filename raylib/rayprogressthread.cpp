@@ -24,11 +24,20 @@ ProgressThread::~ProgressThread()
   join();
 }
 
+void ProgressThread::requestQuit()
+{
+  {
+    std::lock_guard<std::mutex> lock(quit_mutex_);
+    quit_flag_ = true;
+  }
+  quit_requested_.notify_all();
+}
+
 void ProgressThread::join()
 {
   if (running_)
   {
-    quit_flag_ = true;
+    requestQuit();
     thread_.join();
     running_ = false;
   }
@@ -58,7 +67,8 @@ void ProgressThread::run()
       showProgress(current, false, nullptr);
       current.read(&last);
     }
-    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    std::unique_lock<std::mutex> lock(quit_mutex_);
+    quit_requested_.wait_for(lock, std::chrono::milliseconds(200), [this] { return quit_flag_.load(); });
   }
 
   // Past update.
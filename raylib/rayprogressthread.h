@@ -11,6 +11,8 @@
 #include "rayprogress.h"
 
 #include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
 
 namespace ray
@@ -30,7 +32,8 @@ public:
   /// Destructor ensuring the thread is joined.
   ~ProgressThread();
 
-  void requestQuit() { quit_flag_ = true; }
+  /// Stop the display thread. This wakes it up, so that @c join() does not wait for the next display update.
+  void requestQuit();
   void join();
 
 private:
@@ -41,6 +44,8 @@ private:
   Progress &progress_;
   std::atomic_bool quit_flag_;
   std::atomic_bool running_;
+  std::mutex quit_mutex_;
+  std::condition_variable quit_requested_;
   std::thread thread_;
 };
 }  // namespace ray
@@ -0,0 +1,707 @@
+// Copyright (c) 2026
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#include "rayrcz.h"
+#include "raylib/rayprogress.h"
+#include "raylib/rayprogressthread.h"
+#include "raymappedfile.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+namespace ray
+{
+namespace
+{
+const char kRczMagic[4] = { 'R', 'C', 'Z', '1' };
+const uint32_t kRczVersion = 2;
+/// file position of the ray count in the file header
+const size_t kRczNumRaysPos = 24;
+/// total size of the file header
+const size_t kRczHeaderSize = 40;
+/// size of the per-block header: ray count, flags, payload size
+const size_t kRczBlockHeaderSize = 16;
+/// block flag for starts that are interpolated from the trajectory, rather than stored
+const uint32_t kRczTrajectoryStarts = 1;
+
+/// append the binary representation of @c value to @c buffer
+template <class T>
+inline void appendValue(std::vector<uint8_t> &buffer, const T &value)
+{
+  const size_t pos = buffer.size();
+  buffer.resize(pos + sizeof(T));
+  memcpy(&buffer[pos], &value, sizeof(T));
+}
+
+inline uint64_t zigzag(int64_t value)
+{
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value)
+{
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+inline void appendVarint(std::vector<uint8_t> &buffer, uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    buffer.push_back(static_cast<uint8_t>(value) | 0x80);
+    value >>= 7;
+  }
+  buffer.push_back(static_cast<uint8_t>(value));
+}
+
+inline void appendSigned(std::vector<uint8_t> &buffer, int64_t value)
+{
+  appendVarint(buffer, zigzag(value));
+}
+
+/// Bounds checked reading of the encoded values. Reading past the end sets @c failed rather than throwing, so a
+/// corrupt block is reported once it has been decoded
+struct ByteReader
+{
+  ByteReader(const uint8_t *data, size_t size)
+    : pos(data)
+    , end(data + size)
+  {}
+  template <class T>
+  T value()
+  {
+    T result;
+    memset(static_cast<void *>(&result), 0, sizeof(T));
+    if (static_cast<size_t>(end - pos) < sizeof(T))
+    {
+      failed = true;
+      pos = end;
+      return result;
+    }
+    memcpy(static_cast<void *>(&result), pos, sizeof(T));
+    pos += sizeof(T);
+    return result;
+  }
+  uint64_t varint()
+  {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+      if (pos == end)
+      {
+        failed = true;
+        return 0;
+      }
+      const uint8_t byte = *pos++;
+      result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return result;
+    }
+    failed = true;
+    return result;
+  }
+  int64_t signedVarint() { return unzigzag(varint()); }
+  /// returns a reader for the next stream, which is prefixed by its size
+  ByteReader stream()
+  {
+    const uint64_t size = value<uint64_t>();
+    if (failed || size > static_cast<uint64_t>(end - pos))
+    {
+      failed = true;
+      return ByteReader(end, 0);
+    }
+    ByteReader reader(pos, static_cast<size_t>(size));
+    pos += size;
+    return reader;
+  }
+
+  const uint8_t *pos;
+  const uint8_t *end;
+  bool failed = false;
+};
+
+/// Location of a block within the file
+struct RczBlock
+{
+  uint64_t payload_pos;
+  uint64_t payload_size;
+  uint32_t num_rays;
+  uint32_t flags;
+};
+
+/// The fields of the file header
+struct RczHeader
+{
+  uint32_t version;
+  double position_quantum;
+  double time_quantum;
+  uint64_t num_rays;
+  /// file position of the first block
+  uint64_t blocks_pos;
+};
+
+/// Read the file header and the trajectory (for version 2 onwards) that follows it
+bool readRczHeader(std::ifstream &input, const std::string &file_name, RczHeader &header, Trajectory &trajectory)
+{
+  std::vector<uint8_t> buffer(kRczHeaderSize);
+  input.read((char *)buffer.data(), buffer.size());
+  ByteReader header_reader(buffer.data(), input ? buffer.size() : 0);
+  const uint32_t magic = header_reader.value<uint32_t>();
+  header.version = header_reader.value<uint32_t>();
+  header.position_quantum = header_reader.value<double>();
+  header.time_quantum = header_reader.value<double>();
+  header.num_rays = header_reader.value<uint64_t>();
+  header.blocks_pos = kRczHeaderSize;
+  if (header_reader.failed || memcmp(&magic, kRczMagic, 4) != 0)
+  {
+    std::cerr << "Error: " << file_name << " is not a .rcz ray cloud file" << std::endl;
+    return false;
+  }
+  if (header.version < 1 || header.version > kRczVersion)
+  {
+    std::cerr << "Error: unsupported .rcz version " << header.version << " in " << file_name << std::endl;
+    return false;
+  }
+  trajectory.points().clear();
+  trajectory.times().clear();
+  if (header.version == 1)
+  {
+    return true;
+  }
+  uint64_t num_nodes = 0;
+  input.read((char *)&num_nodes, sizeof(num_nodes));
+  const size_t node_size = 4 * sizeof(double);
+  input.seekg(0, input.end);
+  const uint64_t file_size = static_cast<uint64_t>(input.tellg());
+  header.blocks_pos = kRczHeaderSize + sizeof(num_nodes) + num_nodes * node_size;
+  if (!input || header.blocks_pos > file_size)
+  {
+    std::cerr << "Error: truncated trajectory in " << file_name << std::endl;
+    return false;
+  }
+  buffer.resize(num_nodes * node_size);
+  input.seekg(kRczHeaderSize + sizeof(num_nodes));
+  input.read((char *)buffer.data(), buffer.size());
+  ByteReader nodes(buffer.data(), input ? buffer.size() : 0);
+  trajectory.points().resize(num_nodes);
+  trajectory.times().resize(num_nodes);
+  for (uint64_t i = 0; i < num_nodes; i++)
+  {
+    trajectory.times()[i] = nodes.value<double>();
+    for (int j = 0; j < 3; j++) trajectory.points()[i][j] = nodes.value<double>();
+  }
+  if (nodes.failed)
+  {
+    std::cerr << "Error: truncated trajectory in " << file_name << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/// Find the blocks that follow the @c header, checking that they hold the number of rays in the header.
+/// This only reads the block headers, so is fast
+bool readRczBlocks(std::ifstream &input, const std::string &file_name, const RczHeader &header,
+                   std::vector<RczBlock> &blocks)
+{
+  input.seekg(0, input.end);
+  const uint64_t file_size = static_cast<uint64_t>(input.tellg());
+  uint64_t pos = header.blocks_pos;
+  uint64_t total_rays = 0;
+  while (pos + kRczBlockHeaderSize <= file_size)
+  {
+    uint8_t block_header[kRczBlockHeaderSize];
+    input.seekg(pos);
+    input.read((char *)block_header, kRczBlockHeaderSize);
+    ByteReader reader(block_header, input ? kRczBlockHeaderSize : 0);
+    RczBlock block;
+    block.num_rays = reader.value<uint32_t>();
+    block.flags = reader.value<uint32_t>();
+    block.payload_size = reader.value<uint64_t>();
+    block.payload_pos = pos + kRczBlockHeaderSize;
+    if (reader.failed || block.payload_size > file_size - block.payload_pos)
+    {
+      std::cerr << "Error: truncated block in " << file_name << std::endl;
+      return false;
+    }
+    blocks.push_back(block);
+    total_rays += block.num_rays;
+    pos = block.payload_pos + block.payload_size;
+  }
+  if (total_rays != header.num_rays)
+  {
+    std::cerr << "Error: " << file_name << " has " << total_rays << " rays in its blocks, but " << header.num_rays
+              << " in its header. It may not have been finished writing" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/// Decode a block payload of @c num_rays rays into the arrays, which must have space for @c num_rays values
+bool decodeRczBlock(const uint8_t *payload, size_t size, uint32_t num_rays, uint32_t flags, double position_quantum,
+                    double time_quantum, const Trajectory &trajectory, Eigen::Vector3d *starts,
+                    Eigen::Vector3d *ends, double *times, RGBA *colours)
+{
+  ByteReader block(payload, size);
+  Eigen::Vector3d origin;
+  for (int i = 0; i < 3; i++) origin[i] = block.value<double>();
+  const double base_time = block.value<double>();
+  ByteReader end_stream = block.stream();
+  ByteReader start_stream = block.stream();
+  ByteReader time_stream = block.stream();
+  ByteReader colour_stream = block.stream();
+  if (block.failed)
+    return false;
+
+  for (uint32_t i = 0; i < num_rays; i++)
+  {
+    Eigen::Vector3d offset;
+    for (int j = 0; j < 3; j++) offset[j] = static_cast<double>(end_stream.signedVarint());
+    ends[i] = origin + offset * position_quantum;
+  }
+  int64_t time = 0;
+  for (uint32_t i = 0; i < num_rays; i++)
+  {
+    time += time_stream.signedVarint();
+    times[i] = base_time + static_cast<double>(time) * time_quantum;
+  }
+  if (flags & kRczTrajectoryStarts)
+  {
+    if (trajectory.points().empty())
+      return false;
+    trajectory.linear(times, num_rays, starts);
+  }
+  int64_t start[3] = { 0, 0, 0 };
+  for (uint32_t i = 0; i < num_rays && !start_stream.failed && !(flags & kRczTrajectoryStarts);)
+  {
+    const uint64_t run = start_stream.varint();
+    int64_t delta[3];
+    for (int j = 0; j < 3; j++) delta[j] = start_stream.signedVarint();
+    if (run == 0 || run > num_rays - i)
+      return false;
+    for (uint64_t r = 0; r < run; r++, i++)
+    {
+      for (int j = 0; j < 3; j++) start[j] += delta[j];
+      starts[i] = origin + Eigen::Vector3d(static_cast<double>(start[0]), static_cast<double>(start[1]),
+                                           static_cast<double>(start[2])) *
+                             position_quantum;
+    }
+  }
+  for (uint32_t i = 0; i < num_rays && !colour_stream.failed;)
+  {
+    const uint64_t run = colour_stream.varint();
+    const RGBA colour = colour_stream.value<RGBA>();
+    if (run == 0 || run > num_rays - i)
+      return false;
+    for (uint64_t r = 0; r < run; r++, i++) colours[i] = colour;
+  }
+  return !(end_stream.failed || start_stream.failed || time_stream.failed || colour_stream.failed);
+}
+}  // namespace
+
+bool RczWriter::begin(const std::string &file_name, double position_quantum, double time_quantum)
+{
+  out_.open(file_name, std::ios::binary | std::ios::out);
+  if (out_.fail())
+  {
+    std::cerr << "Error: cannot open " << file_name << " for writing." << std::endl;
+    return false;
+  }
+  position_quantum_ = position_quantum;
+  time_quantum_ = time_quantum;
+  num_rays_ = num_blocks_ = 0;
+  trajectory_ = Trajectory();
+  trajectory_written_ = false;
+  has_warned_ = false;
+  buffer_.clear();
+  buffer_.reserve(kRczHeaderSize);
+  appendValue(buffer_, kRczMagic);
+  appendValue(buffer_, kRczVersion);
+  appendValue(buffer_, position_quantum_);
+  appendValue(buffer_, time_quantum_);
+  appendValue(buffer_, num_rays_);  // filled in on end()
+  appendValue(buffer_, num_blocks_);
+  out_.write((const char *)buffer_.data(), buffer_.size());
+  return out_.good();
+}
+
+void RczWriter::setTrajectory(const Trajectory &trajectory)
+{
+  if (trajectory_written_)
+  {
+    std::cerr << "Error: the .rcz trajectory must be set before any rays are written, it is ignored" << std::endl;
+    return;
+  }
+  trajectory_ = trajectory;
+}
+
+bool RczWriter::writeTrajectory()
+{
+  buffer_.clear();
+  appendValue(buffer_, static_cast<uint64_t>(trajectory_.points().size()));
+  for (size_t i = 0; i < trajectory_.points().size(); i++)
+  {
+    appendValue(buffer_, trajectory_.times()[i]);
+    for (int j = 0; j < 3; j++) appendValue(buffer_, trajectory_.points()[i][j]);
+  }
+  out_.write((const char *)buffer_.data(), buffer_.size());
+  trajectory_written_ = true;
+  return out_.good();
+}
+
+bool RczWriter::writeChunk(const std::vector<Eigen::Vector3d> &starts, const std::vector<Eigen::Vector3d> &ends,
+                           const std::vector<double> &times, const std::vector<RGBA> &colours)
+{
+  for (size_t i = 0; i < ends.size(); i++)
+  {
+    // quantisation needs finite values, and these rays would be removed on reading a .ply file anyway
+    if (!ends[i].allFinite() || !starts[i].allFinite() || !std::isfinite(times[i]))
+    {
+      if (!has_warned_)
+      {
+        std::cout << "WARNING: removing non-finite ray " << i << ": " << starts[i].transpose() << ", "
+                  << ends[i].transpose() << ", time " << times[i] << std::endl;
+        has_warned_ = true;
+      }
+      continue;
+    }
+    starts_.push_back(starts[i]);
+    ends_.push_back(ends[i]);
+    times_.push_back(times[i]);
+    colours_.push_back(colours[i]);
+    if (ends_.size() == kRczBlockSize && !writeBlock())
+      return false;
+  }
+  return true;
+}
+
+bool RczWriter::writeBlock()
+{
+  if (!trajectory_written_ && !writeTrajectory())
+    return false;
+  const uint32_t num_rays = static_cast<uint32_t>(ends_.size());
+  if (num_rays == 0)
+    return true;
+  const Eigen::Vector3d origin = ends_[0];
+  const double base_time = times_[0];
+  auto quantise = [&](const Eigen::Vector3d &pos, int64_t *quantised) {
+    for (int j = 0; j < 3; j++) quantised[j] = std::llround((pos[j] - origin[j]) / position_quantum_);
+  };
+
+  // the starts are left out if they are all within the quantisation error of the trajectory, at the times as read
+  uint32_t flags = 0;
+  if (!trajectory_.points().empty())
+  {
+    quantised_times_.resize(num_rays);
+    for (uint32_t i = 0; i < num_rays; i++)
+    {
+      const int64_t quantised = std::llround((times_[i] - base_time) / time_quantum_);
+      quantised_times_[i] = base_time + static_cast<double>(quantised) * time_quantum_;
+    }
+    trajectory_starts_.resize(num_rays);
+    trajectory_.linear(quantised_times_.data(), num_rays, trajectory_starts_.data());
+    flags = kRczTrajectoryStarts;
+    for (uint32_t i = 0; i < num_rays; i++)
+    {
+      if ((trajectory_starts_[i] - starts_[i]).cwiseAbs().maxCoeff() > 0.5 * position_quantum_)
+      {
+        flags = 0;
+        break;
+      }
+    }
+  }
+
+  buffer_.clear();
+  appendValue(buffer_, num_rays);
+  appendValue(buffer_, flags);
+  appendValue(buffer_, uint64_t(0));  // payload size, filled in below
+  for (int j = 0; j < 3; j++) appendValue(buffer_, origin[j]);
+  appendValue(buffer_, base_time);
+  // each stream is prefixed by its size, so that the streams can be found without decoding the previous ones
+  size_t stream_pos = 0;
+  auto beginStream = [&]() {
+    stream_pos = buffer_.size();
+    appendValue(buffer_, uint64_t(0));
+  };
+  auto endStream = [&]() {
+    const uint64_t size = buffer_.size() - stream_pos - sizeof(uint64_t);
+    memcpy(&buffer_[stream_pos], &size, sizeof(size));
+  };
+
+  beginStream();
+  for (auto &end : ends_)
+  {
+    int64_t quantised[3];
+    quantise(end, quantised);
+    for (int j = 0; j < 3; j++) appendSigned(buffer_, quantised[j]);
+  }
+  endStream();
+
+  beginStream();
+  int64_t last_start[3] = { 0, 0, 0 };
+  int64_t run_delta[3] = { 0, 0, 0 };
+  uint64_t run = 0;
+  auto endRun = [&]() {
+    appendVarint(buffer_, run);
+    for (int j = 0; j < 3; j++) appendSigned(buffer_, run_delta[j]);
+  };
+  for (auto &start : starts_)
+  {
+    if (flags & kRczTrajectoryStarts)
+      break;
+    int64_t quantised[3];
+    quantise(start, quantised);
+    const int64_t delta[3] = { quantised[0] - last_start[0], quantised[1] - last_start[1],
+                               quantised[2] - last_start[2] };
+    if (run > 0 && (delta[0] != run_delta[0] || delta[1] != run_delta[1] || delta[2] != run_delta[2]))
+    {
+      endRun();
+      run = 0;
+    }
+    memcpy(run_delta, delta, sizeof(delta));
+    memcpy(last_start, quantised, sizeof(quantised));
+    run++;
+  }
+  if (run > 0)
+    endRun();
+  endStream();
+
+  beginStream();
+  int64_t last_time = 0;
+  for (auto &time : times_)
+  {
+    const int64_t quantised = std::llround((time - base_time) / time_quantum_);
+    appendSigned(buffer_, quantised - last_time);
+    last_time = quantised;
+  }
+  endStream();
+
+  beginStream();
+  for (size_t i = 0; i < colours_.size();)
+  {
+    size_t j = i + 1;
+    while (j < colours_.size() && memcmp(&colours_[j], &colours_[i], sizeof(RGBA)) == 0) j++;
+    appendVarint(buffer_, j - i);
+    appendValue(buffer_, colours_[i]);
+    i = j;
+  }
+  endStream();
+
+  const uint64_t payload_size = buffer_.size() - kRczBlockHeaderSize;
+  memcpy(&buffer_[8], &payload_size, sizeof(payload_size));
+  out_.write((const char *)buffer_.data(), buffer_.size());
+  if (!out_.good())
+  {
+    std::cerr << "error writing to file" << std::endl;
+    return false;
+  }
+  num_rays_ += num_rays;
+  num_blocks_++;
+  starts_.clear();
+  ends_.clear();
+  times_.clear();
+  colours_.clear();
+  return true;
+}
+
+bool RczWriter::end()
+{
+  if (!writeBlock())
+  {
+    out_.close();
+    return false;
+  }
+  out_.seekp(kRczNumRaysPos);
+  out_.write((const char *)&num_rays_, sizeof(num_rays_));
+  out_.write((const char *)&num_blocks_, sizeof(num_blocks_));
+  const bool success = out_.good();
+  out_.close();
+  if (!success)
+  {
+    std::cerr << "error writing to file" << std::endl;
+  }
+  return success;
+}
+
+bool writeRczRayCloud(const std::string &file_name, const std::vector<Eigen::Vector3d> &starts,
+                      const std::vector<Eigen::Vector3d> &ends, const std::vector<double> &times,
+                      const std::vector<RGBA> &colours)
+{
+  RczWriter writer;
+  if (!writer.begin(file_name) || !writer.writeChunk(starts, ends, times, colours) || !writer.end())
+    return false;
+  std::cout << writer.rayCount() << " rays saved to " << file_name << std::endl;
+  return true;
+}
+
+bool readRcz(const std::string &file_name,
+             std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                                std::vector<double> &times, std::vector<RGBA> &colours)>
+               apply,
+             size_t chunk_size, int num_threads)
+{
+  std::cout << "reading: " << file_name << std::endl;
+  std::ifstream input(file_name.c_str(), std::ios::in | std::ios::binary);
+  if (input.fail())
+  {
+    std::cerr << "Couldn't open file: " << file_name << std::endl;
+    return false;
+  }
+  RczHeader header;
+  Trajectory trajectory;
+  if (!readRczHeader(input, file_name, header, trajectory))
+  {
+    return false;
+  }
+  const double position_quantum = header.position_quantum;
+  const double time_quantum = header.time_quantum;
+  std::vector<RczBlock> blocks;
+  if (!readRczBlocks(input, file_name, header, blocks))
+  {
+    return false;
+  }
+
+  MappedFile mapped_file;
+  const bool mapped = mapped_file.open(file_name);
+  std::vector<std::vector<uint8_t>> block_buffers;
+  std::vector<Eigen::Vector3d> starts, ends;
+  std::vector<double> times;
+  std::vector<RGBA> colours;
+  chunk_size = std::max(chunk_size, size_t(1));
+
+  ray::Progress progress;
+  ray::ProgressThread progress_thread(progress);
+  progress.begin("read and process", blocks.size());
+  bool success = true;
+  for (size_t first = 0; first < blocks.size() && success;)
+  {
+    // a chunk is the set of whole blocks that reaches chunk_size rays
+    size_t last = first;
+    size_t chunk_rays = 0;
+    std::vector<size_t> offsets;
+    while (last < blocks.size() && (last == first || chunk_rays + blocks[last].num_rays <= chunk_size))
+    {
+      offsets.push_back(chunk_rays);
+      chunk_rays += blocks[last++].num_rays;
+    }
+    const size_t num_blocks = last - first;
+    std::vector<const uint8_t *> payloads(num_blocks);
+    block_buffers.resize(std::max(block_buffers.size(), num_blocks));
+    for (size_t b = 0; b < num_blocks; b++)
+    {
+      const RczBlock &block = blocks[first + b];
+      if (mapped)
+      {
+        payloads[b] = mapped_file.data() + block.payload_pos;
+        continue;
+      }
+      block_buffers[b].resize(block.payload_size);
+      input.seekg(block.payload_pos);
+      input.read((char *)block_buffers[b].data(), block.payload_size);
+      payloads[b] = block_buffers[b].data();
+    }
+    starts.resize(chunk_rays);
+    ends.resize(chunk_rays);
+    times.resize(chunk_rays);
+    colours.resize(chunk_rays);
+    std::vector<char> decoded(num_blocks, false);
+    auto decode = [&](size_t b) {
+      const RczBlock &block = blocks[first + b];
+      const size_t o = offsets[b];
+      decoded[b] = decodeRczBlock(payloads[b], block.payload_size, block.num_rays, block.flags, position_quantum,
+                                  time_quantum, trajectory, &starts[o], &ends[o], &times[o], &colours[o]);
+    };
+    // the blocks are independent, so are decoded in parallel directly into their part of the chunk
+    const size_t num_workers = std::min(static_cast<size_t>(std::max(num_threads, 1)), num_blocks);
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < num_workers; t++)
+    {
+      workers.emplace_back([&, t]() {
+        for (size_t b = t; b < num_blocks; b += num_workers) decode(b);
+      });
+    }
+    for (size_t b = 0; b < num_blocks; b += num_workers) decode(b);
+    for (auto &worker : workers) worker.join();
+
+    for (size_t b = 0; b < num_blocks; b++)
+    {
+      if (!decoded[b])
+      {
+        std::cerr << "Error: corrupt block " << first + b << " in " << file_name << std::endl;
+        success = false;
+      }
+    }
+    if (success)
+    {
+      apply(starts, ends, times, colours);
+    }
+    if (mapped)
+    {
+      const uint64_t begin = blocks[first].payload_pos;
+      mapped_file.release(begin, blocks[last - 1].payload_pos + blocks[last - 1].payload_size - begin);
+    }
+    progress.increment(num_blocks);
+    first = last;
+  }
+  progress.end();
+  progress_thread.requestQuit();
+  progress_thread.join();
+  return success;
+}
+
+bool readRczTrajectory(const std::string &file_name, Trajectory &trajectory)
+{
+  std::ifstream input(file_name.c_str(), std::ios::in | std::ios::binary);
+  if (input.fail())
+  {
+    std::cerr << "Couldn't open file: " << file_name << std::endl;
+    return false;
+  }
+  RczHeader header;
+  return readRczHeader(input, file_name, header, trajectory);
+}
+
+bool rczStartsOnTrajectory(const std::string &file_name)
+{
+  if (!isRczFile(file_name))
+  {
+    return false;
+  }
+  std::ifstream input(file_name.c_str(), std::ios::in | std::ios::binary);
+  if (input.fail())
+  {
+    return false;
+  }
+  RczHeader header;
+  Trajectory trajectory;
+  std::vector<RczBlock> blocks;
+  if (!readRczHeader(input, file_name, header, trajectory) || trajectory.points().empty() ||
+      !readRczBlocks(input, file_name, header, blocks))
+  {
+    return false;
+  }
+  for (const auto &block : blocks)
+  {
+    if (!(block.flags & kRczTrajectoryStarts))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool readRcz(const std::string &file_name, std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+             std::vector<double> &times, std::vector<RGBA> &colours)
+{
+  auto apply = [&](std::vector<Eigen::Vector3d> &start_points, std::vector<Eigen::Vector3d> &end_points,
+                   std::vector<double> &time_points, std::vector<RGBA> &colour_values) {
+    starts.insert(starts.end(), start_points.begin(), start_points.end());
+    ends.insert(ends.end(), end_points.begin(), end_points.end());
+    times.insert(times.end(), time_points.begin(), time_points.end());
+    colours.insert(colours.end(), colour_values.begin(), colour_values.end());
+  };
+  return readRcz(file_name, apply, std::numeric_limits<size_t>::max());
+}
+}  // namespace ray
@@ -0,0 +1,112 @@
+// Copyright (c) 2026
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#ifndef RAYLIB_RAYRCZ_H
+#define RAYLIB_RAYRCZ_H
+
+#include "raylib/raylibconfig.h"
+
+#include "raytrajectory.h"
+#include "rayutils.h"
+
+#include <fstream>
+
+namespace ray
+{
+/// The .rcz compressed ray cloud format.
+/// The rays are stored in independently decodable blocks of up to kRczBlockSize rays. Within a block:
+/// - ends are quantised to @c position_quantum, relative to the block origin (the first end point)
+/// - starts are quantised in the same way, then delta coded against the previous start, with runs of repeated
+///   deltas stored once. This suits the starts, as they follow a smooth sensor trajectory.
+/// - times are quantised to @c time_quantum relative to the block's base time, then delta coded
+/// - colours are run-length coded
+/// All integers are zigzag varint encoded. The quantisation makes this a lossy format, with a maximum error of half
+/// of the quantum in each position axis and in time.
+/// From version 2 the file may also hold the sensor trajectory, which follows the file header. A block whose starts
+/// all lie on the trajectory (within half a position quantum) stores no starts, they are interpolated from the
+/// trajectory at each ray's time when it is read.
+const uint32_t kRczBlockSize = 1 << 16;
+/// default quantisation of the ray start and end coordinates, in metres
+const double kRczPositionQuantum = 0.0001;
+/// default quantisation of the ray times, in seconds
+const double kRczTimeQuantum = 1e-7;
+
+/// whether @c file_name has the .rcz extension
+inline bool isRczFile(const std::string &file_name)
+{
+  return file_name.size() >= 4 && file_name.compare(file_name.size() - 4, 4, ".rcz") == 0;
+}
+
+/// read in a .rcz ray cloud file, calling the @c apply function one chunk at a time, with chunks of roughly
+/// @c chunk_size rays. @c num_threads greater than 1 decodes the blocks of each chunk concurrently.
+bool RAYLIB_EXPORT readRcz(const std::string &file_name,
+                           std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                                              std::vector<double> &times, std::vector<RGBA> &colours)>
+                             apply,
+                           size_t chunk_size = 1000000, int num_threads = 1);
+
+/// read in a whole .rcz ray cloud file into the fields given by reference
+bool RAYLIB_EXPORT readRcz(const std::string &file_name, std::vector<Eigen::Vector3d> &starts,
+                           std::vector<Eigen::Vector3d> &ends, std::vector<double> &times, std::vector<RGBA> &colours);
+
+/// read the trajectory stored in a .rcz file. This is empty if the file does not reference a trajectory
+bool RAYLIB_EXPORT readRczTrajectory(const std::string &file_name, Trajectory &trajectory);
+
+/// whether @c file_name is a .rcz file with every block referencing its trajectory in place of the ray starts. Such a
+/// file loads exactly as a TrajectoryCloud, whose starts are interpolated from the trajectory
+bool RAYLIB_EXPORT rczStartsOnTrajectory(const std::string &file_name);
+
+/// write a .rcz file representing a ray cloud
+bool RAYLIB_EXPORT writeRczRayCloud(const std::string &file_name, const std::vector<Eigen::Vector3d> &starts,
+                                    const std::vector<Eigen::Vector3d> &ends, const std::vector<double> &times,
+                                    const std::vector<RGBA> &colours);
+
+/// Chunked writing of .rcz files. The rays are collected into blocks of kRczBlockSize, which are compressed and
+/// written as they fill up
+class RAYLIB_EXPORT RczWriter
+{
+public:
+  /// open the file and write the file header
+  bool begin(const std::string &file_name, double position_quantum = kRczPositionQuantum,
+             double time_quantum = kRczTimeQuantum);
+  /// store the ray starts as references to @c trajectory wherever they lie on it. Must be called before the first
+  /// block is written, so before kRczBlockSize rays are added
+  void setTrajectory(const Trajectory &trajectory);
+  /// add a set of rays to the file. These can be any number of rays, including 0
+  bool writeChunk(const std::vector<Eigen::Vector3d> &starts, const std::vector<Eigen::Vector3d> &ends,
+                  const std::vector<double> &times, const std::vector<RGBA> &colours);
+  /// write the remaining rays and fill in the ray count in the file header. Returns false if the file could not be
+  /// written
+  bool end();
+  /// the number of rays written to the file so far
+  unsigned long rayCount() const { return static_cast<unsigned long>(num_rays_); }
+
+private:
+  bool writeTrajectory();
+  bool writeBlock();
+
+  std::ofstream out_;
+  double position_quantum_ = kRczPositionQuantum;
+  double time_quantum_ = kRczTimeQuantum;
+  uint64_t num_rays_ = 0;
+  uint64_t num_blocks_ = 0;
+  /// the trajectory that the ray starts reference, written to file before the first block
+  Trajectory trajectory_;
+  bool trajectory_written_ = false;
+  /// whether a warning has been issued or not. This prevents multiple warnings.
+  bool has_warned_ = false;
+  /// the rays of the block being filled
+  std::vector<Eigen::Vector3d> starts_, ends_;
+  std::vector<double> times_;
+  std::vector<RGBA> colours_;
+  /// the trajectory positions at the block's quantised times
+  std::vector<double> quantised_times_;
+  std::vector<Eigen::Vector3d> trajectory_starts_;
+  /// encoding buffer, kept to avoid repeated reallocations
+  std::vector<uint8_t> buffer_;
+};
+}  // namespace ray
+
+#endif  // RAYLIB_RAYRCZ_H
@@ -7,6 +7,7 @@
 #include "imagewrite.h"
 #include "raycloud.h"
 #include "raylib/raylibconfig.h"
+#include "rayparallel.h"
 #include "rayparse.h"
 #if RAYLIB_WITH_TIFF   // build option to support outputting to geotif (.tif) format
 #include "geotiffio.h" /* for GeoTIFF */
@@ -275,104 +276,202 @@ void DensityGrid::calculateDensities(const std::string &file_name)
 {
   auto calculate = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends, std::vector<double> &,
                        std::vector<RGBA> &colours) {
-    for (size_t i = 0; i < ends.size(); ++i)
+    const auto add_rays = [&](SparseGrid<Voxel> &voxels, size_t begin, size_t end)
     {
-      Eigen::Vector3d start = starts[i];
-      Eigen::Vector3d end = ends[i];
-      if (!bounds_.clipRay(start, end, 1e-10))
+      RayAdder adder(voxels, voxel_width_);
+      for (size_t i = begin; i < end; ++i)
       {
-        continue; // ray is outside of bounds
+        Eigen::Vector3d start = starts[i];
+        Eigen::Vector3d end = ends[i];
+        if (!bounds_.clipRay(start, end, 1e-10))
+        {
+          continue; // ray is outside of bounds
+        }
+        adder.bounded = colours[i].alpha > 0;
+        walkGrid((start - bounds_.min_bound_) / voxel_width_, (end - bounds_.min_bound_) / voxel_width_, adder);
       }
-      bounded_ = colours[i].alpha > 0;
-      walkGrid((start - bounds_.min_bound_) / voxel_width_, (end - bounds_.min_bound_) / voxel_width_, *this);
+    };
+    if (parallelWorkerCount() == 1)
+    {
+      add_rays(voxels_, 0, ends.size());
+      return;
+    }
+    // accumulate into a sparse grid per worker, then sum them into the main grid
+    std::vector<SparseGrid<Voxel>> worker_voxels(parallelWorkerCount());
+    parallelRanges(0, ends.size(), [&](size_t begin, size_t end, int worker) {
+      add_rays(worker_voxels[worker], begin, end);
+    });
+    for (auto &voxels : worker_voxels)
+    {
+      voxels_.merge(voxels, [](Voxel &voxel, const Voxel &other) { voxel += other; });
     }
   };
-  Cloud::read(file_name, calculate);
+  Cloud::read(file_name, bounds_, calculate);
 }
 
 // This is a form of windowed average over the Moore neighbourhood (3x3x3) window.
+// The result for each voxel is shifted -1,-1,-1, and the voxels at the upper boundary keep their unblended values.
 void DensityGrid::addNeighbourPriors()
 {
 #if DENSITY_MIN_RAYS > 0
-  const int X = 1;
-  const int Y = voxel_dims_[0];
-  const int Z = voxel_dims_[0] * voxel_dims_[1];
+  const Eigen::Vector3i one(1, 1, 1);
+  const Eigen::Vector3i max_interior = voxel_dims_ - Eigen::Vector3i(2, 2, 2);
   DensityGrid::Voxel neighbours;
   double num_hit_points = 0.0;
   double num_hit_points_unsatisfied = 0.0;
+  using Leaf = SparseGrid<Voxel>::Leaf;
+  const int leaf_width = 1 << SparseGrid<Voxel>::kLeafBits;
+
+  // only the voxels in the Moore neighbourhood of a voxel that rays passed through can be non-empty once blended
+  SparseGrid<Voxel> blended;
+  SparseGrid<Voxel>::Accessor blended_accessor(blended);
+  voxels_.forEachActive([&](const Eigen::Vector3i &q, const Voxel &vox) {
+    if (q.minCoeff() < 0 || q[0] > max_interior[0] - 1 || q[1] > max_interior[1] - 1 || q[2] > max_interior[2] - 1)
+    {
+      blended_accessor.voxel(q) = vox;  // not overwritten by a shifted result
+    }
+  });
+  // mark the voxels in the Moore neighbourhood of each active voxel, in the active masks of a grid of the same leaves
+  SparseGrid<bool> todo;
+  voxels_.forEachLeaf([&](const Leaf &leaf) {
+    SparseGrid<bool>::Leaf *todo_leaves[27];
+    for (int i = 0; i < 27; i++)
+    {
+      todo_leaves[i] = &todo.touchLeaf(leaf.origin + leaf_width * (Eigen::Vector3i(i % 3, (i / 3) % 3, i / 9) - one));
+    }
+    for (int l = 0; l < SparseGrid<Voxel>::kLeafSize; l++)
+    {
+      if (!leaf.active[l])
+      {
+        continue;
+      }
+      const Eigen::Vector3i local = SparseGrid<Voxel>::localIndex(l);
+      for (int i = 0; i < 27; i++)
+      {
+        const Eigen::Vector3i offset =
+          local + Eigen::Vector3i(i % 3, (i / 3) % 3, i / 9) + Eigen::Vector3i::Constant(leaf_width - 1);
+        const Eigen::Vector3i leaf_index = offset / leaf_width;
+        todo_leaves[leaf_index[0] + 3 * leaf_index[1] + 9 * leaf_index[2]]->active.set(
+          SparseGrid<Voxel>::localOffset(offset - leaf_width * leaf_index));
+      }
+    }
+  });
 
-  // This simple 3x3x3 convolution needs to be a bit sneaky to avoid having to double the memory cost.
-  // well, not that sneaky, we just shift the output -1,-1,-1 for each cell
-  for (int x = 1; x < voxel_dims_[0] - 1; x++)
-  {
-    for (int y = 1; y < voxel_dims_[1] - 1; y++)
+  // each leaf is blended within a dense block of the leaf and a border of one voxel, to index neighbours by offset
+  const int pad_width = leaf_width + 2;
+  const int X = 1;
+  const int Y = pad_width;
+  const int Z = pad_width * pad_width;
+  std::vector<Voxel> block(pad_width * pad_width * pad_width);
+  const Voxel empty_voxel;
+  todo.forEachLeaf([&](const SparseGrid<bool>::Leaf &todo_leaf) {
+    const Eigen::Vector3i &origin = todo_leaf.origin;
+    const Leaf *leaves[27];
+    for (int i = 0; i < 27; i++)
     {
-      for (int z = 1; z < voxel_dims_[2] - 1; z++)
+      leaves[i] = voxels_.leaf(origin + leaf_width * (Eigen::Vector3i(i % 3, (i / 3) % 3, i / 9) - one));
+    }
+    int b = 0;
+    for (int z = 0; z < pad_width; z++)
+    {
+      for (int y = 0; y < pad_width; y++)
       {
-        const int ind = getIndex(Eigen::Vector3i(x, y, z));
-        if (voxels_[ind].numHits() > 0)
-          num_hit_points++;
-        float needed = DENSITY_MIN_RAYS - voxels_[ind].numRays();
-        const DensityGrid::Voxel corner_vox = voxels_[ind - X - Y - Z];
-        voxels_[ind - X - Y - Z] = voxels_[ind];  // move centre up to corner
-        DensityGrid::Voxel &voxel = voxels_[ind - X - Y - Z];
-        if (needed < 0.0)
-          continue;
-        neighbours = voxels_[ind - X];
-        neighbours += voxels_[ind + X];
-        neighbours += voxels_[ind - Y];
-        neighbours += voxels_[ind + Y];
-        neighbours += voxels_[ind - Z];
-        neighbours += voxels_[ind + Z];
-        if (neighbours.numRays() >= needed)
+        for (int x = 0; x < pad_width; x++, b++)
         {
-          voxel += neighbours * (needed / neighbours.numRays());  // add minimal amount to reach DENSITY_MIN_RAYS
-          continue;
+          const Eigen::Vector3i offset = Eigen::Vector3i(x, y, z) + Eigen::Vector3i::Constant(leaf_width - 1);
+          const Eigen::Vector3i leaf_index = offset / leaf_width;
+          const Leaf *leaf = leaves[leaf_index[0] + 3 * leaf_index[1] + 9 * leaf_index[2]];
+          const int local = leaf ? SparseGrid<Voxel>::localOffset(offset - leaf_width * leaf_index) : 0;
+          block[b] = leaf && leaf->active[local] ? leaf->values[local] : empty_voxel;
         }
-        voxel += neighbours;
-        needed -= neighbours.numRays();
-
-        neighbours = voxels_[ind - X - Y];
-        neighbours += voxels_[ind - X + Y];
-        neighbours += voxels_[ind + X - Y];
-        neighbours += voxels_[ind + X + Y];
-
-        neighbours += voxels_[ind - X - Z];
-        neighbours += voxels_[ind - X + Z];
-        neighbours += voxels_[ind + X - Z];
-        neighbours += voxels_[ind + X + Z];
-
-        neighbours += voxels_[ind - Y - Z];
-        neighbours += voxels_[ind - Y + Z];
-        neighbours += voxels_[ind + Y - Z];
-        neighbours += voxels_[ind + Y + Z];
-        if (neighbours.numRays() >= needed)
-        {
-          voxel += neighbours * (needed / neighbours.numRays());  // add minimal amount to reach DENSITY_MIN_RAYS
-          continue;
-        }
-        voxel += neighbours;
-        needed -= neighbours.numRays();
-
-        neighbours = corner_vox;
-        neighbours += voxels_[ind - X - Y + Z];
-        neighbours += voxels_[ind - X + Y - Z];
-        neighbours += voxels_[ind + X - Y - Z];
-        neighbours += voxels_[ind - X + Y + Z];
-        neighbours += voxels_[ind + X - Y + Z];
-        neighbours += voxels_[ind + X + Y - Z];
-        neighbours += voxels_[ind + X + Y + Z];
-        if (neighbours.numRays() >= needed)
+      }
+    }
+    for (int l = 0; l < SparseGrid<Voxel>::kLeafSize; l++)
+    {
+      const Eigen::Vector3i local = SparseGrid<Voxel>::localIndex(l);
+      const Eigen::Vector3i ind = origin + local;
+      if (!todo_leaf.active[l] || ind.minCoeff() < 1 || ind[0] > max_interior[0] || ind[1] > max_interior[1] ||
+          ind[2] > max_interior[2])
+      {
+        continue;
+      }
+      const int c = (local[0] + 1) * X + (local[1] + 1) * Y + (local[2] + 1) * Z;
+      const DensityGrid::Voxel centre = block[c];
+      if (centre.numHits() > 0)
+        num_hit_points++;
+      float needed = DENSITY_MIN_RAYS - centre.numRays();
+      DensityGrid::Voxel voxel = centre;
+      const auto store = [&]()
+      {
+        if (voxel.numRays() > 0.0)
         {
-          voxel += neighbours * (needed / neighbours.numRays());  // add minimal amount to reach DENSITY_MIN_RAYS
-          continue;
+          blended_accessor.voxel(ind - one) = voxel;  // move centre up to corner
         }
-        voxel += neighbours;
-        if (voxels_[ind].numHits() > 0)
-          num_hit_points_unsatisfied++;
+      };
+      if (needed < 0.0)
+      {
+        store();
+        continue;
       }
+      neighbours = block[c - X];
+      neighbours += block[c + X];
+      neighbours += block[c - Y];
+      neighbours += block[c + Y];
+      neighbours += block[c - Z];
+      neighbours += block[c + Z];
+      if (neighbours.numRays() >= needed)
+      {
+        voxel += neighbours * (needed / neighbours.numRays());  // add minimal amount to reach DENSITY_MIN_RAYS
+        store();
+        continue;
+      }
+      voxel += neighbours;
+      needed -= neighbours.numRays();
+
+      neighbours = block[c - X - Y];
+      neighbours += block[c - X + Y];
+      neighbours += block[c + X - Y];
+      neighbours += block[c + X + Y];
+
+      neighbours += block[c - X - Z];
+      neighbours += block[c - X + Z];
+      neighbours += block[c + X - Z];
+      neighbours += block[c + X + Z];
+
+      neighbours += block[c - Y - Z];
+      neighbours += block[c - Y + Z];
+      neighbours += block[c + Y - Z];
+      neighbours += block[c + Y + Z];
+      if (neighbours.numRays() >= needed)
+      {
+        voxel += neighbours * (needed / neighbours.numRays());  // add minimal amount to reach DENSITY_MIN_RAYS
+        store();
+        continue;
+      }
+      voxel += neighbours;
+      needed -= neighbours.numRays();
+
+      neighbours = block[c - X - Y - Z];
+      neighbours += block[c - X - Y + Z];
+      neighbours += block[c - X + Y - Z];
+      neighbours += block[c + X - Y - Z];
+      neighbours += block[c - X + Y + Z];
+      neighbours += block[c + X - Y + Z];
+      neighbours += block[c + X + Y - Z];
+      neighbours += block[c + X + Y + Z];
+      if (neighbours.numRays() >= needed)
+      {
+        voxel += neighbours * (needed / neighbours.numRays());  // add minimal amount to reach DENSITY_MIN_RAYS
+        store();
+        continue;
+      }
+      voxel += neighbours;
+      store();
+      if (centre.numHits() > 0)
+        num_hit_points_unsatisfied++;
     }
-  }
+  });
+  voxels_ = std::move(blended);
   const double percentage = 100.0 * num_hit_points_unsatisfied / num_hit_points;
   std::cout << "Density calculation: " << percentage << "% of voxels had insufficient (<" << DENSITY_MIN_RAYS
             << ") rays within them" << std::endl;
@@ -437,22 +536,16 @@ bool renderCloud(const std::string &cloud_file, const Cuboid &bounds, ViewDirect
 
       grid.addNeighbourPriors();
 
-      for (int x = 0; x < width; x++)
-      {
-        for (int y = 0; y < height; y++)
+      // sum the densities along the view axis, only the voxels that rays passed through can be non-zero
+      grid.voxels().forEachActive([&](const Eigen::Vector3i &ind, const DensityGrid::Voxel &voxel) {
+        const int x = ind[ax1], y = ind[ax2];
+        if (x < 0 || x >= width || y < 0 || y >= height || ind[axis] < 0 || ind[axis] >= depth)
         {
-          double total_density = 0.0;
-          for (int z = 0; z < depth; z++)
-          {
-            Eigen::Vector3i ind;
-            ind[axis] = z;
-            ind[ax1] = x;
-            ind[ax2] = y;
-            total_density += grid.voxels()[grid.getIndex(ind)].density();
-          }
-          pixels[x + width * y] = Eigen::Vector4d(total_density, total_density, total_density, total_density);
+          return;
         }
-      }
+        const double density = voxel.density();
+        pixels[x + width * y] += Eigen::Vector4d(density, density, density, density);
+      });
     }
     else  // otherwise we use a common algorithm, specialising on render style only per-ray
     {
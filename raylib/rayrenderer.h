@@ -8,6 +8,7 @@
 
 #include "raycuboid.h"
 #include "raypose.h"
+#include "raysparsegrid.h"
 #include "rayutils.h"
 
 namespace ray
@@ -53,6 +54,7 @@ bool RAYLIB_EXPORT writeGeoTiffFloat(const std::string &filename, int x, int y,
 /// It is most effective as a measure of leaf area per volume on vegetation, and is described in:
 /// Lowe, Thomas, et al. "Canopy Density Estimation in Perennial Horticulture Crops Using 3D Spinning LiDAR SLAM."
 /// arXiv preprint arXiv:2007.15652 (2020).
+/// The voxels are stored sparsely, so only those that rays pass through take memory.
 struct RAYLIB_EXPORT DensityGrid
 {
   static const int min_voxel_hits = 2;
@@ -63,9 +65,7 @@ struct RAYLIB_EXPORT DensityGrid
     : bounds_(grid_bounds)
     , voxel_width_(vox_width)
     , voxel_dims_(dims)
-  {
-    voxels_.resize(dims[0] * dims[1] * dims[2]);
-  }
+  {}
 
   /// This specific voxel class represents a density
   class Voxel
@@ -99,23 +99,37 @@ struct RAYLIB_EXPORT DensityGrid
   /// To void low-ray-count voxels giving unstable density estimates, we fuse with neighbour information
   /// up to a specified minimum number of rays. Specified in DENSITY_MIN_RAYS
   void addNeighbourPriors();
-  /// Note, for performance, this index function does not check that the specified indices are in valid bounds.
-  /// It is up to the calling function to assure this condition
-  inline int getIndex(const Eigen::Vector3i &inds) const;
-  inline int getIndexFromPos(const Eigen::Vector3d &pos) const;
-  /// Return the vector of density voxels
-  inline const std::vector<Voxel> &voxels() const { return voxels_; }
+  /// the voxel index containing position @c pos
+  inline Eigen::Vector3i getIndexFromPos(const Eigen::Vector3d &pos) const;
+  /// the density voxel at @c inds, which is empty if no rays passed through it
+  inline const Voxel &voxel(const Eigen::Vector3i &inds) const;
+  /// Return the sparse grid of density voxels, use forEachActive to iterate over the voxels that rays passed through
+  inline const SparseGrid<Voxel> &voxels() const { return voxels_; }
   inline Eigen::Vector3i dimensions(){ return voxel_dims_; }
   inline Cuboid bounds(){ return bounds_; }
   inline double voxelWidth() const { return voxel_width_; }
-  // used in walking grid only
-  inline bool operator()(const Eigen::Vector3i &p, const Eigen::Vector3i &target, double in_length, double out_length, double max_length);
 private:
+  /// adds each ray to the voxels that it passes through, for use with walkGrid
+  class RayAdder
+  {
+  public:
+    RayAdder(SparseGrid<Voxel> &voxels, double voxel_width)
+      : accessor_(voxels)
+      , voxel_width_(voxel_width)
+    {}
+    inline bool operator()(const Eigen::Vector3i &p, const Eigen::Vector3i &target, double in_length,
+                           double out_length, double max_length);
+    bool bounded = false;
+
+  private:
+    SparseGrid<Voxel>::Accessor accessor_;
+    double voxel_width_;
+  };
+
   Cuboid bounds_;
-  std::vector<Voxel> voxels_;
+  SparseGrid<Voxel> voxels_;
   double voxel_width_;
   Eigen::Vector3i voxel_dims_;
-  bool bounded_;
 };
 
 // inline functions
@@ -162,26 +176,29 @@ void DensityGrid::Voxel::addMissRay(float length)
   path_length_ += length;
   num_rays_++;
 }
-int DensityGrid::getIndex(const Eigen::Vector3i &inds) const
+Eigen::Vector3i DensityGrid::getIndexFromPos(const Eigen::Vector3d &pos) const
 {
-  return inds[0] + inds[1] * voxel_dims_[0] + inds[2] * voxel_dims_[0] * voxel_dims_[1];
+  Eigen::Vector3d gridspace = (pos - bounds_.min_bound_) / voxel_width_;
+  return gridspace.cast<int>();
 }
-int DensityGrid::getIndexFromPos(const Eigen::Vector3d &pos) const
+const DensityGrid::Voxel &DensityGrid::voxel(const Eigen::Vector3i &inds) const
 {
-  Eigen::Vector3d gridspace = (pos - bounds_.min_bound_) / voxel_width_;
-  return getIndex(gridspace.cast<int>());
+  static const Voxel empty_voxel;
+  const Voxel *voxel = voxels_.find(inds);
+  return voxel ? *voxel : empty_voxel;
 }
-inline bool DensityGrid::operator()(const Eigen::Vector3i &p, const Eigen::Vector3i &target, double in_length, double out_length, double max_length)
+bool DensityGrid::RayAdder::operator()(const Eigen::Vector3i &p, const Eigen::Vector3i &target, double in_length,
+                                       double out_length, double max_length)
 {
-  int index = getIndex(p);
-  if (p == target && bounded_)
+  Voxel &voxel = accessor_.voxel(p);
+  if (p == target && bounded)
   {
     double length_in_voxel = std::min(out_length, max_length) - in_length;
-    voxels_[index].addHitRay(static_cast<float>(length_in_voxel * voxel_width_));
+    voxel.addHitRay(static_cast<float>(length_in_voxel * voxel_width_));
   }
   else
   {
-    voxels_[index].addMissRay(static_cast<float>((out_length - in_length) * voxel_width_));
+    voxel.addMissRay(static_cast<float>((out_length - in_length) * voxel_width_));
   }
   return false;
 }
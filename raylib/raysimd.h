@@ -0,0 +1,156 @@
+// Copyright (c) 2026
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#ifndef RAYLIB_RAYSIMD_H
+#define RAYLIB_RAYSIMD_H
+
+#include "raylib/raylibconfig.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace ray
+{
+/// 4 lanes of doubles and of ints, on AVX2, SSE2, or plain arrays otherwise. The comparisons give lane masks of all
+/// bits set, and are false for NaNs, as the ordered comparison intrinsics are.
+namespace simd
+{
+#if defined(__AVX2__)
+struct Double4
+{
+  __m256d v;
+};
+struct Int4
+{
+  __m128i v;
+};
+inline Double4 load(const double *p) { return { _mm256_load_pd(p) }; }
+inline void store(double *p, Double4 a) { _mm256_store_pd(p, a.v); }
+inline Int4 load(const int *p) { return { _mm_load_si128(reinterpret_cast<const __m128i *>(p)) }; }
+inline void store(int *p, Int4 a) { _mm_store_si128(reinterpret_cast<__m128i *>(p), a.v); }
+inline Double4 operator+(Double4 a, Double4 b) { return { _mm256_add_pd(a.v, b.v) }; }
+inline Double4 operator&(Double4 a, Double4 b) { return { _mm256_and_pd(a.v, b.v) }; }
+inline Double4 andNot(Double4 a, Double4 b) { return { _mm256_andnot_pd(a.v, b.v) }; }
+inline Double4 less(Double4 a, Double4 b) { return { _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ) }; }
+inline Double4 min(Double4 a, Double4 b) { return { _mm256_min_pd(a.v, b.v) }; }
+inline Double4 set(double a) { return { _mm256_set1_pd(a) }; }
+inline Double4 operator-(Double4 a, Double4 b) { return { _mm256_sub_pd(a.v, b.v) }; }
+inline Double4 operator*(Double4 a, Double4 b) { return { _mm256_mul_pd(a.v, b.v) }; }
+inline Double4 operator/(Double4 a, Double4 b) { return { _mm256_div_pd(a.v, b.v) }; }
+inline Double4 sqrt(Double4 a) { return { _mm256_sqrt_pd(a.v) }; }
+inline int moveMask(Double4 mask) { return _mm256_movemask_pd(mask.v); }
+inline Int4 operator+(Int4 a, Int4 b) { return { _mm_add_epi32(a.v, b.v) }; }
+inline Int4 operator&(Int4 a, Int4 b) { return { _mm_and_si128(a.v, b.v) }; }
+inline Int4 equal(Int4 a, Int4 b) { return { _mm_cmpeq_epi32(a.v, b.v) }; }
+/// the 64 bit lane masks as 32 bit lane masks
+inline Int4 narrow(Double4 mask)
+{
+  const __m256i odd = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+  return { _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(_mm256_castpd_si256(mask.v), odd)) };
+}
+inline int moveMask(Int4 mask) { return _mm_movemask_ps(_mm_castsi128_ps(mask.v)); }
+#elif defined(__SSE2__)
+struct Double4
+{
+  __m128d lo, hi;
+};
+struct Int4
+{
+  __m128i v;
+};
+inline Double4 load(const double *p) { return { _mm_load_pd(p), _mm_load_pd(p + 2) }; }
+inline void store(double *p, Double4 a)
+{
+  _mm_store_pd(p, a.lo);
+  _mm_store_pd(p + 2, a.hi);
+}
+inline Int4 load(const int *p) { return { _mm_load_si128(reinterpret_cast<const __m128i *>(p)) }; }
+inline void store(int *p, Int4 a) { _mm_store_si128(reinterpret_cast<__m128i *>(p), a.v); }
+inline Double4 operator+(Double4 a, Double4 b) { return { _mm_add_pd(a.lo, b.lo), _mm_add_pd(a.hi, b.hi) }; }
+inline Double4 operator&(Double4 a, Double4 b) { return { _mm_and_pd(a.lo, b.lo), _mm_and_pd(a.hi, b.hi) }; }
+inline Double4 andNot(Double4 a, Double4 b) { return { _mm_andnot_pd(a.lo, b.lo), _mm_andnot_pd(a.hi, b.hi) }; }
+inline Double4 less(Double4 a, Double4 b) { return { _mm_cmplt_pd(a.lo, b.lo), _mm_cmplt_pd(a.hi, b.hi) }; }
+inline Double4 min(Double4 a, Double4 b) { return { _mm_min_pd(a.lo, b.lo), _mm_min_pd(a.hi, b.hi) }; }
+inline Double4 set(double a) { return { _mm_set1_pd(a), _mm_set1_pd(a) }; }
+inline Double4 operator-(Double4 a, Double4 b) { return { _mm_sub_pd(a.lo, b.lo), _mm_sub_pd(a.hi, b.hi) }; }
+inline Double4 operator*(Double4 a, Double4 b) { return { _mm_mul_pd(a.lo, b.lo), _mm_mul_pd(a.hi, b.hi) }; }
+inline Double4 operator/(Double4 a, Double4 b) { return { _mm_div_pd(a.lo, b.lo), _mm_div_pd(a.hi, b.hi) }; }
+inline Double4 sqrt(Double4 a) { return { _mm_sqrt_pd(a.lo), _mm_sqrt_pd(a.hi) }; }
+inline int moveMask(Double4 mask) { return _mm_movemask_pd(mask.lo) | (_mm_movemask_pd(mask.hi) << 2); }
+inline Int4 operator+(Int4 a, Int4 b) { return { _mm_add_epi32(a.v, b.v) }; }
+inline Int4 operator&(Int4 a, Int4 b) { return { _mm_and_si128(a.v, b.v) }; }
+inline Int4 equal(Int4 a, Int4 b) { return { _mm_cmpeq_epi32(a.v, b.v) }; }
+inline Int4 narrow(Double4 mask)
+{
+  return { _mm_castps_si128(
+    _mm_shuffle_ps(_mm_castpd_ps(mask.lo), _mm_castpd_ps(mask.hi), _MM_SHUFFLE(2, 0, 2, 0))) };
+}
+inline int moveMask(Int4 mask) { return _mm_movemask_ps(_mm_castsi128_ps(mask.v)); }
+#else
+struct Double4
+{
+  double v[4];
+};
+struct Int4
+{
+  int v[4];
+};
+/// the bitwise operations are on the bit patterns of the doubles, as for the intrinsics
+inline uint64_t bits(double d)
+{
+  uint64_t b;
+  std::memcpy(&b, &d, sizeof(b));
+  return b;
+}
+inline double fromBits(uint64_t b)
+{
+  double d;
+  std::memcpy(&d, &b, sizeof(d));
+  return d;
+}
+inline Double4 load(const double *p) { return { { p[0], p[1], p[2], p[3] } }; }
+inline void store(double *p, Double4 a) { std::copy(a.v, a.v + 4, p); }
+inline Int4 load(const int *p) { return { { p[0], p[1], p[2], p[3] } }; }
+inline void store(int *p, Int4 a) { std::copy(a.v, a.v + 4, p); }
+#define RAYLIB_LANES(expression)                 \
+  for (int i = 0; i < 4; i++) r.v[i] = expression; \
+  return r
+inline Double4 operator+(Double4 a, Double4 b) { Double4 r; RAYLIB_LANES(a.v[i] + b.v[i]); }
+inline Double4 operator&(Double4 a, Double4 b) { Double4 r; RAYLIB_LANES(fromBits(bits(a.v[i]) & bits(b.v[i]))); }
+inline Double4 andNot(Double4 a, Double4 b) { Double4 r; RAYLIB_LANES(fromBits(~bits(a.v[i]) & bits(b.v[i]))); }
+inline Double4 less(Double4 a, Double4 b) { Double4 r; RAYLIB_LANES(fromBits(a.v[i] < b.v[i] ? ~uint64_t(0) : 0)); }
+inline Double4 min(Double4 a, Double4 b) { Double4 r; RAYLIB_LANES(a.v[i] < b.v[i] ? a.v[i] : b.v[i]); }
+inline Double4 set(double a) { return { { a, a, a, a } }; }
+inline Double4 operator-(Double4 a, Double4 b) { Double4 r; RAYLIB_LANES(a.v[i] - b.v[i]); }
+inline Double4 operator*(Double4 a, Double4 b) { Double4 r; RAYLIB_LANES(a.v[i] * b.v[i]); }
+inline Double4 operator/(Double4 a, Double4 b) { Double4 r; RAYLIB_LANES(a.v[i] / b.v[i]); }
+inline Double4 sqrt(Double4 a) { Double4 r; RAYLIB_LANES(std::sqrt(a.v[i])); }
+inline Int4 operator+(Int4 a, Int4 b) { Int4 r; RAYLIB_LANES(a.v[i] + b.v[i]); }
+inline Int4 operator&(Int4 a, Int4 b) { Int4 r; RAYLIB_LANES(a.v[i] & b.v[i]); }
+inline Int4 equal(Int4 a, Int4 b) { Int4 r; RAYLIB_LANES(a.v[i] == b.v[i] ? -1 : 0); }
+inline Int4 narrow(Double4 mask) { Int4 r; RAYLIB_LANES(bits(mask.v[i]) ? -1 : 0); }
+#undef RAYLIB_LANES
+inline int moveMask(Int4 mask)
+{
+  return (mask.v[0] < 0 ? 1 : 0) | (mask.v[1] < 0 ? 2 : 0) | (mask.v[2] < 0 ? 4 : 0) | (mask.v[3] < 0 ? 8 : 0);
+}
+inline int moveMask(Double4 mask)
+{
+  return (bits(mask.v[0]) >> 63) | ((bits(mask.v[1]) >> 63) << 1) | ((bits(mask.v[2]) >> 63) << 2) |
+         ((bits(mask.v[3]) >> 63) << 3);
+}
+#endif
+}  // namespace simd
+}  // namespace ray
+
+#endif  // RAYLIB_RAYSIMD_H
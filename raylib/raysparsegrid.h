@@ -0,0 +1,354 @@
+// Copyright (c) 2026
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#ifndef RAYLIB_RAYSPARSEGRID_H
+#define RAYLIB_RAYSPARSEGRID_H
+
+#include "raylib/raylibconfig.h"
+
+#include "rayutils.h"
+
+#include <algorithm>
+#include <bitset>
+#include <deque>
+#include <iterator>
+#include <unordered_map>
+
+namespace ray
+{
+/// Sparse 3D voxel container, in the style of OpenVDB. A hash map at the root holds internal nodes of 16x16x16
+/// leaves, and each leaf is a dense 8x8x8 brick of voxels with a mask of the active ones. So the memory is proportional
+/// to the occupied bricks, rather than to the bounding box, as it is for a dense array.
+/// A voxel becomes active when it is first accessed for writing, and only active voxels are iterated over.
+/// Voxel indices may be negative, and must be within +-2^20 in each axis. Voxels outside this range are not stored:
+/// writes to them go to a discarded leaf, with a warning on the first occurrence, and they are never found.
+template <class T>
+class SparseGrid
+{
+public:
+  static constexpr int kLeafBits = 3;
+  static constexpr int kInternalBits = 4;
+  /// the number of voxels in a leaf brick
+  static constexpr int kLeafSize = 1 << (3 * kLeafBits);
+  /// the number of leaves in an internal node
+  static constexpr int kInternalSize = 1 << (3 * kInternalBits);
+
+  /// a dense brick of voxels, with the index of its first voxel. The values are value initialised, so an activated
+  /// voxel starts as T()
+  struct Leaf
+  {
+    Eigen::Vector3i origin;
+    std::bitset<kLeafSize> active;
+    T values[kLeafSize]{};
+  };
+
+  /// Fast access to the voxels of a grid, which caches the most recently used leaf. Neighbouring voxels along a ray
+  /// mostly share a leaf, so this is the accessor to use when walking rays through the grid. Each thread should
+  /// have its own accessor.
+  class Accessor
+  {
+  public:
+    explicit Accessor(SparseGrid<T> &grid)
+      : grid_(grid)
+    {}
+    /// the voxel at @c index, which is activated if it isn't already
+    T &voxel(const Eigen::Vector3i &index)
+    {
+      size_t local;
+      const uint64_t key = leafKey(index, local);
+      if (key == kNoLeaf)
+      {
+        return grid_.voxel(index);
+      }
+      if (key != key_)
+      {
+        leaf_ = &grid_.touchLeaf(index);
+        key_ = key;
+      }
+      leaf_->active.set(local);
+      return leaf_->values[local];
+    }
+
+  private:
+    SparseGrid<T> &grid_;
+    Leaf *leaf_ = nullptr;
+    uint64_t key_ = kNoLeaf;
+  };
+
+  SparseGrid() = default;
+
+  /// the voxel at @c index, which is activated if it isn't already
+  T &voxel(const Eigen::Vector3i &index)
+  {
+    size_t local;
+    leafKey(index, local);
+    Leaf &leaf = touchLeaf(index);
+    leaf.active.set(local);
+    return leaf.values[local];
+  }
+
+  /// the voxel at @c index, or nullptr if it is not active
+  const T *find(const Eigen::Vector3i &index) const
+  {
+    size_t local;
+    const Leaf *leaf = findLeaf(index, local);
+    return leaf && leaf->active[local] ? &leaf->values[local] : nullptr;
+  }
+  T *find(const Eigen::Vector3i &index)
+  {
+    size_t local;
+    Leaf *leaf = const_cast<Leaf *>(findLeaf(index, local));
+    return leaf && leaf->active[local] ? &leaf->values[local] : nullptr;
+  }
+
+  /// the leaf containing the voxel at @c index, or nullptr if there is none
+  const Leaf *leaf(const Eigen::Vector3i &index) const
+  {
+    size_t local;
+    return findLeaf(index, local);
+  }
+  /// the leaf containing @c index, which is added if not already present. Its voxels are not activated. If @c index
+  /// is out of the range of the grid then this is an empty leaf that is not part of the grid
+  Leaf &touchLeaf(const Eigen::Vector3i &index)
+  {
+    uint64_t x, y, z;
+    if (!offsetIndex(index, x, y, z))
+    {
+      if (!warned_out_of_range_)
+      {
+        std::cerr << "Warning: voxel index " << index[0] << ", " << index[1] << ", " << index[2]
+                  << " is out of range of the sparse grid. Voxels out of range are discarded" << std::endl;
+        warned_out_of_range_ = true;
+      }
+      discarded_.origin = index;
+      discarded_.active.reset();
+      std::fill(std::begin(discarded_.values), std::end(discarded_.values), T());
+      return discarded_;
+    }
+    size_t child;
+    const uint64_t key = internalKey(x, y, z, child);
+    auto it = root_.find(key);
+    if (it == root_.end())
+    {
+      it = root_.emplace(key, static_cast<uint32_t>(internals_.size())).first;
+      internals_.emplace_back();
+    }
+    uint32_t &leaf_id = internals_[it->second].children[child];
+    if (leaf_id == kNoChild)
+    {
+      leaf_id = static_cast<uint32_t>(leaves_.size());
+      leaves_.emplace_back();
+      const int mask = (1 << kLeafBits) - 1;
+      leaves_.back().origin = Eigen::Vector3i(index[0] & ~mask, index[1] & ~mask, index[2] & ~mask);
+    }
+    return leaves_[leaf_id];
+  }
+  /// the index of voxel @c i of a leaf, relative to the leaf origin
+  static inline Eigen::Vector3i localIndex(int i)
+  {
+    const int mask = (1 << kLeafBits) - 1;
+    return Eigen::Vector3i(i & mask, (i >> kLeafBits) & mask, i >> (2 * kLeafBits));
+  }
+  /// the inverse of localIndex
+  static inline int localOffset(const Eigen::Vector3i &local)
+  {
+    return local[0] | (local[1] << kLeafBits) | (local[2] << (2 * kLeafBits));
+  }
+
+  /// the value at @c index, or a default constructed value if the voxel is not active
+  T value(const Eigen::Vector3i &index) const
+  {
+    const T *value = find(index);
+    return value ? *value : T();
+  }
+
+  /// calls @c visit(index, value) for each active voxel, in the order that the leaves were added
+  template <class VisitFunction>
+  void forEachActive(VisitFunction visit) const
+  {
+    for (const auto &leaf : leaves_)
+    {
+      for (int i = 0; i < kLeafSize; i++)
+      {
+        if (leaf.active[i])
+        {
+          visit(leaf.origin + localIndex(i), leaf.values[i]);
+        }
+      }
+    }
+  }
+  template <class VisitFunction>
+  void forEachActive(VisitFunction visit)
+  {
+    for (auto &leaf : leaves_)
+    {
+      for (int i = 0; i < kLeafSize; i++)
+      {
+        if (leaf.active[i])
+        {
+          visit(leaf.origin + localIndex(i), leaf.values[i]);
+        }
+      }
+    }
+  }
+
+  /// calls @c visit(leaf) for each leaf, in the order that they were added. Leaves can have no active voxels
+  template <class VisitFunction>
+  void forEachLeaf(VisitFunction visit) const
+  {
+    for (const auto &leaf : leaves_)
+    {
+      visit(leaf);
+    }
+  }
+
+  /// Combines the active voxels of @c other into this grid, with @c combine(T &value, const T &other_value).
+  /// This is the reduction step for accumulating into a grid in parallel, with one grid per thread.
+  template <class CombineFunction>
+  void merge(const SparseGrid<T> &other, CombineFunction combine)
+  {
+    for (const auto &other_leaf : other.leaves_)
+    {
+      Leaf &leaf = touchLeaf(other_leaf.origin);
+      for (int i = 0; i < kLeafSize; i++)
+      {
+        if (!other_leaf.active[i])
+        {
+          continue;
+        }
+        if (leaf.active[i])
+        {
+          combine(leaf.values[i], other_leaf.values[i]);
+        }
+        else
+        {
+          leaf.values[i] = other_leaf.values[i];
+          leaf.active.set(i);
+        }
+      }
+    }
+  }
+
+  /// the number of active voxels
+  size_t activeCount() const
+  {
+    size_t count = 0;
+    for (const auto &leaf : leaves_)
+    {
+      count += leaf.active.count();
+    }
+    return count;
+  }
+  /// the number of leaf bricks allocated
+  size_t leafCount() const { return leaves_.size(); }
+  /// the approximate memory used by the grid, in bytes
+  size_t memoryUsage() const
+  {
+    return leaves_.size() * sizeof(Leaf) + internals_.size() * sizeof(Internal) +
+           root_.size() * (sizeof(uint64_t) + sizeof(uint32_t));
+  }
+
+  void clear()
+  {
+    root_.clear();
+    internals_.clear();
+    leaves_.clear();
+    warned_out_of_range_ = false;
+  }
+
+private:
+  static constexpr int kKeyBits = 21;
+  static constexpr int kKeyOffset = 1 << (kKeyBits - 1);
+  static constexpr uint32_t kNoChild = ~uint32_t(0);
+  /// the leaf key of an index that is out of range
+  static constexpr uint64_t kNoLeaf = ~uint64_t(0);
+
+  /// the leaf ids of the children of an internal node
+  struct Internal
+  {
+    Internal() { std::fill(children, children + kInternalSize, kNoChild); }
+    uint32_t children[kInternalSize];
+  };
+
+  /// offsets the index to be non-negative, and returns false if it is out of the key range
+  static inline bool offsetIndex(const Eigen::Vector3i &index, uint64_t &x, uint64_t &y, uint64_t &z)
+  {
+    x = static_cast<uint64_t>(static_cast<int64_t>(index[0]) + kKeyOffset);
+    y = static_cast<uint64_t>(static_cast<int64_t>(index[1]) + kKeyOffset);
+    z = static_cast<uint64_t>(static_cast<int64_t>(index[2]) + kKeyOffset);
+    return ((x | y | z) >> kKeyBits) == 0;
+  }
+  /// a unique key for the leaf containing @c index, and the voxel's position @c local within the leaf. Returns
+  /// kNoLeaf, with @c local zero, if @c index is out of range
+  static inline uint64_t leafKey(const Eigen::Vector3i &index, size_t &local)
+  {
+    uint64_t x, y, z;
+    if (!offsetIndex(index, x, y, z))
+    {
+      local = 0;
+      return kNoLeaf;
+    }
+    const uint64_t mask = (1 << kLeafBits) - 1;
+    local = static_cast<size_t>((x & mask) | ((y & mask) << kLeafBits) | ((z & mask) << (2 * kLeafBits)));
+    return (x >> kLeafBits) | ((y >> kLeafBits) << kKeyBits) | ((z >> kLeafBits) << (2 * kKeyBits));
+  }
+  /// the root key of the internal node containing @c x,y,z, and the position @c child of the leaf within it
+  static inline uint64_t internalKey(uint64_t x, uint64_t y, uint64_t z, size_t &child)
+  {
+    const int shift = kLeafBits + kInternalBits;
+    const uint64_t mask = (1 << kInternalBits) - 1;
+    child = static_cast<size_t>(((x >> kLeafBits) & mask) | (((y >> kLeafBits) & mask) << kInternalBits) |
+                                (((z >> kLeafBits) & mask) << (2 * kInternalBits)));
+    return (x >> shift) | ((y >> shift) << kKeyBits) | ((z >> shift) << (2 * kKeyBits));
+  }
+  const Leaf *findLeaf(const Eigen::Vector3i &index, size_t &local) const
+  {
+    uint64_t x, y, z;
+    if (!offsetIndex(index, x, y, z))
+    {
+      return nullptr;
+    }
+    const uint64_t mask = (1 << kLeafBits) - 1;
+    local = static_cast<size_t>((x & mask) | ((y & mask) << kLeafBits) | ((z & mask) << (2 * kLeafBits)));
+    size_t child;
+    const auto it = root_.find(internalKey(x, y, z, child));
+    if (it == root_.end())
+    {
+      return nullptr;
+    }
+    const uint32_t leaf_id = internals_[it->second].children[child];
+    return leaf_id == kNoChild ? nullptr : &leaves_[leaf_id];
+  }
+
+  /// the internal nodes, by the key of their position
+  std::unordered_map<uint64_t, uint32_t> root_;
+  /// deques, so that the leaves don't move as more are added
+  std::deque<Internal> internals_;
+  std::deque<Leaf> leaves_;
+  /// the leaf returned for out of range indices, which is reset on each use
+  Leaf discarded_;
+  /// whether an out of range index has been warned about, so that it is only reported once
+  bool warned_out_of_range_ = false;
+};
+
+template <class T>
+constexpr int SparseGrid<T>::kLeafBits;
+template <class T>
+constexpr int SparseGrid<T>::kInternalBits;
+template <class T>
+constexpr int SparseGrid<T>::kLeafSize;
+template <class T>
+constexpr int SparseGrid<T>::kInternalSize;
+template <class T>
+constexpr int SparseGrid<T>::kKeyBits;
+template <class T>
+constexpr int SparseGrid<T>::kKeyOffset;
+template <class T>
+constexpr uint32_t SparseGrid<T>::kNoChild;
+template <class T>
+constexpr uint64_t SparseGrid<T>::kNoLeaf;
+}  // namespace ray
+
+#endif  // RAYLIB_RAYSPARSEGRID_H
@@ -21,9 +21,9 @@ bool split(const std::string &file_name, const std::string &in_name, const std::
 {
   Cloud cloud_buffer;
   CloudWriter in_writer, out_writer;
-  if (!in_writer.begin(in_name))
+  if (!in_writer.begin(in_name, true))
     return false;
-  if (!out_writer.begin(out_name))
+  if (!out_writer.begin(out_name, true))
     return false;
   Cloud in_chunk, out_chunk;
 
@@ -59,9 +59,9 @@ bool splitPlane(const std::string &file_name, const std::string &in_name, const
                 const Eigen::Vector3d &plane)
 {
   CloudWriter inside_writer, outside_writer;
-  if (!inside_writer.begin(in_name))
+  if (!inside_writer.begin(in_name, true))
     return false;
-  if (!outside_writer.begin(out_name))
+  if (!outside_writer.begin(out_name, true))
     return false;
   Cloud in_chunk, out_chunk;
 
@@ -100,7 +100,7 @@ bool splitPlane(const std::string &file_name, const std::string &in_name, const
     in_chunk.clear();
     out_chunk.clear();
   };
-  if (!readPly(file_name, true, per_chunk, 0))
+  if (!Cloud::read(file_name, per_chunk))
     return false;
 
   inside_writer.end();
@@ -113,9 +113,9 @@ bool splitCapsule(const std::string &file_name, const std::string &in_name, cons
                   const Eigen::Vector3d &end1, const Eigen::Vector3d &end2, double radius)
 {
   CloudWriter inside_writer, outside_writer;
-  if (!inside_writer.begin(in_name))
+  if (!inside_writer.begin(in_name, true))
     return false;
-  if (!outside_writer.begin(out_name))
+  if (!outside_writer.begin(out_name, true))
     return false;
   Cloud in_chunk, out_chunk;
 
@@ -226,7 +226,7 @@ bool splitCapsule(const std::string &file_name, const std::string &in_name, cons
     in_chunk.clear();
     out_chunk.clear();
   };
-  if (!readPly(file_name, true, per_chunk, 0))
+  if (!Cloud::read(file_name, per_chunk))
     return false;
 
   inside_writer.end();
@@ -240,9 +240,9 @@ bool splitBox(const std::string &file_name, const std::string &in_name, const st
               const Eigen::Vector3d &centre, const Eigen::Vector3d &extents)
 {
   CloudWriter inside_writer, outside_writer;
-  if (!inside_writer.begin(in_name))
+  if (!inside_writer.begin(in_name, true))
     return false;
-  if (!outside_writer.begin(out_name))
+  if (!outside_writer.begin(out_name, true))
     return false;
   Cloud in_chunk, out_chunk;
 
@@ -283,7 +283,7 @@ bool splitBox(const std::string &file_name, const std::string &in_name, const st
     in_chunk.clear();
     out_chunk.clear();
   };
-  if (!readPly(file_name, true, per_chunk, 0))
+  if (!Cloud::read(file_name, per_chunk))
     return false;
 
   inside_writer.end();
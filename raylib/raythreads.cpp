@@ -5,67 +5,80 @@
 // Author: Kazys Stepanas
 #include "raythreads.h"
 
-#include "rayunused.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
-#if RAYLIB_WITH_TBB
-#include <tbb/task_scheduler_init.h>
-#endif  // RAYLIB_WITH_TBB
+#if RAYLIB_WITH_TBB && TBB_INTERFACE_VERSION >= 12000
+#include <tbb/info.h>
+#endif  // RAYLIB_WITH_TBB && TBB_INTERFACE_VERSION >= 12000
 
 using namespace ray;
 
 namespace
 {
+/// the thread count set by init, zero for all available threads
+std::atomic_int thread_count_set(0);
 #if RAYLIB_WITH_TBB
-std::unique_ptr<tbb::task_scheduler_init> scheduler;
+/// created on first use, and replaced when the thread count changes
+std::unique_ptr<tbb::task_arena> task_arena;
+std::mutex task_arena_mutex;
 #endif  // RAYLIB_WITH_TBB
 }  // namespace
 
 int Threads::availableThreads()
 {
-#if RAYLIB_WITH_TBB
-  return tbb::task_scheduler_init::default_num_threads();
-#else   // RAYLIB_WITH_TBB
-  return 1;  // Single threaded.
-#endif  // RAYLIB_WITH_TBB
+#if RAYLIB_WITH_TBB && TBB_INTERFACE_VERSION >= 12000
+  // oneTBB respects the process affinity mask, so this is the processors that are allotted to the job
+  return tbb::info::default_concurrency();
+#else   // RAYLIB_WITH_TBB && TBB_INTERFACE_VERSION >= 12000
+  return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+#endif  // RAYLIB_WITH_TBB && TBB_INTERFACE_VERSION >= 12000
 }
 
 
 int Threads::recommendedThreadCount()
 {
-#if RAYLIB_WITH_TBB
-  // Thread performance seems to peek between 4-6. For optimal threads, we use at least 2 threads (if available) up to
-  // 6 threads. We try to leave one thread free and unused for the system and other processes.
-  const int target_thread_count = MaxRecommendedThreads;
+  // We try to leave one thread free and unused for the system and other processes.
   int thread_count = availableThreads();
   if (thread_count > 2)
   {
-    thread_count = std::min(thread_count - 1, target_thread_count);
+    thread_count--;
   }
   return thread_count;
-#else   // RAYLIB_WITH_TBB
-  return 1;  // Single threaded.
-#endif  // RAYLIB_WITH_TBB
 }
 
 
 void Threads::init(int thread_count)
 {
-#if RAYLIB_WITH_TBB
-  if (!scheduler)
+  if (thread_count == ThreadCountRecommended)
   {
-    // Translate to TBB thread count
-    int init_thread_count = tbb::task_scheduler_init::automatic;
-    if (thread_count == ThreadCountRecommended)
-    {
-      init_thread_count = recommendedThreadCount();
-    }
-    else if (thread_count > 0)
-    {
-      init_thread_count = thread_count;
-    }
-    scheduler = std::make_unique<tbb::task_scheduler_init>(init_thread_count);
+    thread_count = recommendedThreadCount();
   }
-#else   // RAYLIB_WITH_TBB
-  RAYLIB_UNUSED(thread_count);
+  thread_count_set = std::max(0, thread_count);
+#if RAYLIB_WITH_TBB
+  std::lock_guard<std::mutex> lock(task_arena_mutex);
+  task_arena.reset();
 #endif  // RAYLIB_WITH_TBB
 }
+
+
+int Threads::threadCount()
+{
+  const int thread_count = thread_count_set;
+  return thread_count > 0 ? thread_count : availableThreads();
+}
+
+
+#if RAYLIB_WITH_TBB
+tbb::task_arena &Threads::arena()
+{
+  std::lock_guard<std::mutex> lock(task_arena_mutex);
+  if (!task_arena)
+  {
+    task_arena = std::make_unique<tbb::task_arena>(threadCount());
+  }
+  return *task_arena;
+}
+#endif  // RAYLIB_WITH_TBB
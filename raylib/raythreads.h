@@ -10,16 +10,16 @@
 
 #include <memory>
 
+#if RAYLIB_WITH_TBB
+#include <tbb/task_arena.h>
+#endif  // RAYLIB_WITH_TBB
+
 namespace ray
 {
-/// A utility class for initialising the thread pool size.
-///
-/// Typical usage is to call @c init() at the start of your program. This is optional and it not specified, all
-/// available threads will be used.
-///
-/// Note: some parts of the program may use threads even when Intel TBB is not availabe (via OpenMP).
+/// A utility class for setting the number of threads that the parallel loops use, see rayparallel.h.
 ///
-/// @todo Also cap OpenMP thread usage.
+/// All available threads are used unless @c init() is called. Each raycloudtool calls it with the value of its
+/// --threads (or -j) option, see @c parseCommandLine, so that several tools can share a machine.
 class RAYLIB_EXPORT Threads
 {
 public:
@@ -28,19 +28,24 @@ public:
   /// Argument for use with @c init() indicating the @c recommendedThreadCount() should be used.
   static const int ThreadCountRecommended = 0;
 
-  /// The maximum number of threads to use for @c recommendedThreadCount() .
-  static const int MaxRecommendedThreads = 8;
-
-  /// Returns the number of available threads. When built with Intel TBB, this returns the number of available
-  /// processors. Without TBB, this returns 1.
+  /// Returns the number of available threads, which is the number of processors available to the process.
   static int availableThreads();
 
-  /// Query the recommended thread count. This is set at least two threads if available, prefering one less than the
-  /// @c availableThreads() up to @c MaxRecommendedThreads threads.
+  /// Query the recommended thread count. This is one less than the @c availableThreads() when there are more than
+  /// two, to leave a thread free for the system and other processes.
   static int recommendedThreadCount();
 
-  /// Initialise the thread count.
+  /// Set the thread count for the parallel loops. This can be called again to change it, but not while a parallel
+  /// loop is running.
   static void init(int thread_count = ThreadCountRecommended);
+
+  /// The number of threads that parallel loops use. This is @c availableThreads() until @c init() is called.
+  static int threadCount();
+
+#if RAYLIB_WITH_TBB
+  /// The TBB task arena that the parallel loops run in, which has @c threadCount() slots
+  static tbb::task_arena &arena();
+#endif  // RAYLIB_WITH_TBB
 };
 }  // namespace ray
 
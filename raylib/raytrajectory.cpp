@@ -13,7 +13,8 @@ void Trajectory::calculateStartPoints(const std::vector<double> &times, std::vec
     std::cout << "Warning: can only calculate start points when a trajectory is available" << std::endl;
 
   starts.resize(times.size());
-  for (size_t i = 0; i < times.size(); i++) starts[i] = linear(times[i]);
+  if (!times.empty())
+    linear(times.data(), times.size(), starts.data());
 }
 
 bool Trajectory::save(const std::string &file_name)
@@ -177,4 +178,33 @@ Eigen::Vector3d Trajectory::linear(double time, bool extrapolate) const
   }
   return points_[index] * (1 - time) + points_[index + 1] * time;
 }
+
+void Trajectory::linear(const double *times, size_t count, Eigen::Vector3d *points) const
+{
+  ASSERT(!points_.empty());
+  if (points_.size() == 1)
+  {
+    std::fill(points, points + count, points_[0]);
+    return;
+  }
+  size_t index = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    double time = times[i];
+    if (inSegment(index, time))
+    {
+      time = (time - times_[index]) / (times_[index + 1] - times_[index]);
+    }
+    else if (inSegment(index + 1, time))
+    {
+      index++;
+      time = (time - times_[index]) / (times_[index + 1] - times_[index]);
+    }
+    else
+    {
+      index = getIndexAndNormaliseTime(time);
+    }
+    points[i] = points_[index] * (1 - time) + points_[index + 1] * time;
+  }
+}
 }  // namespace ray
\ No newline at end of file
@@ -38,6 +38,10 @@ public:
   /// If 'extrapolate' is false, outlier times will clamp to the start or end value
   Eigen::Vector3d linear(double time, bool extrapolate = true) const;
 
+  /// Linear interpolation/extrapolation of @c count @c times into @c points, matching linear(time) per time.
+  /// Ordered times are found by stepping from the previous trajectory segment, rather than a search per time
+  void linear(const double *times, size_t count, Eigen::Vector3d *points) const;
+
 private:
   inline size_t getIndexAndNormaliseTime(double &time) const
   {
@@ -50,6 +54,12 @@ private:
     time = (time - times_[index]) / (times_[index + 1] - times_[index]);
     return index;
   }
+  /// whether getIndexAndNormaliseTime(time) would return @c index, for a trajectory of at least two nodes
+  inline bool inSegment(size_t index, double time) const
+  {
+    return index + 1 < times_.size() && (index == 0 || times_[index] < time) &&
+           (index + 2 == times_.size() || time <= times_[index + 1]);
+  }
   std::vector<Eigen::Vector3d> points_;
   std::vector<double> times_;
 };
@@ -8,6 +8,7 @@
 
 #include "raylib/raylibconfig.h"
 #include "rayrandom.h"
+#include "rayvoxelset.h"
 
 #include <Eigen/Dense>
 #include <algorithm>
@@ -110,14 +111,16 @@ public:
   }
 };
 
+/// appends to @c indices the index of the first of @c points in each voxel of width @c voxel_width that is not
+/// already in @c vox_set , and adds these voxels to @c vox_set
 inline void voxelSubsample(const std::vector<Eigen::Vector3d> &points, double voxel_width,
-                           std::vector<int64_t> &indices, std::set<Eigen::Vector3i, Vector3iLess> &vox_set)
+                           std::vector<int64_t> &indices, VoxelSet &vox_set)
 {
   for (int64_t i = 0; i < (int64_t)points.size(); i++)
   {
     Eigen::Vector3i voxel(int(std::floor(points[i][0] / voxel_width)), int(std::floor(points[i][1] / voxel_width)),
                           int(std::floor(points[i][2] / voxel_width)));
-    if (vox_set.insert(voxel).second)
+    if (vox_set.insert(voxel))
     {
       indices.push_back(i);
     }
@@ -127,7 +130,7 @@ inline void voxelSubsample(const std::vector<Eigen::Vector3d> &points, double vo
 inline void voxelSubsample(const std::vector<Eigen::Vector3d> &points, double voxel_width,
                            std::vector<int64_t> &indices)
 {
-  std::set<Eigen::Vector3i, Vector3iLess> vox_set;
+  VoxelSet vox_set;
   voxelSubsample(points, voxel_width, indices, vox_set);
 }
 
@@ -0,0 +1,397 @@
+// Copyright (c) 2026
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#ifndef RAYLIB_RAYVOXELSET_H
+#define RAYLIB_RAYVOXELSET_H
+
+#include "raylib/raylibconfig.h"
+
+#include <Eigen/Dense>
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <tuple>
+#include <vector>
+
+namespace ray
+{
+/// A set of voxel indices, for marking the voxels already visited when decimating or counting points.
+/// Each voxel is stored as the 63 bit Morton code (see mortonCode) of its index relative to the first voxel inserted,
+/// in one open addressing hash table with linear probing. So a voxel costs 8 to 16 bytes, in a single allocation,
+/// rather than a tree node allocation per voxel as in a std::set, and a lookup usually touches a single cache line.
+/// The codes hold 21 bits of each axis, so they are exact for voxels within 2^20 of the first voxel in each axis
+/// (31 km at 3 cm). The rare voxels further from it are kept in an ordered set of their indices, so the set is exact
+/// for any cloud.
+class RAYLIB_EXPORT VoxelSet
+{
+public:
+  VoxelSet() { clear(); }
+
+  /// the Morton code of @c voxel , which interleaves the low 21 bits of its x, y and z indices
+  static inline uint64_t mortonCode(const Eigen::Vector3i &voxel)
+  {
+    return spreadBits(static_cast<uint32_t>(voxel[0])) | (spreadBits(static_cast<uint32_t>(voxel[1])) << 1) |
+           (spreadBits(static_cast<uint32_t>(voxel[2])) << 2);
+  }
+  /// the offset of the first voxel from the origin of the codes, so the codes span 2^20 voxels either side of it
+  static constexpr int64_t kOriginOffset = int64_t(1) << 20;
+  /// the Morton code of @c voxel relative to @c origin in @c code . Returns false if @c voxel is before the origin or
+  /// 2^21 or more voxels after it in an axis, so has no exact code
+  static inline bool relativeCode(const Eigen::Vector3i &voxel, const int64_t origin[3], uint64_t *code)
+  {
+    Eigen::Vector3i relative;
+    for (int i = 0; i < 3; i++)
+    {
+      const int64_t offset = static_cast<int64_t>(voxel[i]) - origin[i];
+      if (offset < 0 || offset >= 2 * kOriginOffset)
+      {
+        return false;
+      }
+      relative[i] = static_cast<int>(offset);
+    }
+    *code = mortonCode(relative);
+    return true;
+  }
+
+  /// adds @c voxel to the set, returning true if it was not already in the set
+  inline bool insert(const Eigen::Vector3i &voxel);
+  /// whether @c voxel is in the set
+  inline bool contains(const Eigen::Vector3i &voxel) const;
+  /// removes @c voxel from the set, returning true if it was in the set
+  inline bool erase(const Eigen::Vector3i &voxel);
+
+  inline size_t size() const { return size_; }
+  inline bool empty() const { return size_ == 0; }
+  /// the number of voxels that the table has room for, each is 8 bytes
+  inline size_t capacity() const { return slots_.size(); }
+  /// make room for @c count voxels without growing the table
+  void reserve(size_t count)
+  {
+    while (2 * count > slots_.size())
+    {
+      grow();
+    }
+  }
+  /// empties the set and frees its memory
+  void clear()
+  {
+    std::vector<uint64_t>().swap(slots_);
+    far_voxels_.clear();
+    size_ = 0;
+    shift_ = 64;
+    has_origin_ = false;
+    origin_[0] = origin_[1] = origin_[2] = 0;
+  }
+
+private:
+  /// marks an empty slot. Morton codes use only 63 bits, so this is never a code
+  static constexpr uint64_t kEmpty = ~0ull;
+
+  /// spreads the low 21 bits of @c value to every third bit
+  static inline uint64_t spreadBits(uint32_t value)
+  {
+    uint64_t x = value & 0x1fffffull;
+    x = (x | x << 32) & 0x1f00000000ffffull;
+    x = (x | x << 16) & 0x1f0000ff0000ffull;
+    x = (x | x << 8) & 0x100f00f00f00f00full;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+    x = (x | x << 2) & 0x1249249249249249ull;
+    return x;
+  }
+  /// the first slot to probe for @c code . The multiplicative hash spreads the codes of neighbouring voxels apart
+  inline size_t home(uint64_t code) const { return static_cast<size_t>((code * 0x9e3779b97f4a7c15ull) >> shift_); }
+  /// the slot holding @c code , or the empty slot where it would go
+  inline size_t find(uint64_t code) const
+  {
+    const size_t mask = slots_.size() - 1;
+    size_t slot = home(code);
+    while (slots_[slot] != code && slots_[slot] != kEmpty)
+    {
+      slot = (slot + 1) & mask;
+    }
+    return slot;
+  }
+  /// doubles the table size, the table is kept at most half full
+  void grow()
+  {
+    // a copy of kEmpty, as passing it by reference would need a definition outside the class
+    std::vector<uint64_t> old_slots(slots_.empty() ? 8 : 2 * slots_.size(), uint64_t(kEmpty));
+    old_slots.swap(slots_);
+    shift_ = old_slots.empty() ? 61 : shift_ - 1;
+    for (const auto &code : old_slots)
+    {
+      if (code != kEmpty)
+      {
+        slots_[find(code)] = code;
+      }
+    }
+  }
+
+  std::vector<uint64_t> slots_;
+  /// the voxels that are too far from the origin for a code
+  std::set<std::tuple<int, int, int>> far_voxels_;
+  size_t size_;
+  /// 64 - log2 of the table size
+  int shift_;
+  /// the origin of the codes, set by the first voxel inserted
+  int64_t origin_[3];
+  bool has_origin_;
+};
+
+inline bool VoxelSet::insert(const Eigen::Vector3i &voxel)
+{
+  if (!has_origin_)
+  {
+    for (int i = 0; i < 3; i++) origin_[i] = static_cast<int64_t>(voxel[i]) - kOriginOffset;
+    has_origin_ = true;
+  }
+  uint64_t code;
+  if (!relativeCode(voxel, origin_, &code))
+  {
+    const bool inserted = far_voxels_.insert(std::make_tuple(voxel[0], voxel[1], voxel[2])).second;
+    size_ += inserted ? 1 : 0;
+    return inserted;
+  }
+  if (2 * (size_ - far_voxels_.size() + 1) > slots_.size())
+  {
+    grow();
+  }
+  const size_t slot = find(code);
+  if (slots_[slot] == code)
+  {
+    return false;
+  }
+  slots_[slot] = code;
+  size_++;
+  return true;
+}
+
+inline bool VoxelSet::contains(const Eigen::Vector3i &voxel) const
+{
+  if (size_ == 0)
+  {
+    return false;
+  }
+  uint64_t code;
+  if (!relativeCode(voxel, origin_, &code))
+  {
+    return far_voxels_.count(std::make_tuple(voxel[0], voxel[1], voxel[2])) > 0;
+  }
+  return !slots_.empty() && slots_[find(code)] == code;
+}
+
+inline bool VoxelSet::erase(const Eigen::Vector3i &voxel)
+{
+  if (size_ == 0)
+  {
+    return false;
+  }
+  uint64_t code;
+  if (!relativeCode(voxel, origin_, &code))
+  {
+    const bool erased = far_voxels_.erase(std::make_tuple(voxel[0], voxel[1], voxel[2])) > 0;
+    size_ -= erased ? 1 : 0;
+    return erased;
+  }
+  if (slots_.empty())
+  {
+    return false;
+  }
+  size_t slot = find(code);
+  if (slots_[slot] == kEmpty)
+  {
+    return false;
+  }
+  // shift the following codes of the probe sequence back, so that no tombstones are needed
+  const size_t mask = slots_.size() - 1;
+  for (size_t next = (slot + 1) & mask; slots_[next] != kEmpty; next = (next + 1) & mask)
+  {
+    const size_t next_home = home(slots_[next]);
+    // the code at next stays if its home slot is cyclically within (slot, next]
+    const bool stays = slot <= next ? (slot < next_home && next_home <= next) : (slot < next_home || next_home <= next);
+    if (!stays)
+    {
+      slots_[slot] = slots_[next];
+      slot = next;
+    }
+  }
+  slots_[slot] = kEmpty;
+  size_--;
+  return true;
+}
+
+/// A table from voxel indices to a 64 bit value, that many threads can update at once. Each voxel keeps the minimum
+/// of the values given to it, so the result does not depend on the order of the updates, or on the number of threads.
+/// This is used to choose one ray per voxel in parallel (see decimateSpatialParallel).
+/// Voxels are keyed by their VoxelSet::relativeCode from the first voxel updated, in an open addressing table with
+/// linear probing. Voxels are claimed with an atomic compare and swap and never removed, so no locks are needed. The
+/// table does not grow during the updates, instead reserve() is called before each batch of them. The rare voxels too
+/// far from the first voxel for a code are kept in an ordered map under a lock, as in VoxelSet.
+class RAYLIB_EXPORT ConcurrentVoxelMap
+{
+public:
+  /// the value of a voxel that is not in the table
+  static constexpr uint64_t kNone = ~0ull;
+
+  ConcurrentVoxelMap() : capacity_(0), shift_(64), size_(0), has_origin_(false), origin_{0, 0, 0} {}
+
+  /// make room for @c count more voxels. This is not thread safe, so call it between the parallel updates
+  void reserve(size_t count)
+  {
+    const size_t required = 2 * (size() + count);
+    if (required <= capacity_)
+    {
+      return;
+    }
+    size_t capacity = 8;
+    int shift = 61;
+    while (capacity < required)
+    {
+      capacity *= 2;
+      shift--;
+    }
+    std::unique_ptr<Slot[]> old_slots(new Slot[capacity]);
+    old_slots.swap(slots_);
+    const size_t old_capacity = capacity_;
+    capacity_ = capacity;
+    shift_ = shift;
+    for (size_t i = 0; i < capacity_; i++)
+    {
+      slots_[i].code.store(kEmpty, std::memory_order_relaxed);
+      slots_[i].value.store(kNone, std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+      const uint64_t code = old_slots[i].code.load(std::memory_order_relaxed);
+      if (code != kEmpty)
+      {
+        Slot &slot = slots_[find(code)];
+        slot.code.store(code, std::memory_order_relaxed);
+        slot.value.store(old_slots[i].value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /// sets the value of @c voxel to @c value , if the voxel is not yet in the table or has a larger value. This is
+  /// thread safe, but there must be room for the voxel, see reserve()
+  inline void keepMinimum(const Eigen::Vector3i &voxel, uint64_t value);
+  /// the value of @c voxel , or kNone if it is not in the table
+  inline uint64_t value(const Eigen::Vector3i &voxel) const
+  {
+    if (!has_origin_.load(std::memory_order_acquire))
+    {
+      return kNone;
+    }
+    uint64_t code;
+    if (!VoxelSet::relativeCode(voxel, origin_, &code))
+    {
+      std::lock_guard<std::mutex> lock(far_mutex_);
+      const auto it = far_values_.find(std::make_tuple(voxel[0], voxel[1], voxel[2]));
+      return it == far_values_.end() ? kNone : it->second;
+    }
+    if (capacity_ == 0)
+    {
+      return kNone;
+    }
+    const Slot &slot = slots_[find(code)];
+    return slot.value.load(std::memory_order_relaxed);
+  }
+  /// the number of voxels in the table
+  inline size_t size() const { return size_.load(std::memory_order_relaxed); }
+  /// the number of voxels that the table has room for, each is 16 bytes
+  inline size_t capacity() const { return capacity_; }
+
+private:
+  static constexpr uint64_t kEmpty = ~0ull;
+  struct Slot
+  {
+    std::atomic<uint64_t> code;
+    std::atomic<uint64_t> value;
+  };
+
+  inline size_t home(uint64_t code) const { return static_cast<size_t>((code * 0x9e3779b97f4a7c15ull) >> shift_); }
+  /// the slot holding @c code , or the empty slot where it would go. Only for use outside of the parallel updates
+  inline size_t find(uint64_t code) const
+  {
+    const size_t mask = capacity_ - 1;
+    size_t slot = home(code);
+    for (uint64_t current = slots_[slot].code.load(std::memory_order_relaxed); current != code && current != kEmpty;
+         current = slots_[slot].code.load(std::memory_order_relaxed))
+    {
+      slot = (slot + 1) & mask;
+    }
+    return slot;
+  }
+
+  std::unique_ptr<Slot[]> slots_;
+  size_t capacity_;
+  /// 64 - log2 of the table size
+  int shift_;
+  std::atomic<size_t> size_;
+  /// the origin of the codes, set by the first voxel updated
+  std::atomic<bool> has_origin_;
+  int64_t origin_[3];
+  /// the values of the voxels that are too far from the origin for a code, and the lock for them and the origin
+  std::map<std::tuple<int, int, int>, uint64_t> far_values_;
+  mutable std::mutex far_mutex_;
+};
+
+inline void ConcurrentVoxelMap::keepMinimum(const Eigen::Vector3i &voxel, uint64_t value)
+{
+  if (!has_origin_.load(std::memory_order_acquire))
+  {
+    std::lock_guard<std::mutex> lock(far_mutex_);
+    if (!has_origin_.load(std::memory_order_relaxed))
+    {
+      for (int i = 0; i < 3; i++) origin_[i] = static_cast<int64_t>(voxel[i]) - VoxelSet::kOriginOffset;
+      has_origin_.store(true, std::memory_order_release);
+    }
+  }
+  uint64_t code;
+  if (!VoxelSet::relativeCode(voxel, origin_, &code))
+  {
+    std::lock_guard<std::mutex> lock(far_mutex_);
+    const auto inserted = far_values_.insert(std::make_pair(std::make_tuple(voxel[0], voxel[1], voxel[2]), value));
+    if (inserted.second)
+    {
+      size_.fetch_add(1, std::memory_order_relaxed);
+    }
+    else if (value < inserted.first->second)
+    {
+      inserted.first->second = value;
+    }
+    return;
+  }
+  const size_t mask = capacity_ - 1;
+  for (size_t index = home(code);; index = (index + 1) & mask)
+  {
+    Slot &slot = slots_[index];
+    uint64_t current = slot.code.load(std::memory_order_relaxed);
+    if (current == kEmpty)
+    {
+      // claim the empty slot. On failure current is set to the code of the thread that claimed it first
+      if (slot.code.compare_exchange_strong(current, code, std::memory_order_relaxed))
+      {
+        size_.fetch_add(1, std::memory_order_relaxed);
+        current = code;
+      }
+    }
+    if (current == code)
+    {
+      uint64_t old_value = slot.value.load(std::memory_order_relaxed);
+      while (value < old_value && !slot.value.compare_exchange_weak(old_value, value, std::memory_order_relaxed))
+      {
+      }
+      return;
+    }
+  }
+}
+}  // namespace ray
+
+#endif  // RAYLIB_RAYVOXELSET_H
@@ -0,0 +1,705 @@
+// Copyright (c) 2026
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+
+#include "raybvh.h"
+#include "raycloud.h"
+#include "raycloudwriter.h"
+#include "rayellipsoid.h"
+#include "raygrid.h"
+#include "raygridwalk.h"
+#include "rayindex.h"
+#include "raylaz.h"
+#include "raymerger.h"
+#include "rayply.h"
+#include "rayrcz.h"
+#include "rayrenderer.h"
+#include "rayrandom.h"
+#include "rayutils.h"
+#include "rayvoxelset.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+
+/// Raycloud benchmarks. Each benchmark times one library component against its alternatives on the same data and
+/// prints the throughput, so the choice between them can be made on real numbers for the machine at hand.
+namespace raybench
+{
+using Clock = std::chrono::steady_clock;
+
+/// Options shared by all of the benchmarks
+struct Options
+{
+  /// number of rays in the generated test cloud
+  size_t num_rays = 5000000;
+  /// cloud file to benchmark on. When empty, a random cloud of @c num_rays rays is generated
+  std::string cloud_file;
+};
+
+/// Returns the duration in seconds of the fastest of @c repeats calls to @c function. Taking the fastest reduces
+/// the effect of other processes and of a cold file cache on the first run.
+double bestTime(const std::function<void()> &function, int repeats = 3)
+{
+  double best = std::numeric_limits<double>::max();
+  for (int i = 0; i < repeats; i++)
+  {
+    const auto start = Clock::now();
+    function();
+    best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count());
+  }
+  return best;
+}
+
+/// Returns the size of the file in bytes
+size_t fileSize(const std::string &file_name)
+{
+  std::ifstream file(file_name, std::ios::binary | std::ios::ate);
+  return file.good() ? static_cast<size_t>(file.tellg()) : 0;
+}
+
+/// Writes a random ray cloud for the benchmarks to read, unless one was supplied on the command line
+std::string testCloud(const Options &options)
+{
+  if (!options.cloud_file.empty())
+    return options.cloud_file;
+  const std::string file_name = "raybench_cloud.ply";
+  ray::Cloud cloud;
+  cloud.resize(options.num_rays);
+  for (size_t i = 0; i < options.num_rays; i++)
+  {
+    cloud.ends[i] = Eigen::Vector3d(ray::random(-50.0, 50.0), ray::random(-50.0, 50.0), ray::random(0.0, 30.0));
+    cloud.starts[i] = Eigen::Vector3d(0.1 * (double)i / (double)options.num_rays, 0.0, 1.5);
+    cloud.times[i] = 0.001 * (double)i;
+    cloud.colours[i] = ray::RGBA(100, 150, 200, 255);
+  }
+  cloud.save(file_name);
+  return file_name;
+}
+
+/// Compares the throughput of the chunked readPly when reading through an ifstream and from a memory mapped file,
+/// and when decoding on one thread and on all available threads
+void plyRead(const Options &options)
+{
+  const std::string file_name = testCloud(options);
+  const double megabytes = (double)fileSize(file_name) / (1024.0 * 1024.0);
+  const std::map<std::string, ray::PlyReadMode> modes = { { "stream", ray::kPRMStream },
+                                                          { "mapped", ray::kPRMMapped } };
+  const int max_threads = std::max(1, (int)std::thread::hardware_concurrency());
+  for (auto &mode : modes)
+  {
+    for (int num_threads : { 1, max_threads })
+    {
+      Eigen::Vector3d checksum(0, 0, 0);  // stops the reading from being optimised away
+      auto apply = [&checksum](std::vector<Eigen::Vector3d> &, std::vector<Eigen::Vector3d> &ends,
+                               std::vector<double> &, std::vector<ray::RGBA> &) {
+        for (auto &end : ends) checksum += end;
+      };
+      const double seconds = bestTime(
+        [&]() { ray::readPly(file_name, true, apply, 0, false, 1000000, mode.second, num_threads); });
+      std::cout << "plyread " << mode.first << " " << num_threads << " threads: " << seconds << " s, "
+                << megabytes / seconds << " MB/s (checksum " << checksum.sum() << ")" << std::endl;
+      if (max_threads == 1)
+        break;
+    }
+  }
+}
+
+/// Writes a copy of the ray cloud @c file_name with an extra byte per row. This has the same rays but is not in the
+/// standard ray cloud layout, so it is read by the general decoder
+std::string paddedCloud(const std::string &file_name)
+{
+  const std::string padded_name = "raybench_padded.ply";
+  std::ifstream input(file_name, std::ios::binary);
+  std::ofstream output(padded_name, std::ios::binary);
+  std::string line;
+  while (std::getline(input, line) && line != "end_header")
+    output << line << std::endl;
+  output << "property uchar pad" << std::endl << "end_header" << std::endl;
+  std::vector<char> row(sizeof(ray::RayPlyEntry) + 1, 0);
+  while (input.read(&row[0], sizeof(ray::RayPlyEntry)))
+    output.write(&row[0], row.size());
+  return padded_name;
+}
+
+/// Compares the decode cost per ray of the specialised decoder for the standard ray cloud layout, and of the general
+/// decoder. The file is read from memory and the rays are not processed, so this is mostly decode time
+void plyDecode(const Options &options)
+{
+  const std::string file_name = testCloud(options);
+  const std::string padded_name = paddedCloud(file_name);
+  const std::map<std::string, std::string> files = { { "standard layout", file_name },
+                                                     { "general layout", padded_name } };
+  for (auto &file : files)
+  {
+    size_t num_rays = 0;
+    auto apply = [&num_rays](std::vector<Eigen::Vector3d> &, std::vector<Eigen::Vector3d> &ends,
+                             std::vector<double> &, std::vector<ray::RGBA> &) { num_rays += ends.size(); };
+    const double seconds = bestTime([&]() {
+      num_rays = 0;
+      ray::readPly(file.second, true, apply, 0);
+    });
+    std::cout << "plydecode " << file.first << ": " << 1e9 * seconds / (double)num_rays << " ns per ray" << std::endl;
+  }
+  std::remove(padded_name.c_str());
+}
+
+/// Compares the file size and read time of the .ply and compressed .rcz ray cloud formats
+void rczRead(const Options &options)
+{
+  const std::string file_name = testCloud(options);
+  const std::string rcz_name = "raybench_cloud.rcz";
+  ray::Cloud cloud;
+  cloud.load(file_name);
+  cloud.save(rcz_name);
+  for (auto &name : { file_name, rcz_name })
+  {
+    size_t num_rays = 0;
+    auto apply = [&num_rays](std::vector<Eigen::Vector3d> &, std::vector<Eigen::Vector3d> &ends,
+                             std::vector<double> &, std::vector<ray::RGBA> &) { num_rays += ends.size(); };
+    const double seconds = bestTime([&]() {
+      num_rays = 0;
+      ray::Cloud::read(name, apply, 0);
+    });
+    std::cout << "rczread " << name << ": " << (double)fileSize(name) / (double)num_rays << " bytes per ray, "
+              << 1e9 * seconds / (double)num_rays << " ns per ray" << std::endl;
+  }
+  std::remove(rcz_name.c_str());
+}
+
+/// Measures the read throughput of uncompressed .las point clouds, for comparison with the ray cloud formats above
+void lasRead(const Options &options)
+{
+  const std::string file_name = testCloud(options);
+  const std::string las_name = "raybench_cloud.las";
+  ray::Cloud cloud;
+  cloud.load(file_name);
+  ray::writeLas(las_name, cloud.ends, cloud.times, cloud.colours);
+  size_t num_points = 0;
+  auto apply = [&num_points](std::vector<Eigen::Vector3d> &, std::vector<Eigen::Vector3d> &ends,
+                             std::vector<double> &, std::vector<ray::RGBA> &) { num_points += ends.size(); };
+  const double seconds = bestTime([&]() {
+    num_points = 0;
+    size_t num_bounded;
+    ray::readLas(las_name, apply, num_bounded, 100.0, nullptr);
+  });
+  std::cout << "lasread: " << (double)fileSize(las_name) / (double)num_points << " bytes per point, "
+            << 1e9 * seconds / (double)num_points << " ns per point" << std::endl;
+  std::remove(las_name.c_str());
+}
+
+/// Compares Cloud::read with and without chunk prefetching, on a decimation-like per-chunk workload, which is the
+/// typical mix of file reading and processing in the ray tools
+void cloudRead(const Options &options)
+{
+  const std::string file_name = testCloud(options);
+  for (int prefetch_depth : { 0, 1, 2 })
+  {
+    size_t num_kept = 0;
+    auto apply = [&num_kept](std::vector<Eigen::Vector3d> &, std::vector<Eigen::Vector3d> &ends,
+                             std::vector<double> &, std::vector<ray::RGBA> &) {
+      std::vector<int64_t> indices;
+      ray::voxelSubsample(ends, 0.1, indices);
+      num_kept += indices.size();
+    };
+    const double seconds = bestTime([&]() { ray::Cloud::read(file_name, apply, prefetch_depth); });
+    std::cout << "cloudread prefetch depth " << prefetch_depth << ": " << seconds << " s (" << num_kept
+              << " voxels)" << std::endl;
+  }
+}
+
+/// Compares the synchronous and asynchronous CloudWriter, copying a cloud through a per-chunk workload
+void cloudWrite(const Options &options)
+{
+  const std::string file_name = testCloud(options);
+  const double megabytes = (double)fileSize(file_name) / (1024.0 * 1024.0);
+  for (bool asynchronous : { false, true })
+  {
+    const double seconds = bestTime([&]() {
+      ray::CloudWriter writer;
+      writer.begin("raybench_written.ply", asynchronous);
+      auto apply = [&writer](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                             std::vector<double> &times, std::vector<ray::RGBA> &colours) {
+        std::vector<int64_t> indices;
+        ray::voxelSubsample(ends, 0.1, indices);
+        writer.writeChunk(starts, ends, times, colours);
+      };
+      ray::Cloud::read(file_name, apply, 0);
+      writer.end();
+    });
+    std::cout << "cloudwrite " << (asynchronous ? "asynchronous" : "synchronous") << ": " << seconds << " s, "
+              << megabytes / seconds << " MB/s" << std::endl;
+  }
+  std::remove("raybench_written.ply");
+}
+
+/// Compares reading a small region of a cloud with and without its spatial index. The cloud is written as a scan
+/// sweeping along x, so that the indexed blocks are spatially local, as they are in real scans
+void regionRead(const Options &options)
+{
+  const std::string file_name = "raybench_region.ply";
+  ray::CloudWriter writer;
+  writer.begin(file_name);
+  const size_t chunk_size = 100000;
+  ray::Cloud chunk;
+  for (size_t i = 0; i < options.num_rays; i += chunk_size)
+  {
+    chunk.resize(std::min(chunk_size, options.num_rays - i));
+    for (size_t j = 0; j < chunk.ends.size(); j++)
+    {
+      const double x = 100.0 * (double)(i + j) / (double)options.num_rays;
+      chunk.starts[j] = Eigen::Vector3d(x, 0.0, 1.5);
+      chunk.ends[j] = chunk.starts[j] + Eigen::Vector3d(ray::random(-1.0, 1.0), ray::random(-20.0, 20.0), 0.0);
+      chunk.times[j] = 0.001 * (double)(i + j);
+      chunk.colours[j] = ray::RGBA(100, 150, 200, 255);
+    }
+    writer.writeChunk(chunk);
+  }
+  writer.end();
+  const ray::Cuboid region(Eigen::Vector3d(45.0, -5.0, -1.0), Eigen::Vector3d(55.0, 5.0, 5.0));
+  for (bool indexed : { false, true })
+  {
+    if (!indexed)
+      std::rename(ray::RayIndex::fileName(file_name).c_str(), "raybench_region.index");
+    else
+      std::rename("raybench_region.index", ray::RayIndex::fileName(file_name).c_str());
+    size_t num_rays = 0;
+    auto apply = [&num_rays](std::vector<Eigen::Vector3d> &, std::vector<Eigen::Vector3d> &ends,
+                             std::vector<double> &, std::vector<ray::RGBA> &) { num_rays += ends.size(); };
+    const double seconds = bestTime([&]() {
+      num_rays = 0;
+      ray::Cloud::read(file_name, region, apply);
+    });
+    std::cout << "regionread " << (indexed ? "indexed" : "unindexed") << ": " << seconds << " s (" << num_rays
+              << " rays in region)" << std::endl;
+  }
+  std::remove(file_name.c_str());
+  std::remove(ray::RayIndex::fileName(file_name).c_str());
+}
+
+/// The index of the voxel containing @c pos, in units of voxels
+inline Eigen::Vector3i voxelIndex(const Eigen::Vector3d &pos)
+{
+  return Eigen::Vector3i(int(std::floor(pos[0])), int(std::floor(pos[1])), int(std::floor(pos[2])));
+}
+
+/// Adds the rays of @c cloud to the cells of @c grid that they pass through, for the cells that contain a ray end, as
+/// Merger::seedRayGrid and Merger::fillRayGrid do
+template <class GridT>
+void fillRayGrid(GridT &grid, const ray::Cloud &cloud)
+{
+  for (size_t i = 0; i < cloud.rayCount(); i++)
+  {
+    grid.addCell(voxelIndex((cloud.ends[i] - grid.box_min) / grid.voxel_width));
+  }
+  for (unsigned i = 0; i < static_cast<unsigned>(cloud.rayCount()); i++)
+  {
+    const Eigen::Vector3d start = (cloud.starts[i] - grid.box_min) / grid.voxel_width;
+    const Eigen::Vector3d end = (cloud.ends[i] - grid.box_min) / grid.voxel_width;
+    auto add_ray = [&](const Eigen::Vector3i &index, const Eigen::Vector3i &, double, double, double) {
+      grid.insertIfCellExists(index, i);
+      return false;
+    };
+    ray::walkGrid(start, end, add_ray);
+  }
+}
+
+/// Fills the ray grid as compressed sparse rows, in a counting pass and a filling pass
+void fillRayGridRows(ray::FlatGrid<unsigned> &grid, const ray::Cloud &cloud)
+{
+  for (size_t i = 0; i < cloud.rayCount(); i++)
+  {
+    grid.addCell(voxelIndex((cloud.ends[i] - grid.box_min) / grid.voxel_width));
+  }
+  grid.fillRows(static_cast<unsigned>(cloud.rayCount()), [&](unsigned i, const auto &visit) {
+    const Eigen::Vector3d start = (cloud.starts[i] - grid.box_min) / grid.voxel_width;
+    const Eigen::Vector3d end = (cloud.ends[i] - grid.box_min) / grid.voxel_width;
+    auto add_ray = [&](const Eigen::Vector3i &index, const Eigen::Vector3i &, double, double, double) {
+      visit(index, i);
+      return false;
+    };
+    ray::walkGrid(start, end, add_ray);
+  });
+}
+
+/// Sums the ray ids in the 3x3x3 cells around each ray end, which is the access pattern of the transient ellipsoid
+/// marking
+template <class GridT>
+size_t lookupRayGrid(const GridT &grid, const ray::Cloud &cloud)
+{
+  size_t total = 0;
+  for (size_t i = 0; i < cloud.rayCount(); i++)
+  {
+    const Eigen::Vector3i centre = voxelIndex((cloud.ends[i] - grid.box_min) / grid.voxel_width);
+    Eigen::Vector3i index;
+    for (index[0] = centre[0] - 1; index[0] <= centre[0] + 1; index[0]++)
+      for (index[1] = centre[1] - 1; index[1] <= centre[1] + 1; index[1]++)
+        for (index[2] = centre[2] - 1; index[2] <= centre[2] + 1; index[2]++)
+          for (auto &id : grid.cell(index).data) total += id;
+  }
+  return total;
+}
+
+/// Fills @c cloud with a mobile scan of a 200 m street, with the ends on the ground and on two walls
+void streetScan(ray::Cloud &cloud, size_t num_rays)
+{
+  cloud.resize(num_rays);
+  for (size_t i = 0; i < num_rays; i++)
+  {
+    const double x = 200.0 * (double)i / (double)num_rays;
+    cloud.starts[i] = Eigen::Vector3d(x, 0.0, 2.0);
+    const double side = ray::random(-1.0, 1.0);
+    if (std::abs(side) < 0.5)  // ground
+      cloud.ends[i] = Eigen::Vector3d(x + ray::random(-10.0, 10.0), ray::random(-8.0, 8.0), 0.0);
+    else  // walls
+      cloud.ends[i] = Eigen::Vector3d(x + ray::random(-10.0, 10.0), side > 0 ? 8.0 : -8.0, ray::random(0.0, 10.0));
+    cloud.times[i] = 0.001 * (double)i;
+    cloud.colours[i] = ray::RGBA(100, 150, 200, 255);
+  }
+}
+
+/// Compares the bucket hashed Grid with the open addressing FlatGrid, when filling a ray grid as the transient
+/// filter does, and when looking up the cells around each ray end. Without a cloud file this uses a mobile scan of a
+/// street, with the ends on the ground and on two walls.
+void rayGrid(const Options &options)
+{
+  ray::Cloud cloud;
+  if (!options.cloud_file.empty())
+  {
+    if (!cloud.load(options.cloud_file))
+      return;
+  }
+  else
+    streetScan(cloud, options.num_rays);
+  Eigen::Vector3d box_min, box_max;
+  cloud.calcBounds(&box_min, &box_max, ray::kBFEnd | ray::kBFStart);
+  const double voxel_width = 4.0 * cloud.estimatePointSpacing();
+
+  std::unique_ptr<ray::Grid<unsigned>> grid;
+  std::unique_ptr<ray::FlatGrid<unsigned>> flat_grid;
+  const double fill_seconds = bestTime([&]() {
+    grid.reset(new ray::Grid<unsigned>(box_min, box_max, voxel_width));
+    fillRayGrid(*grid, cloud);
+  });
+  const double flat_fill_seconds = bestTime([&]() {
+    flat_grid.reset(new ray::FlatGrid<unsigned>(box_min, box_max, voxel_width));
+    fillRayGrid(*flat_grid, cloud);
+  });
+  std::unique_ptr<ray::FlatGrid<unsigned>> rows_grid;
+  const double rows_fill_seconds = bestTime([&]() {
+    rows_grid.reset(new ray::FlatGrid<unsigned>(box_min, box_max, voxel_width));
+    fillRayGridRows(*rows_grid, cloud);
+  });
+  size_t total = 0, flat_total = 0, rows_total = 0;
+  const double lookup_seconds = bestTime([&]() { total = lookupRayGrid(*grid, cloud); });
+  const double flat_lookup_seconds = bestTime([&]() { flat_total = lookupRayGrid(*flat_grid, cloud); });
+  const double rows_lookup_seconds = bestTime([&]() { rows_total = lookupRayGrid(*rows_grid, cloud); });
+  std::cout << "raygrid " << cloud.rayCount() << " rays, " << flat_grid->cellCount() << " cells of width "
+            << voxel_width << " m" << std::endl;
+  std::cout << "raygrid fill Grid: " << fill_seconds << " s, FlatGrid: " << flat_fill_seconds
+            << " s, FlatGrid rows: " << rows_fill_seconds << " s" << std::endl;
+  std::cout << "raygrid lookup Grid: " << lookup_seconds << " s, FlatGrid: " << flat_lookup_seconds
+            << " s, FlatGrid rows: " << rows_lookup_seconds << " s"
+            << (total == flat_total && total == rows_total ? "" : " MISMATCH") << std::endl;
+}
+
+/// Measures the density estimation of rayrender density on a large sparse area: plots of 20 m square spread over
+/// 2 km square and 20 m high, at 10 cm voxels. This compares the memory of the sparse density voxels with what a
+/// dense voxel array over the same bounds would need.
+void densityGrid(const Options &options)
+{
+  std::string file_name = options.cloud_file;
+  if (file_name.empty())
+  {
+    file_name = "raybench_sparse.ply";
+    ray::Cloud cloud;
+    cloud.resize(options.num_rays);
+    const int num_plots = 16;
+    for (size_t i = 0; i < options.num_rays; i++)
+    {
+      const size_t plot = i % num_plots;
+      const Eigen::Vector3d corner(500.0 * (double)(plot % 4), 500.0 * (double)(plot / 4), 0.0);
+      cloud.ends[i] = corner + Eigen::Vector3d(ray::random(0.0, 20.0), ray::random(0.0, 20.0), ray::random(0.0, 20.0));
+      cloud.starts[i] = cloud.ends[i] + Eigen::Vector3d(ray::random(-1.0, 1.0), ray::random(-1.0, 1.0), 3.0);
+      cloud.times[i] = 0.001 * (double)i;
+      cloud.colours[i] = ray::RGBA(100, 150, 200, 255);
+    }
+    cloud.save(file_name);
+  }
+  ray::Cloud::Info info;
+  if (!ray::Cloud::getInfo(file_name, info))
+    return;
+  const double voxel_width = 0.1;
+  const ray::Cuboid bounds = info.ends_bound;
+  const Eigen::Vector3i dims =
+    ((bounds.max_bound_ - bounds.min_bound_) / voxel_width).cast<int>() + Eigen::Vector3i(2, 2, 2);
+  std::unique_ptr<ray::DensityGrid> grid;
+  const double seconds = bestTime(
+    [&]() {
+      grid.reset(new ray::DensityGrid(bounds, voxel_width, dims));
+      grid->calculateDensities(file_name);
+      grid->addNeighbourPriors();
+    },
+    1);
+  const double dense_gigabytes =
+    (double)dims[0] * (double)dims[1] * (double)dims[2] * sizeof(ray::DensityGrid::Voxel) / 1e9;
+  std::cout << "densitygrid " << dims.transpose() << " voxels: " << seconds << " s, sparse "
+            << (double)grid->voxels().memoryUsage() / 1e9 << " GB for " << grid->voxels().activeCount()
+            << " active voxels, dense " << dense_gigabytes << " GB" << std::endl;
+  if (options.cloud_file.empty())
+    std::remove(file_name.c_str());
+}
+/// Measures the ray-ellipsoid tests per second of Ellipsoid::intersect, against EllipsoidArrays::intersectBatch
+/// testing kEllipsoidBatchSize ellipsoids at a time. The candidates of each ray are those found by a BVH over the
+/// ellipsoids of the street scan, as in the BVH engine of the Merger.
+void ellipsoids(const Options &options)
+{
+  ray::Cloud cloud;
+  if (!options.cloud_file.empty())
+  {
+    if (!cloud.load(options.cloud_file))
+      return;
+  }
+  else
+    streetScan(cloud, options.num_rays);
+  std::vector<ray::Ellipsoid> ellipsoids;
+  ray::generateEllipsoids(&ellipsoids, nullptr, nullptr, cloud);
+  std::vector<uint32_t> ids;
+  std::vector<Eigen::Vector3d> bounds_min, bounds_max;
+  for (size_t i = 0; i < ellipsoids.size(); i++)
+  {
+    if (ellipsoids[i].extents == Eigen::Vector3f::Zero())
+      continue;
+    ids.push_back((uint32_t)i);
+    bounds_min.push_back(ellipsoids[i].pos - ellipsoids[i].extents.cast<double>());
+    bounds_max.push_back(ellipsoids[i].pos + ellipsoids[i].extents.cast<double>());
+  }
+  ray::BVH bvh;
+  bvh.build(bounds_min, bounds_max);
+  ray::EllipsoidArrays arrays;
+  arrays.assign(ellipsoids, ids);
+  // the candidates of each ray, as compressed sparse rows
+  std::vector<uint32_t> candidates;
+  std::vector<size_t> offsets(1, 0);
+  for (size_t i = 0; i < cloud.rayCount(); i++)
+  {
+    bvh.intersectSegment(cloud.starts[i], cloud.ends[i], [&](uint32_t item) { candidates.push_back(item); });
+    offsets.push_back(candidates.size());
+  }
+  std::vector<ray::IntersectResult> scalar(candidates.size()), batch(candidates.size());
+  const double scalar_seconds = bestTime([&]() {
+    for (size_t i = 0; i < cloud.rayCount(); i++)
+    {
+      for (size_t j = offsets[i]; j < offsets[i + 1]; j++)
+        scalar[j] = ellipsoids[ids[candidates[j]]].intersect(cloud.starts[i], cloud.ends[i]);
+    }
+  });
+  const double batch_seconds = bestTime([&]() {
+    for (size_t i = 0; i < cloud.rayCount(); i++)
+    {
+      arrays.intersectBatch(cloud.starts[i], cloud.ends[i], candidates.data() + offsets[i],
+                            offsets[i + 1] - offsets[i], batch.data() + offsets[i]);
+    }
+  });
+  const double num_tests = static_cast<double>(candidates.size());
+  std::cout << "ellipsoids " << candidates.size() << " tests, " << num_tests / static_cast<double>(cloud.rayCount())
+            << " per ray, scalar: " << num_tests / scalar_seconds / 1e6 << " Mtests/s, batch of "
+            << ray::kEllipsoidBatchSize << ": " << num_tests / batch_seconds / 1e6 << " Mtests/s"
+            << (scalar == batch ? "" : " MISMATCH") << std::endl;
+}
+
+/// Measures the voxels traversed per second by the scalar walkGrid, against walkGridPacket stepping
+/// kWalkPacketSize rays at once. The rays are random, 2 to 100 voxels long, in a 1000 voxel cube.
+void gridWalk(const Options &options)
+{
+  std::vector<Eigen::Vector3d> starts(options.num_rays), ends(options.num_rays);
+  for (size_t i = 0; i < options.num_rays; i++)
+  {
+    starts[i] = Eigen::Vector3d(ray::random(0.0, 1000.0), ray::random(0.0, 1000.0), ray::random(0.0, 1000.0));
+    const Eigen::Vector3d dir = Eigen::Vector3d(ray::random(-1.0, 1.0), ray::random(-1.0, 1.0), ray::random(-1.0, 1.0));
+    ends[i] = starts[i] + dir.normalized() * ray::random(2.0, 100.0);
+  }
+  // both visitors sum the voxel coordinates and lengths, so the walks can be checked against each other
+  struct Sum
+  {
+    bool operator()(const Eigen::Vector3i &p, const Eigen::Vector3i &, double in_length, double out_length, double)
+    {
+      voxels++;
+      total += p[0] + 3 * p[1] + 7 * p[2];
+      lengths += out_length - in_length;
+      return false;
+    }
+    size_t voxels = 0;
+    long long total = 0;
+    double lengths = 0.0;
+  };
+  Sum scalar, packet;
+  const double scalar_seconds = bestTime([&]() {
+    scalar = Sum();
+    for (size_t i = 0; i < options.num_rays; i++) ray::walkGrid(starts[i], ends[i], scalar);
+  });
+  const double packet_seconds = bestTime([&]() {
+    packet = Sum();
+    auto visit_batch = [&](const ray::WalkBatch &batch) {
+      for (int lane = 0; lane < ray::kWalkPacketSize; lane++)
+      {
+        if (batch.active & (1 << lane))
+        {
+          packet.voxels++;
+          packet.total += batch.x[lane] + 3 * batch.y[lane] + 7 * batch.z[lane];
+          packet.lengths += batch.out_length[lane] - batch.in_length[lane];
+        }
+      }
+      return 0;
+    };
+    ray::walkGridPacket(starts.data(), ends.data(), options.num_rays, visit_batch);
+  });
+  const bool match = scalar.voxels == packet.voxels && scalar.total == packet.total &&
+                     std::abs(scalar.lengths - packet.lengths) <= 1e-9 * std::abs(scalar.lengths);
+  std::cout << "gridwalk " << scalar.voxels << " voxels, scalar: " << (double)scalar.voxels / scalar_seconds / 1e6
+            << " Mvoxels/s, packet of " << ray::kWalkPacketSize << ": "
+            << (double)packet.voxels / packet_seconds / 1e6 << " Mvoxels/s" << (match ? "" : " MISMATCH")
+            << std::endl;
+}
+
+/// Compares the Merger engines for finding the rays through each ellipsoid: the ray grid at its estimated voxel size
+/// and at twice that, and the BVH. The street scan is filtered at increasing densities, or the cloud file at its own.
+void merger(const Options &options)
+{
+  std::vector<size_t> ray_counts;
+  if (options.cloud_file.empty())
+  {
+    for (size_t num_rays = options.num_rays / 8; num_rays <= options.num_rays; num_rays *= 2)
+      ray_counts.push_back(num_rays);
+  }
+  else
+    ray_counts.push_back(0);
+  for (auto num_rays : ray_counts)
+  {
+    ray::Cloud cloud;
+    if (num_rays == 0)
+    {
+      if (!cloud.load(options.cloud_file))
+        return;
+    }
+    else
+      streetScan(cloud, num_rays);
+    const double voxel_size = 4.0 * cloud.estimatePointSpacing();
+    std::cout << "merger " << cloud.rayCount() << " rays:";
+    const struct
+    {
+      const char *name;
+      ray::MergeEngine engine;
+      double voxel_size;
+    } engines[] = { { "RayGrid", ray::MergeEngine::RayGrid, voxel_size },
+                    { "RayGrid 2x voxels", ray::MergeEngine::RayGrid, 2.0 * voxel_size },
+                    { "BVH", ray::MergeEngine::BVH, voxel_size } };
+    for (auto &engine : engines)
+    {
+      ray::MergerConfig config;
+      config.voxel_size = engine.voxel_size;
+      config.engine = engine.engine;
+      ray::Merger merger(config);
+      const double seconds = bestTime([&]() { merger.filter(cloud); }, 1);
+      std::cout << " " << engine.name << ": " << seconds << " s (" << merger.differenceCloud().rayCount()
+                << " transient)";
+    }
+    std::cout << std::endl;
+  }
+}
+
+/// Compares the std::set of voxel indices that decimation used to mark its visited voxels against the VoxelSet, by
+/// subsampling the cloud ends at 3 cm, which is the inner loop of raydecimate. Memory is the table capacity for the
+/// VoxelSet and an estimated 48 bytes per tree node for the std::set.
+void voxelSet(const Options &options)
+{
+  ray::Cloud cloud;
+  if (!cloud.load(testCloud(options)))
+    return;
+  const double voxel_width = 0.03;
+  std::vector<int64_t> subsample;
+  size_t set_size = 0;
+  const double set_seconds = bestTime([&]() {
+    std::set<Eigen::Vector3i, ray::Vector3iLess> voxel_set;
+    subsample.clear();
+    for (size_t i = 0; i < cloud.ends.size(); i++)
+    {
+      const Eigen::Vector3i place(int(std::floor(cloud.ends[i][0] / voxel_width)),
+                                  int(std::floor(cloud.ends[i][1] / voxel_width)),
+                                  int(std::floor(cloud.ends[i][2] / voxel_width)));
+      if (voxel_set.insert(place).second)
+        subsample.push_back(i);
+    }
+    set_size = voxel_set.size();
+  });
+  const size_t set_count = subsample.size();
+  size_t capacity = 0;
+  const double voxel_set_seconds = bestTime([&]() {
+    ray::VoxelSet voxel_set;
+    subsample.clear();
+    ray::voxelSubsample(cloud.ends, voxel_width, subsample, voxel_set);
+    capacity = voxel_set.capacity();
+  });
+  if (subsample.size() != set_count)
+    std::cerr << "Error: VoxelSet kept " << subsample.size() << " points, std::set kept " << set_count << std::endl;
+  std::cout << "voxelset " << cloud.ends.size() << " points, " << set_size << " voxels:" << std::endl;
+  std::cout << "  std::set: " << 1e-6 * static_cast<double>(cloud.ends.size()) / set_seconds << " Mpoints/s, "
+            << 48e-6 * static_cast<double>(set_size) << " MB" << std::endl;
+  std::cout << "  VoxelSet: " << 1e-6 * static_cast<double>(cloud.ends.size()) / voxel_set_seconds << " Mpoints/s, "
+            << 8e-6 * static_cast<double>(capacity) << " MB" << std::endl;
+}
+}  // namespace raybench
+
+int main(int argc, char **argv)
+{
+  const std::map<std::string, std::function<void(const raybench::Options &)>> benchmarks = {
+    { "cloudread", raybench::cloudRead },
+    { "cloudwrite", raybench::cloudWrite },
+    { "densitygrid", raybench::densityGrid },
+    { "ellipsoids", raybench::ellipsoids },
+    { "gridwalk", raybench::gridWalk },
+    { "lasread", raybench::lasRead },
+    { "merger", raybench::merger },
+    { "plydecode", raybench::plyDecode },
+    { "plyread", raybench::plyRead },
+    { "raygrid", raybench::rayGrid },
+    { "rczread", raybench::rczRead },
+    { "regionread", raybench::regionRead },
+    { "voxelset", raybench::voxelSet },
+  };
+  raybench::Options options;
+  std::string selected;
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--rays") && i + 1 < argc)
+      options.num_rays = std::stoul(argv[++i]);
+    else if (!strcmp(argv[i], "--cloud") && i + 1 < argc)
+      options.cloud_file = argv[++i];
+    else if (benchmarks.count(argv[i]))
+      selected = argv[i];
+    else
+    {
+      std::cout << "usage: raybench [benchmark_name] [--rays N] [--cloud file.ply]" << std::endl;
+      std::cout << "benchmarks:";
+      for (auto &benchmark : benchmarks) std::cout << " " << benchmark.first;
+      std::cout << std::endl;
+      return 1;
+    }
+  }
+  for (auto &benchmark : benchmarks)
+  {
+    if (selected.empty() || selected == benchmark.first)
+      benchmark.second(options);
+  }
+  return 0;
+}
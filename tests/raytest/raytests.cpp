@@ -4,13 +4,27 @@
 //
 // Author: Thomas Lowe
 
+#include "raybvh.h"
 #include "raycloud.h"
+#include "rayellipsoid.h"
+#include "raygrid.h"
+#include "raygridwalk.h"
+#include "rayindex.h"
+#include "raymerger.h"
+#include "raymergestate.h"
 #include "raymesh.h"
+#include "rayparallel.h"
 #include "rayply.h"
+#include "rayrcz.h"
+#include "raysparsegrid.h"
+#include "rayvoxelset.h"
 #include "rayforeststructure.h"
+#include <algorithm>
+#include <set>
 #include <vector>
 #include <gtest/gtest.h>
 #include <cstdlib>
+#include <cstring>
 
 /// Raycloud testing framework. In each test, the statistics of the resulting clouds are compared to the statistics
 /// of the cloud when it was confirmed to be operating correctly. 
@@ -92,7 +106,75 @@ namespace raytest
     EXPECT_TRUE(cloud.load("room_combined.ply"));
     compareMoments(cloud.getMoments(), {-0.0867714, -0.0679941, 0.546619, 0.0215326, 0.0272819, 0.499969, -0.305657, -0.186353, 0.582642, 2.95777, 2.47531, 1.63323, 17.4967, 10.1789, 0.305355, 0.763356, 0.427376, 0.979005, 0.318409, 0.225661, 0.389366, 0.143369});
   }
-  
+
+  /// Merges a second room into the first incrementally, which matches RayCombine, then merges a third room into the
+  /// result, using the merge state kept by the first merge. The state is paged, so a query away from the rooms reads
+  /// none of it
+  TEST(Basic, RayCombineIncremental)
+  {
+    EXPECT_EQ(command("./raycreate room 1"), 0);
+    EXPECT_EQ(copy("room.ply room2.ply"), 0);
+    EXPECT_EQ(command("./raytranslate room2.ply 0,0,1"), 0);
+    EXPECT_EQ(command("./rayrotate room2.ply 0,0,35"), 0);
+    EXPECT_EQ(command("./raycombine min room.ply room2.ply 1 rays --incremental --output room_map.ply"), 0);
+    ray::Cloud cloud;
+    EXPECT_TRUE(cloud.load("room_map.ply"));
+    compareMoments(cloud.getMoments(), {-0.0867714, -0.0679941, 0.546619, 0.0215326, 0.0272819, 0.499969, -0.305657, -0.186353, 0.582642, 2.95777, 2.47531, 1.63323, 17.4967, 10.1789, 0.305355, 0.763356, 0.427376, 0.979005, 0.318409, 0.225661, 0.389366, 0.143369});
+
+    EXPECT_EQ(copy("room.ply room3.ply"), 0);
+    EXPECT_EQ(command("./rayrotate room3.ply 0,0,10"), 0);
+    EXPECT_EQ(command("./raycombine min room_map.ply room3.ply 1 rays --incremental"), 0);
+    ray::Cloud updated;
+    EXPECT_TRUE(updated.load("room_map.ply"));
+    ray::MergeState state;
+    EXPECT_TRUE(state.load("room_map.ply"));
+    EXPECT_EQ(state.rayCount(), updated.rayCount());
+    EXPECT_GT(updated.rayCount(), cloud.rayCount());
+    std::vector<uint64_t> ids;
+    ray::Cloud rays;
+    std::vector<ray::Ellipsoid> ellipsoids;
+    state.ellipsoidsInBox(Eigen::Vector3d(100, 100, 100), Eigen::Vector3d(101, 101, 101), &ids, &rays, &ellipsoids);
+    EXPECT_TRUE(ids.empty());
+    EXPECT_EQ(state.loadedPageCount(), 0u);
+    EXPECT_GT(state.pageCount(), 1u);
+    state.ellipsoidsInBox(Eigen::Vector3d(-100, -100, -100), Eigen::Vector3d(100, 100, 100), &ids, &rays, &ellipsoids);
+    EXPECT_GT(ids.size(), 0u);
+    EXPECT_TRUE(std::is_sorted(ids.begin(), ids.end()));
+    EXPECT_GT(state.loadedPageCount(), 0u);
+  }
+
+  /// Combines two .rcz rooms whose starts are on their trajectories, which raycombine merges as trajectory clouds.
+  /// This matches merging the rooms loaded as ordinary clouds
+  TEST(Basic, RayCombineTrajectory)
+  {
+    EXPECT_EQ(command("raycreate room 1"), 0);
+    EXPECT_EQ(command("rayexport room.ply room_points.ply room_trajectory.ply"), 0);
+    EXPECT_EQ(command("rayimport room_points.ply room_trajectory.ply --compress"), 0);
+    ray::TrajectoryCloud room2;
+    EXPECT_TRUE(room2.load("room_points_raycloud.rcz"));
+    room2.translate(Eigen::Vector3d(0.0, 0.5, 0.3));
+    room2.save("room2.rcz");
+    EXPECT_TRUE(ray::rczStartsOnTrajectory("room2.rcz"));
+    EXPECT_EQ(command("raycombine min room_points_raycloud.rcz room2.rcz 1 rays"), 0);
+
+    std::vector<ray::Cloud> clouds(2);
+    EXPECT_TRUE(clouds[0].load("room_points_raycloud.rcz"));
+    EXPECT_TRUE(clouds[1].load("room2.rcz"));
+    ray::MergerConfig config;
+    config.num_rays_filter_threshold = 1;
+    ray::Merger merger(config);
+    merger.mergeMultiple(clouds);
+    ray::Cloud combined;
+    EXPECT_TRUE(combined.load("room_points_raycloud_combined.ply"));
+    EXPECT_GT(merger.differenceCloud().rayCount(), 0u);
+    ASSERT_EQ(combined.rayCount(), merger.fixedCloud().rayCount());
+    for (size_t i = 0; i < combined.rayCount(); i++)
+    {
+      EXPECT_LT((combined.starts[i] - merger.fixedCloud().starts[i]).norm(), 1e-4);
+      EXPECT_LT((combined.ends[i] - merger.fixedCloud().ends[i]).norm(), 1e-4);
+    }
+  }
+
   /// Creates a building with random seed 1, and compares to the expected results
   TEST(Basic, RayCreate)
   {
@@ -114,6 +196,124 @@ namespace raytest
     compareMoments(cloud.getMoments(), {-0.222571, 1.08156, 1.67264, 6.00755, 5.78731, 0.508713, -0.202668, 1.09517, 2.6238, 6.0285, 5.85715, 3.22093, 69.0574, 35.2775, 0.48969, 0.498403, 0.443549, 1, 0.379062, 0.366963, 0.389535, 0});
   }
 
+  /// Decimates a forest in parallel with different thread counts, which should give identical clouds, with one ray in
+  /// each of the voxels that the sequential decimation keeps a ray in
+  TEST(Basic, RayDecimateParallel)
+  {
+    EXPECT_EQ(command("raycreate forest 1"), 0);
+    EXPECT_EQ(command("raydecimate forest.ply 10 cm"), 0);
+    ray::Cloud sequential;
+    EXPECT_TRUE(sequential.load("forest_decimated.ply"));
+    std::vector<ray::Cloud> clouds(2);
+    const char *thread_counts[] = { "1", "4" };
+    for (int i = 0; i < 2; i++)
+    {
+      EXPECT_EQ(command(std::string("raydecimate forest.ply 10 cm --parallel --threads ") + thread_counts[i]), 0);
+      EXPECT_TRUE(clouds[i].load("forest_decimated.ply"));
+    }
+    ASSERT_EQ(clouds[0].rayCount(), sequential.rayCount());
+    ASSERT_EQ(clouds[1].rayCount(), clouds[0].rayCount());
+    for (size_t i = 0; i < clouds[0].rayCount(); i++)
+    {
+      EXPECT_EQ(clouds[0].ends[i], clouds[1].ends[i]);
+      EXPECT_EQ(clouds[0].starts[i], clouds[1].starts[i]);
+      EXPECT_EQ(clouds[0].times[i], clouds[1].times[i]);
+    }
+  }
+
+  /// Decimates a cloud with points 2^21 voxels apart, which have the same low bits of their voxel indices, so must be
+  /// kept apart by the far voxels of VoxelSet and ConcurrentVoxelMap
+  TEST(Basic, RayDecimateWide)
+  {
+    ray::Cloud cloud;
+    const double far = double(1 << 21) * 0.01;
+    for (int i = 0; i < 4; i++)
+    {
+      const Eigen::Vector3d end((i / 2) * far + 0.005 + 0.01 * (i % 2), 0.005, 0.005);
+      cloud.addRay(end + Eigen::Vector3d(0, 0, 1), end, (double)i, ray::RGBA::white());
+    }
+    cloud.save("wide.ply");
+    const char *options[] = { "", " --parallel" };
+    for (int i = 0; i < 2; i++)
+    {
+      EXPECT_EQ(command(std::string("raydecimate wide.ply 1 cm") + options[i]), 0);
+      ray::Cloud decimated;
+      EXPECT_TRUE(decimated.load("wide_decimated.ply"));
+      EXPECT_EQ(decimated.rayCount(), 4u);
+    }
+    EXPECT_EQ(command("raydecimate wide.ply pyramid 1,3 cm"), 0);
+    ray::Cloud level;
+    EXPECT_TRUE(level.load("wide_decimated_1cm.ply"));
+    EXPECT_EQ(level.rayCount(), 4u);
+  }
+
+  /// Decimates a forest to a pyramid of three widths. The finest level should match a plain spatial decimation, each
+  /// level should have as many rays as a plain decimation at its width, and be a subset of the finer level
+  TEST(Basic, RayDecimatePyramid)
+  {
+    EXPECT_EQ(command("raycreate forest 1"), 0);
+    EXPECT_EQ(command("raydecimate forest.ply pyramid 20,5,10 cm"), 0);
+    const char *widths[] = { "5", "10", "20" };
+    std::vector<ray::Cloud> levels(3);
+    for (int i = 0; i < 3; i++)
+    {
+      EXPECT_TRUE(levels[i].load(std::string("forest_decimated_") + widths[i] + "cm.ply"));
+      EXPECT_EQ(command(std::string("raydecimate forest.ply ") + widths[i] + " cm"), 0);
+      ray::Cloud decimated;
+      EXPECT_TRUE(decimated.load("forest_decimated.ply"));
+      ASSERT_EQ(levels[i].rayCount(), decimated.rayCount());
+      if (i == 0)
+      {
+        for (size_t j = 0; j < decimated.rayCount(); j++) EXPECT_EQ(levels[0].ends[j], decimated.ends[j]);
+      }
+      else
+      {
+        EXPECT_LT(levels[i].rayCount(), levels[i - 1].rayCount());
+        // both levels are in file order, so the coarser one is a subsequence of the finer one
+        size_t k = 0;
+        for (size_t j = 0; j < levels[i].rayCount(); j++)
+        {
+          while (k < levels[i - 1].rayCount() && levels[i - 1].times[k] != levels[i].times[j]) k++;
+          EXPECT_LT(k, levels[i - 1].rayCount());
+        }
+      }
+    }
+  }
+
+  /// Decimates a forest to a pyramid of widths that don't nest. Each level should still be a subset of the finer level,
+  /// with at most one ray per voxel, so no more rays than a plain decimation at its width
+  TEST(Basic, RayDecimatePyramidUnnested)
+  {
+    EXPECT_EQ(command("raycreate forest 1"), 0);
+    EXPECT_EQ(command("raydecimate forest.ply pyramid 3,5,7 cm"), 0);
+    const char *widths[] = { "3", "5", "7" };
+    std::vector<ray::Cloud> levels(3);
+    for (int i = 0; i < 3; i++)
+    {
+      EXPECT_TRUE(levels[i].load(std::string("forest_decimated_") + widths[i] + "cm.ply"));
+      EXPECT_EQ(command(std::string("raydecimate forest.ply ") + widths[i] + " cm"), 0);
+      ray::Cloud decimated;
+      EXPECT_TRUE(decimated.load("forest_decimated.ply"));
+      EXPECT_LE(levels[i].rayCount(), decimated.rayCount());
+      const double width = 0.01 * std::stod(widths[i]);
+      std::set<Eigen::Vector3i, ray::Vector3iLess> voxels;
+      for (const auto &end : levels[i].ends)
+      {
+        const Eigen::Vector3d index(std::floor(end[0] / width), std::floor(end[1] / width), std::floor(end[2] / width));
+        EXPECT_TRUE(voxels.insert(index.cast<int>()).second);
+      }
+      if (i > 0)
+      {
+        size_t k = 0;
+        for (size_t j = 0; j < levels[i].rayCount(); j++)
+        {
+          while (k < levels[i - 1].rayCount() && levels[i - 1].times[k] != levels[i].times[j]) k++;
+          EXPECT_LT(k, levels[i - 1].rayCount());
+        }
+      }
+    }
+  }
+
   /// Creates a room, and calls denoise using a fixed distance threshols, and compares to expected result
   TEST(Basic, RayDenoise)
   {
@@ -124,6 +324,611 @@ namespace raytest
     compareMoments(cloud.getMoments(), {-0.108066, -0.0410134, 0.052168, 8.67026e-08, 8.81787e-08, 2.24394e-08, -0.464107, -0.113806, 0.161496, 2.82122, 2.34281, 1.35279, 17.81, 10.2005, 0.297047, 0.758802, 0.440232, 0.975166, 0.317215, 0.226682, 0.390971, 0.155618});
   }
 
+  /// Saves a cloud without colours, as .ply and .rcz, which colours it by time
+  TEST(Basic, RayCloudSaveUncoloured)
+  {
+    ray::Cloud cloud;
+    for (int i = 0; i < 10; i++)
+    {
+      cloud.starts.push_back(Eigen::Vector3d(0.0, 0.0, 0.0));
+      cloud.ends.push_back(Eigen::Vector3d(1.0, 0.1 * i, 0.0));
+      cloud.times.push_back(i);
+    }
+    for (const std::string name : { "uncoloured.ply", "uncoloured.rcz" })
+    {
+      cloud.save(name);
+      ray::Cloud loaded;
+      EXPECT_TRUE(loaded.load(name));
+      ASSERT_EQ(loaded.rayCount(), cloud.rayCount());
+      EXPECT_TRUE(loaded.rayBounded(0));
+    }
+  }
+
+  /// Exports a room and imports it again, both as a .ply and as a compressed .rcz ray cloud, which should match.
+  /// The .rcz file references the trajectory for its ray starts, so also loads as a trajectory cloud.
+  /// The room is also exported and imported through a .las point cloud, which should keep the times and bounded end
+  /// points
+  TEST(Basic, RayImport)
+  {
+    EXPECT_EQ(command("raycreate room 1"), 0);
+    EXPECT_EQ(command("rayexport room.ply room_points.ply room_trajectory.ply"), 0);
+    EXPECT_EQ(command("rayexport room.ply room_las.las room_trajectory.ply"), 0);
+    EXPECT_EQ(command("rayimport room_points.ply room_trajectory.ply"), 0);
+    EXPECT_EQ(command("rayimport room_points.ply room_trajectory.ply --compress"), 0);
+    EXPECT_EQ(command("rayimport room_las.las room_trajectory.ply"), 0);
+    ray::Cloud cloud, compressed;
+    EXPECT_TRUE(cloud.load("room_points_raycloud.ply"));
+    EXPECT_TRUE(compressed.load("room_points_raycloud.rcz"));
+    EXPECT_EQ(cloud.rayCount(), compressed.rayCount());
+    Eigen::ArrayXd moments = cloud.getMoments();
+    compareMoments(compressed.getMoments(), std::vector<double>(moments.data(), moments.data() + moments.size()), 1e-3);
+    ray::TrajectoryCloud trajectory_cloud;
+    EXPECT_TRUE(trajectory_cloud.load("room_points_raycloud.rcz"));
+    ASSERT_EQ(trajectory_cloud.rayCount(), cloud.rayCount());
+    std::vector<Eigen::Vector3d> starts(cloud.rayCount());
+    trajectory_cloud.calculateStarts(0, starts.size(), starts.data());
+    for (size_t i = 0; i < cloud.rayCount(); i++)
+    {
+      EXPECT_LT((trajectory_cloud.start(i) - cloud.starts[i]).norm(), 1e-3);
+      EXPECT_EQ(trajectory_cloud.start(i), starts[i]);
+    }
+
+    ray::Cloud room, from_las;
+    EXPECT_TRUE(room.load("room.ply"));
+    EXPECT_TRUE(from_las.load("room_las.ply"));
+    ASSERT_EQ(room.rayCount(), from_las.rayCount());
+    for (size_t i = 0; i < room.rayCount(); i++)
+    {
+      EXPECT_EQ(room.times[i], from_las.times[i]);
+      EXPECT_EQ(room.rayBounded(i), from_las.rayBounded(i));
+      if (room.rayBounded(i))
+      {
+        EXPECT_LT((room.ends[i] - from_las.ends[i]).norm(), 1e-3);
+      }
+    }
+  }
+
+  /// Creates a room and checks that the info cached when it was written matches the info from reading the file
+  TEST(Basic, RayInfo)
+  {
+    EXPECT_EQ(command("raycreate room 1"), 0);
+    EXPECT_EQ(command("rayinfo room.ply"), 0);
+    ray::Cloud::Info cached, scanned;
+    EXPECT_TRUE(ray::Cloud::loadInfo("room.ply", cached));
+    EXPECT_EQ(std::remove(ray::Cloud::infoFileName("room.ply").c_str()), 0);
+    EXPECT_FALSE(ray::Cloud::loadInfo("room.ply", scanned));
+    EXPECT_TRUE(ray::Cloud::getInfo("room.ply", scanned));
+    EXPECT_EQ(cached.num_rays, scanned.num_rays);
+    EXPECT_EQ(cached.num_bounded, scanned.num_bounded);
+    EXPECT_EQ(cached.ends_bound.min_bound_, scanned.ends_bound.min_bound_);
+    EXPECT_EQ(cached.ends_bound.max_bound_, scanned.ends_bound.max_bound_);
+    EXPECT_EQ(cached.rays_bound.min_bound_, scanned.rays_bound.min_bound_);
+    EXPECT_EQ(cached.rays_bound.max_bound_, scanned.rays_bound.max_bound_);
+    EXPECT_EQ(cached.min_time, scanned.min_time);
+    EXPECT_EQ(cached.max_time, scanned.max_time);
+    EXPECT_TRUE(cached.centroid.isApprox(scanned.centroid, 1e-9));
+
+    // only an estimate for the whole file is cached
+    EXPECT_TRUE(ray::Cloud::saveInfo("room.ply", cached));
+    ray::Cuboid half = cached.ends_bound;
+    half.max_bound_[0] = 0.5 * (half.min_bound_[0] + half.max_bound_[0]);
+    const double half_spacing = ray::Cloud::estimatePointSpacing("room.ply", half, cached.num_bounded / 2);
+    EXPECT_TRUE(ray::Cloud::loadInfo("room.ply", scanned));
+    EXPECT_EQ(scanned.point_spacing, cached.point_spacing);
+    const double spacing = ray::Cloud::estimatePointSpacing("room.ply", cached.ends_bound, cached.num_bounded);
+    EXPECT_NE(spacing, half_spacing);
+    EXPECT_TRUE(ray::Cloud::loadInfo("room.ply", scanned));
+    EXPECT_EQ(scanned.point_spacing, spacing);
+    EXPECT_EQ(ray::Cloud::estimatePointSpacing("room.ply", half, cached.num_bounded / 2), half_spacing);
+  }
+
+  /// Reads a room ray cloud, and its exported point cloud, in small chunks on one and several threads. The decoded
+  /// rays should be byte-identical
+  TEST(Basic, RayReadPlyThreads)
+  {
+    EXPECT_EQ(command("raycreate room 1"), 0);
+    EXPECT_EQ(command("rayexport room.ply room_points.ply room_trajectory.ply"), 0);
+    struct Rays
+    {
+      std::vector<Eigen::Vector3d> starts, ends;
+      std::vector<double> times;
+      std::vector<ray::RGBA> colours;
+    };
+    for (const bool is_ray_cloud : { true, false })
+    {
+      const std::string file_name = is_ray_cloud ? "room.ply" : "room_points.ply";
+      std::vector<Rays> decoded(3);
+      const int thread_counts[] = { 1, 2, 4 };
+      for (int i = 0; i < 3; i++)
+      {
+        Rays &rays = decoded[i];
+        auto append = [&rays](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                              std::vector<double> &times, std::vector<ray::RGBA> &colours) {
+          rays.starts.insert(rays.starts.end(), starts.begin(), starts.end());
+          rays.ends.insert(rays.ends.end(), ends.begin(), ends.end());
+          rays.times.insert(rays.times.end(), times.begin(), times.end());
+          rays.colours.insert(rays.colours.end(), colours.begin(), colours.end());
+        };
+        EXPECT_TRUE(ray::readPly(file_name, is_ray_cloud, append, 100.0, false, 1000, ray::kPRMMapped,
+                                 thread_counts[i]));
+      }
+      ASSERT_GT(decoded[0].ends.size(), 0u);
+      for (int i = 1; i < 3; i++)
+      {
+        ASSERT_EQ(decoded[i].ends.size(), decoded[0].ends.size());
+        const size_t count = decoded[0].ends.size();
+        EXPECT_EQ(std::memcmp(decoded[i].starts.data(), decoded[0].starts.data(), count * sizeof(Eigen::Vector3d)), 0);
+        EXPECT_EQ(std::memcmp(decoded[i].ends.data(), decoded[0].ends.data(), count * sizeof(Eigen::Vector3d)), 0);
+        EXPECT_EQ(std::memcmp(decoded[i].times.data(), decoded[0].times.data(), count * sizeof(double)), 0);
+        EXPECT_EQ(std::memcmp(decoded[i].colours.data(), decoded[0].colours.data(), count * sizeof(ray::RGBA)), 0);
+      }
+    }
+  }
+
+  /// Reads a region of a forest through its spatial index, which should give the same rays as filtering the whole
+  /// cloud. The file is then rewritten without updating its sidecars, which should be ignored as stale
+  TEST(Basic, RayRegionRead)
+  {
+    EXPECT_EQ(command("raycreate forest 1"), 0);
+    const ray::Cuboid region(Eigen::Vector3d(-2.0, -3.0, -1.0), Eigen::Vector3d(3.0, 1.0, 2.0));
+    const auto compareRegion = [&region](bool expect_index) {
+      ray::RayIndex index;
+      EXPECT_EQ(index.load("forest.ply"), expect_index);
+      ray::Cloud cloud, expected, read;
+      EXPECT_TRUE(cloud.load("forest.ply"));
+      for (size_t i = 0; i < cloud.rayCount(); i++)
+      {
+        Eigen::Vector3d start = cloud.starts[i], end = cloud.ends[i];
+        if (region.clipRay(start, end))
+          expected.addRay(cloud, i);
+      }
+      auto append = [&read](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                            std::vector<double> &times, std::vector<ray::RGBA> &colours) {
+        for (size_t i = 0; i < ends.size(); i++) read.addRay(starts[i], ends[i], times[i], colours[i]);
+      };
+      EXPECT_TRUE(ray::Cloud::read("forest.ply", region, append));
+      EXPECT_GT(expected.rayCount(), 0u);
+      EXPECT_LT(expected.rayCount(), cloud.rayCount());
+      ASSERT_EQ(read.rayCount(), expected.rayCount());
+      for (size_t i = 0; i < read.rayCount(); i++)
+      {
+        EXPECT_EQ(read.starts[i], expected.starts[i]);
+        EXPECT_EQ(read.ends[i], expected.ends[i]);
+        EXPECT_EQ(read.times[i], expected.times[i]);
+      }
+      ray::Cloud::Info info;
+      EXPECT_EQ(ray::Cloud::loadInfo("forest.ply", info), expect_index);
+      if (expect_index)
+      {
+        EXPECT_EQ(info.num_rays, cloud.rayCount());
+      }
+    };
+    compareRegion(true);
+
+    // the same size of file, with different rays
+    ray::Cloud cloud;
+    EXPECT_TRUE(cloud.load("forest.ply"));
+    for (size_t i = 0; i < cloud.rayCount(); i++)
+    {
+      cloud.starts[i] += Eigen::Vector3d(0.5, -0.25, 0.0);
+      cloud.ends[i] += Eigen::Vector3d(0.5, -0.25, 0.0);
+    }
+    EXPECT_TRUE(ray::writePlyRayCloud("forest.ply", cloud.starts, cloud.ends, cloud.times, cloud.colours));
+    compareRegion(false);
+  }
+
+  /// Saves rays just outside a region, which are inside it once rounded to single precision in the file. The index
+  /// is of the rays as stored, so a region read finds them
+  TEST(Basic, RayRegionReadStored)
+  {
+    ray::Cloud cloud;
+    for (int i = 0; i < 10; i++)
+    {
+      const Eigen::Vector3d end(1000.00003, 0.01 * i, 0.0);
+      cloud.addRay(end + Eigen::Vector3d(0, 0, 0.5), end, (double)i, ray::RGBA::white());
+    }
+    cloud.save("stored.ply");
+    const ray::Cuboid region(Eigen::Vector3d(999.0, -1.0, -1.0), Eigen::Vector3d(1000.00002, 1.0, 1.0));
+    size_t num_read = 0;
+    auto count = [&num_read](std::vector<Eigen::Vector3d> &, std::vector<Eigen::Vector3d> &ends, std::vector<double> &,
+                             std::vector<ray::RGBA> &) { num_read += ends.size(); };
+    EXPECT_TRUE(ray::Cloud::read("stored.ply", region, count));
+    EXPECT_EQ(num_read, cloud.rayCount());
+  }
+
+  /// Loads a room as a single precision cloud, and checks that it matches the double precision cloud
+  TEST(Basic, RayCompactCloud)
+  {
+    EXPECT_EQ(command("raycreate room 1"), 0);
+    ray::Cloud cloud;
+    ray::CompactCloud compact;
+    EXPECT_TRUE(cloud.load("room.ply"));
+    EXPECT_TRUE(compact.load("room.ply"));
+    ASSERT_EQ(cloud.rayCount(), compact.rayCount());
+    for (size_t i = 0; i < cloud.rayCount(); i++)
+    {
+      EXPECT_TRUE((cloud.start(i) - compact.start(i)).norm() < 1e-5);
+      EXPECT_TRUE((cloud.end(i) - compact.end(i)).norm() < 1e-5);
+      EXPECT_EQ(cloud.times[i], compact.times[i]);
+      EXPECT_EQ(cloud.rayBounded(i), compact.rayBounded(i));
+    }
+    EXPECT_NEAR(cloud.estimatePointSpacing(), compact.estimatePointSpacing(), 1e-4);
+  }
+
+  /// Fills a FlatGrid by single insertions and as compressed sparse rows, which should give the same cells
+  TEST(Basic, RayFlatGrid)
+  {
+    ray::FlatGrid<unsigned> inserted(Eigen::Vector3d(-1, -1, -1), Eigen::Vector3d(1, 1, 1), 0.1);
+    ray::FlatGrid<unsigned> rows = inserted;
+    for (int i = -5; i < 5; i++)
+    {
+      inserted.addCell(Eigen::Vector3i(i, 0, i));
+      rows.addCell(Eigen::Vector3i(i, 0, i));
+    }
+    const unsigned count = 1000;
+    const auto walk = [](unsigned i, const auto &visit)
+    {
+      const int x = static_cast<int>(i % 13) - 6;
+      for (int j = 0; j < 3; j++)
+      {
+        visit(Eigen::Vector3i(x + j, 0, x + j), i);
+      }
+    };
+    for (unsigned i = 0; i < count; i++)
+    {
+      walk(i, [&inserted](const Eigen::Vector3i &index, unsigned value) { inserted.insertIfCellExists(index, value); });
+    }
+    rows.fillRows(count, walk);
+    ASSERT_EQ(inserted.cellCount(), rows.cellCount());
+    for (int i = -5; i < 5; i++)
+    {
+      const auto &a = inserted.cell(i, 0, i).data;
+      const auto &b = rows.cell(i, 0, i).data;
+      ASSERT_EQ(a.size(), b.size());
+      EXPECT_TRUE(std::equal(a.begin(), a.end(), b.begin()));
+    }
+    EXPECT_TRUE(rows.cell(6, 0, 6).data.empty());
+
+    // indices beyond +-2^20 are out of the key range, so are ignored rather than aliasing other cells
+    const size_t cell_count = inserted.cellCount();
+    inserted.insert(Eigen::Vector3i(1 << 21, 0, 0), 1u);
+    inserted.addCell(Eigen::Vector3i(0, -(1 << 21), 0));
+    EXPECT_EQ(inserted.cellCount(), cell_count);
+    EXPECT_TRUE(inserted.cell(1 << 21, 0, 0).data.empty());
+  }
+
+  /// Seeds and fills a Grid and a FlatGrid with the rays of a forest using the Merger, which should give the same cells
+  TEST(Basic, RayMergerGrids)
+  {
+    EXPECT_EQ(command("raycreate forest 1"), 0);
+    ray::Cloud cloud;
+    EXPECT_TRUE(cloud.load("forest.ply"));
+    const Eigen::Vector3d box_min = cloud.calcMinBound(), box_max = cloud.calcMaxBound();
+    ray::Grid<unsigned> grid(box_min, box_max, 0.5);
+    ray::FlatGrid<unsigned> flat_grid(box_min, box_max, 0.5);
+    ray::MergerConfig config;
+    ray::Merger merger(config);
+    merger.seedRayGrid(&grid, cloud);
+    merger.seedRayGrid(&flat_grid, cloud);
+    ray::Merger::fillRayGrid(&grid, cloud, nullptr);
+    ray::Merger::fillRayGrid(&flat_grid, cloud, nullptr);
+    size_t num_cells = 0;
+    grid.walkCells([&](const ray::Grid<unsigned> &, const ray::Grid<unsigned>::Cell &cell) {
+      const auto &flat_data = flat_grid.cell(cell.index).data;
+      ASSERT_EQ(cell.data.size(), flat_data.size());
+      EXPECT_TRUE(std::equal(cell.data.begin(), cell.data.end(), flat_data.begin()));
+      num_cells++;
+    });
+    EXPECT_GT(num_cells, 0u);
+    EXPECT_EQ(num_cells, flat_grid.cellCount());
+  }
+
+  /// Accumulates into two sparse grids spanning negative and positive indices, and merges them
+  TEST(Basic, RaySparseGrid)
+  {
+    ray::SparseGrid<int> grid, other;
+    for (int i = -20; i < 20; i++)
+    {
+      grid.voxel(Eigen::Vector3i(i, 2 * i, -i)) += 1;
+      other.voxel(Eigen::Vector3i(i, 2 * i, -i)) += 2;
+      other.voxel(Eigen::Vector3i(1000 * i, 0, 0)) += 3;
+    }
+    EXPECT_EQ(grid.activeCount(), 40u);
+    EXPECT_EQ(grid.find(Eigen::Vector3i(1, 1, 1)), nullptr);
+    EXPECT_EQ(grid.value(Eigen::Vector3i(-7, -14, 7)), 1);
+    grid.merge(other, [](int &value, const int &other_value) { value += other_value; });
+    EXPECT_EQ(grid.activeCount(), 79u);  // (0,0,0) is shared
+    int total = 0;
+    grid.forEachActive([&total](const Eigen::Vector3i &, const int &value) { total += value; });
+    EXPECT_EQ(total, 40 * 3 + 40 * 3);
+    EXPECT_EQ(grid.value(Eigen::Vector3i(0, 0, 0)), 6);
+    EXPECT_EQ(grid.value(Eigen::Vector3i(-19000, 0, 0)), 3);
+
+    // the voxels of a new leaf start at zero, and voxels beyond +-2^20 are discarded rather than stored
+    const auto &leaf = grid.touchLeaf(Eigen::Vector3i(5000, 5000, 5000));
+    EXPECT_TRUE(std::all_of(leaf.values, leaf.values + ray::SparseGrid<int>::kLeafSize, [](int v) { return v == 0; }));
+    const size_t active_count = grid.activeCount();
+    ray::SparseGrid<int>::Accessor accessor(grid);
+    for (int i = 0; i < 2; i++)
+    {
+      accessor.voxel(Eigen::Vector3i(1 << 21, 0, 0)) += 1;
+      grid.voxel(Eigen::Vector3i(0, 0, -(1 << 21))) += 1;
+    }
+    EXPECT_EQ(grid.activeCount(), active_count);
+    EXPECT_EQ(grid.find(Eigen::Vector3i(1 << 21, 0, 0)), nullptr);
+  }
+
+  /// Runs the same loops on each parallel backend in this build, with more threads than items per thread
+  TEST(Basic, RayParallelFor)
+  {
+    const ray::ParallelBackend original = ray::parallelBackend();
+    ray::Threads::init(4);
+    const size_t count = 10007;
+    for (auto backend : { ray::ParallelBackend::Serial, ray::ParallelBackend::Threads, ray::ParallelBackend::OpenMP,
+                          ray::ParallelBackend::TBB })
+    {
+      if (!ray::setParallelBackend(backend))
+      {
+        continue;
+      }
+      std::vector<int> visits(count, 0);
+      ray::parallelFor(0, count, [&visits](size_t i) { visits[i]++; });
+      EXPECT_EQ(std::count(visits.begin(), visits.end(), 1), (long)count);
+      const size_t sum = ray::parallelReduce(
+        0, count, size_t(0), [](size_t i, size_t &total) { total += i; },
+        [](size_t &total, const size_t &other_total) { total += other_total; });
+      EXPECT_EQ(sum, count * (count - 1) / 2);
+      // nested loops, with working memory per worker
+      std::vector<size_t> sums(100, 0);
+      ray::parallelForLocal(0, sums.size(), std::vector<size_t>(), [&sums](size_t i, std::vector<size_t> &local) {
+        local.assign(i, 1);
+        sums[i] = ray::parallelReduce(
+          0, local.size(), size_t(0), [&local](size_t j, size_t &total) { total += local[j]; },
+          [](size_t &total, const size_t &other_total) { total += other_total; });
+      });
+      for (size_t i = 0; i < sums.size(); i++)
+      {
+        EXPECT_EQ(sums[i], i);
+      }
+    }
+    ray::setParallelBackend(original);
+    ray::Threads::init(ray::Threads::ThreadCountAll);
+  }
+
+  /// Walks rays of mixed lengths, including some that stop early, one at a time and as packets, which should visit
+  /// the same voxels with the same lengths for each ray
+  TEST(Basic, RayGridWalkPacket)
+  {
+    const int count = 37;
+    std::vector<Eigen::Vector3d> starts(count), ends(count);
+    for (int i = 0; i < count; i++)
+    {
+      starts[i] = Eigen::Vector3d(0.3 * i, -0.7 * i, 0.1 + 0.05 * i);
+      ends[i] = starts[i] + Eigen::Vector3d(std::sin(i), std::cos(1.3 * i), 0.5 - 0.03 * i) * (double)(i % 11);
+    }
+    ends[5] = starts[5];  // a zero length ray
+    using Visits = std::vector<std::vector<double>>;
+    const auto stopAt = [](int ray, size_t visits) { return ray % 3 == 0 && visits == 4; };
+    Visits scalar(count), packet(count);
+    for (int i = 0; i < count; i++)
+    {
+      auto visit = [&](const Eigen::Vector3i &p, const Eigen::Vector3i &, double in_length, double out_length, double)
+      {
+        scalar[i].insert(scalar[i].end(), { (double)p[0], (double)p[1], (double)p[2], in_length, out_length });
+        return stopAt(i, scalar[i].size() / 5);
+      };
+      ray::walkGrid(starts[i], ends[i], visit);
+    }
+    auto visit_batch = [&](const ray::WalkBatch &batch)
+    {
+      int stop = 0;
+      for (int lane = 0; lane < ray::kWalkPacketSize; lane++)
+      {
+        if (batch.active & (1 << lane))
+        {
+          std::vector<double> &visits = packet[batch.ray[lane]];
+          visits.insert(visits.end(), { (double)batch.x[lane], (double)batch.y[lane], (double)batch.z[lane],
+                                        batch.in_length[lane], batch.out_length[lane] });
+          if (stopAt(batch.ray[lane], visits.size() / 5))
+            stop |= 1 << lane;
+        }
+      }
+      return stop;
+    };
+    ray::walkGridPacket(starts.data(), ends.data(), count, visit_batch);
+    for (int i = 0; i < count; i++)
+    {
+      EXPECT_EQ(scalar[i], packet[i]) << "ray " << i;
+    }
+  }
+
+  /// Finds the boxes that segments overlap using a BVH, and by testing every box, which should agree. Also with few
+  /// boxes per leaf, whose leaf boxes are much larger than their boxes
+  TEST(Basic, RayBVH)
+  {
+    const int num_boxes = 500;
+    std::vector<Eigen::Vector3d> box_mins(num_boxes), box_maxs(num_boxes);
+    for (int i = 0; i < num_boxes; i++)
+    {
+      box_mins[i] = Eigen::Vector3d(std::sin(1.1 * i), std::cos(0.7 * i), std::sin(0.3 * i)) * 10.0;
+      box_maxs[i] = box_mins[i] + Eigen::Vector3d(0.1 + (i % 5) * 0.3, 0.2 + (i % 3) * 0.5, (i % 7) * 0.1);
+    }
+    ray::BVH bvh, sparse_bvh;
+    bvh.build(box_mins, box_maxs);
+    const std::vector<Eigen::Vector3d> sparse_mins(box_mins.begin(), box_mins.begin() + 12);
+    const std::vector<Eigen::Vector3d> sparse_maxs(box_maxs.begin(), box_maxs.begin() + 12);
+    sparse_bvh.build(sparse_mins, sparse_maxs);
+    const auto overlaps = [](const Eigen::Vector3d &start, const Eigen::Vector3d &end, const Eigen::Vector3d &box_min,
+                             const Eigen::Vector3d &box_max) {
+      // sampled along the segment, with boxes shrunk slightly so that grazing segments don't count
+      for (int j = 0; j <= 10000; j++)
+      {
+        const Eigen::Vector3d pos = start + (end - start) * (double)j / 10000.0;
+        if ((pos.array() > box_min.array() + 1e-3).all() && (pos.array() < box_max.array() - 1e-3).all())
+          return true;
+      }
+      return false;
+    };
+    // the slab test against the boxes grown slightly, which no segment that misses them can pass
+    const auto misses = [](const Eigen::Vector3d &start, const Eigen::Vector3d &end, const Eigen::Vector3d &box_min,
+                           const Eigen::Vector3d &box_max) {
+      double t_min = 0.0, t_max = 1.0;
+      for (int axis = 0; axis < 3; axis++)
+      {
+        const double lo = box_min[axis] - 1e-3, hi = box_max[axis] + 1e-3;
+        const double dir = end[axis] - start[axis];
+        if (dir == 0.0)
+        {
+          if (start[axis] < lo || start[axis] > hi)
+            return true;
+          continue;
+        }
+        const double t0 = (lo - start[axis]) / dir, t1 = (hi - start[axis]) / dir;
+        t_min = std::max(t_min, std::min(t0, t1));
+        t_max = std::min(t_max, std::max(t0, t1));
+      }
+      return t_min > t_max;
+    };
+    for (int i = 0; i < 50; i++)
+    {
+      const Eigen::Vector3d start(std::sin(2.3 * i) * 12.0, std::cos(1.9 * i) * 12.0, 0.5 * (i % 5));
+      Eigen::Vector3d end = -start + Eigen::Vector3d(0.0, 0.0, 3.0 * std::cos(i));
+      if (i % 10 == 0)
+        end = Eigen::Vector3d(end[0], start[1], start[2]);  // axis aligned
+      std::vector<bool> found(num_boxes, false), sparse_found(num_boxes, false);
+      bvh.intersectSegment(start, end, [&](uint32_t box) { found[box] = true; });
+      sparse_bvh.intersectSegment(start, end, [&](uint32_t box) { sparse_found[box] = true; });
+      for (int j = 0; j < num_boxes; j++)
+      {
+        if (overlaps(start, end, box_mins[j], box_maxs[j]))
+        {
+          EXPECT_TRUE(found[j]) << "segment " << i << " box " << j;
+          if (j < 12)
+          {
+            EXPECT_TRUE(sparse_found[j]) << "segment " << i << " box " << j;
+          }
+        }
+        if (misses(start, end, box_mins[j], box_maxs[j]))
+        {
+          EXPECT_FALSE(found[j]) << "segment " << i << " box " << j;
+          EXPECT_FALSE(sparse_found[j]) << "segment " << i << " box " << j;
+        }
+      }
+    }
+  }
+
+  /// Checks that EllipsoidArrays::intersectBatch matches Ellipsoid::intersect, for candidate counts that do and don't
+  /// fill the last batch, both for a ray against many ellipsoids and for an ellipsoid against many rays
+  TEST(Basic, RayEllipsoidBatch)
+  {
+    const int num_ellipsoids = 37;
+    std::vector<ray::Ellipsoid> ellipsoids(num_ellipsoids);
+    std::vector<uint32_t> ids(num_ellipsoids);
+    for (int i = 0; i < num_ellipsoids; i++)
+    {
+      ray::Ellipsoid &ellipsoid = ellipsoids[i];
+      ellipsoid.pos = Eigen::Vector3d(std::sin(1.3 * i), std::cos(0.9 * i), 0.2 * std::sin(0.4 * i));
+      const Eigen::Matrix3f rotation =
+        Eigen::AngleAxisf(0.7f * (float)i, Eigen::Vector3f(1.0f, 0.5f, (float)(i % 3)).normalized()).toRotationMatrix();
+      const Eigen::Vector3f radii(0.1f + 0.05f * (float)(i % 4), 0.3f + 0.1f * (float)(i % 3), 0.02f);
+      for (int j = 0; j < 3; j++)
+        ellipsoid.eigen_mat.row(j) = rotation.col(j).transpose() / radii[j];
+      ids[i] = (uint32_t)(num_ellipsoids - 1 - i);
+    }
+    ray::EllipsoidArrays arrays;
+    arrays.assign(ellipsoids, ids);
+    std::vector<uint32_t> candidates(num_ellipsoids);
+    for (int i = 0; i < num_ellipsoids; i++)
+      candidates[i] = (uint32_t)((i * 7) % num_ellipsoids);
+    int num_hits = 0;
+    for (int i = 0; i < 200; i++)
+    {
+      const Eigen::Vector3d start(3.0 * std::sin(0.37 * i), 3.0 * std::cos(0.37 * i), 1.0);
+      const Eigen::Vector3d end(std::sin(1.7 * i), std::cos(2.3 * i), 0.1 * std::sin(0.5 * i));
+      const size_t count = 1 + (size_t)i % num_ellipsoids;
+      std::vector<ray::IntersectResult> results(count);
+      arrays.intersectBatch(start, end, candidates.data(), count, results.data());
+      for (size_t j = 0; j < count; j++)
+      {
+        const ray::IntersectResult expected = ellipsoids[ids[candidates[j]]].intersect(start, end);
+        EXPECT_TRUE(results[j] == expected) << "ray " << i << " candidate " << j;
+        num_hits += expected != ray::IntersectResult::Miss;
+      }
+    }
+    EXPECT_GT(num_hits, 0);
+
+    std::vector<Eigen::Vector3d> starts, ends;
+    for (int i = 0; i < 23; i++)
+    {
+      starts.push_back(Eigen::Vector3d(3.0 * std::sin(0.37 * i), 3.0 * std::cos(0.37 * i), 1.0));
+      ends.push_back(Eigen::Vector3d(std::sin(1.7 * i), std::cos(2.3 * i), 0.1 * std::sin(0.5 * i)));
+    }
+    num_hits = 0;
+    for (int i = 0; i < num_ellipsoids; i++)
+    {
+      const size_t count = 1 + (size_t)i % starts.size();
+      std::vector<ray::IntersectResult> results(count);
+      arrays.intersectBatch((uint32_t)i, starts.data(), ends.data(), count, results.data());
+      for (size_t j = 0; j < count; j++)
+      {
+        const ray::IntersectResult expected = ellipsoids[ids[i]].intersect(starts[j], ends[j]);
+        EXPECT_TRUE(results[j] == expected) << "ellipsoid " << i << " ray " << j;
+        num_hits += expected != ray::IntersectResult::Miss;
+      }
+    }
+    EXPECT_GT(num_hits, 0);
+  }
+
+  /// Inserts, looks up and erases pseudo-random voxels, some far apart and negative, checking the VoxelSet against a
+  /// std::set. Then checks that voxels 2^21 apart, which share a Morton code, are kept apart in both voxel tables
+  TEST(Basic, RayVoxelSet)
+  {
+    ray::VoxelSet voxel_set;
+    std::set<Eigen::Vector3i, ray::Vector3iLess> reference;
+    std::vector<Eigen::Vector3i> voxels;
+    for (int i = 0; i < 5000; i++)
+    {
+      const int scale = i % 5 == 0 ? 100000 : 20;
+      voxels.push_back(Eigen::Vector3i((i * 7919) % (2 * scale) - scale, (i * 6271) % (2 * scale) - scale,
+                                       (i * 3571) % (2 * scale) - scale));
+    }
+    for (int i = 0; i < 20000; i++)
+    {
+      const Eigen::Vector3i &voxel = voxels[(i * 2654435761u) % voxels.size()];
+      if (i % 3 == 2)
+        EXPECT_EQ(voxel_set.erase(voxel), reference.erase(voxel) > 0);
+      else
+        EXPECT_EQ(voxel_set.insert(voxel), reference.insert(voxel).second);
+      ASSERT_EQ(voxel_set.size(), reference.size());
+    }
+    for (auto &voxel : voxels) EXPECT_EQ(voxel_set.contains(voxel), reference.count(voxel) > 0);
+    EXPECT_LE(2 * voxel_set.size(), voxel_set.capacity());
+    voxel_set.clear();
+    EXPECT_TRUE(voxel_set.empty());
+    EXPECT_FALSE(voxel_set.contains(voxels[0]));
+
+    const Eigen::Vector3i near(5, -3, 2), far = near + Eigen::Vector3i(1 << 21, 0, -(1 << 21));
+    EXPECT_EQ(ray::VoxelSet::mortonCode(near), ray::VoxelSet::mortonCode(far));
+    EXPECT_TRUE(voxel_set.insert(near));
+    EXPECT_FALSE(voxel_set.contains(far));
+    EXPECT_TRUE(voxel_set.insert(far));
+    EXPECT_FALSE(voxel_set.insert(far));
+    EXPECT_EQ(voxel_set.size(), 2u);
+    EXPECT_TRUE(voxel_set.erase(far));
+    EXPECT_TRUE(voxel_set.contains(near));
+    EXPECT_FALSE(voxel_set.contains(far));
+
+    ray::ConcurrentVoxelMap voxel_map;
+    voxel_map.reserve(3);
+    voxel_map.keepMinimum(near, 7);
+    voxel_map.keepMinimum(far, 9);
+    voxel_map.keepMinimum(far, 4);
+    EXPECT_EQ(voxel_map.size(), 2u);
+    EXPECT_EQ(voxel_map.value(near), 7u);
+    EXPECT_EQ(voxel_map.value(far), 4u);
+    EXPECT_EQ(voxel_map.value(far + Eigen::Vector3i(0, 1, 0)), uint64_t(ray::ConcurrentVoxelMap::kNone));
+  }
+
   /// Creates two rooms, the second is decimated and transformed, then rayrestore is called to apply this transformation to
   /// the first (high resolution) room
   TEST(Basic, RayRestore)
@@ -179,6 +984,49 @@ namespace raytest
     compareMoments(cloud.getMoments(), {-1.05406, -0.240721, -0.0629182, 5.05649e-08, 3.32941e-08, 2.54759e-08, 0.268724, -0.136746, -0.596782, 1.04798, 0.921776, 0.527205, 32.1452, 6.7491, 0.205871, 0.395641, 0.884296, 1, 0.225501, 0.296487, 0.153923, 0});
   }  
 
+  /// Runs raytransients on the room with the BVH engine, which finds the same transients as the ray grid engine
+  TEST(Basic, RayTransientsBVH)
+  {
+    EXPECT_EQ(command("raycreate room 2"), 0);
+    EXPECT_EQ(command("raytransients min room.ply 1 rays"), 0);
+    EXPECT_EQ(copy("room_transient.ply room_grid_transient.ply"), 0);
+    EXPECT_EQ(command("raytransients min room.ply 1 rays --bvh"), 0);
+    ray::Cloud grid_transients, bvh_transients;
+    EXPECT_TRUE(grid_transients.load("room_grid_transient.ply"));
+    EXPECT_TRUE(bvh_transients.load("room_transient.ply"));
+    ASSERT_EQ(grid_transients.rayCount(), bvh_transients.rayCount());
+    for (size_t i = 0; i < grid_transients.rayCount(); i++)
+    {
+      EXPECT_EQ(grid_transients.ends[i], bvh_transients.ends[i]);
+      EXPECT_EQ(grid_transients.times[i], bvh_transients.times[i]);
+    }
+  }
+
+  /// Runs raytransients on the room in tiles, in parallel, which should find the same transients as the whole room.
+  /// An unindexed room is indexed before the tiles read it, and a .rcz room is filtered through an indexed copy
+  TEST(Basic, RayTransientsTiled)
+  {
+    EXPECT_EQ(command("raycreate room 2"), 0);
+    std::remove(ray::RayIndex::fileName("room.ply").c_str());
+    EXPECT_EQ(command("raytransients min room.ply 1 rays --tile_size 3 --threads 4"), 0);
+    ray::RayIndex index;
+    EXPECT_TRUE(index.load("room.ply"));
+    ray::Cloud cloud;
+    EXPECT_TRUE(cloud.load("room_transient.ply"));
+    compareMoments(cloud.getMoments(), {-1.05406, -0.240721, -0.0629182, 5.05649e-08, 3.32941e-08, 2.54759e-08, 0.268724, -0.136746, -0.596782, 1.04798, 0.921776, 0.527205, 32.1452, 6.7491, 0.205871, 0.395641, 0.884296, 1, 0.225501, 0.296487, 0.153923, 0});
+
+    ray::Cloud room;
+    EXPECT_TRUE(room.load("room.ply"));
+    room.save("room.rcz");
+    EXPECT_EQ(command("raytransients min room.rcz 1 rays"), 0);
+    ray::Cloud rcz_transients, rcz_tiled_transients;
+    EXPECT_TRUE(rcz_transients.load("room_transient.ply"));
+    EXPECT_EQ(command("raytransients min room.rcz 1 rays --tile_size 3 --threads 4"), 0);
+    EXPECT_TRUE(rcz_tiled_transients.load("room_transient.ply"));
+    EXPECT_EQ(rcz_tiled_transients.rayCount(), rcz_transients.rayCount());
+    EXPECT_FALSE(ray::RayIndex().load("room_fixed.ply.indexed.ply"));
+  }
+
   /// Creates a forest and translates it in all three axes, comparing to the expected result
   TEST(Basic, RayTranslate)
   {